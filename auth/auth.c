@@ -8,157 +8,9 @@
 
 #include "auth.h"
 #include "crypto.h"
+#include "protocol.h"
 #include "../bus/bus.h"
 
-enum gip_auth_context {
-	GIP_AUTH_CTX_HANDSHAKE = 0x00,
-	GIP_AUTH_CTX_CONTROL = 0x01,
-};
-
-enum gip_auth_command_handshake {
-	GIP_AUTH_CMD_HOST_HELLO = 0x01,
-	GIP_AUTH_CMD_CLIENT_HELLO = 0x02,
-	GIP_AUTH_CMD_CLIENT_CERTIFICATE = 0x03,
-	GIP_AUTH_CMD_HOST_SECRET = 0x05,
-	GIP_AUTH_CMD_HOST_FINISH = 0x07,
-	GIP_AUTH_CMD_CLIENT_FINISH = 0x08,
-
-	GIP_AUTH2_CMD_HOST_HELLO = 0x21,
-	GIP_AUTH2_CMD_CLIENT_HELLO = 0x22,
-	GIP_AUTH2_CMD_CLIENT_CERTIFICATE = 0x23,
-	GIP_AUTH2_CMD_CLIENT_PUBKEY = 0x24,
-	GIP_AUTH2_CMD_HOST_PUBKEY = 0x25,
-	GIP_AUTH2_CMD_HOST_FINISH = 0x26,
-	GIP_AUTH2_CMD_CLIENT_FINISH = 0x27,
-};
-
-enum gip_auth_command_control {
-	GIP_AUTH_CTRL_COMPLETE = 0x00,
-	GIP_AUTH_CTRL_RESET = 0x01,
-};
-
-enum gip_auth_option {
-	GIP_AUTH_OPT_ACKNOWLEDGE = BIT(0),
-	GIP_AUTH_OPT_REQUEST = BIT(1),
-	GIP_AUTH_OPT_FROM_HOST = BIT(6),
-	GIP_AUTH_OPT_FROM_CLIENT = BIT(6) | BIT(7),
-};
-
-struct gip_auth_header_handshake {
-	u8 context;
-	u8 options;
-	u8 error;
-	u8 command;
-	__be16 length;
-} __packed;
-
-struct gip_auth_header_data {
-	u8 command;
-	u8 version;
-	__be16 length;
-} __packed;
-
-struct gip_auth_header_full {
-	struct gip_auth_header_handshake handshake;
-	struct gip_auth_header_data data;
-} __packed;
-
-struct gip_auth_header_control {
-	u8 context;
-	u8 control;
-} __packed;
-
-struct gip_auth_request {
-	struct gip_auth_header_handshake header;
-
-	u8 trailer[GIP_AUTH_TRAILER_LEN];
-} __packed;
-
-struct gip_auth_pkt_host_hello {
-	struct gip_auth_header_full header;
-
-	u8 random[GIP_AUTH_RANDOM_LEN];
-	u8 unknown1[4];
-	u8 unknown2[4];
-
-	u8 trailer[GIP_AUTH_TRAILER_LEN];
-} __packed;
-
-struct gip_auth_pkt_host_secret {
-	struct gip_auth_header_full header;
-
-	u8 encrypted_pms[GIP_AUTH_ENCRYPTED_PMS_LEN];
-
-	u8 trailer[GIP_AUTH_TRAILER_LEN];
-} __packed;
-
-struct gip_auth_pkt_host_finish {
-	struct gip_auth_header_full header;
-
-	u8 transcript[GIP_AUTH_TRANSCRIPT_LEN];
-
-	u8 trailer[GIP_AUTH_TRAILER_LEN];
-} __packed;
-
-struct gip_auth_pkt_client_hello {
-	u8 random[GIP_AUTH_RANDOM_LEN];
-	u8 unknown[48];
-} __packed;
-
-struct gip_auth_pkt_client_finish {
-	u8 transcript[GIP_AUTH_TRANSCRIPT_LEN];
-	u8 unknown[32];
-} __packed;
-
-struct gip_auth2_pkt_host_hello {
-	struct gip_auth_header_full header;
-
-	u8 random[GIP_AUTH_RANDOM_LEN];
-	u8 unknown[4];
-
-	u8 trailer[GIP_AUTH_TRAILER_LEN];
-} __packed;
-
-struct gip_auth2_pkt_host_pubkey {
-	struct gip_auth_header_full header;
-
-	u8 pubkey[GIP_AUTH2_PUBKEY_LEN];
-
-	u8 trailer[GIP_AUTH_TRAILER_LEN];
-} __packed;
-
-struct gip_auth2_pkt_host_finish {
-	struct gip_auth_header_full header;
-
-	u8 transcript[GIP_AUTH_TRANSCRIPT_LEN];
-
-	u8 trailer[GIP_AUTH_TRAILER_LEN];
-} __packed;
-
-struct gip_auth2_pkt_client_hello {
-	u8 random[GIP_AUTH_RANDOM_LEN];
-	u8 unknown1[108];
-	u8 unknown2[32];
-} __packed;
-
-struct gip_auth2_pkt_client_cert {
-	char header[4];
-	u8 unknown1[136];
-	char chip[32];
-	char revision[20];
-	u8 unknown2[576];
-} __packed;
-
-struct gip_auth2_pkt_client_pubkey {
-	u8 pubkey[GIP_AUTH2_PUBKEY_LEN];
-	u8 unknown[64];
-} __packed;
-
-struct gip_auth2_pkt_client_finish {
-	u8 transcript[GIP_AUTH_TRANSCRIPT_LEN];
-	u8 unknown[32];
-} __packed;
-
 static int gip_auth_send_pkt(struct gip_auth *auth,
 			     enum gip_auth_command_handshake cmd,
 			     void *pkt, u16 len)
@@ -0,0 +1,339 @@
+// SPDX-License-Identifier: GPL-2.0-or-later
+/*
+ * Copyright (C) 2023 Severin von Wnuck-Lipinski <severinvonw@outlook.de>
+ */
+
+#include <linux/random.h>
+#include <crypto/hash.h>
+#include <crypto/kpp.h>
+
+#include "client.h"
+#include "crypto.h"
+#include "protocol.h"
+
+static int gip_auth2_client_get_pkt(struct gip_auth_client *auth,
+				    enum gip_auth_command_handshake cmd,
+				    void *out, u16 len)
+{
+	struct gip_auth_header_full *hdr = out;
+	u16 data_len = len - sizeof(hdr->handshake);
+
+	hdr->handshake.context = GIP_AUTH_CTX_HANDSHAKE;
+	hdr->handshake.options = GIP_AUTH_OPT_FROM_CLIENT;
+	hdr->handshake.error = 0;
+	hdr->handshake.command = cmd;
+	hdr->handshake.length = cpu_to_be16(data_len);
+
+	hdr->data.command = cmd;
+	hdr->data.version = 0x02;
+	hdr->data.length = cpu_to_be16(data_len - sizeof(hdr->data));
+
+	crypto_shash_update(auth->shash_transcript,
+			    out + sizeof(hdr->handshake), data_len);
+
+	return len;
+}
+
+static int gip_auth_client_get_acknowledge(void *out)
+{
+	struct gip_auth_header_handshake *hdr = out;
+
+	memset(hdr, 0, sizeof(*hdr));
+	hdr->context = GIP_AUTH_CTX_HANDSHAKE;
+	hdr->options = GIP_AUTH_OPT_ACKNOWLEDGE | GIP_AUTH_OPT_FROM_CLIENT;
+	hdr->command = 0x01;
+
+	return sizeof(*hdr);
+}
+
+/* answers the v1 hello request with a protocol upgrade */
+static int gip_auth_client_get_upgrade(void *out)
+{
+	struct gip_auth_header_full *hdr = out;
+
+	memset(hdr, 0, sizeof(*hdr));
+	hdr->handshake.context = GIP_AUTH_CTX_HANDSHAKE;
+	hdr->handshake.options = GIP_AUTH_OPT_FROM_CLIENT;
+	hdr->handshake.command = GIP_AUTH_CMD_CLIENT_HELLO;
+	hdr->handshake.length = cpu_to_be16(sizeof(hdr->data));
+	hdr->data.command = GIP_AUTH2_CMD_CLIENT_HELLO;
+	hdr->data.version = 0x02;
+
+	return sizeof(*hdr);
+}
+
+static int gip_auth2_client_get_hello(struct gip_auth_client *auth, void *out)
+{
+	struct gip_auth2_pkt_client_hello *pkt;
+
+	pkt = out + sizeof(struct gip_auth_header_full);
+	memset(pkt, 0, sizeof(*pkt));
+
+	get_random_bytes(auth->random_client, sizeof(auth->random_client));
+	memcpy(pkt->random, auth->random_client, sizeof(pkt->random));
+
+	return gip_auth2_client_get_pkt(auth, GIP_AUTH2_CMD_CLIENT_HELLO, out,
+					sizeof(struct gip_auth_header_full) +
+					sizeof(*pkt));
+}
+
+static int gip_auth2_client_get_certificate(struct gip_auth_client *auth,
+					    void *out)
+{
+	struct gip_auth2_pkt_client_cert *pkt;
+
+	pkt = out + sizeof(struct gip_auth_header_full);
+	memset(pkt, 0, sizeof(*pkt));
+
+	memcpy(pkt->header, "XBOX", sizeof(pkt->header));
+	strscpy(pkt->chip, "virtual", sizeof(pkt->chip));
+	strscpy(pkt->revision, "1", sizeof(pkt->revision));
+
+	return gip_auth2_client_get_pkt(auth, GIP_AUTH2_CMD_CLIENT_CERTIFICATE,
+					out,
+					sizeof(struct gip_auth_header_full) +
+					sizeof(*pkt));
+}
+
+static int gip_auth2_client_get_pubkey(struct gip_auth_client *auth,
+				       void *out)
+{
+	struct gip_auth2_pkt_client_pubkey *pkt;
+	struct crypto_kpp *ecdh;
+
+	pkt = out + sizeof(struct gip_auth_header_full);
+	memset(pkt, 0, sizeof(*pkt));
+
+	ecdh = gip_auth_alloc_ecdh(pkt->pubkey, sizeof(pkt->pubkey));
+	if (IS_ERR(ecdh))
+		return PTR_ERR(ecdh);
+
+	if (auth->ecdh)
+		crypto_free_kpp(auth->ecdh);
+
+	auth->ecdh = ecdh;
+
+	return gip_auth2_client_get_pkt(auth, GIP_AUTH2_CMD_CLIENT_PUBKEY, out,
+					sizeof(struct gip_auth_header_full) +
+					sizeof(*pkt));
+}
+
+static int gip_auth2_client_get_finish(struct gip_auth_client *auth,
+				       void *out)
+{
+	struct gip_auth2_pkt_client_finish *pkt;
+	u8 transcript[GIP_AUTH_TRANSCRIPT_LEN];
+	int err;
+
+	pkt = out + sizeof(struct gip_auth_header_full);
+	memset(pkt, 0, sizeof(*pkt));
+
+	err = gip_auth_get_transcript(auth->shash_transcript, transcript);
+	if (err)
+		return err;
+
+	err = gip_auth_compute_prf(auth->shash_prf, "Device Finished",
+				   auth->master_secret,
+				   sizeof(auth->master_secret),
+				   transcript, sizeof(transcript),
+				   pkt->transcript, sizeof(pkt->transcript));
+	if (err)
+		return err;
+
+	return gip_auth2_client_get_pkt(auth, GIP_AUTH2_CMD_CLIENT_FINISH, out,
+					sizeof(struct gip_auth_header_full) +
+					sizeof(*pkt));
+}
+
+static int gip_auth2_client_handle_hello(struct gip_auth_client *auth,
+					 void *data, u32 len)
+{
+	struct gip_auth2_pkt_host_hello *pkt = data;
+
+	if (len < sizeof(*pkt))
+		return -EINVAL;
+
+	/* host restarted the handshake */
+	crypto_shash_init(auth->shash_transcript);
+	memcpy(auth->random_host, pkt->random, sizeof(auth->random_host));
+	auth->complete = false;
+
+	return 0;
+}
+
+static int gip_auth2_client_handle_pubkey(struct gip_auth_client *auth,
+					  void *data, u32 len)
+{
+	struct gip_auth2_pkt_host_pubkey *pkt = data;
+	u8 random[GIP_AUTH_RANDOM_LEN * 2];
+	u8 secret[GIP_AUTH2_SECRET_LEN];
+	int err;
+
+	if (len < sizeof(*pkt) || !auth->ecdh)
+		return -EINVAL;
+
+	memcpy(random, auth->random_host, sizeof(auth->random_host));
+	memcpy(random + sizeof(auth->random_host), auth->random_client,
+	       sizeof(auth->random_client));
+
+	err = gip_auth_compute_ecdh_secret(auth->ecdh, pkt->pubkey,
+					   sizeof(pkt->pubkey), secret);
+	if (err)
+		return err;
+
+	return gip_auth_compute_prf(auth->shash_prf, "Master Secret",
+				    secret, sizeof(secret),
+				    random, sizeof(random),
+				    auth->master_secret,
+				    sizeof(auth->master_secret));
+}
+
+static int gip_auth2_client_handle_finish(struct gip_auth_client *auth,
+					  void *data, u32 len)
+{
+	struct gip_auth2_pkt_host_finish *pkt = data;
+	u8 transcript[GIP_AUTH_TRANSCRIPT_LEN];
+	u8 finished[GIP_AUTH_TRANSCRIPT_LEN];
+	int err;
+
+	if (len < sizeof(*pkt))
+		return -EINVAL;
+
+	err = gip_auth_get_transcript(auth->shash_transcript, transcript);
+	if (err)
+		return err;
+
+	err = gip_auth_compute_prf(auth->shash_prf, "Host Finished",
+				   auth->master_secret,
+				   sizeof(auth->master_secret),
+				   transcript, sizeof(transcript),
+				   finished, sizeof(finished));
+	if (err)
+		return err;
+
+	if (memcmp(pkt->transcript, finished, sizeof(finished)))
+		return -EPROTO;
+
+	return 0;
+}
+
+static int gip_auth_client_process_request(struct gip_auth_client *auth,
+					   u8 cmd, void *out)
+{
+	switch (cmd) {
+	case GIP_AUTH_CMD_CLIENT_HELLO:
+		return gip_auth_client_get_upgrade(out);
+	case GIP_AUTH2_CMD_CLIENT_HELLO:
+		return gip_auth2_client_get_hello(auth, out);
+	case GIP_AUTH2_CMD_CLIENT_CERTIFICATE:
+		return gip_auth2_client_get_certificate(auth, out);
+	case GIP_AUTH2_CMD_CLIENT_PUBKEY:
+		return gip_auth2_client_get_pubkey(auth, out);
+	case GIP_AUTH2_CMD_CLIENT_FINISH:
+		return gip_auth2_client_get_finish(auth, out);
+	default:
+		return -EPROTO;
+	}
+}
+
+static int gip_auth_client_process_data(struct gip_auth_client *auth,
+					void *data, u32 len, void *out)
+{
+	struct gip_auth_header_full *hdr = data;
+	u16 data_len;
+	int err;
+
+	if (len < sizeof(*hdr))
+		return -EINVAL;
+
+	data_len = be16_to_cpu(hdr->handshake.length);
+	if (sizeof(hdr->handshake) + data_len > len)
+		return -EINVAL;
+
+	switch (hdr->data.command) {
+	case GIP_AUTH_CMD_HOST_HELLO:
+		/* upgraded once the host requests the client hello */
+		return gip_auth_client_get_acknowledge(out);
+	case GIP_AUTH2_CMD_HOST_HELLO:
+		err = gip_auth2_client_handle_hello(auth, data, len);
+		break;
+	case GIP_AUTH2_CMD_HOST_PUBKEY:
+		err = gip_auth2_client_handle_pubkey(auth, data, len);
+		break;
+	case GIP_AUTH2_CMD_HOST_FINISH:
+		err = gip_auth2_client_handle_finish(auth, data, len);
+		break;
+	default:
+		err = -EPROTO;
+	}
+
+	if (err)
+		return err;
+
+	crypto_shash_update(auth->shash_transcript,
+			    data + sizeof(hdr->handshake), data_len);
+
+	return gip_auth_client_get_acknowledge(out);
+}
+
+/* returns the length of the response written to out, zero for none */
+int gip_auth_client_process_pkt(struct gip_auth_client *auth,
+				void *data, u32 len, void *out)
+{
+	struct gip_auth_header_handshake *hdr = data;
+	struct gip_auth_header_control *ctrl = data;
+
+	BUILD_BUG_ON(sizeof(struct gip_auth_header_full) +
+		     sizeof(struct gip_auth2_pkt_client_cert) >
+		     GIP_AUTH_CLIENT_PKT_MAX_LEN);
+
+	if (len >= sizeof(*ctrl) && ctrl->context == GIP_AUTH_CTX_CONTROL) {
+		auth->complete = ctrl->control == GIP_AUTH_CTRL_COMPLETE;
+		return 0;
+	}
+
+	if (len < sizeof(*hdr))
+		return -EINVAL;
+
+	if (hdr->options & GIP_AUTH_OPT_REQUEST)
+		return gip_auth_client_process_request(auth, hdr->command, out);
+
+	return gip_auth_client_process_data(auth, data, len, out);
+}
+
+int gip_auth_client_init(struct gip_auth_client *auth)
+{
+	struct shash_desc *shash_transcript, *shash_prf;
+
+	shash_transcript = gip_auth_alloc_shash("sha256");
+	if (IS_ERR(shash_transcript))
+		return PTR_ERR(shash_transcript);
+
+	shash_prf = gip_auth_alloc_shash("hmac(sha256)");
+	if (IS_ERR(shash_prf)) {
+		crypto_free_shash(shash_transcript->tfm);
+		kfree(shash_transcript);
+		return PTR_ERR(shash_prf);
+	}
+
+	memset(auth, 0, sizeof(*auth));
+	auth->shash_transcript = shash_transcript;
+	auth->shash_prf = shash_prf;
+
+	return 0;
+}
+
+void gip_auth_client_free(struct gip_auth_client *auth)
+{
+	if (auth->ecdh)
+		crypto_free_kpp(auth->ecdh);
+
+	crypto_free_shash(auth->shash_transcript->tfm);
+	crypto_free_shash(auth->shash_prf->tfm);
+	kfree(auth->shash_transcript);
+	kfree(auth->shash_prf);
+
+	auth->ecdh = NULL;
+	auth->shash_transcript = NULL;
+	auth->shash_prf = NULL;
+}
@@ -0,0 +1,31 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/*
+ * Copyright (C) 2023 Severin von Wnuck-Lipinski <severinvonw@outlook.de>
+ */
+
+#pragma once
+
+#include "auth.h"
+
+/* longest response of gip_auth_client_process_pkt */
+#define GIP_AUTH_CLIENT_PKT_MAX_LEN 1024
+
+struct crypto_kpp;
+
+/* client side of the v2 handshake, used to emulate devices */
+struct gip_auth_client {
+	struct shash_desc *shash_transcript;
+	struct shash_desc *shash_prf;
+	struct crypto_kpp *ecdh;
+
+	u8 random_host[GIP_AUTH_RANDOM_LEN];
+	u8 random_client[GIP_AUTH_RANDOM_LEN];
+	u8 master_secret[GIP_AUTH_SECRET_LEN];
+
+	bool complete;
+};
+
+int gip_auth_client_init(struct gip_auth_client *auth);
+void gip_auth_client_free(struct gip_auth_client *auth);
+int gip_auth_client_process_pkt(struct gip_auth_client *auth,
+				void *data, u32 len, void *out);
@@ -0,0 +1,7 @@
+// SPDX-License-Identifier: GPL-2.0-or-later
+/*
+ * Copyright (C) 2023 Severin von Wnuck-Lipinski <severinvonw@outlook.de>
+ */
+
+/* xone_virtual links its own copy, xone_gip does not export the helpers */
+#include "crypto.c"
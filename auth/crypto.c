@@ -238,10 +238,28 @@ static int gip_auth_ecdh_get_secret(struct crypto_kpp *tfm,
 	return err;
 }
 
-int gip_auth_compute_ecdh(u8 *pubkey_in, u8 *pubkey_out,
-			  int pubkey_len, u8 *secret_hash)
+/* generates a new key pair */
+struct crypto_kpp *gip_auth_alloc_ecdh(u8 *pubkey, int pubkey_len)
+{
+	struct crypto_kpp *tfm;
+	int err;
+
+	tfm = crypto_alloc_kpp("ecdh-nist-p256", 0, 0);
+	if (IS_ERR(tfm))
+		return tfm;
+
+	err = gip_auth_ecdh_get_pubkey(tfm, pubkey, pubkey_len);
+	if (err) {
+		crypto_free_kpp(tfm);
+		return ERR_PTR(err);
+	}
+
+	return tfm;
+}
+
+int gip_auth_compute_ecdh_secret(struct crypto_kpp *tfm,
+				 u8 *pubkey, int pubkey_len, u8 *secret_hash)
 {
-	struct crypto_kpp *tfm_ecdh;
 	struct crypto_shash *tfm_sha;
 	u8 *secret;
 	int err;
@@ -250,23 +268,13 @@ int gip_auth_compute_ecdh(u8 *pubkey_in, u8 *pubkey_out,
 	if (!secret)
 		return -ENOMEM;
 
-	tfm_ecdh = crypto_alloc_kpp("ecdh-nist-p256", 0, 0);
-	if (IS_ERR(tfm_ecdh)) {
-		err = PTR_ERR(tfm_ecdh);
-		goto err_free_secret;
-	}
-
 	tfm_sha = crypto_alloc_shash("sha256", 0, 0);
 	if (IS_ERR(tfm_sha)) {
 		err = PTR_ERR(tfm_sha);
-		goto err_free_ecdh;
+		goto err_free_secret;
 	}
 
-	err = gip_auth_ecdh_get_pubkey(tfm_ecdh, pubkey_out, pubkey_len);
-	if (err)
-		goto err_free_sha;
-
-	err = gip_auth_ecdh_get_secret(tfm_ecdh, pubkey_in, pubkey_len,
+	err = gip_auth_ecdh_get_secret(tfm, pubkey, pubkey_len,
 				       secret, GIP_AUTH_ECDH_SECRET_LEN);
 	if (err)
 		goto err_free_sha;
@@ -276,10 +284,25 @@ int gip_auth_compute_ecdh(u8 *pubkey_in, u8 *pubkey_out,
 
 err_free_sha:
 	crypto_free_shash(tfm_sha);
-err_free_ecdh:
-	crypto_free_kpp(tfm_ecdh);
 err_free_secret:
 	kfree(secret);
 
 	return err;
 }
+
+int gip_auth_compute_ecdh(u8 *pubkey_in, u8 *pubkey_out,
+			  int pubkey_len, u8 *secret_hash)
+{
+	struct crypto_kpp *tfm;
+	int err;
+
+	tfm = gip_auth_alloc_ecdh(pubkey_out, pubkey_len);
+	if (IS_ERR(tfm))
+		return PTR_ERR(tfm);
+
+	err = gip_auth_compute_ecdh_secret(tfm, pubkey_in, pubkey_len,
+					   secret_hash);
+	crypto_free_kpp(tfm);
+
+	return err;
+}
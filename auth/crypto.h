@@ -7,6 +7,8 @@
 
 #include <linux/types.h>
 
+struct crypto_kpp;
+
 struct shash_desc *gip_auth_alloc_shash(const char *alg);
 int gip_auth_get_transcript(struct shash_desc *desc, void *transcript);
 int gip_auth_compute_prf(struct shash_desc *desc, const char *label,
@@ -17,5 +19,8 @@ int gip_auth_compute_prf(struct shash_desc *desc, const char *label,
 int gip_auth_encrypt_rsa(u8 *key, int key_len,
 			 u8 *in, int in_len,
 			 u8 *out, int out_len);
+struct crypto_kpp *gip_auth_alloc_ecdh(u8 *pubkey, int pubkey_len);
+int gip_auth_compute_ecdh_secret(struct crypto_kpp *tfm,
+				 u8 *pubkey, int pubkey_len, u8 *secret_hash);
 int gip_auth_compute_ecdh(u8 *pubkey_in, u8 *pubkey_out,
 			  int pubkey_len, u8 *secret_hash);
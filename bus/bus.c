@@ -7,6 +7,8 @@
 #include <linux/slab.h>
 #include <linux/idr.h>
 #include <linux/version.h>
+#include <linux/debugfs.h>
+#include <linux/seq_file.h>
 
 #include "bus.h"
 
@@ -15,10 +17,53 @@
 #define to_gip_driver(d) container_of(d, struct gip_driver, drv)
 
 static DEFINE_IDA(gip_adapter_ida);
+static struct dentry *gip_debugfs_root;
+
+DEFINE_SRCU(gip_drv_srcu);
+
+static const char * const gip_adapter_stat_names[] = {
+	[GIP_ADAP_STAT_RX_PACKETS] = "rx_packets",
+	[GIP_ADAP_STAT_RX_BYTES] = "rx_bytes",
+	[GIP_ADAP_STAT_RX_ERRORS] = "rx_errors",
+	[GIP_ADAP_STAT_TX_ENQUEUED] = "tx_enqueued",
+	[GIP_ADAP_STAT_TX_POSTED] = "tx_posted",
+	[GIP_ADAP_STAT_TX_MERGED] = "tx_merged",
+	[GIP_ADAP_STAT_TX_PACKETS] = "tx_packets",
+	[GIP_ADAP_STAT_TX_BYTES] = "tx_bytes",
+	[GIP_ADAP_STAT_TX_TRANSFERS] = "tx_transfers",
+	[GIP_ADAP_STAT_TX_FULL] = "tx_full",
+	[GIP_ADAP_STAT_TX_ERRORS] = "tx_errors",
+	[GIP_ADAP_STAT_TX_STALLS] = "tx_stalls",
+};
+
+static const char * const gip_client_stat_names[] = {
+	[GIP_CLIENT_STAT_RX_PACKETS] = "rx_packets",
+	[GIP_CLIENT_STAT_RX_BYTES] = "rx_bytes",
+	[GIP_CLIENT_STAT_TX_PACKETS] = "tx_packets",
+	[GIP_CLIENT_STAT_TX_BYTES] = "tx_bytes",
+	[GIP_CLIENT_STAT_DRV_DROPPED] = "drv_dropped",
+	[GIP_CLIENT_STAT_SEQ_GAPS] = "seq_gaps",
+	[GIP_CLIENT_STAT_CHUNK_COMPLETED] = "chunk_completed",
+	[GIP_CLIENT_STAT_CHUNK_FAILED] = "chunk_failed",
+	[GIP_CLIENT_STAT_CHUNK_RETRANSMITS] = "chunk_retransmits",
+	[GIP_CLIENT_STAT_CHUNK_BYTES] = "chunk_bytes",
+	[GIP_CLIENT_STAT_CHUNK_RX_DUPLICATES] = "chunk_rx_duplicates",
+	[GIP_CLIENT_STAT_CHUNK_RX_OUT_OF_ORDER] = "chunk_rx_out_of_order",
+	[GIP_CLIENT_STAT_CHUNK_RX_INCOMPLETE] = "chunk_rx_incomplete",
+};
+
+static_assert(ARRAY_SIZE(gip_adapter_stat_names) == GIP_ADAP_STAT_COUNT);
+static_assert(ARRAY_SIZE(gip_client_stat_names) == GIP_CLIENT_STAT_COUNT);
+static_assert(GIP_ADAP_STAT_COUNT <= GIP_STATS_MAX);
+static_assert(GIP_CLIENT_STAT_COUNT <= GIP_STATS_MAX);
 
 static void gip_adapter_release(struct device *dev)
 {
-	kfree(to_gip_adapter(dev));
+	struct gip_adapter *adap = to_gip_adapter(dev);
+
+	gip_tx_destroy(adap);
+	gip_stats_free(&adap->stats);
+	kfree(adap);
 }
 
 static struct device_type gip_adapter_type = {
@@ -45,9 +90,10 @@ static void gip_client_release(struct device *dev)
 {
 	struct gip_client *client = to_gip_client(dev);
 
+	gip_destroy_chunk_transfers(client);
 	gip_free_client_info(client);
-	kfree(client->chunk_buf_out);
-	kfree(client->chunk_buf_in);
+	gip_free_chunk_buffer(client->chunk_buf_out);
+	gip_stats_free(&client->stats);
 	kfree(client);
 }
 
@@ -88,10 +134,10 @@ static int gip_bus_probe(struct device *dev)
 	if (down_interruptible(&client->drv_lock))
 		return -EINTR;
 
-	if (!client->drv) {
+	if (!rcu_access_pointer(client->drv)) {
 		err = drv->probe(client);
 		if (!err)
-			client->drv = drv;
+			rcu_assign_pointer(client->drv, drv);
 	}
 
 	up(&client->drv_lock);
@@ -106,9 +152,13 @@ static void gip_bus_remove(struct device *dev)
 
 	down(&client->drv_lock);
 
-	drv = client->drv;
+	drv = rcu_dereference_protected(client->drv, true);
 	if (drv) {
-		client->drv = NULL;
+		RCU_INIT_POINTER(client->drv, NULL);
+
+		/* wait for the receive path to leave the driver */
+		synchronize_srcu(&gip_drv_srcu);
+
 		if (drv->remove)
 			drv->remove(client);
 	}
@@ -136,6 +186,21 @@ static struct bus_type gip_bus_type = {
 #endif
 };
 
+static int gip_adapter_stats_show(struct seq_file *s, void *data)
+{
+	struct gip_adapter *adap = s->private;
+
+	gip_stats_show(s, &adap->stats);
+
+	return 0;
+}
+
+static void gip_adapter_stats_reset(struct gip_adapter *adap)
+{
+	gip_stats_reset(&adap->stats);
+}
+DEFINE_GIP_STATS_ATTRIBUTE(gip_adapter_stats);
+
 struct gip_adapter *gip_create_adapter(struct device *parent,
 				       struct gip_adapter_ops *ops,
 				       int audio_pkts)
@@ -147,6 +212,12 @@ struct gip_adapter *gip_create_adapter(struct device *parent,
 	if (!adap)
 		return ERR_PTR(-ENOMEM);
 
+	/* release frees the TX ring and statistics on every error path */
+	adap->dev.parent = parent;
+	adap->dev.type = &gip_adapter_type;
+	adap->dev.bus = &gip_bus_type;
+	device_initialize(&adap->dev);
+
 	adap->id = ida_simple_get(&gip_adapter_ida, 0, 0, GFP_KERNEL);
 	if (adap->id < 0) {
 		err = adap->id;
@@ -159,18 +230,32 @@ struct gip_adapter *gip_create_adapter(struct device *parent,
 		goto err_remove_ida;
 	}
 
-	adap->dev.parent = parent;
-	adap->dev.type = &gip_adapter_type;
-	adap->dev.bus = &gip_bus_type;
+	err = gip_tx_init(adap);
+	if (err)
+		goto err_destroy_queue;
+
+	err = gip_stats_init(&adap->stats, gip_adapter_stat_names,
+			     GIP_ADAP_STAT_COUNT, GFP_KERNEL);
+	if (err)
+		goto err_destroy_queue;
+
+	gip_capture_init(adap);
+
 	adap->ops = ops;
 	adap->audio_packet_count = audio_pkts;
 	dev_set_name(&adap->dev, "gip%d", adap->id);
-	spin_lock_init(&adap->send_lock);
 
-	err = device_register(&adap->dev);
+	err = device_add(&adap->dev);
 	if (err)
 		goto err_destroy_queue;
 
+	adap->debugfs = debugfs_create_dir(dev_name(&adap->dev),
+					   gip_debugfs_root);
+	debugfs_create_file("stats", 0644, adap->debugfs, adap,
+			    &gip_adapter_stats_fops);
+	gip_tx_init_debugfs(adap);
+	gip_capture_init_debugfs(adap);
+
 	dev_dbg(&adap->dev, "%s: registered\n", __func__);
 
 	return adap;
@@ -211,9 +296,14 @@ void gip_destroy_adapter(struct gip_adapter *adap)
 		if (!client || !device_is_registered(&client->dev))
 			continue;
 
+		debugfs_remove_recursive(client->debugfs);
 		device_unregister(&client->dev);
 	}
 
+	/* transport is about to go away */
+	gip_tx_stop(adap);
+
+	debugfs_remove_recursive(adap->debugfs);
 	ida_simple_remove(&gip_adapter_ida, adap->id);
 	destroy_workqueue(adap->clients_wq);
 
@@ -222,6 +312,46 @@ void gip_destroy_adapter(struct gip_adapter *adap)
 }
 EXPORT_SYMBOL_GPL(gip_destroy_adapter);
 
+static int gip_client_stats_show(struct seq_file *s, void *data)
+{
+	struct gip_client *client = s->private;
+
+	gip_stats_show(s, &client->stats);
+	seq_printf(s, "chunk_rate_bytes_per_sec: %lld\n",
+		   atomic64_read(&client->chunk_rate));
+
+	return 0;
+}
+
+static void gip_client_stats_reset(struct gip_client *client)
+{
+	gip_stats_reset(&client->stats);
+}
+DEFINE_GIP_STATS_ATTRIBUTE(gip_client_stats);
+
+static int gip_client_latency_show(struct seq_file *s, void *data)
+{
+	struct gip_client *client = s->private;
+	int i;
+
+	seq_puts(s, "input_latency_ns:\n");
+
+	for (i = 0; i < GIP_RX_LATENCY_BUCKETS; i++)
+		seq_printf(s, "  < %llu: %lld\n", BIT_ULL(i),
+			   atomic64_read(&client->rx_latency[i]));
+
+	return 0;
+}
+
+static void gip_client_latency_reset(struct gip_client *client)
+{
+	int i;
+
+	for (i = 0; i < GIP_RX_LATENCY_BUCKETS; i++)
+		atomic64_set(&client->rx_latency[i], 0);
+}
+DEFINE_GIP_STATS_ATTRIBUTE(gip_client_latency);
+
 static void gip_register_client(struct work_struct *work)
 {
 	struct gip_client *client = container_of(work, typeof(*client),
@@ -235,11 +365,20 @@ static void gip_register_client(struct work_struct *work)
 	dev_set_name(&client->dev, "gip%d.%u", client->adapter->id, client->id);
 
 	err = device_register(&client->dev);
-	if (err)
+	if (err) {
 		dev_err(&client->dev, "%s: register failed: %d\n",
 			__func__, err);
-	else
-		dev_dbg(&client->dev, "%s: registered\n", __func__);
+		return;
+	}
+
+	client->debugfs = debugfs_create_dir(dev_name(&client->dev),
+					     client->adapter->debugfs);
+	debugfs_create_file("stats", 0644, client->debugfs, client,
+			    &gip_client_stats_fops);
+	debugfs_create_file("latency", 0644, client->debugfs, client,
+			    &gip_client_latency_fops);
+
+	dev_dbg(&client->dev, "%s: registered\n", __func__);
 }
 
 static void gip_unregister_client(struct work_struct *work)
@@ -251,6 +390,7 @@ static void gip_unregister_client(struct work_struct *work)
 		return;
 
 	dev_dbg(&client->dev, "%s: unregistered\n", __func__);
+	debugfs_remove_recursive(client->debugfs);
 	device_unregister(&client->dev);
 }
 
@@ -266,11 +406,18 @@ struct gip_client *gip_get_client(struct gip_adapter *adap, u8 id)
 	if (!client)
 		return ERR_PTR(-ENOMEM);
 
+	if (gip_stats_init(&client->stats, gip_client_stat_names,
+			   GIP_CLIENT_STAT_COUNT, GFP_ATOMIC)) {
+		kfree(client);
+		return ERR_PTR(-ENOMEM);
+	}
+
 	client->id = id;
 	client->adapter = adap;
 	sema_init(&client->drv_lock, 1);
 	INIT_WORK(&client->work_register, gip_register_client);
 	INIT_WORK(&client->work_unregister, gip_unregister_client);
+	gip_init_chunk_transfers(client);
 
 	adap->clients[id] = client;
 
@@ -291,33 +438,6 @@ void gip_remove_client(struct gip_client *client)
 	queue_work(client->adapter->clients_wq, &client->work_unregister);
 }
 
-void gip_free_client_info(struct gip_client *client)
-{
-	int i;
-
-	kfree(client->client_commands);
-	kfree(client->firmware_versions);
-	kfree(client->audio_formats);
-	kfree(client->capabilities_out);
-	kfree(client->capabilities_in);
-
-	if (client->classes)
-		for (i = 0; i < client->classes->count; i++)
-			kfree(client->classes->strings[i]);
-
-	kfree(client->classes);
-	kfree(client->interfaces);
-	kfree(client->hid_descriptor);
-
-	client->client_commands = NULL;
-	client->audio_formats = NULL;
-	client->capabilities_out = NULL;
-	client->capabilities_in = NULL;
-	client->classes = NULL;
-	client->interfaces = NULL;
-	client->hid_descriptor = NULL;
-}
-
 int __gip_register_driver(struct gip_driver *drv, struct module *owner,
 			  const char *mod_name)
 {
@@ -338,12 +458,33 @@ EXPORT_SYMBOL_GPL(gip_unregister_driver);
 
 static int __init gip_bus_init(void)
 {
-	return bus_register(&gip_bus_type);
+	int err;
+
+	gip_debugfs_root = debugfs_create_dir("xone-gip", NULL);
+
+	err = gip_pool_init(gip_debugfs_root);
+	if (err)
+		goto err_remove_debugfs;
+
+	err = bus_register(&gip_bus_type);
+	if (err)
+		goto err_exit_pool;
+
+	return 0;
+
+err_exit_pool:
+	gip_pool_exit();
+err_remove_debugfs:
+	debugfs_remove_recursive(gip_debugfs_root);
+
+	return err;
 }
 
 static void __exit gip_bus_exit(void)
 {
 	bus_unregister(&gip_bus_type);
+	debugfs_remove_recursive(gip_debugfs_root);
+	gip_pool_exit();
 }
 
 module_init(gip_bus_init);
@@ -8,17 +8,204 @@
 #include <linux/types.h>
 #include <linux/device.h>
 #include <linux/semaphore.h>
+#include <linux/srcu.h>
+#include <linux/completion.h>
+#include <linux/hrtimer.h>
+#include <linux/sizes.h>
+#include <linux/percpu.h>
+#include <linux/u64_stats_sync.h>
+#include <linux/kfifo.h>
+#include <linux/jump_label.h>
 
 #include "protocol.h"
+#include "capture.h"
 
 #define GIP_MAX_CLIENTS 16
 
+#define GIP_HDR_CLIENT_ID GENMASK(3, 0)
+#define GIP_HDR_MIN_LENGTH 3
+
+/* max length, even for wireless packets (except audio) */
+#define GIP_PKT_MAX_LENGTH 58
+
+#define GIP_BATT_LEVEL GENMASK(1, 0)
+#define GIP_BATT_TYPE GENMASK(3, 2)
+#define GIP_STATUS_CONNECTED BIT(7)
+
+/* must be a power of two */
+#define GIP_TX_RING_SIZE 64
+
+/* longest header (including chunk offset) + longest payload */
+#define GIP_TX_SLOT_LENGTH 66
+
+#define GIP_TX_LATENCY_BUCKETS 32
+#define GIP_TX_BATCH_BUCKETS 8
+#define GIP_RX_LATENCY_BUCKETS 32
+
+/* largest chunk buffer including its header, see gip_pool_alloc */
+#define GIP_POOL_MAX_SIZE (SZ_64K + 128)
+
+/* outgoing chunked transfers in flight per client */
+#define GIP_CHUNK_MAX_TRANSFERS 4
+
 #define gip_register_driver(drv) \
 	__gip_register_driver(drv, THIS_MODULE, KBUILD_MODNAME)
 
 #define module_gip_driver(drv) \
 	module_driver(drv, gip_register_driver, gip_unregister_driver)
 
+enum gip_command_core {
+	GIP_CMD_ACKNOWLEDGE = 0x01,
+	GIP_CMD_ANNOUNCE = 0x02,
+	GIP_CMD_STATUS = 0x03,
+	GIP_CMD_IDENTIFY = 0x04,
+	GIP_CMD_POWER = 0x05,
+	GIP_CMD_AUTHENTICATE = 0x06,
+	GIP_CMD_VIRTUAL_KEY = 0x07,
+	GIP_CMD_AUDIO_CONTROL = 0x08,
+	GIP_CMD_LED = 0x0a,
+	GIP_CMD_HID_REPORT = 0x0b,
+	GIP_CMD_FIRMWARE = 0x0c,
+	GIP_CMD_SERIAL_NUMBER = 0x1e,
+	GIP_CMD_AUDIO_SAMPLES = 0x60,
+};
+
+enum gip_command_client {
+	GIP_CMD_RUMBLE = 0x09,
+	GIP_CMD_INPUT = 0x20,
+};
+
+enum gip_option {
+	GIP_OPT_ACKNOWLEDGE = BIT(4),
+	GIP_OPT_INTERNAL = BIT(5),
+	GIP_OPT_CHUNK_START = BIT(6),
+	GIP_OPT_CHUNK = BIT(7),
+};
+
+enum gip_audio_control {
+	GIP_AUD_CTRL_VOLUME_CHAT = 0x00,
+	GIP_AUD_CTRL_FORMAT_CHAT = 0x01,
+	GIP_AUD_CTRL_FORMAT = 0x02,
+	GIP_AUD_CTRL_VOLUME = 0x03,
+};
+
+enum gip_audio_volume_mute {
+	GIP_AUD_VOLUME_UNMUTED = 0x04,
+	GIP_AUD_VOLUME_MIC_MUTED = 0x05,
+};
+
+struct gip_pkt_acknowledge {
+	u8 unknown;
+	u8 command;
+	u8 options;
+	__le16 length;
+	u8 padding[2];
+	__le16 remaining;
+} __packed;
+
+struct gip_pkt_announce {
+	u8 address[6];
+	__le16 unknown;
+	__le16 vendor_id;
+	__le16 product_id;
+	struct gip_version {
+		__le16 major;
+		__le16 minor;
+		__le16 build;
+		__le16 revision;
+	} __packed fw_version, hw_version;
+} __packed;
+
+struct gip_pkt_status {
+	u8 status;
+	u8 unknown[3];
+} __packed;
+
+struct gip_pkt_identify {
+	u8 unknown[16];
+	__le16 client_commands_offset;
+	__le16 firmware_versions_offset;
+	__le16 audio_formats_offset;
+	__le16 capabilities_out_offset;
+	__le16 capabilities_in_offset;
+	__le16 classes_offset;
+	__le16 interfaces_offset;
+	__le16 hid_descriptor_offset;
+} __packed;
+
+struct gip_pkt_power {
+	u8 mode;
+} __packed;
+
+struct gip_pkt_virtual_key {
+	u8 down;
+	u8 key;
+} __packed;
+
+struct gip_pkt_audio_control {
+	u8 subcommand;
+} __packed;
+
+struct gip_pkt_audio_volume_chat {
+	struct gip_pkt_audio_control control;
+	u8 mute;
+	u8 gain_out;
+	u8 out;
+	u8 in;
+} __packed;
+
+struct gip_pkt_audio_format_chat {
+	struct gip_pkt_audio_control control;
+	u8 in_out;
+} __packed;
+
+struct gip_pkt_audio_format {
+	struct gip_pkt_audio_control control;
+	u8 in;
+	u8 out;
+} __packed;
+
+struct gip_pkt_audio_volume {
+	struct gip_pkt_audio_control control;
+	u8 mute;
+	u8 out;
+	u8 chat;
+	u8 in;
+	u8 unknown1;
+	u8 unknown2[2];
+} __packed;
+
+struct gip_pkt_led {
+	u8 unknown;
+	u8 mode;
+	u8 brightness;
+} __packed;
+
+struct gip_pkt_serial_number {
+	u8 unknown[2];
+	char serial[14];
+} __packed;
+
+struct gip_pkt_audio_samples {
+	__le16 length_out;
+	u8 samples[];
+} __packed;
+
+struct gip_command_descriptor {
+	u8 marker;
+	u8 unknown1;
+	u8 command;
+	u8 length;
+	u8 unknown2[3];
+	u8 options;
+	u8 unknown3[15];
+} __packed;
+
+struct gip_firmware_version {
+	__le16 major;
+	__le16 minor;
+} __packed;
+
 struct gip_adapter_buffer {
 	enum gip_adapter_buffer_type {
 		GIP_BUF_DATA,
@@ -28,6 +215,9 @@ struct gip_adapter_buffer {
 	void *context;
 	void *data;
 	int length;
+
+	/* latency-sensitive commands are waiting, see gip_tx_get_buffer */
+	bool urgent;
 };
 
 struct gip_adapter_ops {
@@ -35,11 +225,187 @@ struct gip_adapter_ops {
 			  struct gip_adapter_buffer *buf);
 	int (*submit_buffer)(struct gip_adapter *adap,
 			     struct gip_adapter_buffer *buf);
+	/* returns a buffer that was taken but not submitted */
+	void (*put_buffer)(struct gip_adapter *adap,
+			   struct gip_adapter_buffer *buf);
 	int (*set_encryption_key)(struct gip_adapter *adap, u8 *key, int len);
 	int (*enable_audio)(struct gip_adapter *adap);
 	int (*init_audio_in)(struct gip_adapter *adap);
 	int (*init_audio_out)(struct gip_adapter *adap, int pkt_len);
 	int (*disable_audio)(struct gip_adapter *adap);
+	/* processes replayed packets, serialized against the RX path */
+	int (*replay_buffer)(struct gip_adapter *adap, void *data, int len,
+			     u64 time);
+};
+
+struct seq_file;
+
+/* most counters in one set, see gip_stats_show */
+#define GIP_STATS_MAX 16
+
+enum gip_adapter_stat {
+	GIP_ADAP_STAT_RX_PACKETS,
+	GIP_ADAP_STAT_RX_BYTES,
+	GIP_ADAP_STAT_RX_ERRORS,
+	GIP_ADAP_STAT_TX_ENQUEUED,
+	GIP_ADAP_STAT_TX_POSTED,
+	GIP_ADAP_STAT_TX_MERGED,
+	GIP_ADAP_STAT_TX_PACKETS,
+	GIP_ADAP_STAT_TX_BYTES,
+	GIP_ADAP_STAT_TX_TRANSFERS,
+	GIP_ADAP_STAT_TX_FULL,
+	GIP_ADAP_STAT_TX_ERRORS,
+	GIP_ADAP_STAT_TX_STALLS,
+	GIP_ADAP_STAT_COUNT,
+};
+
+enum gip_client_stat {
+	GIP_CLIENT_STAT_RX_PACKETS,
+	GIP_CLIENT_STAT_RX_BYTES,
+	GIP_CLIENT_STAT_TX_PACKETS,
+	GIP_CLIENT_STAT_TX_BYTES,
+	GIP_CLIENT_STAT_DRV_DROPPED,
+	GIP_CLIENT_STAT_SEQ_GAPS,
+	GIP_CLIENT_STAT_CHUNK_COMPLETED,
+	GIP_CLIENT_STAT_CHUNK_FAILED,
+	GIP_CLIENT_STAT_CHUNK_RETRANSMITS,
+	GIP_CLIENT_STAT_CHUNK_BYTES,
+	GIP_CLIENT_STAT_CHUNK_RX_DUPLICATES,
+	GIP_CLIENT_STAT_CHUNK_RX_OUT_OF_ORDER,
+	GIP_CLIENT_STAT_CHUNK_RX_INCOMPLETE,
+	GIP_CLIENT_STAT_COUNT,
+};
+
+struct gip_stats_cpu {
+	struct u64_stats_sync syncp;
+	u64_stats_t values[];
+};
+
+/* lockless per-CPU counters, summed up on read */
+struct gip_stats {
+	struct gip_stats_cpu __percpu *cpu;
+	const char * const *names;
+	int count;
+
+	/* values at the last reset */
+	u64 *base;
+};
+
+static inline void gip_stats_add(struct gip_stats *stats, int stat, u64 val)
+{
+	struct gip_stats_cpu *cpu = get_cpu_ptr(stats->cpu);
+	unsigned long flags;
+
+	flags = u64_stats_update_begin_irqsave(&cpu->syncp);
+	u64_stats_add(&cpu->values[stat], val);
+	u64_stats_update_end_irqrestore(&cpu->syncp, flags);
+
+	put_cpu_ptr(stats->cpu);
+}
+
+static inline void gip_stats_inc(struct gip_stats *stats, int stat)
+{
+	gip_stats_add(stats, stat, 1);
+}
+
+/* like DEFINE_SHOW_ATTRIBUTE, any write resets the counters */
+#define DEFINE_GIP_STATS_ATTRIBUTE(__name)				\
+static int __name ## _open(struct inode *inode, struct file *file)	\
+{									\
+	return single_open(file, __name ## _show, inode->i_private);	\
+}									\
+									\
+static ssize_t __name ## _write(struct file *file,			\
+				const char __user *buf,			\
+				size_t len, loff_t *pos)		\
+{									\
+	struct seq_file *s = file->private_data;			\
+									\
+	__name ## _reset(s->private);					\
+									\
+	return len;							\
+}									\
+									\
+static const struct file_operations __name ## _fops = {			\
+	.owner = THIS_MODULE,						\
+	.open = __name ## _open,					\
+	.read = seq_read,						\
+	.write = __name ## _write,					\
+	.llseek = seq_lseek,						\
+	.release = single_release,					\
+}
+
+enum gip_tx_flags {
+	/* assign next data sequence number */
+	GIP_TX_SEQ_NEW = BIT(0),
+	/* reuse sequence number of current chunked transfer */
+	GIP_TX_SEQ_CHUNK = BIT(1),
+	GIP_TX_CHUNK_START = BIT(2),
+};
+
+/* latest-wins commands, a burst collapses into one transfer */
+enum gip_tx_mailbox {
+	GIP_TX_MBOX_RUMBLE,
+	GIP_TX_MBOX_LED,
+	GIP_TX_MBOX_VOLUME,
+	GIP_TX_MBOX_COUNT,
+};
+
+#define GIP_TX_MBOX_SLOTS (GIP_MAX_CLIENTS * GIP_TX_MBOX_COUNT)
+
+struct gip_tx_packet {
+	u8 client_id;
+	u8 flags;
+	u8 transfer;
+	u16 length;
+	u8 data[GIP_TX_SLOT_LENGTH];
+};
+
+struct gip_tx_slot {
+	atomic_t position;
+	u64 time;
+
+	struct gip_tx_packet packet;
+};
+
+/* bounded multi-producer ring, drained by a single submitter */
+struct gip_tx_ring {
+	struct gip_tx_slot *slots;
+	atomic_t head;
+	unsigned int tail;
+	unsigned long flags;
+
+	/* sequence numbers of outgoing chunked transfers */
+	u8 chunk_sequence[GIP_MAX_CLIENTS][GIP_CHUNK_MAX_TRANSFERS];
+
+	/* buffers released by the transport, see gip_tx_kick */
+	atomic_t kicks;
+
+	/* coalesces packets queued within the aggregation window */
+	struct hrtimer window;
+
+	/* serializes access to mailboxes */
+	spinlock_t mbox_lock;
+	struct gip_tx_packet *mailboxes;
+	DECLARE_BITMAP(mbox_pending, GIP_TX_MBOX_SLOTS);
+
+	/* log2 histogram of packets per transfer */
+	atomic64_t batch[GIP_TX_BATCH_BUCKETS];
+
+	/* log2 histogram of enqueue latencies in ns, including mailboxes */
+	atomic64_t latency[GIP_TX_LATENCY_BUCKETS];
+};
+
+/* packet capture, see gip_capture */
+struct gip_capture {
+	/* serializes writers, the only reader holds busy */
+	spinlock_t lock;
+	unsigned long busy;
+	void *buffer;
+	DECLARE_KFIFO_PTR(fifo, u8);
+	u32 dropped;
+
+	wait_queue_head_t wait;
 };
 
 struct gip_adapter {
@@ -52,11 +418,38 @@ struct gip_adapter {
 	struct gip_client *clients[GIP_MAX_CLIENTS];
 	struct workqueue_struct *clients_wq;
 
-	/* serializes access to data sequence number */
-	spinlock_t send_lock;
+	/* data sequence number is only used by the submitter */
+	struct gip_tx_ring tx;
+	struct gip_stats stats;
+	struct gip_capture capture;
 
 	u8 data_sequence;
 	u8 audio_sequence;
+
+	struct dentry *debugfs;
+};
+
+/* outgoing chunked transfer, see gip_send_pkt_chunked */
+struct gip_chunk_transfer {
+	struct list_head list;
+	struct gip_header header;
+	u8 index;
+
+	/* first chunk has been sent and acknowledged */
+	bool announced;
+	bool accepted;
+
+	/* offsets acknowledged by the device and sent by the host */
+	u32 length;
+	u32 acked;
+	u32 sent;
+
+	ktime_t start;
+	ktime_t deadline;
+	unsigned int retries;
+	unsigned int retransmits;
+
+	u8 data[];
 };
 
 struct gip_client {
@@ -64,16 +457,37 @@ struct gip_client {
 	u8 id;
 
 	struct gip_adapter *adapter;
-	struct gip_driver *drv;
+
+	/* updates are serialized by drv_lock, readers use gip_drv_srcu */
+	struct gip_driver __rcu *drv;
 	struct semaphore drv_lock;
 
+	struct gip_stats stats;
+
+	/* last sequence number received for each command */
+	u8 rx_sequence[256];
+
+	/* completion time of the buffer being processed */
+	u64 rx_time;
+
+	/* log2 histogram of input latencies in ns, see gip_report_latency */
+	atomic64_t rx_latency[GIP_RX_LATENCY_BUCKETS];
+
 	struct work_struct work_register;
 	struct work_struct work_unregister;
 
 	struct gip_chunk_buffer *chunk_buf_out;
-	struct gip_chunk_buffer *chunk_buf_in;
 	struct gip_hardware hardware;
 
+	/* outgoing chunked transfers, oldest first */
+	spinlock_t chunk_lock;
+	struct list_head chunk_transfers;
+	unsigned long chunk_indices;
+	struct hrtimer chunk_timer;
+
+	/* throughput of the last transfer in bytes/s */
+	atomic64_t chunk_rate;
+
 	struct gip_info_element *client_commands;
 	struct gip_info_element *firmware_versions;
 	struct gip_info_element *audio_formats;
@@ -85,6 +499,8 @@ struct gip_client {
 
 	struct gip_audio_config audio_config_in;
 	struct gip_audio_config audio_config_out;
+
+	struct dentry *debugfs;
 };
 
 struct gip_driver_ops {
@@ -113,16 +529,70 @@ struct gip_driver {
 	void (*remove)(struct gip_client *client);
 };
 
+extern struct srcu_struct gip_drv_srcu;
+
 struct gip_adapter *gip_create_adapter(struct device *parent,
 				       struct gip_adapter_ops *ops,
 				       int audio_pkts);
 int gip_power_off_adapter(struct gip_adapter *adap);
 void gip_destroy_adapter(struct gip_adapter *adap);
 
+int gip_tx_init(struct gip_adapter *adap);
+void gip_tx_destroy(struct gip_adapter *adap);
+struct gip_tx_slot *gip_tx_reserve(struct gip_adapter *adap);
+void gip_tx_commit(struct gip_adapter *adap, struct gip_tx_slot *slot);
+void gip_tx_flush(struct gip_adapter *adap);
+void gip_tx_post(struct gip_adapter *adap, enum gip_tx_mailbox mbox,
+		 struct gip_tx_packet *pkt);
+void gip_tx_kick(struct gip_adapter *adap);
+int gip_tx_depth(struct gip_adapter *adap);
+void gip_tx_stop(struct gip_adapter *adap);
+void gip_tx_init_debugfs(struct gip_adapter *adap);
+
 struct gip_client *gip_get_client(struct gip_adapter *adap, u8 id);
 void gip_add_client(struct gip_client *client);
 void gip_remove_client(struct gip_client *client);
 void gip_free_client_info(struct gip_client *client);
+void gip_init_chunk_transfers(struct gip_client *client);
+void gip_destroy_chunk_transfers(struct gip_client *client);
+void gip_free_chunk_buffer(struct gip_chunk_buffer *buf);
+
+int gip_stats_init(struct gip_stats *stats, const char * const *names,
+		   int count, gfp_t gfp);
+void gip_stats_free(struct gip_stats *stats);
+void gip_stats_show(struct seq_file *s, struct gip_stats *stats);
+void gip_stats_reset(struct gip_stats *stats);
+
+void gip_capture_init(struct gip_adapter *adap);
+void gip_capture_init_debugfs(struct gip_adapter *adap);
+void __gip_capture(struct gip_adapter *adap, enum gip_capture_direction dir,
+		   u64 time, u8 *data, int len);
+
+DECLARE_STATIC_KEY_FALSE(gip_capture_key);
+
+static inline void gip_capture(struct gip_adapter *adap,
+			       enum gip_capture_direction dir,
+			       u64 time, u8 *data, int len)
+{
+	if (static_branch_unlikely(&gip_capture_key))
+		__gip_capture(adap, dir, time, data, len);
+}
+
+/* the clock is only read while capturing */
+static inline void gip_capture_tx(struct gip_adapter *adap, u8 *data, int len)
+{
+	if (static_branch_unlikely(&gip_capture_key))
+		__gip_capture(adap, GIP_CAPTURE_TX, ktime_get_ns(), data, len);
+}
+
+int gip_get_header_length(struct gip_header *hdr);
+void gip_encode_header(struct gip_header *hdr, u8 *buf);
+int gip_decode_header(struct gip_header *hdr, u8 *data, int len);
+
+int gip_pool_init(struct dentry *debugfs);
+void gip_pool_exit(void);
+void *gip_pool_alloc(size_t size);
+void gip_pool_free(void *ptr, size_t size);
 
 int __gip_register_driver(struct gip_driver *drv, struct module *owner,
 			  const char *mod_name);
@@ -0,0 +1,315 @@
+// SPDX-License-Identifier: GPL-2.0-or-later
+/*
+ * Copyright (C) 2021 Severin von Wnuck-Lipinski <severinvonw@outlook.de>
+ */
+
+#include <linux/module.h>
+#include <linux/vmalloc.h>
+#include <linux/log2.h>
+#include <linux/poll.h>
+#include <linux/uaccess.h>
+#include <linux/debugfs.h>
+
+#include "bus.h"
+
+/* keeps the size in bytes within the kfifo limits */
+#define GIP_CAPTURE_MIN_BUFFER_KB 4u
+#define GIP_CAPTURE_MAX_BUFFER_KB 65536u
+
+static unsigned int capture_buffer_kb = 1024;
+module_param(capture_buffer_kb, uint, 0644);
+MODULE_PARM_DESC(capture_buffer_kb,
+		 "Size of the packet capture buffer (KiB, 4 to 65536)");
+
+static unsigned int capture_snaplen = 512;
+module_param(capture_snaplen, uint, 0644);
+MODULE_PARM_DESC(capture_snaplen, "Maximum captured bytes per packet");
+
+/* only enabled while a capture file is open */
+DEFINE_STATIC_KEY_FALSE(gip_capture_key);
+
+void gip_capture_init(struct gip_adapter *adap)
+{
+	struct gip_capture *cap = &adap->capture;
+
+	spin_lock_init(&cap->lock);
+	init_waitqueue_head(&cap->wait);
+}
+
+/* data starts with the encoded header, called from any context */
+void __gip_capture(struct gip_adapter *adap, enum gip_capture_direction dir,
+		   u64 time, u8 *data, int len)
+{
+	struct gip_capture *cap = &adap->capture;
+	struct gip_capture_record rec = {};
+	struct gip_header hdr;
+	unsigned long flags;
+	int captured;
+
+	if (len < GIP_HDR_MIN_LENGTH)
+		return;
+
+	gip_decode_header(&hdr, data, len);
+	captured = min_t(int, len, READ_ONCE(capture_snaplen));
+
+	rec.time_ns = cpu_to_le64(time);
+	rec.length = cpu_to_le16(len);
+	rec.captured = cpu_to_le16(captured);
+	rec.direction = dir;
+	rec.client = hdr.options & GIP_HDR_CLIENT_ID;
+	rec.command = hdr.command;
+	rec.options = hdr.options;
+	rec.sequence = hdr.sequence;
+	rec.packet_length = cpu_to_le32(hdr.packet_length);
+	rec.chunk_offset = cpu_to_le32(hdr.chunk_offset);
+
+	spin_lock_irqsave(&cap->lock, flags);
+
+	if (!cap->buffer)
+		goto out_unlock;
+
+	/*
+	 * Records that do not fit are dropped. The reader sees a byte
+	 * stream and reassembles records from their lengths, a read can
+	 * end within a record or race with the second kfifo_in.
+	 */
+	if (kfifo_avail(&cap->fifo) < sizeof(rec) + captured) {
+		cap->dropped++;
+		goto out_unlock;
+	}
+
+	rec.dropped = cpu_to_le32(cap->dropped);
+	cap->dropped = 0;
+
+	kfifo_in(&cap->fifo, (u8 *)&rec, sizeof(rec));
+	kfifo_in(&cap->fifo, data, captured);
+	spin_unlock_irqrestore(&cap->lock, flags);
+
+	wake_up_interruptible(&cap->wait);
+	return;
+
+out_unlock:
+	spin_unlock_irqrestore(&cap->lock, flags);
+}
+
+static int gip_capture_open(struct inode *inode, struct file *file)
+{
+	struct gip_adapter *adap = inode->i_private;
+	struct gip_capture *cap = &adap->capture;
+	unsigned int kb = clamp(READ_ONCE(capture_buffer_kb),
+				GIP_CAPTURE_MIN_BUFFER_KB,
+				GIP_CAPTURE_MAX_BUFFER_KB);
+	unsigned int size = roundup_pow_of_two(kb * SZ_1K);
+	void *buf;
+	int err;
+
+	/* a single reader per adapter */
+	if (test_and_set_bit(0, &cap->busy))
+		return -EBUSY;
+
+	buf = vmalloc(size);
+	if (!buf) {
+		err = -ENOMEM;
+		goto err_clear_busy;
+	}
+
+	err = kfifo_init(&cap->fifo, buf, size);
+	if (err)
+		goto err_free_buf;
+
+	spin_lock_irq(&cap->lock);
+	cap->buffer = buf;
+	cap->dropped = 0;
+	spin_unlock_irq(&cap->lock);
+
+	static_branch_inc(&gip_capture_key);
+	file->private_data = cap;
+
+	return nonseekable_open(inode, file);
+
+err_free_buf:
+	vfree(buf);
+err_clear_busy:
+	clear_bit(0, &cap->busy);
+
+	return err;
+}
+
+static int gip_capture_release(struct inode *inode, struct file *file)
+{
+	struct gip_capture *cap = file->private_data;
+	void *buf;
+
+	static_branch_dec(&gip_capture_key);
+
+	spin_lock_irq(&cap->lock);
+	buf = cap->buffer;
+	cap->buffer = NULL;
+	spin_unlock_irq(&cap->lock);
+
+	vfree(buf);
+	clear_bit(0, &cap->busy);
+
+	return 0;
+}
+
+static ssize_t gip_capture_read(struct file *file, char __user *data,
+				size_t count, loff_t *ppos)
+{
+	struct gip_capture *cap = file->private_data;
+	unsigned int copied;
+	int err;
+
+	if (kfifo_is_empty(&cap->fifo)) {
+		if (file->f_flags & O_NONBLOCK)
+			return -EAGAIN;
+
+		err = wait_event_interruptible(cap->wait,
+					       !kfifo_is_empty(&cap->fifo));
+		if (err)
+			return err;
+	}
+
+	/* single reader, no locking required */
+	err = kfifo_to_user(&cap->fifo, data, count, &copied);
+
+	return err ?: copied;
+}
+
+static __poll_t gip_capture_poll(struct file *file, poll_table *wait)
+{
+	struct gip_capture *cap = file->private_data;
+
+	poll_wait(file, &cap->wait, wait);
+
+	return kfifo_is_empty(&cap->fifo) ? 0 : EPOLLIN | EPOLLRDNORM;
+}
+
+static const struct file_operations gip_capture_fops = {
+	.owner = THIS_MODULE,
+	.open = gip_capture_open,
+	.release = gip_capture_release,
+	.read = gip_capture_read,
+	.poll = gip_capture_poll,
+};
+
+/* results of one replay session, see gip_replay_write */
+struct gip_replay {
+	struct gip_adapter *adapter;
+
+	u64 packets;
+	u64 bytes;
+	u64 errors;
+	u64 skipped;
+	u64 time_ns;
+};
+
+static int gip_replay_open(struct inode *inode, struct file *file)
+{
+	struct gip_replay *replay;
+
+	replay = kzalloc(sizeof(*replay), GFP_KERNEL);
+	if (!replay)
+		return -ENOMEM;
+
+	replay->adapter = inode->i_private;
+	file->private_data = replay;
+
+	return nonseekable_open(inode, file);
+}
+
+static int gip_replay_release(struct inode *inode, struct file *file)
+{
+	kfree(file->private_data);
+
+	return 0;
+}
+
+static void gip_replay_record(struct gip_replay *replay,
+			      struct gip_capture_record *rec, u8 *data)
+{
+	struct gip_adapter *adap = replay->adapter;
+	int len = le16_to_cpu(rec->captured);
+	u64 start;
+	int err;
+
+	/* only complete received packets can be processed again */
+	if (rec->direction != GIP_CAPTURE_RX ||
+	    len != le16_to_cpu(rec->length)) {
+		replay->skipped++;
+		return;
+	}
+
+	start = ktime_get_ns();
+	err = adap->ops->replay_buffer(adap, data, len, start);
+	replay->time_ns += ktime_get_ns() - start;
+
+	replay->packets++;
+	replay->bytes += len;
+
+	if (err)
+		replay->errors++;
+}
+
+/* accepts whole capture records, a partial record is left to the caller */
+static ssize_t gip_replay_write(struct file *file, const char __user *data,
+				size_t count, loff_t *ppos)
+{
+	struct gip_replay *replay = file->private_data;
+	struct gip_capture_record *rec;
+	size_t pos = 0, len;
+	u8 *buf;
+
+	count = min_t(size_t, count, SZ_64K);
+
+	buf = memdup_user(data, count);
+	if (IS_ERR(buf))
+		return PTR_ERR(buf);
+
+	while (count - pos >= sizeof(*rec)) {
+		rec = (struct gip_capture_record *)(buf + pos);
+		len = sizeof(*rec) + le16_to_cpu(rec->captured);
+		if (count - pos < len)
+			break;
+
+		gip_replay_record(replay, rec, buf + pos + sizeof(*rec));
+		pos += len;
+	}
+
+	kfree(buf);
+
+	return pos ?: -EINVAL;
+}
+
+static ssize_t gip_replay_read(struct file *file, char __user *data,
+			       size_t count, loff_t *ppos)
+{
+	struct gip_replay *replay = file->private_data;
+	char buf[160];
+	int len;
+
+	len = scnprintf(buf, sizeof(buf),
+			"packets: %llu\nbytes: %llu\nerrors: %llu\nskipped: %llu\ntime_ns: %llu\n",
+			replay->packets, replay->bytes, replay->errors,
+			replay->skipped, replay->time_ns);
+
+	return simple_read_from_buffer(data, count, ppos, buf, len);
+}
+
+static const struct file_operations gip_replay_fops = {
+	.owner = THIS_MODULE,
+	.open = gip_replay_open,
+	.release = gip_replay_release,
+	.read = gip_replay_read,
+	.write = gip_replay_write,
+};
+
+void gip_capture_init_debugfs(struct gip_adapter *adap)
+{
+	debugfs_create_file("capture", 0400, adap->debugfs, adap,
+			    &gip_capture_fops);
+	/* packets cannot be injected between those of real hardware */
+	if (adap->ops->replay_buffer)
+		debugfs_create_file("replay", 0600, adap->debugfs, adap,
+				    &gip_replay_fops);
+}
@@ -0,0 +1,38 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/*
+ * Copyright (C) 2021 Severin von Wnuck-Lipinski <severinvonw@outlook.de>
+ */
+
+#pragma once
+
+#include <linux/types.h>
+
+/*
+ * Record format of the debugfs "capture" file, also used by userspace.
+ * Each record is followed by the first 'captured' bytes of the packet,
+ * starting with the encoded header. All fields are little-endian.
+ */
+enum gip_capture_direction {
+	GIP_CAPTURE_RX = 0x00,
+	GIP_CAPTURE_TX = 0x01,
+};
+
+struct gip_capture_record {
+	__le64 time_ns;
+
+	/* records lost before this one */
+	__le32 dropped;
+
+	__le16 length;
+	__le16 captured;
+
+	__u8 direction;
+	__u8 client;
+	__u8 command;
+	__u8 options;
+	__u8 sequence;
+	__u8 reserved[3];
+
+	__le32 packet_length;
+	__le32 chunk_offset;
+} __attribute__((packed));
@@ -0,0 +1,143 @@
+// SPDX-License-Identifier: GPL-2.0-or-later
+/*
+ * Copyright (C) 2021 Severin von Wnuck-Lipinski <severinvonw@outlook.de>
+ */
+
+#include <linux/slab.h>
+#include <linux/mempool.h>
+#include <linux/debugfs.h>
+#include <linux/seq_file.h>
+
+#include "bus.h"
+
+/*
+ * Chunk buffers are allocated from URB completions. Each size class keeps
+ * a few reserved buffers so that identification and authentication still
+ * work under memory pressure.
+ */
+static struct gip_pool_class {
+	const char *name;
+	unsigned int size;
+	int reserved;
+
+	struct kmem_cache *cache;
+	mempool_t *pool;
+
+	atomic64_t slab;
+	atomic64_t reserve;
+	atomic64_t misses;
+} gip_pool_classes[] = {
+	{ .name = "gip_chunk_256", .size = 256, .reserved = 16 },
+	{ .name = "gip_chunk_1k", .size = 1024, .reserved = 8 },
+	{ .name = "gip_chunk_4k", .size = 4096, .reserved = 4 },
+	{ .name = "gip_chunk_16k", .size = 16384, .reserved = 2 },
+	{ .name = "gip_chunk_64k", .size = GIP_POOL_MAX_SIZE, .reserved = 2 },
+};
+
+static struct gip_pool_class *gip_pool_get_class(size_t size)
+{
+	int i;
+
+	for (i = 0; i < ARRAY_SIZE(gip_pool_classes); i++)
+		if (size <= gip_pool_classes[i].size)
+			return &gip_pool_classes[i];
+
+	return NULL;
+}
+
+/* memory is not zeroed, callers initialize what they use */
+void *gip_pool_alloc(size_t size)
+{
+	struct gip_pool_class *class = gip_pool_get_class(size);
+	void *ptr;
+
+	if (!class)
+		return NULL;
+
+	ptr = kmem_cache_alloc(class->cache, GFP_ATOMIC | __GFP_NOWARN);
+	if (ptr) {
+		atomic64_inc(&class->slab);
+		return ptr;
+	}
+
+	/* fall back to the reserved buffers */
+	ptr = mempool_alloc(class->pool, GFP_ATOMIC);
+	if (ptr)
+		atomic64_inc(&class->reserve);
+	else
+		atomic64_inc(&class->misses);
+
+	return ptr;
+}
+
+void gip_pool_free(void *ptr, size_t size)
+{
+	struct gip_pool_class *class = gip_pool_get_class(size);
+
+	if (ptr && !WARN_ON(!class))
+		mempool_free(ptr, class->pool);
+}
+
+static int gip_pool_stats_show(struct seq_file *s, void *data)
+{
+	struct gip_pool_class *class;
+	int i;
+
+	for (i = 0; i < ARRAY_SIZE(gip_pool_classes); i++) {
+		class = &gip_pool_classes[i];
+
+		seq_printf(s, "%s: slab=%lld reserve=%lld misses=%lld available=%d/%d\n",
+			   class->name, atomic64_read(&class->slab),
+			   atomic64_read(&class->reserve),
+			   atomic64_read(&class->misses),
+			   READ_ONCE(class->pool->curr_nr), class->reserved);
+	}
+
+	return 0;
+}
+DEFINE_SHOW_ATTRIBUTE(gip_pool_stats);
+
+void gip_pool_exit(void)
+{
+	struct gip_pool_class *class;
+	int i;
+
+	for (i = 0; i < ARRAY_SIZE(gip_pool_classes); i++) {
+		class = &gip_pool_classes[i];
+
+		mempool_destroy(class->pool);
+		kmem_cache_destroy(class->cache);
+		class->pool = NULL;
+		class->cache = NULL;
+	}
+}
+
+int gip_pool_init(struct dentry *debugfs)
+{
+	struct gip_pool_class *class;
+	int i;
+
+	for (i = 0; i < ARRAY_SIZE(gip_pool_classes); i++) {
+		class = &gip_pool_classes[i];
+
+		class->cache = kmem_cache_create(class->name, class->size, 0,
+						 0, NULL);
+		if (!class->cache)
+			goto err_exit;
+
+		class->pool = mempool_create_slab_pool(class->reserved,
+						       class->cache);
+		if (!class->pool)
+			goto err_exit;
+	}
+
+	debugfs_create_file("pools", 0444, debugfs, NULL,
+			    &gip_pool_stats_fops);
+
+	return 0;
+
+err_exit:
+	gip_pool_exit();
+
+	return -ENOMEM;
+}
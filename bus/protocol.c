@@ -3,26 +3,32 @@
  * Copyright (C) 2021 Severin von Wnuck-Lipinski <severinvonw@outlook.de>
  */
 
+#include <linux/module.h>
+#include <linux/version.h>
 #include <linux/slab.h>
 #include <linux/bitfield.h>
 #include <linux/uuid.h>
 
 #include "bus.h"
-
-#define GIP_HDR_CLIENT_ID GENMASK(3, 0)
-#define GIP_HDR_MIN_LENGTH 3
-
-/* max length, even for wireless packets (except audio) */
-#define GIP_PKT_MAX_LENGTH 58
+#include "trace.h"
 
 /* reliable packet transmission coalesce count */
 #define GIP_PKT_COALESCE_COUNT 5
 
-#define GIP_CHUNK_BUF_MAX_LENGTH 0xffff
+/* outgoing chunked transfers, see gip_send_pkt_chunked */
+static unsigned int chunk_window = GIP_PKT_COALESCE_COUNT;
+module_param(chunk_window, uint, 0644);
+MODULE_PARM_DESC(chunk_window, "Unacknowledged chunks in flight per transfer");
 
-#define GIP_BATT_LEVEL GENMASK(1, 0)
-#define GIP_BATT_TYPE GENMASK(3, 2)
-#define GIP_STATUS_CONNECTED BIT(7)
+static unsigned int chunk_timeout_ms = 100;
+module_param(chunk_timeout_ms, uint, 0644);
+MODULE_PARM_DESC(chunk_timeout_ms, "Time before unacknowledged chunks are retransmitted (ms)");
+
+static unsigned int chunk_retries = 5;
+module_param(chunk_retries, uint, 0644);
+MODULE_PARM_DESC(chunk_retries, "Retransmissions before a transfer is aborted");
+
+#define GIP_CHUNK_BUF_MAX_LENGTH 0xffff
 
 #define GIP_VKEY_LEFT_WIN 0x5b
 
@@ -30,157 +36,24 @@
 #define gip_warn(client, ...) dev_warn(&(client)->adapter->dev, __VA_ARGS__)
 #define gip_err(client, ...) dev_err(&(client)->adapter->dev, __VA_ARGS__)
 
-enum gip_command_core {
-	GIP_CMD_ACKNOWLEDGE = 0x01,
-	GIP_CMD_ANNOUNCE = 0x02,
-	GIP_CMD_STATUS = 0x03,
-	GIP_CMD_IDENTIFY = 0x04,
-	GIP_CMD_POWER = 0x05,
-	GIP_CMD_AUTHENTICATE = 0x06,
-	GIP_CMD_VIRTUAL_KEY = 0x07,
-	GIP_CMD_AUDIO_CONTROL = 0x08,
-	GIP_CMD_LED = 0x0a,
-	GIP_CMD_HID_REPORT = 0x0b,
-	GIP_CMD_FIRMWARE = 0x0c,
-	GIP_CMD_SERIAL_NUMBER = 0x1e,
-	GIP_CMD_AUDIO_SAMPLES = 0x60,
-};
-
-enum gip_command_client {
-	GIP_CMD_RUMBLE = 0x09,
-	GIP_CMD_INPUT = 0x20,
-};
-
-enum gip_option {
-	GIP_OPT_ACKNOWLEDGE = BIT(4),
-	GIP_OPT_INTERNAL = BIT(5),
-	GIP_OPT_CHUNK_START = BIT(6),
-	GIP_OPT_CHUNK = BIT(7),
-};
-
-enum gip_audio_control {
-	GIP_AUD_CTRL_VOLUME_CHAT = 0x00,
-	GIP_AUD_CTRL_FORMAT_CHAT = 0x01,
-	GIP_AUD_CTRL_FORMAT = 0x02,
-	GIP_AUD_CTRL_VOLUME = 0x03,
-};
-
-enum gip_audio_volume_mute {
-	GIP_AUD_VOLUME_UNMUTED = 0x04,
-	GIP_AUD_VOLUME_MIC_MUTED = 0x05,
-};
-
-struct gip_pkt_acknowledge {
-	u8 unknown;
-	u8 command;
-	u8 options;
-	__le16 length;
-	u8 padding[2];
-	__le16 remaining;
-} __packed;
-
-struct gip_pkt_announce {
-	u8 address[6];
-	__le16 unknown;
-	__le16 vendor_id;
-	__le16 product_id;
-	struct gip_version {
-		__le16 major;
-		__le16 minor;
-		__le16 build;
-		__le16 revision;
-	} __packed fw_version, hw_version;
-} __packed;
-
-struct gip_pkt_status {
-	u8 status;
-	u8 unknown[3];
-} __packed;
-
-struct gip_pkt_identify {
-	u8 unknown[16];
-	__le16 client_commands_offset;
-	__le16 firmware_versions_offset;
-	__le16 audio_formats_offset;
-	__le16 capabilities_out_offset;
-	__le16 capabilities_in_offset;
-	__le16 classes_offset;
-	__le16 interfaces_offset;
-	__le16 hid_descriptor_offset;
-} __packed;
-
-struct gip_pkt_power {
-	u8 mode;
-} __packed;
-
-struct gip_pkt_virtual_key {
-	u8 down;
-	u8 key;
-} __packed;
-
-struct gip_pkt_audio_control {
-	u8 subcommand;
-} __packed;
-
-struct gip_pkt_audio_volume_chat {
-	struct gip_pkt_audio_control control;
-	u8 mute;
-	u8 gain_out;
-	u8 out;
-	u8 in;
-} __packed;
-
-struct gip_pkt_audio_format_chat {
-	struct gip_pkt_audio_control control;
-	u8 in_out;
-} __packed;
-
-struct gip_pkt_audio_format {
-	struct gip_pkt_audio_control control;
-	u8 in;
-	u8 out;
-} __packed;
-
-struct gip_pkt_audio_volume {
-	struct gip_pkt_audio_control control;
-	u8 mute;
-	u8 out;
-	u8 chat;
-	u8 in;
-	u8 unknown1;
-	u8 unknown2[2];
-} __packed;
-
-struct gip_pkt_led {
-	u8 unknown;
-	u8 mode;
-	u8 brightness;
-} __packed;
-
-struct gip_pkt_serial_number {
-	u8 unknown[2];
-	char serial[14];
-} __packed;
-
-struct gip_pkt_audio_samples {
-	__le16 length_out;
-	u8 samples[];
-} __packed;
-
-struct gip_command_descriptor {
-	u8 marker;
-	u8 unknown1;
-	u8 command;
-	u8 length;
-	u8 unknown2[3];
-	u8 options;
-	u8 unknown3[15];
-} __packed;
-
-struct gip_firmware_version {
-	__le16 major;
-	__le16 minor;
-} __packed;
+/*
+ * Calls a driver operation without blocking on probe/remove. Packets for
+ * clients without a bound driver are counted and dropped.
+ */
+#define gip_call_driver(client, op, ...) ({				\
+	struct gip_driver *__drv;					\
+	int __err = 0, __idx;						\
+									\
+	__idx = srcu_read_lock(&gip_drv_srcu);				\
+	__drv = srcu_dereference((client)->drv, &gip_drv_srcu);		\
+	if (!__drv)							\
+		gip_stats_inc(&(client)->stats,				\
+			      GIP_CLIENT_STAT_DRV_DROPPED);		\
+	else if (__drv->ops.op)						\
+		__err = __drv->ops.op(client, ##__VA_ARGS__);		\
+	srcu_read_unlock(&gip_drv_srcu, __idx);				\
+	__err;								\
+})
 
 static int gip_encode_varint(u8 *buf, u32 val)
 {
@@ -236,15 +109,16 @@ static int gip_get_actual_header_length(struct gip_header *hdr)
 	return len;
 }
 
-static int gip_get_header_length(struct gip_header *hdr)
+int gip_get_header_length(struct gip_header *hdr)
 {
 	int len = gip_get_actual_header_length(hdr);
 
 	/* round up to nearest even length */
 	return len + (len % 2);
 }
+EXPORT_SYMBOL_GPL(gip_get_header_length);
 
-static void gip_encode_header(struct gip_header *hdr, u8 *buf)
+void gip_encode_header(struct gip_header *hdr, u8 *buf)
 {
 	int hdr_len = 0;
 
@@ -263,8 +137,9 @@ static void gip_encode_header(struct gip_header *hdr, u8 *buf)
 	if (hdr->options & GIP_OPT_CHUNK)
 		gip_encode_varint(buf + hdr_len, hdr->chunk_offset);
 }
+EXPORT_SYMBOL_GPL(gip_encode_header);
 
-static int gip_decode_header(struct gip_header *hdr, u8 *data, int len)
+int gip_decode_header(struct gip_header *hdr, u8 *data, int len)
 {
 	int hdr_len = 0;
 
@@ -283,6 +158,7 @@ static int gip_decode_header(struct gip_header *hdr, u8 *data, int len)
 
 	return hdr_len;
 }
+EXPORT_SYMBOL_GPL(gip_decode_header);
 
 static int gip_init_chunk_buffer(struct gip_client *client,
 				 struct gip_header *hdr,
@@ -296,14 +172,25 @@ static int gip_init_chunk_buffer(struct gip_client *client,
 	if (*buf) {
 		gip_err(client, "%s: already initialized (%s)\n", __func__,
 				is_input ? "in" : "out");
-		kfree(*buf);
+		gip_free_chunk_buffer(*buf);
 		*buf = NULL;
 	}
 
-	*buf = kzalloc(sizeof(**buf) + hdr->chunk_offset, GFP_ATOMIC);
+	/* data is never zeroed, only complete buffers get dispatched */
+	*buf = gip_pool_alloc(struct_size(*buf, data, hdr->chunk_offset));
 	if (!*buf)
 		return -ENOMEM;
 
+	(*buf)->received = gip_pool_alloc(BITS_TO_LONGS(hdr->chunk_offset) *
+					  sizeof(long));
+	if (!(*buf)->received) {
+		gip_pool_free(*buf, struct_size(*buf, data, hdr->chunk_offset));
+		*buf = NULL;
+		return -ENOMEM;
+	}
+
+	bitmap_zero((*buf)->received, hdr->chunk_offset);
+	(*buf)->received_count = 0;
 	(*buf)->header = *hdr;
 	/* clear GIP_OPT_ACKNOWLEDGE and GIP_OPT_CHUNK_START */
 	(*buf)->header.options &= ~(GIP_OPT_ACKNOWLEDGE | GIP_OPT_CHUNK_START);
@@ -315,85 +202,425 @@ static int gip_init_chunk_buffer(struct gip_client *client,
 	return 0;
 }
 
+void gip_free_chunk_buffer(struct gip_chunk_buffer *buf)
+{
+	if (!buf)
+		return;
+
+	gip_pool_free(buf->received, BITS_TO_LONGS(buf->length) * sizeof(long));
+	gip_pool_free(buf, struct_size(buf, data, buf->length));
+}
+
+static void gip_free_chunk_transfer(struct gip_chunk_transfer *xfer)
+{
+	gip_pool_free(xfer, struct_size(xfer, data, xfer->length));
+}
+
+/* returns the number of bytes that had not been received before */
+static u32 gip_fill_chunk_buffer(struct gip_chunk_buffer *buf,
+				 u32 offset, void *data, u32 len)
+{
+	u32 count;
+
+	/* bits already set in the range, counted word by word */
+	count = len - (bitmap_weight(buf->received, offset + len) -
+		       bitmap_weight(buf->received, offset));
+	bitmap_set(buf->received, offset, len);
+
+	memcpy(buf->data + offset, data, len);
+	buf->received_count += count;
+
+	return count;
+}
+
+/* offset of the first missing byte */
+static u32 gip_chunk_buffer_offset(struct gip_chunk_buffer *buf)
+{
+	return find_first_zero_bit(buf->received, buf->length);
+}
+
+static void gip_encode_pkt(struct gip_client *client,
+			   struct gip_header *hdr, void *data,
+			   struct gip_tx_packet *pkt)
+{
+	int hdr_len = gip_get_header_length(hdr);
+
+	/* sequence number is assigned by the submitter */
+	pkt->flags = 0;
+
+	if (hdr->options & GIP_OPT_CHUNK &&
+	    !(hdr->options & GIP_OPT_CHUNK_START))
+		pkt->flags = GIP_TX_SEQ_CHUNK;
+	else if (!hdr->sequence)
+		pkt->flags = GIP_TX_SEQ_NEW;
+
+	if (hdr->options & GIP_OPT_CHUNK_START)
+		pkt->flags |= GIP_TX_CHUNK_START;
+
+	gip_encode_header(hdr, pkt->data);
+	if (data)
+		memcpy(pkt->data + hdr_len, data, hdr->packet_length);
+
+	pkt->client_id = client->id;
+	pkt->transfer = 0;
+	pkt->length = hdr_len + hdr->packet_length;
+
+	/* debug message sent */
+	gip_dbg(client, "%s: cmd=0x%02x len=0x%04x seq=0x%02x offset=0x%04x\n",
+		__func__, hdr->command, pkt->length, hdr->sequence,
+		hdr->chunk_offset);
+}
+
+static void gip_count_tx(struct gip_client *client,
+			 struct gip_tx_packet *pkt)
+{
+	gip_stats_inc(&client->stats, GIP_CLIENT_STAT_TX_PACKETS);
+	gip_stats_add(&client->stats, GIP_CLIENT_STAT_TX_BYTES, pkt->length);
+}
+
 static int gip_send_pkt_simple(struct gip_client *client,
 			       struct gip_header *hdr, void *data)
 {
 	struct gip_adapter *adap = client->adapter;
-	struct gip_adapter_buffer buf = {};
-	int hdr_len, err;
-	unsigned long flags;
+	struct gip_tx_slot *slot;
 
-	buf.type = GIP_BUF_DATA;
+	if (gip_get_header_length(hdr) + hdr->packet_length >
+	    GIP_TX_SLOT_LENGTH)
+		return -EINVAL;
 
-	spin_lock_irqsave(&adap->send_lock, flags);
+	/* queued until the transport has a free buffer */
+	slot = gip_tx_reserve(adap);
+	if (IS_ERR(slot)) {
+		gip_err(client, "%s: reserve failed: %ld\n",
+			__func__, PTR_ERR(slot));
+		return PTR_ERR(slot);
+	}
 
-	err = adap->ops->get_buffer(adap, &buf);
-	if (err) {
-		gip_err(client, "%s: get buffer failed: %d\n", __func__, err);
-		goto err_unlock;
+	gip_encode_pkt(client, hdr, data, &slot->packet);
+	gip_count_tx(client, &slot->packet);
+	gip_tx_commit(adap, slot);
+
+	return 0;
+}
+
+static int gip_send_pkt_latest(struct gip_client *client,
+			       struct gip_header *hdr, void *data,
+			       enum gip_tx_mailbox mbox)
+{
+	struct gip_tx_packet pkt;
+
+	if (gip_get_header_length(hdr) + hdr->packet_length >
+	    GIP_TX_SLOT_LENGTH)
+		return -EINVAL;
+
+	/* replaces any pending packet of the same kind */
+	gip_encode_pkt(client, hdr, data, &pkt);
+	gip_count_tx(client, &pkt);
+	gip_tx_post(client->adapter, mbox, &pkt);
+
+	return 0;
+}
+
+static int gip_send_chunk(struct gip_client *client,
+			  struct gip_chunk_transfer *xfer,
+			  u32 offset, u32 len, u8 options)
+{
+	struct gip_adapter *adap = client->adapter;
+	struct gip_header hdr = xfer->header;
+	struct gip_tx_slot *slot;
+
+	hdr.options |= options;
+	hdr.packet_length = len;
+
+	/* chunk offset of first chunk is total length */
+	if (options & GIP_OPT_CHUNK_START)
+		hdr.chunk_offset = xfer->length;
+	else
+		hdr.chunk_offset = offset;
+
+	slot = gip_tx_reserve(adap);
+	if (IS_ERR(slot))
+		return PTR_ERR(slot);
+
+	gip_encode_pkt(client, &hdr, len ? xfer->data + offset : NULL,
+		       &slot->packet);
+	slot->packet.transfer = xfer->index;
+
+	/* retransmitted first chunk keeps the sequence number */
+	if ((options & GIP_OPT_CHUNK_START) && xfer->announced)
+		slot->packet.flags = GIP_TX_SEQ_CHUNK;
+
+	gip_count_tx(client, &slot->packet);
+	gip_tx_commit(adap, slot);
+
+	return 0;
+}
+
+static int gip_send_chunk_window(struct gip_client *client,
+				 struct gip_chunk_transfer *xfer)
+{
+	u32 limit = xfer->acked + max(chunk_window, 1u) * GIP_PKT_MAX_LENGTH;
+	u32 len;
+	u8 options;
+	int err;
+
+	xfer->deadline = ktime_add_ms(ktime_get(), chunk_timeout_ms);
+
+	/* device has to acknowledge the first chunk before the others */
+	if (!xfer->accepted) {
+		err = gip_send_chunk(client, xfer, 0, GIP_PKT_MAX_LENGTH,
+				     GIP_OPT_ACKNOWLEDGE | GIP_OPT_CHUNK_START);
+		if (err)
+			return err;
+
+		xfer->announced = true;
+		xfer->sent = GIP_PKT_MAX_LENGTH;
+		return 0;
 	}
 
-	hdr_len = gip_get_header_length(hdr);
-	if (buf.length < hdr_len + hdr->packet_length) {
-		err = -ENOSPC;
-		goto err_unlock;
+	limit = min(limit, xfer->length);
+
+	while (xfer->sent < limit) {
+		len = min_t(u32, limit - xfer->sent, GIP_PKT_MAX_LENGTH);
+
+		/* last chunk of the window advances it */
+		options = xfer->sent + len == limit ? GIP_OPT_ACKNOWLEDGE : 0;
+
+		err = gip_send_chunk(client, xfer, xfer->sent, len, options);
+		if (err)
+			return err;
+
+		xfer->sent += len;
 	}
 
-	/* sequence number is always greater than zero */
-	while (!hdr->sequence)
-		hdr->sequence = adap->data_sequence++;
+	return 0;
+}
 
-	gip_encode_header(hdr, buf.data);
-	if (data)
-		memcpy(buf.data + hdr_len, data, hdr->packet_length);
+/* transfers for the same command are sent one after another */
+static bool gip_chunk_transfer_active(struct gip_client *client,
+				      struct gip_chunk_transfer *xfer)
+{
+	struct gip_chunk_transfer *cur;
 
-	/* set actual length */
-	buf.length = hdr_len + hdr->packet_length;
+	list_for_each_entry(cur, &client->chunk_transfers, list) {
+		if (cur == xfer)
+			return true;
 
-	/* debug message sent */
-	gip_dbg(client, "%s: cmd=0x%02x len=0x%04x seq=0x%02x offset=0x%04x\n",
-		__func__, hdr->command, buf.length, hdr->sequence,
-		hdr->chunk_offset);
+		if (cur->header.command == xfer->header.command)
+			return false;
+	}
 
-	/* always fails on adapter removal */
-	err = adap->ops->submit_buffer(adap, &buf);
-	if (err)
-		gip_dbg(client, "%s: submit buffer failed: %d\n", __func__, err);
+	return false;
+}
 
-err_unlock:
-	spin_unlock_irqrestore(&adap->send_lock, flags);
+static void gip_arm_chunk_timer(struct gip_client *client)
+{
+	struct gip_chunk_transfer *xfer;
+	ktime_t expires = KTIME_MAX;
 
-	return err;
+	list_for_each_entry(xfer, &client->chunk_transfers, list)
+		if (gip_chunk_transfer_active(client, xfer))
+			expires = min(expires, xfer->deadline);
+
+	if (expires != KTIME_MAX)
+		hrtimer_start(&client->chunk_timer, expires,
+			      HRTIMER_MODE_ABS_SOFT);
 }
 
-static int gip_send_pkt(struct gip_client *client,
-			struct gip_header *hdr, void *data)
+static int gip_start_chunk_transfer(struct gip_client *client,
+				    struct gip_chunk_transfer *xfer)
+{
+	xfer->start = ktime_get();
+
+	return gip_send_chunk_window(client, xfer);
+}
+
+static void gip_finish_chunk_transfer(struct gip_client *client,
+				      struct gip_chunk_transfer *xfer,
+				      int status)
+{
+	struct gip_chunk_transfer *next;
+	u64 time = ktime_to_ns(ktime_sub(ktime_get(), xfer->start));
+	u64 rate = div64_u64((u64)xfer->length * NSEC_PER_SEC, time ?: 1);
+
+	list_del(&xfer->list);
+	clear_bit(xfer->index, &client->chunk_indices);
+
+	if (status) {
+		gip_stats_inc(&client->stats, GIP_CLIENT_STAT_CHUNK_FAILED);
+	} else {
+		gip_stats_inc(&client->stats, GIP_CLIENT_STAT_CHUNK_COMPLETED);
+		gip_stats_add(&client->stats, GIP_CLIENT_STAT_CHUNK_BYTES,
+			      xfer->length);
+		atomic64_set(&client->chunk_rate, rate);
+	}
+
+	gip_dbg(client, "%s: cmd=0x%02x len=0x%04x time=%lluus rate=%lluB/s retransmits=%u status=%d\n",
+		__func__, xfer->header.command, xfer->length,
+		div_u64(time, NSEC_PER_USEC), rate, xfer->retransmits, status);
+
+	/* start next transfer for the same command */
+	list_for_each_entry(next, &client->chunk_transfers, list) {
+		if (next->header.command != xfer->header.command)
+			continue;
+
+		if (gip_start_chunk_transfer(client, next))
+			gip_err(client, "%s: start failed\n", __func__);
+
+		break;
+	}
+
+	gip_free_chunk_transfer(xfer);
+}
+
+static void gip_retransmit_chunks(struct gip_client *client,
+				  struct gip_chunk_transfer *xfer)
 {
 	int err;
 
-	/* packet fits into single buffer */
-	if (hdr->packet_length <= GIP_PKT_MAX_LENGTH)
-		return gip_send_pkt_simple(client, hdr, data);
+	xfer->retransmits++;
+	gip_stats_inc(&client->stats, GIP_CLIENT_STAT_CHUNK_RETRANSMITS);
 
-	/* chunk offset of first chunk is total length */
-	hdr->options |= GIP_OPT_ACKNOWLEDGE | GIP_OPT_CHUNK_START |
-			GIP_OPT_CHUNK;
-	hdr->chunk_offset = hdr->packet_length;
-	hdr->packet_length = GIP_PKT_MAX_LENGTH;
+	/* go back to the last acknowledged offset */
+	xfer->sent = xfer->acked;
 
-	err = gip_send_pkt_simple(client, hdr, data);
+	err = gip_send_chunk_window(client, xfer);
 	if (err)
-		return err;
+		gip_dbg(client, "%s: send failed: %d\n", __func__, err);
+}
 
-	/* allocate output buffer for all chunks */
-	err = gip_init_chunk_buffer(client, hdr, &client->chunk_buf_in, false);
-	if (err)
-		return err;
+static enum hrtimer_restart gip_chunk_timeout(struct hrtimer *timer)
+{
+	struct gip_client *client = container_of(timer, typeof(*client),
+						 chunk_timer);
+	struct gip_chunk_transfer *xfer, *tmp;
+	ktime_t now = ktime_get();
+	unsigned long flags;
+
+	spin_lock_irqsave(&client->chunk_lock, flags);
+
+	list_for_each_entry_safe(xfer, tmp, &client->chunk_transfers, list) {
+		if (!gip_chunk_transfer_active(client, xfer) ||
+		    ktime_before(now, xfer->deadline))
+			continue;
+
+		if (xfer->retries++ < chunk_retries) {
+			gip_retransmit_chunks(client, xfer);
+			continue;
+		}
+
+		gip_err(client, "%s: transfer timed out: cmd=0x%02x offset=0x%04x/0x%04x\n",
+			__func__, xfer->header.command, xfer->acked,
+			xfer->length);
+		gip_finish_chunk_transfer(client, xfer, -ETIMEDOUT);
+	}
+
+	gip_arm_chunk_timer(client);
+
+	spin_unlock_irqrestore(&client->chunk_lock, flags);
+
+	return HRTIMER_NORESTART;
+}
+
+void gip_init_chunk_transfers(struct gip_client *client)
+{
+	spin_lock_init(&client->chunk_lock);
+	INIT_LIST_HEAD(&client->chunk_transfers);
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(6, 13, 0)
+	hrtimer_setup(&client->chunk_timer, gip_chunk_timeout,
+		      CLOCK_MONOTONIC, HRTIMER_MODE_ABS_SOFT);
+#else
+	hrtimer_init(&client->chunk_timer, CLOCK_MONOTONIC,
+		     HRTIMER_MODE_ABS_SOFT);
+	client->chunk_timer.function = gip_chunk_timeout;
+#endif
+}
+
+void gip_destroy_chunk_transfers(struct gip_client *client)
+{
+	struct gip_chunk_transfer *xfer, *tmp;
+	unsigned long flags;
+	LIST_HEAD(list);
+
+	spin_lock_irqsave(&client->chunk_lock, flags);
+	list_splice_init(&client->chunk_transfers, &list);
+	spin_unlock_irqrestore(&client->chunk_lock, flags);
+
+	/* timer does not rearm itself without transfers */
+	hrtimer_cancel(&client->chunk_timer);
+
+	list_for_each_entry_safe(xfer, tmp, &list, list)
+		gip_free_chunk_transfer(xfer);
+}
+
+static int gip_send_pkt_chunked(struct gip_client *client,
+				struct gip_header *hdr, void *data)
+{
+	struct gip_chunk_transfer *xfer;
+	unsigned long flags;
+	int index, err = 0;
+
+	if (hdr->packet_length > GIP_CHUNK_BUF_MAX_LENGTH)
+		return -EINVAL;
+
+	BUILD_BUG_ON(struct_size(xfer, data, GIP_CHUNK_BUF_MAX_LENGTH) >
+		     GIP_POOL_MAX_SIZE);
+
+	xfer = gip_pool_alloc(struct_size(xfer, data, hdr->packet_length));
+	if (!xfer)
+		return -ENOMEM;
+
+	/* data is copied below, only the state needs to be cleared */
+	memset(xfer, 0, sizeof(*xfer));
+	xfer->header = *hdr;
+	xfer->header.options &= ~(GIP_OPT_ACKNOWLEDGE | GIP_OPT_CHUNK_START);
+	xfer->header.options |= GIP_OPT_CHUNK;
+	xfer->length = hdr->packet_length;
 
 	if (data)
-		memcpy(client->chunk_buf_in->data, data, hdr->chunk_offset);
+		memcpy(xfer->data, data, hdr->packet_length);
+	else
+		memset(xfer->data, 0, hdr->packet_length);
 
-	return 0;
+	spin_lock_irqsave(&client->chunk_lock, flags);
+
+	index = find_first_zero_bit(&client->chunk_indices,
+				    GIP_CHUNK_MAX_TRANSFERS);
+	if (index >= GIP_CHUNK_MAX_TRANSFERS) {
+		spin_unlock_irqrestore(&client->chunk_lock, flags);
+		gip_err(client, "%s: too many transfers\n", __func__);
+		gip_free_chunk_transfer(xfer);
+		return -EBUSY;
+	}
+
+	set_bit(index, &client->chunk_indices);
+	xfer->index = index;
+	list_add_tail(&xfer->list, &client->chunk_transfers);
+
+	gip_dbg(client, "%s: command=0x%02x, length=0x%04x, index=%d\n",
+		__func__, hdr->command, xfer->length, index);
+
+	if (gip_chunk_transfer_active(client, xfer)) {
+		err = gip_start_chunk_transfer(client, xfer);
+		if (err)
+			gip_finish_chunk_transfer(client, xfer, err);
+		else
+			gip_arm_chunk_timer(client);
+	}
+
+	spin_unlock_irqrestore(&client->chunk_lock, flags);
+
+	return err;
+}
+
+static int gip_send_pkt(struct gip_client *client,
+			struct gip_header *hdr, void *data)
+{
+	/* packet fits into single buffer */
+	if (hdr->packet_length <= GIP_PKT_MAX_LENGTH)
+		return gip_send_pkt_simple(client, hdr, data);
+
+	return gip_send_pkt_chunked(client, hdr, data);
 }
 
 static int gip_acknowledge_pkt(struct gip_client *client,
@@ -403,6 +630,13 @@ static int gip_acknowledge_pkt(struct gip_client *client,
 	struct gip_header hdr = {};
 	struct gip_pkt_acknowledge pkt = {};
 	u32 len = ack->chunk_offset + ack->packet_length;
+	u32 remaining = 0;
+
+	/* device resends everything after the first missing byte */
+	if ((ack->options & GIP_OPT_CHUNK) && buf) {
+		len = gip_chunk_buffer_offset(buf);
+		remaining = buf->length - len;
+	}
 
 	hdr.command = GIP_CMD_ACKNOWLEDGE;
 	hdr.options = client->id | GIP_OPT_INTERNAL;
@@ -412,12 +646,10 @@ static int gip_acknowledge_pkt(struct gip_client *client,
 	pkt.command = ack->command;
 	pkt.options = client->id | GIP_OPT_INTERNAL;
 	pkt.length = cpu_to_le16(len);
+	pkt.remaining = cpu_to_le16(remaining);
 
-	if ((ack->options & GIP_OPT_CHUNK) && buf)
-		pkt.remaining = cpu_to_le16(buf->length - len);
-
-	gip_dbg(client, "%s: ACME(host) command=0x%02x, length=0x%04x\n",
-		__func__, pkt.command, len);
+	gip_dbg(client, "%s: ACME(host) command=0x%02x, length=0x%04x, remaining=0x%04x\n",
+		__func__, pkt.command, len, remaining);
 
 	return gip_send_pkt(client, &hdr, &pkt);
 }
@@ -537,7 +769,7 @@ int gip_set_audio_volume(struct gip_client *client, u8 in, u8 chat, u8 out)
 	pkt.chat = chat;
 	pkt.in = in;
 
-	return gip_send_pkt(client, &hdr, &pkt);
+	return gip_send_pkt_latest(client, &hdr, &pkt, GIP_TX_MBOX_VOLUME);
 }
 EXPORT_SYMBOL_GPL(gip_set_audio_volume);
 
@@ -549,7 +781,7 @@ int gip_send_rumble(struct gip_client *client, void *pkt, u32 len)
 	hdr.options = client->id;
 	hdr.packet_length = len;
 
-	return gip_send_pkt(client, &hdr, pkt);
+	return gip_send_pkt_latest(client, &hdr, pkt, GIP_TX_MBOX_RUMBLE);
 }
 EXPORT_SYMBOL_GPL(gip_send_rumble);
 
@@ -566,7 +798,7 @@ int gip_set_led_mode(struct gip_client *client,
 	pkt.mode = mode;
 	pkt.brightness = brightness;
 
-	return gip_send_pkt(client, &hdr, &pkt);
+	return gip_send_pkt_latest(client, &hdr, &pkt, GIP_TX_MBOX_LED);
 }
 EXPORT_SYMBOL_GPL(gip_set_led_mode);
 
@@ -595,6 +827,8 @@ static void gip_copy_audio_samples(struct gip_client *client,
 
 		gip_encode_header(&hdr, dest);
 		memcpy(dest + hdr_len, src, cfg->fragment_size);
+		gip_capture_tx(client->adapter, dest,
+			       hdr_len + cfg->fragment_size);
 	}
 }
 
@@ -650,9 +884,7 @@ int gip_set_encryption_key(struct gip_client *client, u8 *key, int len)
 	if (!adap->ops->set_encryption_key) {
 		gip_dbg(client, "%s: no callback, notifying driver.\n",
 				__func__);
-		if (client->drv->ops.authenticated)
-			return client->drv->ops.authenticated(client);
-		return 0;
+		return gip_call_driver(client, authenticated);
 	}
 
 	err = adap->ops->set_encryption_key(adap, key, len);
@@ -661,8 +893,7 @@ int gip_set_encryption_key(struct gip_client *client, u8 *key, int len)
 		return err;
 	}
 
-	if (client->drv->ops.authenticated)
-		client->drv->ops.authenticated(client);
+	gip_call_driver(client, authenticated);
 
 	return 0;
 }
@@ -1029,76 +1260,68 @@ static int gip_parse_hid_descriptor(struct gip_client *client,
 	return 0;
 }
 
-static int gip_send_remaining_chunks(struct gip_client *client, u32 offset)
-{
-	struct gip_chunk_buffer *buf = client->chunk_buf_in;
-	struct gip_header hdr = buf->header;
-	u32 len = buf->length - offset;
-	int err;
-
-	gip_dbg(client, "%s: sending chunk 0x%04x/0x%04x/0x%04x\n", __func__,
-		len, hdr.chunk_offset, buf->length);
-
-	int coalesce_count = GIP_PKT_COALESCE_COUNT;
-	while (len && coalesce_count) {
-		/* require acknowledgment for last chunk */
-		if (len <= GIP_PKT_MAX_LENGTH)
-			hdr.options |= GIP_OPT_ACKNOWLEDGE;
-
-		hdr.packet_length = min_t(u32, len, GIP_PKT_MAX_LENGTH);
-		hdr.chunk_offset = buf->length - len;
-
-		err = gip_send_pkt_simple(client, &hdr,
-					  buf->data + hdr.chunk_offset);
-		if (err)
-			return err;
-
-		len -= hdr.packet_length;
-		coalesce_count--;
-	}
-
-	return 0;
-}
-
 static int gip_handle_pkt_acknowledge(struct gip_client *client,
 				      void *data, u32 len)
 {
 	struct gip_pkt_acknowledge *pkt = data;
-	struct gip_chunk_buffer *buf = client->chunk_buf_in;
-	struct gip_header hdr;
+	struct gip_chunk_transfer *xfer;
+	unsigned long flags;
+	u32 offset;
+	int err;
 
 	if (len != sizeof(*pkt))
 		return -EINVAL;
 
-	if (!buf)
-		return 0;
+	spin_lock_irqsave(&client->chunk_lock, flags);
 
-	gip_dbg(client, "%s: ACME(dev) cmd=0x%02x/0x%02x, len=0x%04x/0x%04x\n",
-		__func__, pkt->command, buf->header.command,
-		le16_to_cpu(pkt->length), buf->length);
+	/* acknowledgment for the oldest transfer of the command */
+	list_for_each_entry(xfer, &client->chunk_transfers, list)
+		if (xfer->header.command == pkt->command)
+			goto found;
 
-	/* acknowledgment for different command */
-	if (pkt->command != buf->header.command)
-		return 0;
+	spin_unlock_irqrestore(&client->chunk_lock, flags);
+
+	return 0;
+
+found:
+	gip_dbg(client, "%s: ACME(dev) cmd=0x%02x, len=0x%04x/0x%04x\n",
+		__func__, pkt->command, le16_to_cpu(pkt->length),
+		xfer->length);
 
 	/*
 	 * offset comes from the device and may be malicious or invalid
 	 * so sanitize value to prevent buffer overflow.
 	 */
-	if (le16_to_cpu(pkt->length) < buf->length)
-		return gip_send_remaining_chunks(client, le16_to_cpu(pkt->length));
+	offset = min_t(u32, le16_to_cpu(pkt->length), xfer->length);
 
-	gip_dbg(client, "%s: all chunks sent\n", __func__);
+	if (offset == xfer->length) {
+		gip_dbg(client, "%s: all chunks sent\n", __func__);
 
-	/* empty chunk signals the completion of the transfer */
-	hdr = buf->header;
-	hdr.packet_length = 0;
-	hdr.chunk_offset = buf->length;
+		/* empty chunk signals the completion of the transfer */
+		err = gip_send_chunk(client, xfer, xfer->length, 0, 0);
+		gip_finish_chunk_transfer(client, xfer, err);
+	} else if (!xfer->accepted || offset > xfer->acked) {
+		/* first acknowledgment tells where to continue */
+		if (!xfer->accepted || xfer->sent < offset)
+			xfer->sent = offset;
+
+		xfer->accepted = true;
+		xfer->acked = offset;
+		xfer->retries = 0;
+
+		err = gip_send_chunk_window(client, xfer);
+		if (err)
+			gip_dbg(client, "%s: send failed: %d\n", __func__, err);
+	} else if (offset == xfer->acked && xfer->sent > offset) {
+		/* repeated acknowledgment, chunks got lost */
+		gip_retransmit_chunks(client, xfer);
+	}
+
+	gip_arm_chunk_timer(client);
 
-	kfree(buf);
-	client->chunk_buf_in = NULL;
+	spin_unlock_irqrestore(&client->chunk_lock, flags);
 
-	return gip_send_pkt_simple(client, &hdr, NULL);
+	return 0;
 }
 
 static int gip_handle_pkt_announce(struct gip_client *client,
@@ -1137,7 +1360,6 @@ static int gip_handle_pkt_status(struct gip_client *client,
 				 void *data, u32 len)
 {
 	struct gip_pkt_status *pkt = data;
-	int err = 0;
 	u8 batt_type, batt_lvl;
 
 	/* some devices occasionally send larger status packets */
@@ -1153,15 +1375,35 @@ static int gip_handle_pkt_status(struct gip_client *client,
 	batt_type = FIELD_GET(GIP_BATT_TYPE, pkt->status);
 	batt_lvl = FIELD_GET(GIP_BATT_LEVEL, pkt->status);
 
-	if (down_trylock(&client->drv_lock))
-		return -EBUSY;
-
-	if (client->drv && client->drv->ops.battery)
-		err = client->drv->ops.battery(client, batt_type, batt_lvl);
+	return gip_call_driver(client, battery, batt_type, batt_lvl);
+}
 
-	up(&client->drv_lock);
+void gip_free_client_info(struct gip_client *client)
+{
+	int i;
 
-	return err;
+	kfree(client->client_commands);
+	kfree(client->firmware_versions);
+	kfree(client->audio_formats);
+	kfree(client->capabilities_out);
+	kfree(client->capabilities_in);
+
+	if (client->classes)
+		for (i = 0; i < client->classes->count; i++)
+			kfree(client->classes->strings[i]);
+
+	kfree(client->classes);
+	kfree(client->interfaces);
+	kfree(client->hid_descriptor);
+
+	client->client_commands = NULL;
+	client->firmware_versions = NULL;
+	client->audio_formats = NULL;
+	client->capabilities_out = NULL;
+	client->capabilities_in = NULL;
+	client->classes = NULL;
+	client->interfaces = NULL;
+	client->hid_descriptor = NULL;
 }
 
 static int gip_handle_pkt_identify(struct gip_client *client,
@@ -1223,24 +1465,13 @@ err_free_info:
 static int gip_handle_pkt_authenticate(struct gip_client *client,
 				       void *data, u32 len)
 {
-	int err = 0;
-
-	if (down_trylock(&client->drv_lock))
-		return -EBUSY;
-
-	if (client->drv && client->drv->ops.authenticate)
-		err = client->drv->ops.authenticate(client, data, len);
-
-	up(&client->drv_lock);
-
-	return err;
+	return gip_call_driver(client, authenticate, data, len);
 }
 
 static int gip_handle_pkt_virtual_key(struct gip_client *client,
 				      void *data, u32 len)
 {
 	struct gip_pkt_virtual_key *pkt = data;
-	int err = 0;
 
 	if (len != sizeof(*pkt))
 		return -EINVAL;
@@ -1248,15 +1479,7 @@ static int gip_handle_pkt_virtual_key(struct gip_client *client,
 	if (pkt->key != GIP_VKEY_LEFT_WIN)
 		return -EINVAL;
 
-	if (down_trylock(&client->drv_lock))
-		return -EBUSY;
-
-	if (client->drv && client->drv->ops.guide_button)
-		err = client->drv->ops.guide_button(client, pkt->down);
-
-	up(&client->drv_lock);
-
-	return err;
+	return gip_call_driver(client, guide_button, pkt->down);
 }
 
 static int gip_handle_pkt_audio_format_chat(struct gip_client *client,
@@ -1283,35 +1506,18 @@ static int gip_handle_pkt_audio_format_chat(struct gip_client *client,
 	if (err)
 		return err;
 
-	if (down_trylock(&client->drv_lock))
-		return -EBUSY;
-
-	if (client->drv && client->drv->ops.audio_ready)
-		err = client->drv->ops.audio_ready(client);
-
-	up(&client->drv_lock);
-
-	return err;
+	return gip_call_driver(client, audio_ready);
 }
 
 static int gip_handle_pkt_audio_volume_chat(struct gip_client *client,
 					    void *data, u32 len)
 {
 	struct gip_pkt_audio_volume_chat *pkt = data;
-	int err = 0;
 
 	if (len != sizeof(*pkt))
 		return -EINVAL;
 
-	if (down_trylock(&client->drv_lock))
-		return -EBUSY;
-
-	if (client->drv && client->drv->ops.audio_volume)
-		err = client->drv->ops.audio_volume(client, pkt->in, pkt->out);
-
-	up(&client->drv_lock);
-
-	return err;
+	return gip_call_driver(client, audio_volume, pkt->in, pkt->out);
 }
 
 static int gip_handle_pkt_audio_format(struct gip_client *client,
@@ -1345,35 +1551,18 @@ static int gip_handle_pkt_audio_format(struct gip_client *client,
 	if (err)
 		return err;
 
-	if (down_trylock(&client->drv_lock))
-		return -EBUSY;
-
-	if (client->drv && client->drv->ops.audio_ready)
-		err = client->drv->ops.audio_ready(client);
-
-	up(&client->drv_lock);
-
-	return err;
+	return gip_call_driver(client, audio_ready);
 }
 
 static int gip_handle_pkt_audio_volume(struct gip_client *client,
 				       void *data, u32 len)
 {
 	struct gip_pkt_audio_volume *pkt = data;
-	int err = 0;
 
 	if (len != sizeof(*pkt))
 		return -EINVAL;
 
-	if (down_trylock(&client->drv_lock))
-		return -EBUSY;
-
-	if (client->drv && client->drv->ops.audio_volume)
-		err = client->drv->ops.audio_volume(client, pkt->in, pkt->out);
-
-	up(&client->drv_lock);
-
-	return err;
+	return gip_call_driver(client, audio_volume, pkt->in, pkt->out);
 }
 
 static int gip_handle_pkt_audio_control(struct gip_client *client,
@@ -1404,75 +1593,38 @@ static int gip_handle_pkt_audio_control(struct gip_client *client,
 static int gip_handle_pkt_hid_report(struct gip_client *client,
 				     void *data, u32 len)
 {
-	int err = 0;
-
-	if (down_trylock(&client->drv_lock))
-		return -EBUSY;
-
-	if (client->drv && client->drv->ops.hid_report)
-		err = client->drv->ops.hid_report(client, data, len);
-
-	up(&client->drv_lock);
-
-	return err;
+	return gip_call_driver(client, hid_report, data, len);
 }
 
 static int gip_handle_pkt_input(struct gip_client *client,
 				void *data, u32 len)
 {
-	int err = 0;
-
-	if (down_trylock(&client->drv_lock))
-		return -EBUSY;
-
-	if (client->drv && client->drv->ops.input)
-		err = client->drv->ops.input(client, data, len);
-
-	up(&client->drv_lock);
-
-	return err;
+	return gip_call_driver(client, input, data, len);
 }
 
 static int gip_handle_pkt_audio_samples(struct gip_client *client,
 					void *data, u32 len)
 {
 	struct gip_pkt_audio_samples *pkt = data;
-	int err = 0;
 
 	if (len < sizeof(*pkt))
 		return -EINVAL;
 
-	if (down_trylock(&client->drv_lock))
-		return -EBUSY;
-
-	if (client->drv && client->drv->ops.audio_samples)
-		err = client->drv->ops.audio_samples(client, pkt->samples,
-						     len - sizeof(*pkt));
-
-	up(&client->drv_lock);
-
-	return err;
+	return gip_call_driver(client, audio_samples, pkt->samples,
+			       len - sizeof(*pkt));
 }
 
 static int gip_handle_pkt_firmware(struct gip_client *client, void *data,
 				   u32 len)
 {
-	int err;
-
-	if (down_trylock(&client->drv_lock))
-		return -EBUSY;
-
-	if (client->drv && client->drv->ops.firmware)
-		err = client->drv->ops.firmware(client, data, len);
-
-	up(&client->drv_lock);
-
-	return err;
+	return gip_call_driver(client, firmware, data, len);
 }
 
 static int gip_dispatch_pkt(struct gip_client *client,
 			    struct gip_header *hdr, void *data, u32 len)
 {
+	trace_gip_rx_dispatch(client, hdr, len);
+
 	if (hdr->options & GIP_OPT_INTERNAL) {
 		switch (hdr->command) {
 		case GIP_CMD_ACKNOWLEDGE:
@@ -1514,8 +1666,8 @@ static int gip_process_pkt_chunked(struct gip_client *client,
 				   struct gip_header *hdr, void *data)
 {
 	struct gip_chunk_buffer *buf = client->chunk_buf_out;
+	u32 len, offset;
 	int err;
-	u32 len;
 
 	gip_dbg(client, "%s: flags=[%s %s %s], offset=0x%04x, length=0x%04x\n",
 		__func__,
@@ -1545,34 +1697,75 @@ static int gip_process_pkt_chunked(struct gip_client *client,
 	}
 
 	if (hdr->packet_length) {
+		offset = gip_chunk_buffer_offset(buf);
+
+		/* device did not get our acknowledgment */
+		if (!gip_fill_chunk_buffer(buf, hdr->chunk_offset, data,
+					   hdr->packet_length))
+			gip_stats_inc(&client->stats,
+				      GIP_CLIENT_STAT_CHUNK_RX_DUPLICATES);
+		/* earlier chunks got lost */
+		else if (hdr->chunk_offset > offset)
+			gip_stats_inc(&client->stats,
+				      GIP_CLIENT_STAT_CHUNK_RX_OUT_OF_ORDER);
+
 		/*
 		 * acknowledge last non-empty chunked packet even when
 		 * not asked in current chunk header
 		 */
-		bool last_chunk = (buf->length == len);
-		if ((hdr->options & GIP_OPT_ACKNOWLEDGE) || last_chunk) {
-			err = gip_acknowledge_pkt(client, hdr);
-			if (err)
-				return err;
-		}
-		memcpy(buf->data + hdr->chunk_offset, data, hdr->packet_length);
+		if ((hdr->options & GIP_OPT_ACKNOWLEDGE) || buf->length == len)
+			return gip_acknowledge_pkt(client, hdr);
+
 		return 0;
 	}
 
+	/* ask the device for the missing ranges */
+	if (buf->received_count < buf->length) {
+		gip_dbg(client, "%s: incomplete, offset=0x%04x, remaining=0x%04x\n",
+			__func__, gip_chunk_buffer_offset(buf),
+			buf->length - buf->received_count);
+		gip_stats_inc(&client->stats,
+			      GIP_CLIENT_STAT_CHUNK_RX_INCOMPLETE);
+		return gip_acknowledge_pkt(client, hdr);
+	}
+
 	/* empty chunk signals the completion of the transfer */
 	err = gip_dispatch_pkt(client, hdr, buf->data, buf->length);
 
-	kfree(buf);
+	gip_free_chunk_buffer(buf);
 	client->chunk_buf_out = NULL;
 
 	return err;
 }
 
+/* sequence numbers are counted separately for each command */
+static void gip_check_sequence(struct gip_client *client,
+			       struct gip_header *hdr)
+{
+	u8 last = client->rx_sequence[hdr->command];
+	u8 next = last + 1 ?: 1;
+
+	/* chunks reuse the sequence number of the transfer */
+	if ((hdr->options & GIP_OPT_CHUNK) &&
+	    !(hdr->options & GIP_OPT_CHUNK_START))
+		return;
+
+	client->rx_sequence[hdr->command] = hdr->sequence;
+
+	/* first packet or retransmission */
+	if (!last || hdr->sequence == last || hdr->sequence == next)
+		return;
+
+	gip_stats_inc(&client->stats, GIP_CLIENT_STAT_SEQ_GAPS);
+}
+
 static int gip_process_pkt(struct gip_client *client,
 			   struct gip_header *hdr, void *data)
 {
 	int err;
 
+	gip_check_sequence(client, hdr);
+
 	if (hdr->options & GIP_OPT_CHUNK_START) {
 		err = gip_init_chunk_buffer(client, hdr,
 					    &client->chunk_buf_out, true);
@@ -1594,7 +1787,24 @@ static int gip_process_pkt(struct gip_client *client,
 	return gip_dispatch_pkt(client, hdr, data, hdr->packet_length);
 }
 
-int gip_process_buffer(struct gip_adapter *adap, void *data, int len)
+/* called by drivers once the input events of a packet are synced */
+void gip_report_latency(struct gip_client *client)
+{
+	u64 time = READ_ONCE(client->rx_time);
+	u64 delta;
+	int bucket;
+
+	if (!time)
+		return;
+
+	delta = ktime_get_ns() - time;
+	bucket = delta ? min(ilog2(delta) + 1, GIP_RX_LATENCY_BUCKETS - 1) : 0;
+	atomic64_inc(&client->rx_latency[bucket]);
+}
+EXPORT_SYMBOL_GPL(gip_report_latency);
+
+int gip_process_buffer(struct gip_adapter *adap, void *data, int len,
+		       u64 time)
 {
 	struct gip_header hdr;
 	struct gip_client *client;
@@ -1602,21 +1812,42 @@ int gip_process_buffer(struct gip_adapter *adap, void *data, int len)
 
 	while (len > GIP_HDR_MIN_LENGTH) {
 		hdr_len = gip_decode_header(&hdr, data, len);
-		if (len < hdr_len + hdr.packet_length)
-			return -EINVAL;
+		if (len < hdr_len + hdr.packet_length) {
+			err = -EINVAL;
+			goto err_count;
+		}
+
+		trace_gip_rx_packet(adap, &hdr);
+		gip_capture(adap, GIP_CAPTURE_RX, time, data,
+			    hdr_len + hdr.packet_length);
+		gip_stats_inc(&adap->stats, GIP_ADAP_STAT_RX_PACKETS);
+		gip_stats_add(&adap->stats, GIP_ADAP_STAT_RX_BYTES,
+			      hdr_len + hdr.packet_length);
 
 		client = gip_get_client(adap, hdr.options & GIP_HDR_CLIENT_ID);
-		if (IS_ERR(client))
-			return PTR_ERR(client);
+		if (IS_ERR(client)) {
+			err = PTR_ERR(client);
+			goto err_count;
+		}
 
+		gip_stats_inc(&client->stats, GIP_CLIENT_STAT_RX_PACKETS);
+		gip_stats_add(&client->stats, GIP_CLIENT_STAT_RX_BYTES,
+			      hdr_len + hdr.packet_length);
+
+		WRITE_ONCE(client->rx_time, time);
 		err = gip_process_pkt(client, &hdr, data + hdr_len);
 		if (err)
-			return err;
+			goto err_count;
 
 		data += hdr_len + hdr.packet_length;
 		len -= hdr_len + hdr.packet_length;
 	}
 
 	return 0;
+
+err_count:
+	gip_stats_inc(&adap->stats, GIP_ADAP_STAT_RX_ERRORS);
+
+	return err;
 }
 EXPORT_SYMBOL_GPL(gip_process_buffer);
@@ -65,6 +65,11 @@ struct gip_header {
 struct gip_chunk_buffer {
 	struct gip_header header;
 	u32 length;
+
+	/* bitmap of received bytes, data is only valid when complete */
+	unsigned long *received;
+	u32 received_count;
+
 	u8 data[];
 };
 
@@ -119,4 +124,7 @@ int gip_init_audio_in(struct gip_client *client);
 int gip_init_audio_out(struct gip_client *client);
 void gip_disable_audio(struct gip_client *client);
 
-int gip_process_buffer(struct gip_adapter *adap, void *data, int len);
+void gip_report_latency(struct gip_client *client);
+
+int gip_process_buffer(struct gip_adapter *adap, void *data, int len,
+		       u64 time);
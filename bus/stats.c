@@ -0,0 +1,106 @@
+// SPDX-License-Identifier: GPL-2.0-or-later
+/*
+ * Copyright (C) 2021 Severin von Wnuck-Lipinski <severinvonw@outlook.de>
+ */
+
+#include <linux/module.h>
+#include <linux/slab.h>
+#include <linux/percpu.h>
+#include <linux/seq_file.h>
+
+#include "bus.h"
+
+/* serializes readers against resets */
+static DEFINE_MUTEX(gip_stats_lock);
+
+int gip_stats_init(struct gip_stats *stats, const char * const *names,
+		   int count, gfp_t gfp)
+{
+	struct gip_stats_cpu *cpu;
+	int i;
+
+	stats->cpu = __alloc_percpu_gfp(struct_size(cpu, values, count),
+					__alignof__(*cpu), gfp);
+	if (!stats->cpu)
+		return -ENOMEM;
+
+	stats->base = kcalloc(count, sizeof(*stats->base), gfp);
+	if (!stats->base) {
+		free_percpu(stats->cpu);
+		stats->cpu = NULL;
+		return -ENOMEM;
+	}
+
+	for_each_possible_cpu(i)
+		u64_stats_init(&per_cpu_ptr(stats->cpu, i)->syncp);
+
+	stats->names = names;
+	stats->count = count;
+
+	return 0;
+}
+EXPORT_SYMBOL_GPL(gip_stats_init);
+
+void gip_stats_free(struct gip_stats *stats)
+{
+	free_percpu(stats->cpu);
+	kfree(stats->base);
+	stats->cpu = NULL;
+	stats->base = NULL;
+}
+EXPORT_SYMBOL_GPL(gip_stats_free);
+
+static void gip_stats_sum(struct gip_stats *stats, u64 *values)
+{
+	struct gip_stats_cpu *cpu;
+	unsigned int start;
+	u64 val;
+	int i, j;
+
+	memset(values, 0, sizeof(*values) * stats->count);
+
+	for_each_possible_cpu(i) {
+		cpu = per_cpu_ptr(stats->cpu, i);
+
+		/* only retried on 32-bit during concurrent updates */
+		for (j = 0; j < stats->count; j++) {
+			do {
+				start = u64_stats_fetch_begin(&cpu->syncp);
+				val = u64_stats_read(&cpu->values[j]);
+			} while (u64_stats_fetch_retry(&cpu->syncp, start));
+
+			values[j] += val;
+		}
+	}
+}
+
+void gip_stats_show(struct seq_file *s, struct gip_stats *stats)
+{
+	u64 values[GIP_STATS_MAX];
+	int i;
+
+	if (!stats->cpu || WARN_ON(stats->count > GIP_STATS_MAX))
+		return;
+
+	mutex_lock(&gip_stats_lock);
+	gip_stats_sum(stats, values);
+
+	for (i = 0; i < stats->count; i++)
+		seq_printf(s, "%s: %llu\n", stats->names[i],
+			   values[i] - stats->base[i]);
+
+	mutex_unlock(&gip_stats_lock);
+}
+EXPORT_SYMBOL_GPL(gip_stats_show);
+
+/* counters keep running, readers see the difference to the snapshot */
+void gip_stats_reset(struct gip_stats *stats)
+{
+	if (!stats->cpu)
+		return;
+
+	mutex_lock(&gip_stats_lock);
+	gip_stats_sum(stats, stats->base);
+	mutex_unlock(&gip_stats_lock);
+}
+EXPORT_SYMBOL_GPL(gip_stats_reset);
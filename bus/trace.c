@@ -0,0 +1,10 @@
+// SPDX-License-Identifier: GPL-2.0-or-later
+/*
+ * Copyright (C) 2021 Severin von Wnuck-Lipinski <severinvonw@outlook.de>
+ */
+
+#define CREATE_TRACE_POINTS
+#include "trace.h"
+
+/* completions are traced by the transports */
+EXPORT_TRACEPOINT_SYMBOL_GPL(gip_tx_complete);
@@ -0,0 +1,142 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/*
+ * Copyright (C) 2021 Severin von Wnuck-Lipinski <severinvonw@outlook.de>
+ */
+
+#undef TRACE_SYSTEM
+#define TRACE_SYSTEM xone_gip
+
+#if !defined(_GIP_TRACE_H) || defined(TRACE_HEADER_MULTI_READ)
+#define _GIP_TRACE_H
+
+#include <linux/tracepoint.h>
+
+#include "bus.h"
+
+TRACE_EVENT(gip_rx_packet,
+	TP_PROTO(struct gip_adapter *adap, struct gip_header *hdr),
+	TP_ARGS(adap, hdr),
+	TP_STRUCT__entry(
+		__field(int, adapter)
+		__field(u8, command)
+		__field(u8, options)
+		__field(u8, sequence)
+		__field(u32, length)
+		__field(u32, offset)
+	),
+	TP_fast_assign(
+		__entry->adapter = adap->id;
+		__entry->command = hdr->command;
+		__entry->options = hdr->options;
+		__entry->sequence = hdr->sequence;
+		__entry->length = hdr->packet_length;
+		__entry->offset = hdr->chunk_offset;
+	),
+	TP_printk("gip%d.%u cmd=0x%02x opts=0x%02x seq=0x%02x len=%u offset=%u",
+		  __entry->adapter, __entry->options & 0x0f,
+		  __entry->command, __entry->options, __entry->sequence,
+		  __entry->length, __entry->offset)
+);
+
+TRACE_EVENT(gip_rx_dispatch,
+	TP_PROTO(struct gip_client *client, struct gip_header *hdr, u32 len),
+	TP_ARGS(client, hdr, len),
+	TP_STRUCT__entry(
+		__field(int, adapter)
+		__field(u8, client)
+		__field(u8, command)
+		__field(u8, options)
+		__field(u32, length)
+	),
+	TP_fast_assign(
+		__entry->adapter = client->adapter->id;
+		__entry->client = client->id;
+		__entry->command = hdr->command;
+		__entry->options = hdr->options;
+		__entry->length = len;
+	),
+	TP_printk("gip%d.%u cmd=0x%02x opts=0x%02x len=%u",
+		  __entry->adapter, __entry->client, __entry->command,
+		  __entry->options, __entry->length)
+);
+
+TRACE_EVENT(gip_tx_enqueue,
+	TP_PROTO(struct gip_adapter *adap, struct gip_tx_packet *pkt),
+	TP_ARGS(adap, pkt),
+	TP_STRUCT__entry(
+		__field(int, adapter)
+		__field(u8, client)
+		__field(u8, command)
+		__field(u8, options)
+		__field(u8, flags)
+		__field(u16, length)
+	),
+	TP_fast_assign(
+		__entry->adapter = adap->id;
+		__entry->client = pkt->client_id;
+		__entry->command = pkt->data[0];
+		__entry->options = pkt->data[1];
+		__entry->flags = pkt->flags;
+		__entry->length = pkt->length;
+	),
+	TP_printk("gip%d.%u cmd=0x%02x opts=0x%02x flags=0x%02x len=%u",
+		  __entry->adapter, __entry->client, __entry->command,
+		  __entry->options, __entry->flags, __entry->length)
+);
+
+/* buf is the buffer context, matched by gip_tx_complete */
+TRACE_EVENT(gip_tx_submit,
+	TP_PROTO(struct gip_adapter *adap, const void *buf, int count,
+		 int length, int err),
+	TP_ARGS(adap, buf, count, length, err),
+	TP_STRUCT__entry(
+		__field(int, adapter)
+		__field(const void *, buf)
+		__field(int, count)
+		__field(int, length)
+		__field(int, err)
+	),
+	TP_fast_assign(
+		__entry->adapter = adap->id;
+		__entry->buf = buf;
+		__entry->count = count;
+		__entry->length = length;
+		__entry->err = err;
+	),
+	TP_printk("gip%d buf=%p packets=%d len=%d err=%d",
+		  __entry->adapter, __entry->buf, __entry->count,
+		  __entry->length, __entry->err)
+);
+
+/*
+ * Adapter might already be gone, transports pass its id.
+ * The length is the GIP payload, without transport headers.
+ */
+TRACE_EVENT(gip_tx_complete,
+	TP_PROTO(int adapter, const void *buf, int length, int status),
+	TP_ARGS(adapter, buf, length, status),
+	TP_STRUCT__entry(
+		__field(int, adapter)
+		__field(const void *, buf)
+		__field(int, length)
+		__field(int, status)
+	),
+	TP_fast_assign(
+		__entry->adapter = adapter;
+		__entry->buf = buf;
+		__entry->length = length;
+		__entry->status = status;
+	),
+	TP_printk("gip%d buf=%p len=%d status=%d",
+		  __entry->adapter, __entry->buf, __entry->length,
+		  __entry->status)
+);
+
+#endif /* _GIP_TRACE_H */
+
+#undef TRACE_INCLUDE_PATH
+#define TRACE_INCLUDE_PATH .
+#undef TRACE_INCLUDE_FILE
+#define TRACE_INCLUDE_FILE trace
+
+#include <trace/define_trace.h>
@@ -0,0 +1,559 @@
+// SPDX-License-Identifier: GPL-2.0-or-later
+/*
+ * Copyright (C) 2021 Severin von Wnuck-Lipinski <severinvonw@outlook.de>
+ */
+
+#include <linux/module.h>
+#include <linux/version.h>
+#include <linux/slab.h>
+#include <linux/log2.h>
+#include <linux/ktime.h>
+#include <linux/debugfs.h>
+#include <linux/seq_file.h>
+
+#include "bus.h"
+#include "trace.h"
+
+#define GIP_TX_SUBMITTING 0
+#define GIP_TX_STALLED 1
+#define GIP_TX_ARMED 2
+#define GIP_TX_STOPPED 3
+
+/* offset of the sequence number in the header */
+#define GIP_TX_SEQUENCE_OFFSET 2
+
+static unsigned int tx_window_us;
+module_param(tx_window_us, uint, 0644);
+MODULE_PARM_DESC(tx_window_us, "Delay before sending packets (us), more packets share a transfer");
+
+static struct gip_stats *gip_tx_stats(struct gip_tx_ring *ring)
+{
+	return &container_of(ring, struct gip_adapter, tx)->stats;
+}
+
+static enum hrtimer_restart gip_tx_window_expired(struct hrtimer *timer)
+{
+	struct gip_tx_ring *ring = container_of(timer, typeof(*ring), window);
+
+	/* later packets arm the timer again */
+	clear_bit(GIP_TX_ARMED, &ring->flags);
+	smp_mb__after_atomic();
+
+	gip_tx_flush(container_of(ring, struct gip_adapter, tx));
+
+	return HRTIMER_NORESTART;
+}
+
+int gip_tx_init(struct gip_adapter *adap)
+{
+	struct gip_tx_ring *ring = &adap->tx;
+	int i;
+
+	ring->slots = kcalloc(GIP_TX_RING_SIZE, sizeof(*ring->slots),
+			      GFP_KERNEL);
+	if (!ring->slots)
+		return -ENOMEM;
+
+	ring->mailboxes = kcalloc(GIP_TX_MBOX_SLOTS, sizeof(*ring->mailboxes),
+				  GFP_KERNEL);
+	if (!ring->mailboxes) {
+		kfree(ring->slots);
+		ring->slots = NULL;
+		return -ENOMEM;
+	}
+
+	for (i = 0; i < GIP_TX_RING_SIZE; i++)
+		atomic_set(&ring->slots[i].position, i);
+
+	spin_lock_init(&ring->mbox_lock);
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(6, 13, 0)
+	hrtimer_setup(&ring->window, gip_tx_window_expired, CLOCK_MONOTONIC,
+		      HRTIMER_MODE_REL_SOFT);
+#else
+	hrtimer_init(&ring->window, CLOCK_MONOTONIC, HRTIMER_MODE_REL_SOFT);
+	ring->window.function = gip_tx_window_expired;
+#endif
+
+	return 0;
+}
+
+static struct gip_tx_slot *gip_tx_peek(struct gip_tx_ring *ring,
+				       unsigned int offset)
+{
+	unsigned int tail = READ_ONCE(ring->tail) + offset;
+	struct gip_tx_slot *slot;
+	int pos;
+
+	slot = &ring->slots[tail & (GIP_TX_RING_SIZE - 1)];
+	pos = atomic_read_acquire(&slot->position);
+
+	/* slot has not been committed yet */
+	if (pos != tail + 1)
+		return NULL;
+
+	return slot;
+}
+
+static void gip_tx_pop(struct gip_tx_ring *ring, struct gip_tx_slot *slot)
+{
+	/* hand slot back to the producers for the next lap */
+	atomic_set_release(&slot->position, ring->tail + GIP_TX_RING_SIZE);
+	WRITE_ONCE(ring->tail, ring->tail + 1);
+}
+
+void gip_tx_destroy(struct gip_adapter *adap)
+{
+	struct gip_tx_ring *ring = &adap->tx;
+	struct gip_tx_slot *slot;
+
+	if (!ring->slots)
+		return;
+
+	hrtimer_cancel(&ring->window);
+
+	/* drop packets that have never been submitted */
+	while ((slot = gip_tx_peek(ring, 0)))
+		gip_tx_pop(ring, slot);
+
+	kfree(ring->mailboxes);
+	kfree(ring->slots);
+	ring->mailboxes = NULL;
+	ring->slots = NULL;
+}
+
+struct gip_tx_slot *gip_tx_reserve(struct gip_adapter *adap)
+{
+	struct gip_tx_ring *ring = &adap->tx;
+	struct gip_tx_slot *slot;
+	u64 time = ktime_get_ns();
+	int head, pos, diff;
+
+	head = atomic_read(&ring->head);
+
+	for (;;) {
+		slot = &ring->slots[head & (GIP_TX_RING_SIZE - 1)];
+		pos = atomic_read_acquire(&slot->position);
+		diff = pos - head;
+
+		if (!diff) {
+			if (atomic_try_cmpxchg_relaxed(&ring->head,
+						       &head, head + 1))
+				break;
+		} else if (diff < 0) {
+			/* submitter is a full lap behind */
+			gip_stats_inc(&adap->stats, GIP_ADAP_STAT_TX_FULL);
+			return ERR_PTR(-ENOSPC);
+		} else {
+			head = atomic_read(&ring->head);
+		}
+	}
+
+	slot->packet.flags = 0;
+	slot->time = time;
+
+	return slot;
+}
+
+/* sends packets right away or once the aggregation window expires */
+static void gip_tx_schedule(struct gip_adapter *adap)
+{
+	struct gip_tx_ring *ring = &adap->tx;
+	unsigned int window = READ_ONCE(tx_window_us);
+
+	if (!window) {
+		gip_tx_flush(adap);
+		return;
+	}
+
+	/* packets will be picked up by the armed timer */
+	if (test_and_set_bit(GIP_TX_ARMED, &ring->flags))
+		return;
+
+	hrtimer_start(&ring->window, us_to_ktime(window),
+		      HRTIMER_MODE_REL_SOFT);
+}
+
+static void gip_tx_account_enqueue(struct gip_tx_ring *ring, u64 time)
+{
+	u64 delta = ktime_get_ns() - time;
+	int bucket = delta ? min(ilog2(delta) + 1,
+				 GIP_TX_LATENCY_BUCKETS - 1) : 0;
+
+	atomic64_inc(&ring->latency[bucket]);
+}
+
+void gip_tx_commit(struct gip_adapter *adap, struct gip_tx_slot *slot)
+{
+	struct gip_tx_ring *ring = &adap->tx;
+	int pos = atomic_read(&slot->position);
+
+	gip_stats_inc(&adap->stats, GIP_ADAP_STAT_TX_ENQUEUED);
+	gip_tx_account_enqueue(ring, slot->time);
+
+	trace_gip_tx_enqueue(adap, &slot->packet);
+
+	/* make slot visible to the submitter */
+	atomic_set_release(&slot->position, pos + 1);
+
+	gip_tx_schedule(adap);
+}
+
+static int gip_tx_get_buffer(struct gip_adapter *adap,
+			     struct gip_adapter_buffer *buf)
+{
+	struct gip_tx_ring *ring = &adap->tx;
+
+	buf->type = GIP_BUF_DATA;
+
+	/* rumble and LED commands may skip ahead of other adapters */
+	buf->urgent = !bitmap_empty(ring->mbox_pending, GIP_TX_MBOX_SLOTS);
+
+	/* returns ENOSPC if no buffer is available */
+	return adap->ops->get_buffer(adap, buf);
+}
+
+static void gip_tx_pack(struct gip_adapter *adap, struct gip_tx_packet *pkt,
+			u8 *data)
+{
+	struct gip_tx_ring *ring = &adap->tx;
+	u8 seq = pkt->data[GIP_TX_SEQUENCE_OFFSET];
+
+	if (pkt->flags & GIP_TX_SEQ_CHUNK) {
+		seq = ring->chunk_sequence[pkt->client_id][pkt->transfer];
+	} else if (pkt->flags & GIP_TX_SEQ_NEW) {
+		/* sequence number is always greater than zero */
+		do {
+			seq = adap->data_sequence++;
+		} while (!seq);
+
+		if (pkt->flags & GIP_TX_CHUNK_START)
+			ring->chunk_sequence[pkt->client_id][pkt->transfer] = seq;
+	}
+
+	memcpy(data, pkt->data, pkt->length);
+	data[GIP_TX_SEQUENCE_OFFSET] = seq;
+
+	gip_capture_tx(adap, data, pkt->length);
+}
+
+static int gip_tx_take_mailbox(struct gip_tx_ring *ring,
+			       struct gip_tx_packet *pkt, int space)
+{
+	unsigned long flags;
+	int i;
+
+	for_each_set_bit(i, ring->mbox_pending, GIP_TX_MBOX_SLOTS) {
+		spin_lock_irqsave(&ring->mbox_lock, flags);
+
+		/* leave packet for the next transfer */
+		if (ring->mailboxes[i].length > space) {
+			spin_unlock_irqrestore(&ring->mbox_lock, flags);
+			continue;
+		}
+
+		clear_bit(i, ring->mbox_pending);
+		*pkt = ring->mailboxes[i];
+		spin_unlock_irqrestore(&ring->mbox_lock, flags);
+
+		return i;
+	}
+
+	return -ENOENT;
+}
+
+static void gip_tx_drop_mailboxes(struct gip_tx_ring *ring, int length)
+{
+	unsigned long flags;
+	int i;
+
+	spin_lock_irqsave(&ring->mbox_lock, flags);
+
+	for_each_set_bit(i, ring->mbox_pending, GIP_TX_MBOX_SLOTS) {
+		if (ring->mailboxes[i].length <= length)
+			continue;
+
+		clear_bit(i, ring->mbox_pending);
+		gip_stats_inc(gip_tx_stats(ring), GIP_ADAP_STAT_TX_ERRORS);
+	}
+
+	spin_unlock_irqrestore(&ring->mbox_lock, flags);
+}
+
+/*
+ * Packs as many packets as possible into the buffer.
+ * Queued packets are reliable and go first, in order.
+ * Returns the number of ring slots used by the transfer.
+ */
+static int gip_tx_fill(struct gip_adapter *adap,
+		       struct gip_adapter_buffer *buf, int *count)
+{
+	struct gip_tx_ring *ring = &adap->tx;
+	struct gip_tx_slot *slot;
+	struct gip_tx_packet pkt;
+	int len = 0, slots = 0;
+
+	while ((slot = gip_tx_peek(ring, slots))) {
+		if (len + slot->packet.length > buf->length)
+			break;
+
+		gip_tx_pack(adap, &slot->packet, buf->data + len);
+		len += slot->packet.length;
+		slots++;
+	}
+
+	/* packet does not even fit into an empty buffer */
+	if (!len && slot) {
+		gip_stats_inc(&adap->stats, GIP_ADAP_STAT_TX_ERRORS);
+		gip_tx_pop(ring, slot);
+		return 0;
+	}
+
+	*count = slots;
+
+	while (gip_tx_take_mailbox(ring, &pkt, buf->length - len) >= 0) {
+		gip_tx_pack(adap, &pkt, buf->data + len);
+		len += pkt.length;
+		(*count)++;
+	}
+
+	if (!len) {
+		gip_tx_drop_mailboxes(ring, buf->length);
+		return 0;
+	}
+
+	buf->length = len;
+
+	return slots;
+}
+
+static void gip_tx_account(struct gip_adapter *adap, int count, int len,
+			   int err)
+{
+	int bucket = min(ilog2(count), GIP_TX_BATCH_BUCKETS - 1);
+
+	if (err) {
+		gip_stats_add(&adap->stats, GIP_ADAP_STAT_TX_ERRORS, count);
+		return;
+	}
+
+	gip_stats_add(&adap->stats, GIP_ADAP_STAT_TX_PACKETS, count);
+	gip_stats_add(&adap->stats, GIP_ADAP_STAT_TX_BYTES, len);
+	gip_stats_inc(&adap->stats, GIP_ADAP_STAT_TX_TRANSFERS);
+	atomic64_inc(&adap->tx.batch[bucket]);
+}
+
+static void gip_tx_stall(struct gip_tx_ring *ring, int kicks)
+{
+	set_bit(GIP_TX_STALLED, &ring->flags);
+
+	/* pairs with the barrier in gip_tx_kick */
+	smp_mb__after_atomic();
+
+	/* transport released a buffer in the meantime */
+	if (atomic_read(&ring->kicks) != kicks) {
+		clear_bit(GIP_TX_STALLED, &ring->flags);
+		return;
+	}
+
+	gip_stats_inc(gip_tx_stats(ring), GIP_ADAP_STAT_TX_STALLS);
+}
+
+static bool gip_tx_queued(struct gip_tx_ring *ring)
+{
+	return gip_tx_peek(ring, 0) ||
+	       !bitmap_empty(ring->mbox_pending, GIP_TX_MBOX_SLOTS);
+}
+
+static void gip_tx_drain(struct gip_adapter *adap)
+{
+	struct gip_tx_ring *ring = &adap->tx;
+	struct gip_tx_slot *slot;
+	struct gip_adapter_buffer buf = {};
+	struct gip_tx_packet pkt;
+	int kicks, slots, count, err;
+
+	while (!test_bit(GIP_TX_STALLED, &ring->flags) &&
+	       !test_bit(GIP_TX_STOPPED, &ring->flags) &&
+	       gip_tx_queued(ring)) {
+		kicks = atomic_read(&ring->kicks);
+
+		err = gip_tx_get_buffer(adap, &buf);
+		if (err == -ENOSPC) {
+			gip_tx_stall(ring, kicks);
+			continue;
+		}
+
+		if (err) {
+			dev_dbg(&adap->dev, "%s: get buffer failed: %d\n",
+				__func__, err);
+
+			/* avoid retrying the same packet forever */
+			slot = gip_tx_peek(ring, 0);
+			if (slot)
+				gip_tx_pop(ring, slot);
+			else
+				gip_tx_take_mailbox(ring, &pkt, INT_MAX);
+
+			gip_stats_inc(&adap->stats, GIP_ADAP_STAT_TX_ERRORS);
+			continue;
+		}
+
+		count = 0;
+		slots = gip_tx_fill(adap, &buf, &count);
+		if (!count) {
+			/* only oversized packets or dropped mailboxes */
+			adap->ops->put_buffer(adap, &buf);
+			continue;
+		}
+
+		/* always fails on adapter removal */
+		err = adap->ops->submit_buffer(adap, &buf);
+		if (err)
+			dev_dbg(&adap->dev, "%s: submit buffer failed: %d\n",
+				__func__, err);
+
+		trace_gip_tx_submit(adap, buf.context, count, buf.length, err);
+		gip_tx_account(adap, count, buf.length, err);
+
+		while (slots--)
+			gip_tx_pop(ring, gip_tx_peek(ring, 0));
+	}
+}
+
+static bool gip_tx_pending(struct gip_tx_ring *ring)
+{
+	if (test_bit(GIP_TX_STALLED, &ring->flags))
+		return false;
+
+	return gip_tx_queued(ring);
+}
+
+void gip_tx_flush(struct gip_adapter *adap)
+{
+	struct gip_tx_ring *ring = &adap->tx;
+
+	preempt_disable();
+
+	do {
+		/* current submitter will pick up the new packets */
+		if (test_and_set_bit_lock(GIP_TX_SUBMITTING, &ring->flags))
+			break;
+
+		/* pairs with the barrier in gip_tx_stop */
+		smp_mb__after_atomic();
+
+		if (test_bit(GIP_TX_STOPPED, &ring->flags)) {
+			clear_bit_unlock(GIP_TX_SUBMITTING, &ring->flags);
+			break;
+		}
+
+		gip_tx_drain(adap);
+		clear_bit_unlock(GIP_TX_SUBMITTING, &ring->flags);
+
+		/* pairs with the release in gip_tx_commit */
+		smp_mb__after_atomic();
+	} while (gip_tx_pending(ring));
+
+	preempt_enable();
+}
+
+void gip_tx_post(struct gip_adapter *adap, enum gip_tx_mailbox mbox,
+		 struct gip_tx_packet *pkt)
+{
+	struct gip_tx_ring *ring = &adap->tx;
+	int i = pkt->client_id * GIP_TX_MBOX_COUNT + mbox;
+	u64 time = ktime_get_ns();
+	unsigned long flags;
+
+	trace_gip_tx_enqueue(adap, pkt);
+
+	spin_lock_irqsave(&ring->mbox_lock, flags);
+
+	ring->mailboxes[i] = *pkt;
+	if (test_and_set_bit(i, ring->mbox_pending))
+		gip_stats_inc(&adap->stats, GIP_ADAP_STAT_TX_MERGED);
+
+	spin_unlock_irqrestore(&ring->mbox_lock, flags);
+
+	gip_tx_account_enqueue(ring, time);
+	gip_stats_inc(&adap->stats, GIP_ADAP_STAT_TX_POSTED);
+	gip_tx_schedule(adap);
+}
+
+/*
+ * Called by the transport whenever a data buffer becomes available again,
+ * resumes submission after get_buffer ran out of buffers.
+ */
+void gip_tx_kick(struct gip_adapter *adap)
+{
+	struct gip_tx_ring *ring = &adap->tx;
+
+	atomic_inc(&ring->kicks);
+
+	/* pairs with the barrier in gip_tx_stall */
+	smp_mb__after_atomic();
+
+	if (test_and_clear_bit(GIP_TX_STALLED, &ring->flags))
+		gip_tx_flush(adap);
+}
+EXPORT_SYMBOL_GPL(gip_tx_kick);
+
+/* number of packets waiting for a buffer, including mailboxes */
+int gip_tx_depth(struct gip_adapter *adap)
+{
+	struct gip_tx_ring *ring = &adap->tx;
+
+	return atomic_read(&ring->head) - READ_ONCE(ring->tail) +
+	       bitmap_weight(ring->mbox_pending, GIP_TX_MBOX_SLOTS);
+}
+EXPORT_SYMBOL_GPL(gip_tx_depth);
+
+/*
+ * Called on adapter removal, the transport must not be asked for buffers
+ * afterwards. Unsent packets are failed by gip_tx_destroy.
+ */
+void gip_tx_stop(struct gip_adapter *adap)
+{
+	struct gip_tx_ring *ring = &adap->tx;
+
+	set_bit(GIP_TX_STOPPED, &ring->flags);
+
+	/* pairs with the barrier in gip_tx_flush */
+	smp_mb__after_atomic();
+
+	hrtimer_cancel(&ring->window);
+
+	/* wait for the current submitter */
+	while (test_bit(GIP_TX_SUBMITTING, &ring->flags))
+		cpu_relax();
+}
+
+static int gip_tx_stats_show(struct seq_file *s, void *data)
+{
+	struct gip_tx_ring *ring = s->private;
+	int i;
+
+	seq_printf(s, "stalled: %d\n",
+		   test_bit(GIP_TX_STALLED, &ring->flags));
+
+	seq_puts(s, "packets_per_transfer:\n");
+
+	for (i = 0; i < GIP_TX_BATCH_BUCKETS; i++)
+		seq_printf(s, "  < %llu: %lld\n", BIT_ULL(i + 1),
+			   atomic64_read(&ring->batch[i]));
+
+	seq_puts(s, "enqueue_latency_ns:\n");
+
+	for (i = 0; i < GIP_TX_LATENCY_BUCKETS; i++)
+		seq_printf(s, "  < %llu: %lld\n", BIT_ULL(i),
+			   atomic64_read(&ring->latency[i]));
+
+	return 0;
+}
+DEFINE_SHOW_ATTRIBUTE(gip_tx_stats);
+
+void gip_tx_init_debugfs(struct gip_adapter *adap)
+{
+	debugfs_create_file("tx", 0444, adap->debugfs, &adap->tx,
+			    &gip_tx_stats_fops);
+}
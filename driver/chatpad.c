@@ -128,7 +128,7 @@ static int gip_chatpad_op_guide_button(struct gip_client *client, bool down)
 	struct gip_chatpad *chatpad = dev_get_drvdata(&client->dev);
 
 	input_report_key(chatpad->input.dev, BTN_MODE, down);
-	input_sync(chatpad->input.dev);
+	gip_sync_input(&chatpad->input);
 
 	return 0;
 }
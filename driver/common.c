@@ -213,7 +213,21 @@ int gip_init_input(struct gip_input *input, struct gip_client *client,
 	input->dev->id.product = client->hardware.product;
 	input->dev->id.version = client->hardware.version;
 	input->dev->dev.parent = &client->dev;
+	input->client = client;
 
 	return 0;
 }
 EXPORT_SYMBOL_GPL(gip_init_input);
+
+void gip_sync_input(struct gip_input *input)
+{
+	u64 time = READ_ONCE(input->client->rx_time);
+
+	/* stamp events with the URB completion instead of the sync time */
+	if (time)
+		input_set_timestamp(input->dev, ns_to_ktime(time));
+
+	input_sync(input->dev);
+	gip_report_latency(input->client);
+}
+EXPORT_SYMBOL_GPL(gip_sync_input);
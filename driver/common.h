@@ -29,6 +29,8 @@ struct gip_led {
 
 struct gip_input {
 	struct input_dev *dev;
+
+	struct gip_client *client;
 };
 
 struct gip_vidpid {
@@ -46,3 +48,4 @@ int gip_init_led(struct gip_led *led, struct gip_client *client);
 
 int gip_init_input(struct gip_input *input, struct gip_client *client,
 		   const char *name);
+void gip_sync_input(struct gip_input *input);
@@ -92,8 +92,8 @@ struct gip_gamepad_pkt_input {
 } __packed;
 
 struct gip_gamepad_pkt_dli {
-	u32 counter_us1;
-	u32 counter_us2;
+	__le32 counter_us1;
+	__le32 counter_us2;
 } __packed;
 
 struct gip_gamepad_pkt_rumble {
@@ -256,6 +256,11 @@ static int gip_gamepad_init_input(struct gip_gamepad *gamepad)
 	if (gamepad->supports_share)
 		input_set_capability(dev, EV_KEY, KEY_RECORD);
 
+	if (gamepad->supports_dli) {
+		input_set_capability(dev, EV_MSC, MSC_TIMESTAMP);
+		input_set_capability(dev, EV_MSC, MSC_RAW);
+	}
+
 	if (gamepad->paddle_support) {
 		pr_debug("%s: Paddle support detected", __func__);
 		input_set_capability(dev, EV_KEY, BTN_TRIGGER_HAPPY5);
@@ -333,7 +338,7 @@ static int gip_gamepad_op_guide_button(struct gip_client *client, bool down)
 	struct gip_gamepad *gamepad = dev_get_drvdata(&client->dev);
 
 	input_report_key(gamepad->input.dev, BTN_MODE, down);
-	input_sync(gamepad->input.dev);
+	gip_sync_input(&gamepad->input);
 
 	return 0;
 }
@@ -361,7 +366,7 @@ static int gip_gamepad_op_firmware(struct gip_client *client, void *data,
 	input_report_key(dev, BTN_TRIGGER_HAPPY7, pkt->paddles & GIP_GP_BTN_P3);
 	input_report_key(dev, BTN_TRIGGER_HAPPY8, pkt->paddles & GIP_GP_BTN_P4);
 
-	input_sync(dev);
+	gip_sync_input(&gamepad->input);
 	return 0;
 }
 
@@ -369,6 +374,7 @@ static int gip_gamepad_op_input(struct gip_client *client, void *data, u32 len)
 {
 	struct gip_gamepad *gamepad = dev_get_drvdata(&client->dev);
 	struct gip_gamepad_pkt_input *pkt = data;
+	struct gip_gamepad_pkt_dli *dli;
 	struct input_dev *dev = gamepad->input.dev;
 	u16 buttons;
 	u8 share_offset = GIP_GP_BTN_SHARE_OFFSET;
@@ -390,6 +396,18 @@ static int gip_gamepad_op_input(struct gip_client *client, void *data, u32 len)
 				 ((u8 *)data)[len - share_offset]);
 	}
 
+	/*
+	 * Device counters in microseconds, appended to the input packet.
+	 * evdev has a single timestamp code, the second counter is raw.
+	 */
+	if (gamepad->supports_dli && len >= sizeof(*pkt) + sizeof(*dli)) {
+		dli = data + len - sizeof(*dli);
+		input_event(dev, EV_MSC, MSC_TIMESTAMP,
+			    le32_to_cpu(dli->counter_us1));
+		input_event(dev, EV_MSC, MSC_RAW,
+			    le32_to_cpu(dli->counter_us2));
+	}
+
 	input_report_key(dev, BTN_START, buttons & GIP_GP_BTN_MENU);
 	input_report_key(dev, BTN_SELECT, buttons & GIP_GP_BTN_VIEW);
 	input_report_key(dev, BTN_A, buttons & GIP_GP_BTN_A);
@@ -469,7 +487,7 @@ static int gip_gamepad_op_input(struct gip_client *client, void *data, u32 len)
 					 !!(buttons & GIP_GP_BTN_DPAD_L));
 	input_report_abs(dev, ABS_HAT0Y, !!(buttons & GIP_GP_BTN_DPAD_D) -
 					 !!(buttons & GIP_GP_BTN_DPAD_U));
-	input_sync(dev);
+	gip_sync_input(&gamepad->input);
 	return 0;
 }
 
@@ -90,7 +90,7 @@ static int gip_strat_op_guide_button(struct gip_client *client, bool down)
 	struct gip_strat *strat = dev_get_drvdata(&client->dev);
 
 	input_report_key(strat->input.dev, BTN_MODE, down);
-	input_sync(strat->input.dev);
+	gip_sync_input(&strat->input);
 
 	return 0;
 }
@@ -136,7 +136,7 @@ static int gip_strat_op_input(struct gip_client *client, void *data, u32 len)
 					 !!(buttons & GIP_ST_BTN_DPAD_L));
 	input_report_abs(dev, ABS_HAT0Y, !!(buttons & GIP_ST_BTN_DPAD_D) -
 					 !!(buttons & GIP_ST_BTN_DPAD_U));
-	input_sync(dev);
+	gip_sync_input(&strat->input);
 
 	return 0;
 }
@@ -0,0 +1,469 @@
+// SPDX-License-Identifier: GPL-2.0-or-later
+/*
+ * Copyright (C) 2021 Severin von Wnuck-Lipinski <severinvonw@outlook.de>
+ *
+ * Microbenchmarks for the GIP protocol core, built in userspace against
+ * the kernel API in shim/. The protocol code is included directly so
+ * that its static functions can be measured as well.
+ */
+
+#include "../bus/protocol.c"
+
+#include <getopt.h>
+
+int shim_verbose;
+
+struct srcu_struct gip_drv_srcu;
+DEFINE_STATIC_KEY_FALSE(gip_capture_key);
+
+static unsigned long long bench_tx_packets;
+static unsigned long long bench_input_packets;
+static struct gip_tx_slot bench_tx_slot;
+
+/* bus functions outside of protocol.c */
+int gip_stats_init(struct gip_stats *stats, const char * const *names,
+		   int count, gfp_t gfp)
+{
+	stats->cpu = calloc(1, struct_size(stats->cpu, values, count));
+	stats->count = count;
+
+	return stats->cpu ? 0 : -ENOMEM;
+}
+
+void gip_stats_free(struct gip_stats *stats)
+{
+	free(stats->cpu);
+	stats->cpu = NULL;
+}
+
+struct gip_client *gip_get_client(struct gip_adapter *adap, u8 id)
+{
+	struct gip_client *client = adap->clients[id];
+
+	if (client)
+		return client;
+
+	client = kzalloc(sizeof(*client), GFP_ATOMIC);
+	if (!client)
+		return ERR_PTR(-ENOMEM);
+
+	if (gip_stats_init(&client->stats, NULL, GIP_CLIENT_STAT_COUNT,
+			   GFP_ATOMIC)) {
+		kfree(client);
+		return ERR_PTR(-ENOMEM);
+	}
+
+	client->id = id;
+	client->adapter = adap;
+	gip_init_chunk_transfers(client);
+	adap->clients[id] = client;
+
+	return client;
+}
+
+void gip_add_client(struct gip_client *client)
+{
+}
+
+void gip_remove_client(struct gip_client *client)
+{
+	client->adapter->clients[client->id] = NULL;
+}
+
+struct gip_tx_slot *gip_tx_reserve(struct gip_adapter *adap)
+{
+	return &bench_tx_slot;
+}
+
+void gip_tx_commit(struct gip_adapter *adap, struct gip_tx_slot *slot)
+{
+	bench_tx_packets++;
+}
+
+void gip_tx_post(struct gip_adapter *adap, enum gip_tx_mailbox mbox,
+		 struct gip_tx_packet *pkt)
+{
+	bench_tx_packets++;
+}
+
+void *gip_pool_alloc(size_t size)
+{
+	return malloc(size);
+}
+
+void gip_pool_free(void *ptr, size_t size)
+{
+	free(ptr);
+}
+
+void __gip_capture(struct gip_adapter *adap, enum gip_capture_direction dir,
+		   u64 time, u8 *data, int len)
+{
+}
+
+static int bench_op_input(struct gip_client *client, void *data, u32 len)
+{
+	bench_input_packets++;
+
+	return 0;
+}
+
+static struct gip_driver bench_driver = {
+	.name = "bench",
+	.ops.input = bench_op_input,
+};
+
+struct bench {
+	const char *name;
+	void (*setup)(void);
+	int (*run)(void);
+	void (*teardown)(void);
+};
+
+static struct gip_adapter bench_adapter;
+static struct gip_client *bench_client;
+
+static u8 bench_buf[4096];
+static int bench_len;
+
+/* keeps results alive without letting the compiler drop the loop */
+static volatile u32 bench_sink;
+
+static void bench_setup_client(void)
+{
+	bench_client = gip_get_client(&bench_adapter, 0);
+	if (IS_ERR(bench_client)) {
+		fprintf(stderr, "client allocation failed\n");
+		exit(1);
+	}
+
+	bench_client->drv = &bench_driver;
+}
+
+static void bench_teardown_client(void)
+{
+	gip_free_client_info(bench_client);
+	gip_free_chunk_buffer(bench_client->chunk_buf_out);
+	gip_stats_free(&bench_client->stats);
+	free(bench_client);
+
+	bench_adapter.clients[0] = NULL;
+	bench_client = NULL;
+}
+
+static int bench_encode_header(void)
+{
+	struct gip_header hdr = {
+		.command = GIP_CMD_INPUT,
+		.sequence = bench_sink,
+		.packet_length = 14,
+	};
+
+	gip_encode_header(&hdr, bench_buf);
+	bench_sink += bench_buf[2];
+
+	return 0;
+}
+
+static int bench_encode_header_chunk(void)
+{
+	struct gip_header hdr = {
+		.command = GIP_CMD_IDENTIFY,
+		.options = GIP_OPT_INTERNAL | GIP_OPT_CHUNK,
+		.sequence = bench_sink,
+		.packet_length = 0x3a,
+		.chunk_offset = 0x1d4,
+	};
+
+	gip_encode_header(&hdr, bench_buf);
+	bench_sink += bench_buf[2];
+
+	return 0;
+}
+
+static void bench_setup_decode(void)
+{
+	struct gip_header hdr = {
+		.command = GIP_CMD_IDENTIFY,
+		.options = GIP_OPT_INTERNAL | GIP_OPT_CHUNK,
+		.sequence = 1,
+		.packet_length = 0x3a,
+		.chunk_offset = 0x1d4,
+	};
+
+	gip_encode_header(&hdr, bench_buf);
+	bench_len = gip_get_header_length(&hdr) + hdr.packet_length;
+}
+
+static int bench_decode_header(void)
+{
+	struct gip_header hdr;
+
+	bench_sink += gip_decode_header(&hdr, bench_buf, bench_len);
+	bench_sink += hdr.chunk_offset;
+
+	return 0;
+}
+
+static void bench_setup_input(void)
+{
+	struct gip_header hdr = {
+		.command = GIP_CMD_INPUT,
+		.sequence = 1,
+		.packet_length = 14,
+	};
+	int hdr_len = gip_get_header_length(&hdr);
+
+	bench_setup_client();
+
+	gip_encode_header(&hdr, bench_buf);
+	memset(bench_buf + hdr_len, 0x55, hdr.packet_length);
+	bench_len = hdr_len + hdr.packet_length;
+}
+
+static int bench_process_input(void)
+{
+	/* sequence numbers advance like on a real device */
+	bench_buf[2] = bench_buf[2] + 1 ?: 1;
+
+	return gip_process_buffer(&bench_adapter, bench_buf, bench_len, 0);
+}
+
+static u8 *bench_put_element(u8 *pos, u8 count, int item_len, u8 fill)
+{
+	*pos++ = count;
+	memset(pos, fill, count * item_len);
+
+	return pos + count * item_len;
+}
+
+/* identify packet of a gamepad with two classes and four interfaces */
+static int bench_build_identify(u8 *buf)
+{
+	struct gip_pkt_identify *pkt = (struct gip_pkt_identify *)buf;
+	static const char * const classes[] = {
+		"Windows.Xbox.Input.Gamepad",
+		"Windows.Xbox.Input.NavigationController",
+	};
+	u8 *data = buf + sizeof(pkt->unknown);
+	u8 *pos = buf + sizeof(*pkt);
+	u16 len;
+	int i;
+
+	memset(buf, 0, sizeof(*pkt));
+
+	pkt->client_commands_offset = cpu_to_le16(pos - data);
+	pos = bench_put_element(pos, 8, sizeof(struct gip_command_descriptor),
+				0x01);
+	pkt->firmware_versions_offset = cpu_to_le16(pos - data);
+	pos = bench_put_element(pos, 1, sizeof(struct gip_firmware_version),
+				0x05);
+	pkt->audio_formats_offset = cpu_to_le16(pos - data);
+	pos = bench_put_element(pos, 2, 2, GIP_AUD_FORMAT_24KHZ_MONO);
+	pkt->capabilities_out_offset = cpu_to_le16(pos - data);
+	pos = bench_put_element(pos, 4, 1, 0x02);
+	pkt->capabilities_in_offset = cpu_to_le16(pos - data);
+	pos = bench_put_element(pos, 3, 1, 0x03);
+
+	pkt->classes_offset = cpu_to_le16(pos - data);
+	*pos++ = ARRAY_SIZE(classes);
+
+	for (i = 0; i < ARRAY_SIZE(classes); i++) {
+		len = strlen(classes[i]);
+		pos[0] = len;
+		pos[1] = len >> 8;
+		memcpy(pos + 2, classes[i], len);
+		pos += 2 + len;
+	}
+
+	pkt->interfaces_offset = cpu_to_le16(pos - data);
+	pos = bench_put_element(pos, 4, sizeof(guid_t), 0x42);
+	pkt->hid_descriptor_offset = cpu_to_le16(pos - data);
+	pos = bench_put_element(pos, 32, 1, 0x09);
+
+	return pos - buf;
+}
+
+static void bench_setup_identify(void)
+{
+	bench_setup_client();
+	bench_len = bench_build_identify(bench_buf);
+}
+
+static int bench_parse_identify(void)
+{
+	int err;
+
+	err = gip_handle_pkt_identify(bench_client, bench_buf, bench_len);
+	gip_free_client_info(bench_client);
+
+	return err;
+}
+
+/* the same identify packet, split into chunks like on the wire */
+static u8 bench_chunks[8192];
+static int bench_chunks_len;
+
+static int bench_put_chunk(u8 *buf, u8 options, u32 offset, u8 *data,
+			   u32 len)
+{
+	struct gip_header hdr = {
+		.command = GIP_CMD_IDENTIFY,
+		.options = GIP_OPT_INTERNAL | GIP_OPT_CHUNK | options,
+		.sequence = 1,
+		.packet_length = len,
+		.chunk_offset = offset,
+	};
+	int hdr_len = gip_get_header_length(&hdr);
+
+	gip_encode_header(&hdr, buf);
+	if (len)
+		memcpy(buf + hdr_len, data, len);
+
+	return hdr_len + len;
+}
+
+static void bench_setup_chunked(void)
+{
+	u8 identify[1024];
+	int len, offset, chunk;
+
+	bench_setup_client();
+	len = bench_build_identify(identify);
+
+	/* first chunk announces the total length */
+	chunk = min(len, GIP_PKT_MAX_LENGTH);
+	bench_chunks_len = bench_put_chunk(bench_chunks,
+					   GIP_OPT_CHUNK_START |
+					   GIP_OPT_ACKNOWLEDGE,
+					   len, identify, chunk);
+
+	for (offset = chunk; offset < len; offset += chunk) {
+		chunk = min(len - offset, GIP_PKT_MAX_LENGTH);
+		bench_chunks_len += bench_put_chunk(bench_chunks +
+						    bench_chunks_len, 0,
+						    offset, identify + offset,
+						    chunk);
+	}
+
+	/* empty chunk completes the transfer */
+	bench_chunks_len += bench_put_chunk(bench_chunks + bench_chunks_len,
+					    0, len, NULL, 0);
+}
+
+static int bench_process_chunked(void)
+{
+	int err;
+
+	err = gip_process_buffer(&bench_adapter, bench_chunks,
+				 bench_chunks_len, 0);
+	gip_free_client_info(bench_client);
+
+	return err;
+}
+
+static const struct bench benches[] = {
+	{ "encode_header", NULL, bench_encode_header, NULL },
+	{ "encode_header_chunk", NULL, bench_encode_header_chunk, NULL },
+	{ "decode_header_chunk", bench_setup_decode, bench_decode_header,
+	  NULL },
+	{ "process_input", bench_setup_input, bench_process_input,
+	  bench_teardown_client },
+	{ "parse_identify", bench_setup_identify, bench_parse_identify,
+	  bench_teardown_client },
+	{ "process_identify_chunked", bench_setup_chunked,
+	  bench_process_chunked, bench_teardown_client },
+};
+
+static u64 bench_now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+static int bench_run(const struct bench *bench, u64 iterations)
+{
+	u64 i, start, elapsed;
+	int err;
+
+	if (bench->setup)
+		bench->setup();
+
+	/* warm up caches and the branch predictor */
+	for (i = 0; i < iterations / 10; i++) {
+		err = bench->run();
+		if (err) {
+			fprintf(stderr, "%s: failed: %d\n", bench->name, err);
+			return err;
+		}
+	}
+
+	start = bench_now();
+
+	for (i = 0; i < iterations; i++)
+		bench->run();
+
+	elapsed = bench_now() - start;
+
+	if (bench->teardown)
+		bench->teardown();
+
+	printf("%-28s %12llu ops %10.1f ns/op\n", bench->name,
+	       (unsigned long long)iterations, (double)elapsed / iterations);
+
+	return 0;
+}
+
+static void usage(const char *name)
+{
+	fprintf(stderr, "usage: %s [-n ITERATIONS] [-v] [BENCHMARK...]\n",
+		name);
+}
+
+int main(int argc, char **argv)
+{
+	u64 iterations = 1000000;
+	bool found;
+	int opt, i, j, err = 0;
+
+	while ((opt = getopt(argc, argv, "n:vh")) != -1) {
+		switch (opt) {
+		case 'n':
+			iterations = strtoull(optarg, NULL, 0);
+			break;
+		case 'v':
+			shim_verbose = 1;
+			break;
+		default:
+			usage(argv[0]);
+			return opt != 'h';
+		}
+	}
+
+	if (!iterations)
+		iterations = 1;
+
+	if (gip_stats_init(&bench_adapter.stats, NULL, GIP_ADAP_STAT_COUNT,
+			   GFP_KERNEL)) {
+		fprintf(stderr, "adapter allocation failed\n");
+		return 1;
+	}
+
+	for (i = 0; i < ARRAY_SIZE(benches); i++) {
+		found = optind == argc;
+
+		for (j = optind; j < argc; j++)
+			if (!strcmp(argv[j], benches[i].name))
+				found = true;
+
+		if (found)
+			err |= bench_run(&benches[i], iterations);
+	}
+
+	gip_stats_free(&bench_adapter.stats);
+
+	return !!err;
+}
@@ -0,0 +1,646 @@
+// SPDX-License-Identifier: GPL-2.0-or-later
+/*
+ * Copyright (C) 2021 Severin von Wnuck-Lipinski <severinvonw@outlook.de>
+ *
+ * Records GIP packet captures to pcapng and replays them through the
+ * drivers, see the debugfs "capture" and "replay" files of each adapter.
+ */
+
+#include <endian.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <glob.h>
+#include <signal.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "../bus/capture.h"
+
+#define DEBUGFS_ROOT "/sys/kernel/debug/xone-gip"
+
+#define PCAPNG_BLOCK_SHB 0x0a0d0d0a
+#define PCAPNG_BLOCK_IDB 0x00000001
+#define PCAPNG_BLOCK_EPB 0x00000006
+#define PCAPNG_BYTE_ORDER 0x1a2b3c4d
+
+#define PCAPNG_OPT_END 0
+#define PCAPNG_OPT_IF_NAME 2
+#define PCAPNG_OPT_IF_TSRESOL 9
+#define PCAPNG_OPT_EPB_FLAGS 2
+#define PCAPNG_OPT_EPB_DROPCOUNT 4
+
+#define PCAPNG_FLAG_INBOUND 0x01
+#define PCAPNG_FLAG_OUTBOUND 0x02
+
+#define LINKTYPE_USER0 147
+
+#define BUF_SIZE 65536
+#define LATENCY_BUCKETS 32
+
+static volatile sig_atomic_t stop;
+
+static const char *debugfs_root = DEBUGFS_ROOT;
+
+static void handle_signal(int sig)
+{
+	stop = 1;
+}
+
+static uint64_t now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+static uint64_t cpu_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &ts);
+
+	return ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+static int write_all(int fd, const void *buf, size_t len)
+{
+	ssize_t ret;
+
+	while (len) {
+		ret = write(fd, buf, len);
+		if (ret < 0) {
+			if (errno == EINTR)
+				continue;
+
+			return -errno;
+		}
+
+		buf = (const uint8_t *)buf + ret;
+		len -= ret;
+	}
+
+	return 0;
+}
+
+static int open_adapter_file(const char *adapter, const char *name, int flags)
+{
+	char path[256];
+	int fd;
+
+	snprintf(path, sizeof(path), "%s/%s/%s", debugfs_root, adapter, name);
+
+	fd = open(path, flags);
+	if (fd < 0)
+		fprintf(stderr, "open %s: %s\n", path, strerror(errno));
+
+	return fd;
+}
+
+static size_t pad4(size_t len)
+{
+	return (len + 3) & ~(size_t)3;
+}
+
+/* blocks are written in host byte order, see PCAPNG_BYTE_ORDER */
+static int pcapng_write_header(FILE *out, const char *adapter)
+{
+	struct {
+		uint32_t type;
+		uint32_t length;
+		uint32_t byte_order;
+		uint16_t major;
+		uint16_t minor;
+		int64_t section_length;
+		uint32_t length_end;
+	} __attribute__((packed)) shb = {
+		.type = PCAPNG_BLOCK_SHB,
+		.length = sizeof(shb),
+		.byte_order = PCAPNG_BYTE_ORDER,
+		.major = 1,
+		.section_length = -1,
+		.length_end = sizeof(shb),
+	};
+	uint32_t idb[24] = {};
+	size_t name_len = strlen(adapter);
+	size_t pos = 0;
+
+	if (name_len > 32)
+		name_len = 32;
+
+	if (fwrite(&shb, sizeof(shb), 1, out) != 1)
+		return -EIO;
+
+	/* interface description block with nanosecond timestamps */
+	idb[pos++] = PCAPNG_BLOCK_IDB;
+	pos++;
+	idb[pos++] = LINKTYPE_USER0;
+	idb[pos++] = 0;
+
+	idb[pos++] = PCAPNG_OPT_IF_NAME | name_len << 16;
+	memcpy(&idb[pos], adapter, name_len);
+	pos += pad4(name_len) / 4;
+
+	idb[pos++] = PCAPNG_OPT_IF_TSRESOL | 1 << 16;
+	*(uint8_t *)&idb[pos++] = 9;
+	idb[pos++] = PCAPNG_OPT_END;
+
+	idb[1] = (pos + 1) * 4;
+	idb[pos++] = idb[1];
+
+	if (fwrite(idb, 4, pos, out) != pos)
+		return -EIO;
+
+	return 0;
+}
+
+static int pcapng_write_packet(FILE *out, struct gip_capture_record *rec,
+			       const uint8_t *data)
+{
+	uint32_t captured = le16toh(rec->captured);
+	uint32_t dropped = le32toh(rec->dropped);
+	uint64_t time = le64toh(rec->time_ns);
+	uint32_t hdr[7], opts[8];
+	uint32_t len, opt_len = 0;
+	uint64_t dropcount = dropped;
+	static const uint8_t pad[4];
+
+	opts[opt_len++] = PCAPNG_OPT_EPB_FLAGS | 4 << 16;
+	opts[opt_len++] = rec->direction == GIP_CAPTURE_RX ?
+			  PCAPNG_FLAG_INBOUND : PCAPNG_FLAG_OUTBOUND;
+
+	if (dropped) {
+		opts[opt_len++] = PCAPNG_OPT_EPB_DROPCOUNT | 8 << 16;
+		memcpy(&opts[opt_len], &dropcount, 8);
+		opt_len += 2;
+	}
+
+	opts[opt_len++] = PCAPNG_OPT_END;
+
+	len = sizeof(hdr) + pad4(captured) + opt_len * 4 + 4;
+
+	hdr[0] = PCAPNG_BLOCK_EPB;
+	hdr[1] = len;
+	hdr[2] = 0;
+	hdr[3] = time >> 32;
+	hdr[4] = time;
+	hdr[5] = captured;
+	hdr[6] = le16toh(rec->length);
+
+	if (fwrite(hdr, sizeof(hdr), 1, out) != 1 ||
+	    fwrite(data, 1, captured, out) != captured ||
+	    fwrite(pad, 1, pad4(captured) - captured, out) !=
+	    pad4(captured) - captured ||
+	    fwrite(opts, 4, opt_len, out) != opt_len ||
+	    fwrite(&len, 4, 1, out) != 1)
+		return -EIO;
+
+	return 0;
+}
+
+static int cmd_record(const char *adapter, const char *path)
+{
+	struct gip_capture_record rec;
+	uint8_t *buf;
+	size_t len = 0, pos, rec_len;
+	unsigned long packets = 0;
+	ssize_t ret;
+	FILE *out;
+	int fd, err = 0;
+
+	fd = open_adapter_file(adapter, "capture", O_RDONLY);
+	if (fd < 0)
+		return 1;
+
+	out = fopen(path, "wb");
+	if (!out) {
+		fprintf(stderr, "open %s: %s\n", path, strerror(errno));
+		close(fd);
+		return 1;
+	}
+
+	buf = malloc(BUF_SIZE);
+	if (!buf || pcapng_write_header(out, adapter)) {
+		err = -ENOMEM;
+		goto out;
+	}
+
+	signal(SIGINT, handle_signal);
+	signal(SIGTERM, handle_signal);
+
+	while (!stop) {
+		ret = read(fd, buf + len, BUF_SIZE - len);
+		if (ret < 0) {
+			if (errno == EINTR)
+				continue;
+
+			err = -errno;
+			break;
+		}
+
+		if (!ret)
+			break;
+
+		len += ret;
+		pos = 0;
+
+		/* the capture file is a stream, records can span reads */
+		while (len - pos >= sizeof(rec)) {
+			memcpy(&rec, buf + pos, sizeof(rec));
+			rec_len = sizeof(rec) + le16toh(rec.captured);
+			if (len - pos < rec_len)
+				break;
+
+			err = pcapng_write_packet(out, &rec,
+						  buf + pos + sizeof(rec));
+			if (err)
+				goto out;
+
+			pos += rec_len;
+			packets++;
+		}
+
+		memmove(buf, buf + pos, len - pos);
+		len -= pos;
+	}
+
+	fprintf(stderr, "%lu packets captured\n", packets);
+
+out:
+	if (err)
+		fprintf(stderr, "record failed: %s\n", strerror(-err));
+
+	free(buf);
+	fclose(out);
+	close(fd);
+
+	return !!err;
+}
+
+/* returns the payload of the next enhanced packet block */
+struct pcapng_reader {
+	FILE *in;
+	uint8_t *block;
+	uint64_t resolution;
+};
+
+struct pcapng_packet {
+	uint64_t time_ns;
+	uint32_t flags;
+	uint32_t captured;
+	uint32_t length;
+	uint8_t *data;
+};
+
+static uint64_t pcapng_resolution(uint8_t val)
+{
+	uint64_t res = 1;
+	int i;
+
+	/* units per second */
+	for (i = 0; i < (val & 0x7f); i++)
+		res *= val & 0x80 ? 2 : 10;
+
+	return res;
+}
+
+static void pcapng_parse_options(uint8_t *opts, uint8_t *end,
+				 uint64_t *resolution, uint32_t *flags)
+{
+	uint16_t code, len;
+
+	while (opts + 4 <= end) {
+		memcpy(&code, opts, 2);
+		memcpy(&len, opts + 2, 2);
+		if (code == PCAPNG_OPT_END || opts + 4 + len > end)
+			break;
+
+		if (resolution && code == PCAPNG_OPT_IF_TSRESOL && len == 1)
+			*resolution = pcapng_resolution(opts[4]);
+
+		if (flags && code == PCAPNG_OPT_EPB_FLAGS && len == 4)
+			memcpy(flags, opts + 4, 4);
+
+		opts += 4 + pad4(len);
+	}
+}
+
+static int pcapng_next(struct pcapng_reader *r, struct pcapng_packet *pkt)
+{
+	uint32_t hdr[2], *epb;
+	uint64_t ts;
+	size_t len;
+
+	while (fread(hdr, sizeof(hdr), 1, r->in) == 1) {
+		len = hdr[1];
+		if (len < 12 || len > BUF_SIZE || len % 4)
+			return -EINVAL;
+
+		if (fread(r->block, len - 8, 1, r->in) != 1)
+			return -EIO;
+
+		if (hdr[0] == PCAPNG_BLOCK_SHB) {
+			memcpy(hdr, r->block, 4);
+			if (hdr[0] != PCAPNG_BYTE_ORDER)
+				return -EPROTONOSUPPORT;
+		} else if (hdr[0] == PCAPNG_BLOCK_IDB && len >= 20) {
+			r->resolution = 1000000;
+			pcapng_parse_options(r->block + 8, r->block + len - 12,
+					     &r->resolution, NULL);
+		} else if (hdr[0] == PCAPNG_BLOCK_EPB && len >= 32) {
+			epb = (uint32_t *)r->block;
+			ts = (uint64_t)epb[1] << 32 | epb[2];
+
+			pkt->time_ns = ts / r->resolution * 1000000000ull +
+				       ts % r->resolution * 1000000000ull /
+				       r->resolution;
+			pkt->captured = epb[3];
+			pkt->length = epb[4];
+			pkt->data = r->block + 20;
+			pkt->flags = 0;
+
+			if (20 + pad4(pkt->captured) > len - 12)
+				return -EINVAL;
+
+			pcapng_parse_options(pkt->data + pad4(pkt->captured),
+					     r->block + len - 12, NULL,
+					     &pkt->flags);
+			return 1;
+		}
+	}
+
+	return 0;
+}
+
+static void reset_latency(const char *adapter)
+{
+	char pattern[256];
+	glob_t g;
+	size_t i;
+	int fd;
+
+	snprintf(pattern, sizeof(pattern), "%s/%s/%s.*/latency",
+		 debugfs_root, adapter, adapter);
+
+	if (glob(pattern, 0, NULL, &g))
+		return;
+
+	for (i = 0; i < g.gl_pathc; i++) {
+		fd = open(g.gl_pathv[i], O_WRONLY);
+		if (fd < 0)
+			continue;
+
+		write_all(fd, "0", 1);
+		close(fd);
+	}
+
+	globfree(&g);
+}
+
+static void print_latency(const char *adapter)
+{
+	static const int percentiles[] = { 50, 90, 99, 100 };
+	unsigned long long hist[LATENCY_BUCKETS] = {}, total = 0, sum;
+	unsigned long long bound, count;
+	char pattern[256], line[128];
+	size_t i, j;
+	glob_t g;
+	FILE *f;
+
+	snprintf(pattern, sizeof(pattern), "%s/%s/%s.*/latency",
+		 debugfs_root, adapter, adapter);
+
+	if (glob(pattern, 0, NULL, &g))
+		return;
+
+	for (i = 0; i < g.gl_pathc; i++) {
+		f = fopen(g.gl_pathv[i], "r");
+		if (!f)
+			continue;
+
+		j = 0;
+		while (fgets(line, sizeof(line), f) && j < LATENCY_BUCKETS) {
+			if (sscanf(line, " < %llu: %llu", &bound, &count) != 2)
+				continue;
+
+			hist[j++] += count;
+			total += count;
+		}
+
+		fclose(f);
+	}
+
+	globfree(&g);
+
+	if (!total) {
+		printf("input latency: no samples\n");
+		return;
+	}
+
+	printf("input latency (%llu samples):\n", total);
+
+	for (i = 0; i < sizeof(percentiles) / sizeof(*percentiles); i++) {
+		sum = 0;
+
+		for (j = 0; j < LATENCY_BUCKETS; j++) {
+			sum += hist[j];
+			if (sum * 100 >= total * percentiles[i])
+				break;
+		}
+
+		printf("  p%d: < %llu ns\n", percentiles[i], 1ull << j);
+	}
+}
+
+static int replay_flush(int fd, uint8_t *buf, size_t *len)
+{
+	size_t pos = 0;
+	ssize_t ret;
+
+	/* the kernel only consumes whole records */
+	while (pos < *len) {
+		ret = write(fd, buf + pos, *len - pos);
+		if (ret < 0) {
+			if (errno == EINTR)
+				continue;
+
+			return -errno;
+		}
+
+		pos += ret;
+	}
+
+	*len = 0;
+
+	return 0;
+}
+
+static int cmd_replay(const char *adapter, const char *path, double speed)
+{
+	struct pcapng_reader reader = { .resolution = 1000000 };
+	struct gip_capture_record rec = {};
+	struct pcapng_packet pkt;
+	uint64_t first = 0, start, cpu_start, target, elapsed, cpu;
+	unsigned long long packets = 0, kernel_packets = 0, kernel_ns = 0;
+	struct timespec ts;
+	uint8_t *buf = NULL;
+	char summary[256];
+	size_t len = 0;
+	ssize_t ret;
+	int fd, err;
+
+	reader.in = fopen(path, "rb");
+	if (!reader.in) {
+		fprintf(stderr, "open %s: %s\n", path, strerror(errno));
+		return 1;
+	}
+
+	fd = open_adapter_file(adapter, "replay", O_RDWR);
+	if (fd < 0) {
+		fclose(reader.in);
+		return 1;
+	}
+
+	reader.block = malloc(BUF_SIZE);
+	buf = malloc(BUF_SIZE);
+	if (!reader.block || !buf) {
+		err = -ENOMEM;
+		goto out;
+	}
+
+	reset_latency(adapter);
+
+	start = now_ns();
+	cpu_start = cpu_ns();
+
+	while ((err = pcapng_next(&reader, &pkt)) > 0) {
+		/* responses of the host are not replayed */
+		if (pkt.flags & PCAPNG_FLAG_OUTBOUND)
+			continue;
+
+		if (!packets)
+			first = pkt.time_ns;
+
+		if (speed > 0) {
+			target = start + (pkt.time_ns - first) / speed;
+			if (target > now_ns()) {
+				err = replay_flush(fd, buf, &len);
+				if (err)
+					break;
+
+				ts.tv_sec = target / 1000000000ull;
+				ts.tv_nsec = target % 1000000000ull;
+				clock_nanosleep(CLOCK_MONOTONIC,
+						TIMER_ABSTIME, &ts, NULL);
+			}
+		}
+
+		if (len + sizeof(rec) + pkt.captured > BUF_SIZE) {
+			err = replay_flush(fd, buf, &len);
+			if (err)
+				break;
+		}
+
+		rec.time_ns = htole64(pkt.time_ns);
+		rec.length = htole16(pkt.length);
+		rec.captured = htole16(pkt.captured);
+		rec.direction = GIP_CAPTURE_RX;
+
+		memcpy(buf + len, &rec, sizeof(rec));
+		memcpy(buf + len + sizeof(rec), pkt.data, pkt.captured);
+		len += sizeof(rec) + pkt.captured;
+		packets++;
+	}
+
+	if (!err)
+		err = replay_flush(fd, buf, &len);
+
+	elapsed = now_ns() - start;
+	cpu = cpu_ns() - cpu_start;
+
+	if (err)
+		goto out;
+
+	/* file is not seekable, writes never move the position */
+	ret = read(fd, summary, sizeof(summary) - 1);
+	if (ret < 0) {
+		err = -errno;
+		goto out;
+	}
+
+	summary[ret] = 0;
+	printf("%s", summary);
+
+	sscanf(strstr(summary, "packets:") ?: "", "packets: %llu",
+	       &kernel_packets);
+	sscanf(strstr(summary, "time_ns:") ?: "", "time_ns: %llu",
+	       &kernel_ns);
+
+	printf("replayed: %llu packets in %.3f s\n", packets, elapsed / 1e9);
+	printf("rate: %.0f packets/s\n", packets * 1e9 / (elapsed ?: 1));
+	printf("kernel: %.0f ns/packet\n",
+	       (double)kernel_ns / (kernel_packets ?: 1));
+	printf("replay tool: %.0f ns/packet\n", (double)cpu / (packets ?: 1));
+	print_latency(adapter);
+
+out:
+	if (err)
+		fprintf(stderr, "replay failed: %s\n", strerror(-err));
+
+	free(buf);
+	free(reader.block);
+	close(fd);
+	fclose(reader.in);
+
+	return !!err;
+}
+
+static void usage(const char *name)
+{
+	fprintf(stderr,
+		"usage: %s [-d debugfs] record ADAPTER FILE\n"
+		"       %s [-d debugfs] replay ADAPTER FILE [SPEED]\n"
+		"\n"
+		"SPEED is a multiple of real time, 0 replays at full speed.\n",
+		name, name);
+}
+
+int main(int argc, char **argv)
+{
+	double speed = 1;
+	int opt;
+
+	while ((opt = getopt(argc, argv, "d:h")) != -1) {
+		switch (opt) {
+		case 'd':
+			debugfs_root = optarg;
+			break;
+		default:
+			usage(argv[0]);
+			return opt != 'h';
+		}
+	}
+
+	argc -= optind;
+	argv += optind;
+
+	if (argc == 3 && !strcmp(argv[0], "record"))
+		return cmd_record(argv[1], argv[2]);
+
+	if ((argc == 3 || argc == 4) && !strcmp(argv[0], "replay")) {
+		if (argc == 4)
+			speed = strtod(argv[3], NULL);
+
+		return cmd_replay(argv[1], argv[2], speed);
+	}
+
+	usage(argv[-optind]);
+
+	return 1;
+}
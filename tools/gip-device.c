@@ -0,0 +1,361 @@
+// SPDX-License-Identifier: GPL-2.0-or-later
+/*
+ * Copyright (C) 2021 Severin von Wnuck-Lipinski <severinvonw@outlook.de>
+ *
+ * Device side of GIP shared by the emulators, mirrors the virtual devices
+ * of transport/virtual.c.
+ */
+
+#include <errno.h>
+#include <string.h>
+#include <linux/input.h>
+
+#include "gip-device.h"
+
+/* device models of transport/virtual.c */
+static const struct gip_model gip_models[] = {
+	{
+		.name = "gamepad",
+		.class = "Windows.Xbox.Input.Gamepad",
+		.vendor = 0x045e,
+		.product = 0x0b12,
+		.input_length = 14,
+		/* high byte of the left stick X axis, exceeds the fuzz */
+		.input_sweep = 7,
+		.axis = ABS_X,
+		.axis_shift = 8,
+	}, {
+		.name = "strat",
+		.class = "MadCatz.Xbox.Guitar.Stratocaster",
+		.vendor = 0x0738,
+		.input_length = 7,
+		/* whammy bar */
+		.input_sweep = 3,
+		.axis = ABS_Y,
+	}, {
+		.name = "jaguar",
+		.class = "PDP.Xbox.Guitar.Jaguar",
+		.vendor = 0x0e6f,
+		.input_length = 4,
+		/* whammy bar */
+		.input_sweep = 3,
+		.axis = ABS_Y,
+	}, {
+		.name = "headset",
+		.class = "Windows.Xbox.Input.Headset",
+		.vendor = 0x045e,
+		.audio_in = GIP_AUD_FORMAT_24KHZ_MONO,
+		.audio_out = GIP_AUD_FORMAT_48KHZ_STEREO,
+	},
+};
+
+/* advertised interface, see transport/virtual.c */
+static const u8 gip_interface[16] = {
+	0x2c, 0x40, 0x2e, 0x08, 0xdf, 0x07, 0xe1, 0x45,
+	0xa5, 0xab, 0xa3, 0x12, 0x7a, 0xf1, 0x97, 0xb5,
+};
+
+static void put_le16(u8 *buf, u16 val)
+{
+	buf[0] = val;
+	buf[1] = val >> 8;
+}
+
+static int encode_varint(u8 *buf, u32 val)
+{
+	unsigned int i;
+
+	/* same encoding as gip_encode_varint */
+	for (i = 0; i < sizeof(val); i++) {
+		buf[i] = val;
+		if (val > 0x7f)
+			buf[i] |= 0x80;
+
+		val >>= 7;
+		if (!val)
+			break;
+	}
+
+	return i + 1;
+}
+
+static int decode_varint(const u8 *data, int len, u32 *val)
+{
+	int i;
+
+	*val = 0;
+
+	for (i = 0; i < (int)sizeof(*val) && i < len; i++) {
+		*val |= (data[i] & 0x7f) << (i * 7);
+
+		if (!(data[i] & 0x80))
+			break;
+	}
+
+	return i + 1;
+}
+
+const struct gip_model *gip_find_model(const char *name)
+{
+	size_t i;
+
+	for (i = 0; i < sizeof(gip_models) / sizeof(gip_models[0]); i++)
+		if (!strcmp(gip_models[i].name, name))
+			return &gip_models[i];
+
+	return NULL;
+}
+
+int gip_put_packet(u8 *buf, u8 cmd, u8 options, u8 seq,
+		   u32 len, u32 offset, const void *data)
+{
+	int hdr_len = GIP_HDR_MIN_LENGTH;
+	int actual_len = GIP_HDR_MIN_LENGTH;
+	u32 val = len;
+
+	/* see gip_get_actual_header_length */
+	do {
+		actual_len++;
+		val >>= 7;
+	} while (val);
+
+	if (options & GIP_OPT_CHUNK)
+		for (val = offset; val; val >>= 7)
+			actual_len++;
+
+	buf[0] = cmd;
+	buf[1] = options;
+	buf[2] = seq;
+	hdr_len += encode_varint(buf + hdr_len, len);
+
+	/* header length must be even */
+	if (actual_len % 2) {
+		buf[hdr_len - 1] |= 0x80;
+		buf[hdr_len++] = 0;
+	}
+
+	if (options & GIP_OPT_CHUNK)
+		encode_varint(buf + hdr_len, offset);
+
+	hdr_len = actual_len + actual_len % 2;
+
+	if (data)
+		memcpy(buf + hdr_len, data, len);
+	else
+		memset(buf + hdr_len, 0, len);
+
+	return hdr_len + len;
+}
+
+u8 gip_next_sequence(struct gip_device *dev, u8 cmd)
+{
+	u8 seq = dev->sequence[cmd] + 1 ?: 1;
+
+	dev->sequence[cmd] = seq;
+
+	return seq;
+}
+
+/* every chunk is a separate packet */
+void gip_send(struct gip_device *dev, void *ctx, u8 cmd, u8 options,
+	      const u8 *data, u32 len)
+{
+	/* header of up to 8 bytes */
+	u8 buf[GIP_PKT_MAX_LENGTH + 8];
+	u8 seq = gip_next_sequence(dev, cmd);
+	u32 offset, chunk;
+	int pkt_len;
+
+	if (len <= GIP_PKT_MAX_LENGTH) {
+		pkt_len = gip_put_packet(buf, cmd, options, seq, len, 0, data);
+		dev->ops->send(dev, ctx, buf, pkt_len);
+		return;
+	}
+
+	/* devices never wait for acknowledgments */
+	for (offset = 0; offset < len; offset += chunk) {
+		chunk = len - offset;
+		if (chunk > GIP_PKT_MAX_LENGTH)
+			chunk = GIP_PKT_MAX_LENGTH;
+
+		/* chunk offset of first chunk is total length */
+		if (!offset)
+			pkt_len = gip_put_packet(buf, cmd,
+						 options | GIP_OPT_CHUNK |
+						 GIP_OPT_CHUNK_START |
+						 GIP_OPT_ACKNOWLEDGE,
+						 seq, chunk, len, data);
+		else
+			pkt_len = gip_put_packet(buf, cmd,
+						 options | GIP_OPT_CHUNK,
+						 seq, chunk, offset,
+						 data + offset);
+
+		dev->ops->send(dev, ctx, buf, pkt_len);
+	}
+
+	/* empty chunk signals the completion of the transfer */
+	pkt_len = gip_put_packet(buf, cmd, options | GIP_OPT_CHUNK, seq,
+				 0, len, NULL);
+	dev->ops->send(dev, ctx, buf, pkt_len);
+}
+
+static void gip_send_acknowledge(struct gip_device *dev, void *ctx,
+				 u8 cmd, u8 seq, u32 len, u32 remaining)
+{
+	u8 body[9] = {};
+	u8 buf[16];
+
+	body[1] = cmd;
+	body[2] = GIP_OPT_INTERNAL;
+	put_le16(body + 3, len);
+	put_le16(body + 7, remaining);
+
+	dev->ops->send(dev, ctx, buf,
+		       gip_put_packet(buf, GIP_CMD_ACKNOWLEDGE,
+				      GIP_OPT_INTERNAL, seq, sizeof(body),
+				      0, body));
+}
+
+void gip_send_announce(struct gip_device *dev, void *ctx)
+{
+	u8 pkt[28] = {};
+
+	memcpy(pkt, dev->address, sizeof(dev->address));
+	put_le16(pkt + 8, dev->model->vendor);
+	put_le16(pkt + 10, dev->model->product);
+	/* firmware and hardware version 1.0.0.0 */
+	put_le16(pkt + 12, 1);
+	put_le16(pkt + 20, 1);
+
+	gip_send(dev, ctx, GIP_CMD_ANNOUNCE, GIP_OPT_INTERNAL,
+		 pkt, sizeof(pkt));
+}
+
+static void gip_send_identify(struct gip_device *dev, void *ctx)
+{
+	const struct gip_model *model = dev->model;
+	u8 buf[128] = {};
+	/* offsets start after the unknown header */
+	u8 *data = buf + 16;
+	int off = 16;
+	u16 class_len = strlen(model->class);
+
+	/* firmware version 1.0 */
+	put_le16(buf + 18, off);
+	data[off++] = 1;
+	put_le16(data + off, 1);
+	off += 4;
+
+	if (model->audio_in) {
+		put_le16(buf + 20, off);
+		data[off++] = 1;
+		data[off++] = model->audio_in;
+		data[off++] = model->audio_out;
+	}
+
+	/* capabilities out and in */
+	put_le16(buf + 22, off);
+	data[off++] = 1;
+	data[off++] = 0x01;
+	put_le16(buf + 24, off);
+	data[off++] = 1;
+	data[off++] = 0x01;
+
+	put_le16(buf + 26, off);
+	data[off++] = 1;
+	put_le16(data + off, class_len);
+	off += sizeof(class_len);
+	memcpy(data + off, model->class, class_len);
+	off += class_len;
+
+	put_le16(buf + 28, off);
+	data[off++] = 1;
+	memcpy(data + off, gip_interface, sizeof(gip_interface));
+	off += sizeof(gip_interface);
+
+	gip_send(dev, ctx, GIP_CMD_IDENTIFY, GIP_OPT_INTERNAL, buf, 16 + off);
+}
+
+void gip_reset(struct gip_device *dev)
+{
+	dev->chunk_length = 0;
+	dev->chunk_received = 0;
+}
+
+static void gip_process_chunk(struct gip_device *dev, void *ctx,
+			      u8 cmd, u8 options, u8 seq,
+			      u32 len, u32 offset)
+{
+	if (options & GIP_OPT_CHUNK_START) {
+		/* offset is total length of all chunks */
+		dev->chunk_length = offset;
+		dev->chunk_received = 0;
+		offset = 0;
+	}
+
+	if (!len) {
+		/* empty chunk signals the completion of the transfer */
+		dev->chunk_length = 0;
+		return;
+	}
+
+	/* only chunks in order, the host resends the others */
+	if (offset == dev->chunk_received &&
+	    dev->chunk_received + len <= dev->chunk_length)
+		dev->chunk_received += len;
+
+	if ((options & GIP_OPT_ACKNOWLEDGE) ||
+	    dev->chunk_received == dev->chunk_length)
+		gip_send_acknowledge(dev, ctx, cmd, seq, dev->chunk_received,
+				     dev->chunk_length - dev->chunk_received);
+}
+
+/* packets sent by the host to the device */
+int gip_process_buffer(struct gip_device *dev, void *ctx,
+		       const u8 *data, u32 len)
+{
+	u8 cmd, options, seq;
+	u32 pkt_len, offset;
+	int hdr_len;
+
+	while (len > GIP_HDR_MIN_LENGTH) {
+		cmd = data[0];
+		options = data[1];
+		seq = data[2];
+		hdr_len = GIP_HDR_MIN_LENGTH;
+		hdr_len += decode_varint(data + hdr_len, len - hdr_len,
+					 &pkt_len);
+		offset = 0;
+
+		if (options & GIP_OPT_CHUNK)
+			hdr_len += decode_varint(data + hdr_len,
+						 len - hdr_len, &offset);
+
+		if (hdr_len + pkt_len > len)
+			return -EINVAL;
+
+		if (dev->ops->receive)
+			dev->ops->receive(dev, ctx, hdr_len + pkt_len);
+
+		if (options & GIP_OPT_CHUNK) {
+			gip_process_chunk(dev, ctx, cmd, options, seq,
+					  pkt_len, offset);
+		} else {
+			if (options & GIP_OPT_ACKNOWLEDGE)
+				gip_send_acknowledge(dev, ctx, cmd, seq,
+						     pkt_len, 0);
+
+			if (cmd == GIP_CMD_IDENTIFY)
+				gip_send_identify(dev, ctx);
+			else
+				dev->ops->dispatch(dev, ctx, cmd,
+						   data + hdr_len, pkt_len);
+		}
+
+		data += hdr_len + pkt_len;
+		len -= hdr_len + pkt_len;
+	}
+
+	return 0;
+}
@@ -0,0 +1,103 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/*
+ * Copyright (C) 2021 Severin von Wnuck-Lipinski <severinvonw@outlook.de>
+ */
+
+#ifndef GIP_DEVICE_H
+#define GIP_DEVICE_H
+
+#include <stdint.h>
+
+typedef uint8_t u8;
+typedef uint16_t u16;
+typedef uint32_t u32;
+typedef uint64_t u64;
+
+/* GIP, see bus/bus.h */
+#define GIP_CMD_ACKNOWLEDGE 0x01
+#define GIP_CMD_ANNOUNCE 0x02
+#define GIP_CMD_STATUS 0x03
+#define GIP_CMD_IDENTIFY 0x04
+#define GIP_CMD_POWER 0x05
+#define GIP_CMD_AUDIO_CONTROL 0x08
+#define GIP_CMD_INPUT 0x20
+#define GIP_CMD_AUDIO_SAMPLES 0x60
+
+#define GIP_OPT_ACKNOWLEDGE 0x10
+#define GIP_OPT_INTERNAL 0x20
+#define GIP_OPT_CHUNK_START 0x40
+#define GIP_OPT_CHUNK 0x80
+
+#define GIP_HDR_MIN_LENGTH 3
+#define GIP_PKT_MAX_LENGTH 58
+#define GIP_PWR_ON 0x00
+
+#define GIP_AUD_CTRL_FORMAT 0x02
+#define GIP_AUD_CTRL_VOLUME 0x03
+#define GIP_AUD_VOLUME_UNMUTED 0x04
+#define GIP_AUD_FORMAT_24KHZ_MONO 0x09
+#define GIP_AUD_FORMAT_48KHZ_STEREO 0x10
+
+/* connected, standard batteries, full */
+#define GIP_STATUS_CONNECTED_FULL 0x87
+
+#define GIP_MAX_INPUT_LENGTH 16
+
+struct gip_model {
+	const char *name;
+	const char *class;
+	u16 vendor;
+	u16 product;
+
+	/* periodic input packets, no input without length */
+	u8 input_length;
+	/* byte of the input packet that changes with every packet */
+	u8 input_sweep;
+	/* evdev axis reporting the swept byte, shifted left */
+	u16 axis;
+	u8 axis_shift;
+
+	/* audio formats, zero without audio */
+	u8 audio_in;
+	u8 audio_out;
+};
+
+struct gip_device;
+
+struct gip_device_ops {
+	/* single packet for the host */
+	void (*send)(struct gip_device *dev, void *ctx,
+		     const u8 *data, int len);
+	/* every packet from the host, including chunks */
+	void (*receive)(struct gip_device *dev, void *ctx, u32 len);
+	/* complete packet from the host, identification is handled */
+	void (*dispatch)(struct gip_device *dev, void *ctx,
+			 u8 cmd, const u8 *data, u32 len);
+};
+
+struct gip_device {
+	const struct gip_model *model;
+	const struct gip_device_ops *ops;
+	u8 address[6];
+
+	u8 sequence[256];
+
+	/* chunked transfer from the host */
+	u32 chunk_length;
+	u32 chunk_received;
+};
+
+const struct gip_model *gip_find_model(const char *name);
+
+int gip_put_packet(u8 *buf, u8 cmd, u8 options, u8 seq,
+		   u32 len, u32 offset, const void *data);
+u8 gip_next_sequence(struct gip_device *dev, u8 cmd);
+
+void gip_send(struct gip_device *dev, void *ctx, u8 cmd, u8 options,
+	      const u8 *data, u32 len);
+void gip_send_announce(struct gip_device *dev, void *ctx);
+void gip_reset(struct gip_device *dev);
+int gip_process_buffer(struct gip_device *dev, void *ctx,
+		       const u8 *data, u32 len);
+
+#endif /* GIP_DEVICE_H */
@@ -0,0 +1,1377 @@
+// SPDX-License-Identifier: GPL-2.0-or-later
+/*
+ * Copyright (C) 2021 Severin von Wnuck-Lipinski <severinvonw@outlook.de>
+ *
+ * Emulates an Xbox Wireless Adapter on a USB device controller through
+ * raw-gadget (e.g. dummy_hcd) to benchmark the dongle driver without any
+ * hardware. The wireless clients act like PDP Jaguar guitars, which do not
+ * require authentication.
+ */
+
+#include <endian.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <linux/usb/ch9.h>
+#include <linux/usb/raw_gadget.h>
+
+#include "gip-device.h"
+
+/* kernel helpers used by the register definitions */
+#define __packed __attribute__((packed))
+#define BIT(n) (1UL << (n))
+#define GENMASK(h, l) (((~0UL) << (l)) & (~0UL >> (8 * sizeof(long) - 1 - (h))))
+#define FIELD_GET(m, v) (((v) & (m)) / ((m) & -(m)))
+#define FIELD_PREP(m, v) (((v) * ((m) & -(m))) & (m))
+#define container_of(ptr, type, member) \
+	((type *)((char *)(ptr) - offsetof(type, member)))
+
+#include "../transport/mt76_defs.h"
+
+#define RAW_GADGET_PATH "/dev/raw-gadget"
+#define UDC_DRIVER "dummy_udc"
+#define UDC_DEVICE "dummy_udc.0"
+
+#define DONGLE_VENDOR 0x045e
+#define DONGLE_PRODUCT 0x02fe
+
+/* see transport/mt76.h */
+#define EP_OUT 0x04
+#define EP_IN_WLAN 0x84
+#define EP_IN_CMD 0x85
+#define EP_MAX_PACKET 512
+
+/* see transport/mt76.c */
+#define FW_LOAD_IVB 0x12
+#define FW_ILM_LEN 0x10000
+#define FW_DLM_LEN 0x4000
+
+#define MS_SET_MAC_ADDRESS 0x00
+#define MS_REMOVE_CLIENT 0x02
+
+/* 802.11 frame control */
+#define FCTL_TYPE 0x00fc
+#define FCTL_TODS 0x0100
+#define FTYPE_MGMT 0x0000
+#define FTYPE_DATA 0x0008
+#define STYPE_ASSOC_REQ 0x0000
+#define STYPE_ASSOC_RESP 0x0010
+#define STYPE_QOS_DATA 0x0080
+
+#define HDR_LEN_MGMT 24
+#define HDR_LEN_QOS 26
+
+#define MAX_CLIENTS 16
+#define MAX_REGS 1024
+#define EFUSE_SIZE 1024
+#define OUT_BUF_SIZE 65536
+#define FRAME_SIZE 1024
+#define OUTBOX_FRAMES 16
+
+#define NSEC_PER_MSEC 1000000ull
+#define ASSOC_RETRY_NS (500 * NSEC_PER_MSEC)
+#define ANNOUNCE_RETRY_NS (100 * NSEC_PER_MSEC)
+/* the driver only handles events once the radio init has returned */
+#define ASSOC_DELAY_NS (100 * NSEC_PER_MSEC)
+
+enum client_state {
+	CLIENT_IDLE,
+	CLIENT_ASSOCIATING,
+	CLIENT_ASSOCIATED,
+	CLIENT_IDENTIFIED,
+	CLIENT_READY,
+};
+
+struct client {
+	struct gip_device dev;
+	u8 wcid;
+	enum client_state state;
+
+	/* first association request, last request or announcement */
+	u64 assoc_start;
+	u64 last_tx;
+
+	u8 input_count;
+};
+
+struct latency {
+	u64 count;
+	u64 sum;
+	u64 min;
+	u64 max;
+};
+
+struct raw_control_event {
+	struct usb_raw_event inner;
+	struct usb_ctrlrequest ctrl;
+};
+
+struct raw_ep0_io {
+	struct usb_raw_ep_io inner;
+	u8 data[256];
+};
+
+struct raw_out_io {
+	struct usb_raw_ep_io inner;
+	u8 data[OUT_BUF_SIZE];
+};
+
+struct raw_frame {
+	struct usb_raw_ep_io inner;
+	u8 data[FRAME_SIZE];
+};
+
+/* frames built under the lock, written to the host afterwards */
+struct outbox {
+	int count;
+	struct raw_frame frames[OUTBOX_FRAMES];
+};
+
+static volatile sig_atomic_t stop;
+
+static int client_count = MAX_CLIENTS;
+static unsigned int interval_us = 4000;
+static unsigned int duration_s;
+
+static int raw_fd = -1;
+static int ep_out = -1, ep_in_wlan = -1, ep_in_cmd = -1;
+static pthread_t main_thread;
+
+/* protects everything below */
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+/* each endpoint only takes a single transfer at a time */
+static pthread_mutex_t wlan_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_mutex_t cmd_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static struct {
+	u32 addr;
+	u32 val;
+} regs[MAX_REGS];
+static int reg_count;
+
+static u8 efuse[EFUSE_SIZE];
+static u32 efuse_addr;
+
+static const u8 fuse_address[6] = { 0x62, 0x45, 0xbd, 0x00, 0x00, 0x01 };
+static u8 address[6];
+static u8 wcid_address[MAX_CLIENTS + 1][6];
+static bool fw_loaded;
+
+static struct client clients[MAX_CLIENTS];
+
+/* timestamps of the bring-up phases */
+static u64 time_connect, time_first_request, time_fw_start, time_fw_done;
+static u64 time_radio_ready, time_input_start;
+
+static u64 fw_bytes, fw_chunks;
+static u64 reg_reads, reg_writes, mcu_commands, mcu_responses;
+static u64 assoc_retries, announce_retries;
+static u64 rx_frames, rx_bytes, rx_errors, input_frames, input_bytes;
+static u64 tx_packets, tx_bytes, tx_errors;
+static struct latency assoc_latency, ready_latency, write_latency;
+
+static const struct usb_device_descriptor device_desc = {
+	.bLength = USB_DT_DEVICE_SIZE,
+	.bDescriptorType = USB_DT_DEVICE,
+	.bcdUSB = __constant_cpu_to_le16(0x0200),
+	.bDeviceClass = USB_CLASS_VENDOR_SPEC,
+	.bDeviceSubClass = 0xff,
+	.bDeviceProtocol = 0xff,
+	.bMaxPacketSize0 = 64,
+	.idVendor = __constant_cpu_to_le16(DONGLE_VENDOR),
+	.idProduct = __constant_cpu_to_le16(DONGLE_PRODUCT),
+	.bcdDevice = __constant_cpu_to_le16(0x0100),
+	.iManufacturer = 1,
+	.iProduct = 2,
+	.iSerialNumber = 3,
+	.bNumConfigurations = 1,
+};
+
+static const struct usb_interface_descriptor interface_desc = {
+	.bLength = USB_DT_INTERFACE_SIZE,
+	.bDescriptorType = USB_DT_INTERFACE,
+	.bNumEndpoints = 3,
+	.bInterfaceClass = USB_CLASS_VENDOR_SPEC,
+	.bInterfaceSubClass = 0xff,
+	.bInterfaceProtocol = 0xff,
+};
+
+static struct usb_endpoint_descriptor endpoint_descs[] = {
+	{
+		.bLength = USB_DT_ENDPOINT_SIZE,
+		.bDescriptorType = USB_DT_ENDPOINT,
+		.bEndpointAddress = EP_OUT,
+		.bmAttributes = USB_ENDPOINT_XFER_BULK,
+		.wMaxPacketSize = __constant_cpu_to_le16(EP_MAX_PACKET),
+	}, {
+		.bLength = USB_DT_ENDPOINT_SIZE,
+		.bDescriptorType = USB_DT_ENDPOINT,
+		.bEndpointAddress = EP_IN_WLAN,
+		.bmAttributes = USB_ENDPOINT_XFER_BULK,
+		.wMaxPacketSize = __constant_cpu_to_le16(EP_MAX_PACKET),
+	}, {
+		.bLength = USB_DT_ENDPOINT_SIZE,
+		.bDescriptorType = USB_DT_ENDPOINT,
+		.bEndpointAddress = EP_IN_CMD,
+		.bmAttributes = USB_ENDPOINT_XFER_BULK,
+		.wMaxPacketSize = __constant_cpu_to_le16(EP_MAX_PACKET),
+	},
+};
+
+static const char * const strings[] = { "Microsoft", "XBOX ACC", "1" };
+
+static void handle_signal(int sig)
+{
+	stop = 1;
+}
+
+static u64 now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+static u16 get_le16(const u8 *buf)
+{
+	return buf[0] | (buf[1] << 8);
+}
+
+static u32 get_le32(const u8 *buf)
+{
+	return get_le16(buf) | ((u32)get_le16(buf + 2) << 16);
+}
+
+static void put_le16(u8 *buf, u16 val)
+{
+	buf[0] = val;
+	buf[1] = val >> 8;
+}
+
+static void put_le32(u8 *buf, u32 val)
+{
+	put_le16(buf, val);
+	put_le16(buf + 2, val >> 16);
+}
+
+static void latency_add(struct latency *lat, u64 ns)
+{
+	if (!lat->count || ns < lat->min)
+		lat->min = ns;
+
+	if (ns > lat->max)
+		lat->max = ns;
+
+	lat->count++;
+	lat->sum += ns;
+}
+
+static u32 *reg_find(u32 addr)
+{
+	int i;
+
+	for (i = 0; i < reg_count; i++)
+		if (regs[i].addr == addr)
+			return &regs[i].val;
+
+	if (reg_count == MAX_REGS)
+		return NULL;
+
+	regs[reg_count].addr = addr;
+	regs[reg_count].val = 0;
+
+	return &regs[reg_count++].val;
+}
+
+static void reg_set(u32 addr, u32 val)
+{
+	u32 *reg = reg_find(addr);
+
+	if (reg)
+		*reg = val;
+}
+
+static u32 read_register(u32 addr)
+{
+	u32 offset = addr - MT_EFUSE_DATA_BASE;
+	u32 *reg;
+
+	reg_reads++;
+
+	/* data of the block selected by the last EFUSE read */
+	if (addr >= MT_EFUSE_DATA_BASE && offset < 0x20) {
+		if (efuse_addr + offset + sizeof(u32) > EFUSE_SIZE)
+			return 0;
+
+		return get_le32(efuse + efuse_addr + offset);
+	}
+
+	reg = reg_find(addr);
+
+	return reg ? *reg : 0;
+}
+
+static void write_register(u32 addr, u32 val)
+{
+	reg_writes++;
+
+	switch (addr) {
+	case MT_EFUSE_CTRL:
+		/* reads complete immediately */
+		if (val & MT_EFUSE_CTRL_KICK) {
+			efuse_addr = FIELD_GET(MT_EFUSE_CTRL_AIN, val);
+			val &= ~MT_EFUSE_CTRL_KICK;
+		}
+		break;
+	case MT_FCE_DMA_LEN | MT_VEND_TYPE_CFG:
+		/* the host only polls once the bulk transfer has completed */
+		val |= 0xc0000000;
+		break;
+	case MT_BEACON_TIME_CFG:
+		/* last step of the radio initialization */
+		if ((val & MT_BEACON_TIME_CFG_BEACON_TX) && !time_radio_ready)
+			time_radio_ready = now_ns();
+		break;
+	}
+
+	reg_set(addr, val);
+}
+
+static void load_ivb(void)
+{
+	if (!fw_loaded) {
+		fw_loaded = true;
+		time_fw_done = now_ns();
+	}
+
+	/* firmware running, see xone_mt76_load_firmware */
+	reg_set(MT_FCE_DMA_ADDR | MT_VEND_TYPE_CFG, 0x80000001);
+}
+
+static struct raw_frame *outbox_add(struct outbox *box, int ep)
+{
+	struct raw_frame *frame;
+
+	if (box->count == OUTBOX_FRAMES) {
+		rx_errors++;
+		return NULL;
+	}
+
+	frame = &box->frames[box->count++];
+	frame->inner.ep = ep;
+	frame->inner.flags = USB_RAW_IO_FLAGS_ZERO;
+	frame->inner.length = 0;
+
+	return frame;
+}
+
+/* DMA message header, padding and trailer, see xone_dongle_process_message */
+static void put_message(struct raw_frame *frame, u32 info, int len)
+{
+	int padded = (len + 3) & ~3;
+
+	put_le32(frame->data, info | FIELD_PREP(MT_RX_FCE_INFO_LEN, padded));
+	memset(frame->data + MT_CMD_HDR_LEN + len, 0,
+	       padded - len + MT_CMD_HDR_LEN);
+	frame->inner.length = MT_CMD_HDR_LEN + padded + MT_CMD_HDR_LEN;
+}
+
+static void queue_wlan_frame(struct outbox *box, struct client *client,
+			     u16 fc, const void *body, int len)
+{
+	struct raw_frame *frame;
+	struct mt76_rxwi *rxwi;
+	bool qos = fc == (FTYPE_DATA | STYPE_QOS_DATA | FCTL_TODS);
+	int hdr_len = qos ? HDR_LEN_QOS : HDR_LEN_MGMT;
+	int pad = qos ? 2 : 0;
+	int msg_len = sizeof(*rxwi) + hdr_len + pad + len;
+	u8 *hdr;
+
+	if (MT_CMD_HDR_LEN * 2 + msg_len + 3 > FRAME_SIZE) {
+		rx_errors++;
+		return;
+	}
+
+	frame = outbox_add(box, ep_in_wlan);
+	if (!frame)
+		return;
+
+	rxwi = (struct mt76_rxwi *)(frame->data + MT_CMD_HDR_LEN);
+	memset(rxwi, 0, sizeof(*rxwi));
+	rxwi->rxinfo = htole32(pad ? MT_RXINFO_L2PAD : 0);
+	rxwi->ctl = htole32(FIELD_PREP(MT_RXWI_CTL_WCID, client->wcid) |
+			    FIELD_PREP(MT_RXWI_CTL_MPDU_LEN, hdr_len + len));
+
+	hdr = (u8 *)(rxwi + 1);
+	memset(hdr, 0, hdr_len + pad);
+	put_le16(hdr, fc);
+	memcpy(hdr + 4, address, sizeof(address));
+	memcpy(hdr + 10, client->dev.address, sizeof(client->dev.address));
+	memcpy(hdr + 16, address, sizeof(address));
+	memcpy(hdr + hdr_len + pad, body, len);
+
+	put_message(frame, FIELD_PREP(MT_RX_FCE_INFO_D_PORT, MT_WLAN_PORT),
+		    msg_len);
+}
+
+/* completes commands sent with a sequence number */
+static void queue_response(struct outbox *box, u8 seq)
+{
+	struct raw_frame *frame = outbox_add(box, ep_in_cmd);
+
+	if (!frame)
+		return;
+
+	put_message(frame, FIELD_PREP(MT_RX_FCE_INFO_D_PORT, MT_CPU_RX_PORT) |
+		    FIELD_PREP(MT_RX_FCE_INFO_CMD_SEQ, seq), 0);
+	mcu_responses++;
+}
+
+static void flush_outbox(struct outbox *box)
+{
+	struct raw_frame *frame;
+	pthread_mutex_t *ep_lock;
+	u64 start, end;
+	int i, ret;
+
+	for (i = 0; i < box->count; i++) {
+		frame = &box->frames[i];
+		ep_lock = frame->inner.ep == ep_in_cmd ? &cmd_lock : &wlan_lock;
+
+		/* returns once the host has received the transfer */
+		pthread_mutex_lock(ep_lock);
+		start = now_ns();
+		ret = ioctl(raw_fd, USB_RAW_IOCTL_EP_WRITE, &frame->inner);
+		end = now_ns();
+		pthread_mutex_unlock(ep_lock);
+
+		pthread_mutex_lock(&lock);
+
+		if (ret < 0) {
+			rx_errors++;
+		} else if (frame->inner.ep == ep_in_wlan) {
+			rx_frames++;
+			rx_bytes += frame->inner.length;
+			latency_add(&write_latency, end - start);
+		}
+
+		pthread_mutex_unlock(&lock);
+	}
+
+	box->count = 0;
+}
+
+static void client_handle_power(struct outbox *box, struct client *client,
+				const u8 *data, u32 len)
+{
+	u8 status[4] = { GIP_STATUS_CONNECTED_FULL };
+
+	if (len < 1)
+		return;
+
+	if (data[0] != GIP_PWR_ON) {
+		client->state = CLIENT_IDENTIFIED;
+		return;
+	}
+
+	if (client->state == CLIENT_READY)
+		return;
+
+	client->state = CLIENT_READY;
+	latency_add(&ready_latency, now_ns() - client->assoc_start);
+
+	gip_send(&client->dev, box, GIP_CMD_STATUS, GIP_OPT_INTERNAL,
+		 status, sizeof(status));
+}
+
+static void client_send(struct gip_device *dev, void *ctx,
+			const u8 *data, int len)
+{
+	struct client *client = container_of(dev, struct client, dev);
+
+	queue_wlan_frame(ctx, client, FTYPE_DATA | STYPE_QOS_DATA | FCTL_TODS,
+			 data, len);
+}
+
+/* packets sent by the host to a client */
+static void client_receive(struct gip_device *dev, void *ctx, u32 len)
+{
+	struct client *client = container_of(dev, struct client, dev);
+
+	tx_packets++;
+	tx_bytes += len;
+
+	/* the host requested the identification */
+	if (client->state == CLIENT_ASSOCIATED)
+		client->state = CLIENT_IDENTIFIED;
+}
+
+static void client_dispatch(struct gip_device *dev, void *ctx,
+			    u8 cmd, const u8 *data, u32 len)
+{
+	struct client *client = container_of(dev, struct client, dev);
+
+	if (cmd == GIP_CMD_POWER)
+		client_handle_power(ctx, client, data, len);
+
+	/* the guitar ignores authentication, LEDs and everything else */
+}
+
+static const struct gip_device_ops client_ops = {
+	.send = client_send,
+	.receive = client_receive,
+	.dispatch = client_dispatch,
+};
+
+static struct client *find_client(const u8 *addr)
+{
+	int i;
+
+	for (i = 0; i < client_count; i++)
+		if (!memcmp(clients[i].dev.address, addr, 6))
+			return &clients[i];
+
+	return NULL;
+}
+
+static struct client *find_client_wcid(u8 wcid)
+{
+	int i;
+
+	for (i = 0; i < client_count; i++)
+		if (clients[i].wcid == wcid && clients[i].state > CLIENT_IDLE)
+			return &clients[i];
+
+	return NULL;
+}
+
+static void handle_firmware(u32 len)
+{
+	if (!time_fw_start)
+		time_fw_start = now_ns();
+
+	fw_bytes += len;
+	fw_chunks++;
+}
+
+/* WCID data + TXWI + QoS header + padding, see xone_dongle_prep_packet */
+static int handle_client_data(struct outbox *box, const u8 *data, u32 len)
+{
+	const struct mt76_txwi *txwi = (const void *)(data + 8);
+	const u8 *frame = (const u8 *)(txwi + 1);
+	u32 frame_len, hdr_len = 8 + sizeof(*txwi);
+	struct client *client;
+	u16 fc;
+
+	if (len < hdr_len + HDR_LEN_MGMT)
+		return -EINVAL;
+
+	frame_len = le16toh(txwi->len_ctl) & GENMASK(13, 0);
+	fc = get_le16(frame);
+
+	/* client commands like enabling encryption are not emulated */
+	if ((fc & FCTL_TYPE) != (FTYPE_DATA | STYPE_QOS_DATA))
+		return 0;
+
+	if (frame_len < HDR_LEN_QOS || hdr_len + frame_len + 2 > len)
+		return -EINVAL;
+
+	client = find_client_wcid(data[3] + 1);
+	if (!client)
+		return 0;
+
+	return gip_process_buffer(&client->dev, box, frame + HDR_LEN_QOS + 2,
+				  frame_len - HDR_LEN_QOS);
+}
+
+static void handle_ms_command(const u8 *data, u32 len)
+{
+	struct client *client;
+
+	if (len < sizeof(u32))
+		return;
+
+	switch (get_le32(data)) {
+	case MS_SET_MAC_ADDRESS:
+		if (len >= sizeof(u32) + sizeof(address))
+			memcpy(address, data + sizeof(u32), sizeof(address));
+		break;
+	case MS_REMOVE_CLIENT:
+		/* associates again on the next tick */
+		client = len > sizeof(u32) ?
+			 find_client_wcid(data[sizeof(u32)] + 1) : NULL;
+		if (client) {
+			client->state = CLIENT_IDLE;
+			client->wcid = 0;
+		}
+		break;
+	}
+}
+
+static void handle_burst_write(const u8 *data, u32 len)
+{
+	u32 idx, i, wcid;
+
+	if (len < sizeof(u32))
+		return;
+
+	idx = get_le32(data) - MT_MCU_MEMMAP_WLAN;
+	data += sizeof(u32);
+	len -= sizeof(u32);
+
+	for (i = 0; i + sizeof(u32) <= len; i += sizeof(u32))
+		reg_set(idx + i, get_le32(data + i));
+
+	if (idx < MT_WCID_ADDR(0) || idx > MT_WCID_ADDR(MAX_CLIENTS) ||
+	    (idx - MT_WCID_ADDR_BASE) % 8 || len < 6)
+		return;
+
+	wcid = (idx - MT_WCID_ADDR_BASE) / 8;
+	memcpy(wcid_address[wcid], data, 6);
+}
+
+/* address and value pairs, see xone_mt76_write_registers */
+static void handle_random_write(const u8 *data, u32 len)
+{
+	u32 i;
+
+	for (i = 0; i + sizeof(u32) * 2 <= len; i += sizeof(u32) * 2)
+		write_register(get_le32(data + i) - MT_MCU_MEMMAP_WLAN,
+			       get_le32(data + i + sizeof(u32)));
+}
+
+/* management frames sent by the driver, see xone_mt76_send_wlan */
+static int handle_wlan_tx(struct outbox *box, const u8 *data, u32 len)
+{
+	const u8 *frame = data + sizeof(struct mt76_txwi);
+	struct client *client;
+	int wcid;
+
+	if (len < sizeof(struct mt76_txwi) + HDR_LEN_MGMT)
+		return -EINVAL;
+
+	if ((get_le16(frame) & FCTL_TYPE) != (FTYPE_MGMT | STYPE_ASSOC_RESP))
+		return 0;
+
+	client = find_client(frame + 4);
+	if (!client || client->state != CLIENT_ASSOCIATING)
+		return 0;
+
+	for (wcid = 1; wcid <= MAX_CLIENTS; wcid++)
+		if (!memcmp(wcid_address[wcid], client->dev.address, 6))
+			break;
+
+	if (wcid > MAX_CLIENTS)
+		return -EINVAL;
+
+	client->wcid = wcid;
+	client->state = CLIENT_ASSOCIATED;
+	client->last_tx = now_ns();
+	latency_add(&assoc_latency, client->last_tx - client->assoc_start);
+
+	gip_send_announce(&client->dev, box);
+
+	return 0;
+}
+
+static int handle_message(struct outbox *box, u32 info,
+			  const u8 *data, u32 len)
+{
+	u8 cmd, seq;
+	int err = 0;
+
+	if (!(info & MT_MCU_MSG_TYPE_CMD)) {
+		if (FIELD_GET(MT_TXD_INFO_DPORT, info) == MT_WLAN_PORT)
+			err = handle_wlan_tx(box, data, len);
+
+		return err;
+	}
+
+	cmd = FIELD_GET(MT_MCU_MSG_CMD_TYPE, info);
+	seq = FIELD_GET(MT_MCU_MSG_CMD_SEQ, info);
+	mcu_commands++;
+
+	switch (cmd) {
+	case 0:
+		/* firmware chunks until the vector block gets loaded */
+		if (fw_loaded)
+			err = handle_client_data(box, data, len);
+		else
+			handle_firmware(len);
+		break;
+	case MT_CMD_INIT_GAIN_OP:
+		handle_ms_command(data, len);
+		break;
+	case MT_CMD_BURST_WRITE:
+		handle_burst_write(data, len);
+		break;
+	case MT_CMD_RANDOM_WRITE:
+		handle_random_write(data, len);
+		break;
+	}
+
+	if (seq)
+		queue_response(box, seq);
+
+	return err;
+}
+
+/* transfers can contain several messages without a zero-length packet */
+static void process_out(struct outbox *box, const u8 *data, u32 len)
+{
+	u32 info, msg_len;
+	int err;
+
+	while (len >= MT_CMD_HDR_LEN * 2) {
+		info = get_le32(data);
+		msg_len = FIELD_GET(MT_MCU_MSG_LEN, info);
+
+		pthread_mutex_lock(&lock);
+
+		err = msg_len + MT_CMD_HDR_LEN * 2 > len ? -EINVAL :
+		      handle_message(box, info, data + MT_CMD_HDR_LEN, msg_len);
+		if (err)
+			tx_errors++;
+
+		pthread_mutex_unlock(&lock);
+
+		flush_outbox(box);
+
+		if (err == -EINVAL && msg_len + MT_CMD_HDR_LEN * 2 > len)
+			break;
+
+		data += msg_len + MT_CMD_HDR_LEN * 2;
+		len -= msg_len + MT_CMD_HDR_LEN * 2;
+	}
+}
+
+static void *out_thread(void *arg)
+{
+	static struct raw_out_io io;
+	static struct outbox box;
+	int ret;
+
+	while (!stop) {
+		io.inner.ep = ep_out;
+		io.inner.flags = 0;
+		io.inner.length = sizeof(io.data);
+
+		ret = ioctl(raw_fd, USB_RAW_IOCTL_EP_READ, &io.inner);
+		if (ret < 0) {
+			/* requests are cancelled when the host resets us */
+			if (errno == ESHUTDOWN || errno == ECONNRESET ||
+			    errno == EINTR) {
+				usleep(1000);
+				continue;
+			}
+
+			perror("bulk read failed");
+			break;
+		}
+
+		process_out(&box, io.data, ret);
+	}
+
+	return NULL;
+}
+
+static void queue_association(struct outbox *box, struct client *client)
+{
+	/* capability info and listen interval */
+	u8 body[4] = {};
+
+	queue_wlan_frame(box, client, FTYPE_MGMT | STYPE_ASSOC_REQ,
+			 body, sizeof(body));
+}
+
+static void queue_input(struct outbox *box, struct client *client)
+{
+	const struct gip_model *model = client->dev.model;
+	u8 data[GIP_MAX_INPUT_LENGTH] = {};
+	u8 buf[32];
+	u8 seq = gip_next_sequence(&client->dev, GIP_CMD_INPUT);
+
+	data[model->input_sweep] = client->input_count++;
+
+	queue_wlan_frame(box, client, FTYPE_DATA | STYPE_QOS_DATA | FCTL_TODS,
+			 buf, gip_put_packet(buf, GIP_CMD_INPUT, 0, seq,
+					     model->input_length, 0, data));
+	input_frames++;
+	input_bytes += box->frames[box->count - 1].inner.length;
+}
+
+static void tick_client(struct outbox *box, struct client *client, u64 now)
+{
+	switch (client->state) {
+	case CLIENT_IDLE:
+		client->assoc_start = now;
+		client->last_tx = now;
+		client->state = CLIENT_ASSOCIATING;
+		queue_association(box, client);
+		break;
+	case CLIENT_ASSOCIATING:
+		if (now - client->last_tx < ASSOC_RETRY_NS)
+			break;
+
+		client->last_tx = now;
+		assoc_retries++;
+		queue_association(box, client);
+		break;
+	case CLIENT_ASSOCIATED:
+		/* client might not be registered by the driver yet */
+		if (now - client->last_tx < ANNOUNCE_RETRY_NS)
+			break;
+
+		client->last_tx = now;
+		announce_retries++;
+		gip_send_announce(&client->dev, box);
+		break;
+	case CLIENT_IDENTIFIED:
+		break;
+	case CLIENT_READY:
+		if (!time_input_start)
+			time_input_start = now;
+
+		queue_input(box, client);
+		break;
+	}
+}
+
+static void *tick_thread(void *arg)
+{
+	static struct outbox box;
+	struct timespec next;
+	u64 now;
+	int i;
+
+	clock_gettime(CLOCK_MONOTONIC, &next);
+
+	while (!stop) {
+		next.tv_nsec += interval_us * 1000;
+		while (next.tv_nsec >= 1000000000) {
+			next.tv_nsec -= 1000000000;
+			next.tv_sec++;
+		}
+
+		clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &next, NULL);
+		now = now_ns();
+
+		if (!time_radio_ready || now < time_radio_ready + ASSOC_DELAY_NS)
+			continue;
+
+		if (duration_s && now >= time_radio_ready +
+		    duration_s * 1000000000ull) {
+			stop = 1;
+			pthread_kill(main_thread, SIGINT);
+			break;
+		}
+
+		for (i = 0; i < client_count; i++) {
+			pthread_mutex_lock(&lock);
+			tick_client(&box, &clients[i], now);
+			pthread_mutex_unlock(&lock);
+
+			flush_outbox(&box);
+		}
+	}
+
+	return NULL;
+}
+
+static int put_string(u8 *buf, const char *str)
+{
+	int i, len = strlen(str);
+
+	buf[0] = 2 + len * 2;
+	buf[1] = USB_DT_STRING;
+
+	for (i = 0; i < len; i++)
+		put_le16(buf + 2 + i * 2, str[i]);
+
+	return buf[0];
+}
+
+static int put_config(u8 *buf)
+{
+	struct usb_config_descriptor config = {
+		.bLength = USB_DT_CONFIG_SIZE,
+		.bDescriptorType = USB_DT_CONFIG,
+		.bNumInterfaces = 1,
+		.bConfigurationValue = 1,
+		.bmAttributes = USB_CONFIG_ATT_ONE | USB_CONFIG_ATT_WAKEUP,
+		/* 500 mA */
+		.bMaxPower = 250,
+	};
+	int i, len = USB_DT_CONFIG_SIZE;
+
+	memcpy(buf + len, &interface_desc, USB_DT_INTERFACE_SIZE);
+	len += USB_DT_INTERFACE_SIZE;
+
+	for (i = 0; i < 3; i++) {
+		memcpy(buf + len, &endpoint_descs[i], USB_DT_ENDPOINT_SIZE);
+		len += USB_DT_ENDPOINT_SIZE;
+	}
+
+	config.wTotalLength = htole16(len);
+	memcpy(buf, &config, USB_DT_CONFIG_SIZE);
+
+	return len;
+}
+
+static int start_thread(void *(*func)(void *))
+{
+	sigset_t mask, old;
+	pthread_t thread;
+	int err;
+
+	/* signals are only handled by the control thread */
+	sigemptyset(&mask);
+	sigaddset(&mask, SIGINT);
+	sigaddset(&mask, SIGTERM);
+	pthread_sigmask(SIG_BLOCK, &mask, &old);
+	err = pthread_create(&thread, NULL, func, NULL);
+	pthread_sigmask(SIG_SETMASK, &old, NULL);
+
+	if (!err)
+		pthread_detach(thread);
+
+	return -err;
+}
+
+static int configure(void)
+{
+	int err;
+
+	/* the driver resets the device, endpoints stay enabled */
+	if (ep_out < 0) {
+		ep_out = ioctl(raw_fd, USB_RAW_IOCTL_EP_ENABLE,
+			       &endpoint_descs[0]);
+		ep_in_wlan = ioctl(raw_fd, USB_RAW_IOCTL_EP_ENABLE,
+				   &endpoint_descs[1]);
+		ep_in_cmd = ioctl(raw_fd, USB_RAW_IOCTL_EP_ENABLE,
+				  &endpoint_descs[2]);
+		if (ep_out < 0 || ep_in_wlan < 0 || ep_in_cmd < 0) {
+			perror("enable endpoints failed");
+			return -EIO;
+		}
+
+		err = start_thread(out_thread);
+		if (!err)
+			err = start_thread(tick_thread);
+		if (err)
+			return err;
+	}
+
+	ioctl(raw_fd, USB_RAW_IOCTL_VBUS_DRAW, 250);
+	ioctl(raw_fd, USB_RAW_IOCTL_CONFIGURE, 0);
+
+	return 0;
+}
+
+static int handle_standard_in(struct usb_ctrlrequest *ctrl, u8 *data)
+{
+	u16 val = le16toh(ctrl->wValue);
+	u8 idx = val & 0xff;
+
+	switch (ctrl->bRequest) {
+	case USB_REQ_GET_DESCRIPTOR:
+		switch (val >> 8) {
+		case USB_DT_DEVICE:
+			memcpy(data, &device_desc, sizeof(device_desc));
+			return sizeof(device_desc);
+		case USB_DT_CONFIG:
+			return put_config(data);
+		case USB_DT_STRING:
+			if (!idx) {
+				/* English (United States) */
+				data[0] = 4;
+				data[1] = USB_DT_STRING;
+				put_le16(data + 2, 0x0409);
+				return 4;
+			}
+
+			if (idx > 3)
+				return -1;
+
+			return put_string(data, strings[idx - 1]);
+		}
+
+		return -1;
+	case USB_REQ_GET_STATUS:
+		put_le16(data, 0);
+		return 2;
+	case USB_REQ_GET_CONFIGURATION:
+		data[0] = 1;
+		return 1;
+	case USB_REQ_GET_INTERFACE:
+		data[0] = 0;
+		return 1;
+	}
+
+	return -1;
+}
+
+static int handle_vendor_in(struct usb_ctrlrequest *ctrl, u8 *data, int len)
+{
+	u32 addr = (le16toh(ctrl->wValue) << 16) | le16toh(ctrl->wIndex);
+
+	switch (ctrl->bRequest) {
+	case MT_VEND_MULTI_READ:
+		put_le32(data, read_register(addr));
+		return sizeof(u32);
+	case MT_VEND_READ_CFG:
+		put_le32(data, read_register(addr | MT_VEND_TYPE_CFG));
+		return sizeof(u32);
+	}
+
+	memset(data, 0, len);
+
+	return len;
+}
+
+static void handle_vendor_out(struct usb_ctrlrequest *ctrl,
+			      u8 *data, unsigned int len)
+{
+	u32 addr = (le16toh(ctrl->wValue) << 16) | le16toh(ctrl->wIndex);
+
+	switch (ctrl->bRequest) {
+	case MT_VEND_MULTI_WRITE:
+		if (len >= sizeof(u32))
+			write_register(addr, get_le32(data));
+		break;
+	case MT_VEND_WRITE_CFG:
+		if (len >= sizeof(u32))
+			write_register(addr | MT_VEND_TYPE_CFG,
+				       get_le32(data));
+		break;
+	case MT_VEND_DEV_MODE:
+		if (le16toh(ctrl->wValue) == FW_LOAD_IVB)
+			load_ivb();
+		break;
+	}
+}
+
+static void handle_control(struct usb_ctrlrequest *ctrl)
+{
+	struct raw_ep0_io io = {};
+	u8 type = ctrl->bRequestType & USB_TYPE_MASK;
+	unsigned int len = le16toh(ctrl->wLength);
+	int ret = -1;
+
+	if (len > sizeof(io.data))
+		len = sizeof(io.data);
+
+	if (type == USB_TYPE_VENDOR) {
+		pthread_mutex_lock(&lock);
+		if (!time_first_request)
+			time_first_request = now_ns();
+		pthread_mutex_unlock(&lock);
+	}
+
+	if (ctrl->bRequestType & USB_DIR_IN) {
+		if (type == USB_TYPE_STANDARD) {
+			ret = handle_standard_in(ctrl, io.data);
+		} else if (type == USB_TYPE_VENDOR) {
+			pthread_mutex_lock(&lock);
+			ret = handle_vendor_in(ctrl, io.data, len);
+			pthread_mutex_unlock(&lock);
+		}
+
+		if (ret < 0)
+			goto err_stall;
+
+		io.inner.length = ret;
+		if (io.inner.length > len)
+			io.inner.length = len;
+
+		ret = ioctl(raw_fd, USB_RAW_IOCTL_EP0_WRITE, &io.inner);
+	} else {
+		if (type == USB_TYPE_STANDARD &&
+		    ctrl->bRequest == USB_REQ_SET_CONFIGURATION) {
+			if (configure()) {
+				stop = 1;
+				goto err_stall;
+			}
+		} else if (type != USB_TYPE_STANDARD &&
+			   type != USB_TYPE_VENDOR) {
+			goto err_stall;
+		}
+
+		/* also acknowledges requests without data */
+		io.inner.length = len;
+		ret = ioctl(raw_fd, USB_RAW_IOCTL_EP0_READ, &io.inner);
+		if (ret >= 0 && type == USB_TYPE_VENDOR) {
+			pthread_mutex_lock(&lock);
+			handle_vendor_out(ctrl, io.data, ret);
+			pthread_mutex_unlock(&lock);
+		}
+	}
+
+	if (ret < 0 && errno != ESHUTDOWN && errno != ECONNRESET)
+		perror("control transfer failed");
+
+	return;
+
+err_stall:
+	ioctl(raw_fd, USB_RAW_IOCTL_EP0_STALL, 0);
+}
+
+static void init_device(void)
+{
+	int i;
+
+	/* positive transmit power for every channel, valid crystal trim */
+	memset(efuse, 0x20, sizeof(efuse));
+	efuse[MT_EE_CHIP_ID + 1] = 0x76;
+	efuse[MT_EE_CHIP_ID + 2] = 0x32;
+	memcpy(efuse + MT_EE_MAC_ADDR, fuse_address, sizeof(fuse_address));
+
+	for (i = 0; i < client_count; i++) {
+		clients[i].dev.model = gip_find_model("jaguar");
+		clients[i].dev.ops = &client_ops;
+
+		/* locally administered address */
+		clients[i].dev.address[0] = 0x02;
+		clients[i].dev.address[5] = i + 1;
+	}
+}
+
+static void print_phase(const char *name, u64 start, u64 end)
+{
+	if (start && end)
+		printf("%-12s %.1f ms\n", name, (end - start) / 1e6);
+	else
+		printf("%-12s -\n", name);
+}
+
+static void print_clients(const char *name, struct latency *lat)
+{
+	printf("%-12s %llu/%d clients", name, (unsigned long long)lat->count,
+	       client_count);
+
+	if (lat->count)
+		printf(", min/avg/max %.1f/%.1f/%.1f ms", lat->min / 1e6,
+		       (double)lat->sum / lat->count / 1e6, lat->max / 1e6);
+
+	printf("\n");
+}
+
+static void print_report(void)
+{
+	u64 now = now_ns();
+	double elapsed;
+
+	pthread_mutex_lock(&lock);
+
+	print_phase("probe:", time_connect, time_first_request);
+	print_phase("firmware:", time_fw_start, time_fw_done);
+	printf("%-12s %llu bytes in %llu chunks\n", "",
+	       (unsigned long long)fw_bytes, (unsigned long long)fw_chunks);
+	print_phase("radio init:", time_fw_done, time_radio_ready);
+	print_clients("association:", &assoc_latency);
+	printf("%-12s %llu association, %llu announce retries\n", "",
+	       (unsigned long long)assoc_retries,
+	       (unsigned long long)announce_retries);
+	print_clients("ready:", &ready_latency);
+
+	elapsed = time_input_start ? (now - time_input_start) / 1e9 : 0;
+	printf("%-12s %llu frames, %llu bytes, %llu errors\n", "rx:",
+	       (unsigned long long)rx_frames, (unsigned long long)rx_bytes,
+	       (unsigned long long)rx_errors);
+	printf("%-12s %llu frames in %.3f s, %.0f frames/s, %.0f bytes/s\n",
+	       "input:", (unsigned long long)input_frames, elapsed,
+	       elapsed ? input_frames / elapsed : 0,
+	       elapsed ? input_bytes / elapsed : 0);
+
+	if (write_latency.count)
+		printf("%-12s avg %.1f us, max %.1f us\n", "rx write:",
+		       (double)write_latency.sum / write_latency.count / 1e3,
+		       write_latency.max / 1e3);
+
+	printf("%-12s %llu packets, %llu bytes, %llu errors\n", "tx:",
+	       (unsigned long long)tx_packets, (unsigned long long)tx_bytes,
+	       (unsigned long long)tx_errors);
+	printf("%-12s %llu reads, %llu writes, %llu MCU commands, "
+	       "%llu responses\n", "registers:",
+	       (unsigned long long)reg_reads, (unsigned long long)reg_writes,
+	       (unsigned long long)mcu_commands,
+	       (unsigned long long)mcu_responses);
+
+	pthread_mutex_unlock(&lock);
+}
+
+static int cmd_run(const char *driver, const char *device)
+{
+	struct usb_raw_init init = {
+		.speed = USB_SPEED_HIGH,
+	};
+	struct raw_control_event event;
+	int err = 0;
+
+	init_device();
+
+	raw_fd = open(RAW_GADGET_PATH, O_RDWR);
+	if (raw_fd < 0) {
+		perror("open " RAW_GADGET_PATH);
+		return 1;
+	}
+
+	strncpy((char *)init.driver_name, driver, UDC_NAME_LENGTH_MAX - 1);
+	strncpy((char *)init.device_name, device, UDC_NAME_LENGTH_MAX - 1);
+
+	if (ioctl(raw_fd, USB_RAW_IOCTL_INIT, &init) ||
+	    ioctl(raw_fd, USB_RAW_IOCTL_RUN, 0)) {
+		perror("start gadget failed");
+		close(raw_fd);
+		return 1;
+	}
+
+	printf("emulating %d clients on %s\n", client_count, device);
+
+	while (!stop) {
+		event.inner.type = USB_RAW_EVENT_INVALID;
+		event.inner.length = sizeof(event.ctrl);
+
+		if (ioctl(raw_fd, USB_RAW_IOCTL_EVENT_FETCH, &event.inner)) {
+			if (errno == EINTR)
+				continue;
+
+			err = -errno;
+			perror("fetch event failed");
+			break;
+		}
+
+		switch (event.inner.type) {
+		case USB_RAW_EVENT_CONNECT:
+			pthread_mutex_lock(&lock);
+			if (!time_connect)
+				time_connect = now_ns();
+			pthread_mutex_unlock(&lock);
+			break;
+		case USB_RAW_EVENT_CONTROL:
+			handle_control(&event.ctrl);
+			break;
+		}
+	}
+
+	print_report();
+	close(raw_fd);
+
+	return !!err;
+}
+
+/* header followed by zeroed memory, enough for the driver to load it */
+static int cmd_firmware(const char *path)
+{
+	struct mt76_fw_header hdr = {};
+	static u8 data[FW_ILM_LEN + FW_DLM_LEN];
+	FILE *out;
+	int err = 0;
+
+	hdr.ilm_len = htole32(FW_ILM_LEN);
+	hdr.dlm_len = htole32(FW_DLM_LEN);
+	hdr.build_ver = htole16(1);
+	hdr.fw_ver = htole16(1);
+	strncpy(hdr.build_time, "gip-dongle", sizeof(hdr.build_time));
+
+	out = fopen(path, "wb");
+	if (!out) {
+		perror(path);
+		return 1;
+	}
+
+	if (fwrite(&hdr, sizeof(hdr), 1, out) != 1 ||
+	    fwrite(data, sizeof(data), 1, out) != 1) {
+		perror(path);
+		err = 1;
+	}
+
+	if (fclose(out))
+		err = 1;
+
+	return err;
+}
+
+static void usage(const char *name)
+{
+	fprintf(stderr,
+		"usage: %s [-c CLIENTS] [-i INTERVAL_US] [-t SECONDS] "
+		"[-u DRIVER] [-d DEVICE] run\n"
+		"       %s firmware FILE\n"
+		"\n"
+		"Clients associate once the radio is up and send input every\n"
+		"INTERVAL_US. The report is printed after SECONDS or on exit.\n",
+		name, name);
+}
+
+int main(int argc, char **argv)
+{
+	struct sigaction act = {
+		.sa_handler = handle_signal,
+	};
+	const char *driver = UDC_DRIVER;
+	const char *device = UDC_DEVICE;
+	int opt;
+
+	while ((opt = getopt(argc, argv, "c:i:t:u:d:h")) != -1) {
+		switch (opt) {
+		case 'c':
+			client_count = atoi(optarg);
+			break;
+		case 'i':
+			interval_us = strtoul(optarg, NULL, 0);
+			break;
+		case 't':
+			duration_s = strtoul(optarg, NULL, 0);
+			break;
+		case 'u':
+			driver = optarg;
+			break;
+		case 'd':
+			device = optarg;
+			break;
+		default:
+			usage(argv[0]);
+			return opt != 'h';
+		}
+	}
+
+	if (client_count < 0 || client_count > MAX_CLIENTS) {
+		fprintf(stderr, "at most %d clients\n", MAX_CLIENTS);
+		return 1;
+	}
+
+	if (interval_us < 100)
+		interval_us = 100;
+
+	argc -= optind;
+	argv += optind;
+
+	if (argc == 2 && !strcmp(argv[0], "firmware"))
+		return cmd_firmware(argv[1]);
+
+	if (argc == 1 && !strcmp(argv[0], "run")) {
+		/* interrupts blocking ioctls, no SA_RESTART */
+		sigaction(SIGINT, &act, NULL);
+		sigaction(SIGTERM, &act, NULL);
+		main_thread = pthread_self();
+
+		return cmd_run(driver, device);
+	}
+
+	usage(argv[-optind]);
+
+	return 1;
+}
@@ -0,0 +1,1207 @@
+// SPDX-License-Identifier: GPL-2.0-or-later
+/*
+ * Copyright (C) 2021 Severin von Wnuck-Lipinski <severinvonw@outlook.de>
+ *
+ * Emulates a wired GIP device on a USB device controller through raw-gadget
+ * to benchmark the wired transport without any hardware. Measures the
+ * latency from the interrupt IN endpoint to evdev, the polling jitter of
+ * the data endpoint and underruns of the isochronous audio endpoints.
+ */
+
+#include <endian.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <glob.h>
+#include <poll.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <linux/input.h>
+#include <linux/usb/ch9.h>
+#include <linux/usb/raw_gadget.h>
+
+#include "gip-device.h"
+
+#define RAW_GADGET_PATH "/dev/raw-gadget"
+#define UDC_DRIVER "dummy_udc"
+#define UDC_DEVICE "dummy_udc.0"
+#define EVDEV_GLOB "/dev/input/event*"
+
+/* see transport/wired.c */
+#define INTF_DATA 0
+#define INTF_AUDIO 1
+#define EP_DATA_OUT 0x02
+#define EP_DATA_IN 0x82
+#define EP_AUDIO_OUT 0x03
+#define EP_AUDIO_IN 0x83
+#define EP_DATA_MAX_PACKET 64
+#define EP_AUDIO_OUT_MAX_PACKET 228
+#define EP_AUDIO_IN_MAX_PACKET 64
+
+/* see bus/bus.h */
+#define GIP_AUDIO_INTERVAL_US 8000
+#define GIP_AUDIO_PKTS 8
+
+#define MAX_FRAMES 8
+
+#define NSEC_PER_USEC 1000ull
+#define NSEC_PER_MSEC 1000000ull
+#define NSEC_PER_SEC 1000000000ull
+#define ANNOUNCE_RETRY_NS (500 * NSEC_PER_MSEC)
+#define EVDEV_RETRY_MS 100
+
+enum device_state {
+	STATE_UNCONFIGURED,
+	STATE_ANNOUNCED,
+	STATE_IDENTIFIED,
+	STATE_READY,
+};
+
+struct latency {
+	u64 count;
+	u64 sum;
+	u64 min;
+	u64 max;
+};
+
+struct raw_control_event {
+	struct usb_raw_event inner;
+	struct usb_ctrlrequest ctrl;
+};
+
+struct raw_ep0_io {
+	struct usb_raw_ep_io inner;
+	u8 data[256];
+};
+
+struct raw_packet {
+	struct usb_raw_ep_io inner;
+	u8 data[EP_AUDIO_OUT_MAX_PACKET];
+	/* index into the input timestamps, negative for other packets */
+	int sweep;
+};
+
+/* packets built under the lock, written to the host afterwards */
+struct outbox {
+	int count;
+	struct raw_packet packets[MAX_FRAMES];
+};
+
+static volatile sig_atomic_t stop;
+
+static struct gip_device gip = {
+	/* locally administered address */
+	.address = { 0x02, 0x00, 0x00, 0x00, 0x00, 0x01 },
+};
+static unsigned int interval_us = 1000;
+static unsigned int poll_interval = 4;
+static unsigned int duration_s;
+
+static int raw_fd = -1;
+static int ep_data_out = -1, ep_data_in = -1;
+static int ep_audio_out = -1, ep_audio_in = -1;
+static pthread_t main_thread;
+
+/* protects everything below */
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+/* the interrupt endpoint only takes a single transfer at a time */
+static pthread_mutex_t data_in_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static enum device_state state;
+static u8 audio_alt;
+static u8 audio_format_in;
+static bool mic;
+
+static u64 last_announce;
+static u8 input_count;
+
+static struct {
+	u64 queued;
+	u64 completed;
+} input_times[256];
+static u64 last_input_completed;
+
+static u64 time_connect, time_configured, time_ready;
+static u64 time_input_start, time_input_end;
+
+static u64 configurations;
+static u64 data_out_packets, data_out_bytes, data_out_errors;
+static u64 input_packets, input_errors, input_missed;
+static u64 audio_out_packets, audio_out_bytes, audio_out_underruns;
+static u64 audio_in_packets, audio_in_errors;
+static u64 last_audio_out;
+
+static struct latency queued_latency, completed_latency;
+static struct latency poll_jitter, audio_jitter;
+
+static const char * const strings[] = { "Microsoft", "Controller", "1" };
+
+static const struct usb_device_descriptor device_desc_template = {
+	.bLength = USB_DT_DEVICE_SIZE,
+	.bDescriptorType = USB_DT_DEVICE,
+	.bcdUSB = __constant_cpu_to_le16(0x0200),
+	.bDeviceClass = USB_CLASS_VENDOR_SPEC,
+	.bDeviceSubClass = 0x47,
+	.bDeviceProtocol = 0xd0,
+	.bMaxPacketSize0 = 64,
+	.bcdDevice = __constant_cpu_to_le16(0x0100),
+	.iManufacturer = 1,
+	.iProduct = 2,
+	.iSerialNumber = 3,
+	.bNumConfigurations = 1,
+};
+
+static const struct usb_interface_descriptor data_intf_desc = {
+	.bLength = USB_DT_INTERFACE_SIZE,
+	.bDescriptorType = USB_DT_INTERFACE,
+	.bInterfaceNumber = INTF_DATA,
+	.bNumEndpoints = 2,
+	.bInterfaceClass = USB_CLASS_VENDOR_SPEC,
+	.bInterfaceSubClass = 0x47,
+	.bInterfaceProtocol = 0xd0,
+};
+
+/* alternate setting 1 enables the isochronous endpoints */
+static const struct usb_interface_descriptor audio_intf_descs[] = {
+	{
+		.bLength = USB_DT_INTERFACE_SIZE,
+		.bDescriptorType = USB_DT_INTERFACE,
+		.bInterfaceNumber = INTF_AUDIO,
+		.bInterfaceClass = USB_CLASS_VENDOR_SPEC,
+		.bInterfaceSubClass = 0x47,
+		.bInterfaceProtocol = 0xd0,
+	}, {
+		.bLength = USB_DT_INTERFACE_SIZE,
+		.bDescriptorType = USB_DT_INTERFACE,
+		.bInterfaceNumber = INTF_AUDIO,
+		.bAlternateSetting = 1,
+		.bNumEndpoints = 2,
+		.bInterfaceClass = USB_CLASS_VENDOR_SPEC,
+		.bInterfaceSubClass = 0x47,
+		.bInterfaceProtocol = 0xd0,
+	},
+};
+
+static struct usb_endpoint_descriptor data_ep_descs[] = {
+	{
+		.bLength = USB_DT_ENDPOINT_SIZE,
+		.bDescriptorType = USB_DT_ENDPOINT,
+		.bEndpointAddress = EP_DATA_OUT,
+		.bmAttributes = USB_ENDPOINT_XFER_INT,
+		.wMaxPacketSize = __constant_cpu_to_le16(EP_DATA_MAX_PACKET),
+	}, {
+		.bLength = USB_DT_ENDPOINT_SIZE,
+		.bDescriptorType = USB_DT_ENDPOINT,
+		.bEndpointAddress = EP_DATA_IN,
+		.bmAttributes = USB_ENDPOINT_XFER_INT,
+		.wMaxPacketSize = __constant_cpu_to_le16(EP_DATA_MAX_PACKET),
+	},
+};
+
+static struct usb_endpoint_descriptor audio_ep_descs[] = {
+	{
+		.bLength = USB_DT_ENDPOINT_SIZE,
+		.bDescriptorType = USB_DT_ENDPOINT,
+		.bEndpointAddress = EP_AUDIO_OUT,
+		.bmAttributes = USB_ENDPOINT_XFER_ISOC,
+		.wMaxPacketSize =
+			__constant_cpu_to_le16(EP_AUDIO_OUT_MAX_PACKET),
+		.bInterval = 1,
+	}, {
+		.bLength = USB_DT_ENDPOINT_SIZE,
+		.bDescriptorType = USB_DT_ENDPOINT,
+		.bEndpointAddress = EP_AUDIO_IN,
+		.bmAttributes = USB_ENDPOINT_XFER_ISOC,
+		.wMaxPacketSize =
+			__constant_cpu_to_le16(EP_AUDIO_IN_MAX_PACKET),
+		.bInterval = 1,
+	},
+};
+
+static void handle_signal(int sig)
+{
+	stop = 1;
+}
+
+static u64 now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return ts.tv_sec * NSEC_PER_SEC + ts.tv_nsec;
+}
+
+static void put_le16(u8 *buf, u16 val)
+{
+	buf[0] = val;
+	buf[1] = val >> 8;
+}
+
+static void latency_add(struct latency *lat, u64 ns)
+{
+	if (!lat->count || ns < lat->min)
+		lat->min = ns;
+
+	if (ns > lat->max)
+		lat->max = ns;
+
+	lat->count++;
+	lat->sum += ns;
+}
+
+static u64 abs_diff(u64 a, u64 b)
+{
+	return a > b ? a - b : b - a;
+}
+
+static struct raw_packet *outbox_add(struct outbox *box)
+{
+	struct raw_packet *pkt;
+
+	if (box->count == MAX_FRAMES) {
+		input_errors++;
+		return NULL;
+	}
+
+	pkt = &box->packets[box->count++];
+	pkt->inner.ep = ep_data_in;
+	pkt->inner.flags = 0;
+	pkt->inner.length = 0;
+	pkt->sweep = -1;
+
+	return pkt;
+}
+
+static void flush_outbox(struct outbox *box)
+{
+	struct raw_packet *pkt;
+	u64 start, end;
+	int i, ret;
+
+	for (i = 0; i < box->count; i++) {
+		pkt = &box->packets[i];
+
+		/* returns once the host has polled the endpoint */
+		pthread_mutex_lock(&data_in_lock);
+		start = now_ns();
+		ret = ioctl(raw_fd, USB_RAW_IOCTL_EP_WRITE, &pkt->inner);
+		end = now_ns();
+		pthread_mutex_unlock(&data_in_lock);
+
+		if (pkt->sweep < 0)
+			continue;
+
+		pthread_mutex_lock(&lock);
+
+		if (ret < 0) {
+			input_errors++;
+		} else {
+			input_times[pkt->sweep].queued = start;
+			input_times[pkt->sweep].completed = end;
+			input_packets++;
+			time_input_end = end;
+
+			/* queued back to back, completions follow the polling */
+			if (last_input_completed &&
+			    start - last_input_completed < NSEC_PER_MSEC)
+				latency_add(&poll_jitter,
+					    abs_diff(end - last_input_completed,
+						     poll_interval *
+						     NSEC_PER_MSEC));
+
+			last_input_completed = end;
+		}
+
+		pthread_mutex_unlock(&lock);
+	}
+
+	box->count = 0;
+}
+
+static void handle_power(struct outbox *box, const u8 *data, u32 len)
+{
+	u8 status[4] = { GIP_STATUS_CONNECTED_FULL };
+	u8 vol[8] = {
+		GIP_AUD_CTRL_VOLUME, GIP_AUD_VOLUME_UNMUTED, 100, 50, 100,
+	};
+
+	if (len < 1)
+		return;
+
+	if (data[0] != GIP_PWR_ON) {
+		state = STATE_IDENTIFIED;
+		mic = false;
+		return;
+	}
+
+	gip_send(&gip, box, GIP_CMD_STATUS, GIP_OPT_INTERNAL,
+		 status, sizeof(status));
+
+	if (state != STATE_READY) {
+		state = STATE_READY;
+		time_ready = now_ns();
+	}
+
+	/* audio starts once the format has been accepted */
+	if (!audio_format_in)
+		return;
+
+	gip_send(&gip, box, GIP_CMD_AUDIO_CONTROL, GIP_OPT_INTERNAL,
+		 vol, sizeof(vol));
+	mic = true;
+}
+
+static void handle_audio_control(struct outbox *box, const u8 *data, u32 len)
+{
+	const struct gip_model *model = gip.model;
+	u8 pkt[3] = { GIP_AUD_CTRL_FORMAT, model->audio_in, model->audio_out };
+
+	/* volume changes are ignored */
+	if (len < sizeof(pkt) || data[0] != GIP_AUD_CTRL_FORMAT ||
+	    !model->audio_in)
+		return;
+
+	/* rejected formats are answered with the supported ones */
+	if (data[1] == model->audio_in && data[2] == model->audio_out)
+		audio_format_in = data[1];
+
+	gip_send(&gip, box, GIP_CMD_AUDIO_CONTROL, GIP_OPT_INTERNAL,
+		 pkt, sizeof(pkt));
+}
+
+static void send_pkt(struct gip_device *dev, void *ctx,
+		     const u8 *data, int len)
+{
+	struct raw_packet *pkt = outbox_add(ctx);
+
+	/* every packet is a separate transfer of at most 64 bytes */
+	if (!pkt)
+		return;
+
+	memcpy(pkt->data, data, len);
+	pkt->inner.length = len;
+}
+
+static void receive_pkt(struct gip_device *dev, void *ctx, u32 len)
+{
+	data_out_packets++;
+
+	/* the host requested the identification */
+	if (state == STATE_ANNOUNCED)
+		state = STATE_IDENTIFIED;
+}
+
+static void dispatch_pkt(struct gip_device *dev, void *ctx,
+			 u8 cmd, const u8 *data, u32 len)
+{
+	switch (cmd) {
+	case GIP_CMD_POWER:
+		handle_power(ctx, data, len);
+		break;
+	case GIP_CMD_AUDIO_CONTROL:
+		handle_audio_control(ctx, data, len);
+		break;
+	}
+
+	/* authentication, rumble and LEDs are ignored */
+}
+
+static const struct gip_device_ops gip_ops = {
+	.send = send_pkt,
+	.receive = receive_pkt,
+	.dispatch = dispatch_pkt,
+};
+
+static void *data_out_thread(void *arg)
+{
+	struct raw_packet io;
+	static struct outbox box;
+	int ret;
+
+	while (!stop) {
+		io.inner.ep = ep_data_out;
+		io.inner.flags = 0;
+		io.inner.length = EP_DATA_MAX_PACKET;
+
+		ret = ioctl(raw_fd, USB_RAW_IOCTL_EP_READ, &io.inner);
+		if (ret < 0) {
+			/* requests are cancelled when the host resets us */
+			if (errno == ESHUTDOWN || errno == ECONNRESET ||
+			    errno == EINTR) {
+				usleep(1000);
+				continue;
+			}
+
+			perror("interrupt read failed");
+			break;
+		}
+
+		pthread_mutex_lock(&lock);
+		data_out_bytes += ret;
+		if (gip_process_buffer(&gip, &box, io.data, ret))
+			data_out_errors++;
+		pthread_mutex_unlock(&lock);
+
+		flush_outbox(&box);
+	}
+
+	return NULL;
+}
+
+/* host sends one packet of audio samples per frame */
+static void *audio_out_thread(void *arg)
+{
+	struct raw_packet io;
+	u64 now, gap;
+	int ret;
+
+	while (!stop) {
+		if (!__atomic_load_n(&audio_alt, __ATOMIC_RELAXED)) {
+			usleep(1000);
+			continue;
+		}
+
+		io.inner.ep = ep_audio_out;
+		io.inner.flags = 0;
+		io.inner.length = EP_AUDIO_OUT_MAX_PACKET;
+
+		ret = ioctl(raw_fd, USB_RAW_IOCTL_EP_READ, &io.inner);
+		now = now_ns();
+
+		pthread_mutex_lock(&lock);
+
+		if (ret < 0) {
+			audio_out_underruns++;
+			last_audio_out = 0;
+		} else if (!ret) {
+			/* the driver ran out of samples */
+			audio_out_underruns++;
+		} else {
+			audio_out_packets++;
+			audio_out_bytes += ret;
+		}
+
+		if (ret >= 0 && last_audio_out) {
+			gap = now - last_audio_out;
+			latency_add(&audio_jitter, abs_diff(gap, NSEC_PER_MSEC));
+
+			/* missed frames between two packets */
+			if (gap > NSEC_PER_MSEC * 3 / 2)
+				audio_out_underruns += (gap + NSEC_PER_MSEC / 2) /
+						       NSEC_PER_MSEC - 1;
+		}
+
+		if (ret >= 0)
+			last_audio_out = now;
+
+		pthread_mutex_unlock(&lock);
+
+		if (ret < 0 && errno != ESHUTDOWN && errno != ECONNRESET &&
+		    errno != EINTR)
+			usleep(1000);
+	}
+
+	return NULL;
+}
+
+static int get_fragment_size(u8 format)
+{
+	switch (format) {
+	case GIP_AUD_FORMAT_24KHZ_MONO:
+		return 24000 * 2 * GIP_AUDIO_INTERVAL_US / 1000000 /
+		       GIP_AUDIO_PKTS;
+	case GIP_AUD_FORMAT_48KHZ_STEREO:
+		return 48000 * 4 * GIP_AUDIO_INTERVAL_US / 1000000 /
+		       GIP_AUDIO_PKTS;
+	}
+
+	return 0;
+}
+
+/* silence from the microphone, one packet per frame */
+static void *audio_in_thread(void *arg)
+{
+	struct raw_packet io;
+	u8 samples[EP_AUDIO_IN_MAX_PACKET] = {};
+	u8 seq;
+	int len, ret;
+
+	while (!stop) {
+		pthread_mutex_lock(&lock);
+		len = mic && audio_alt ?
+		      get_fragment_size(audio_format_in) + 2 : 0;
+		if (len) {
+			seq = gip_next_sequence(&gip, GIP_CMD_AUDIO_SAMPLES);
+			io.inner.length = gip_put_packet(io.data,
+					GIP_CMD_AUDIO_SAMPLES, GIP_OPT_INTERNAL,
+					seq, len, 0, samples);
+		}
+		pthread_mutex_unlock(&lock);
+
+		if (!len) {
+			usleep(1000);
+			continue;
+		}
+
+		io.inner.ep = ep_audio_in;
+		io.inner.flags = 0;
+		ret = ioctl(raw_fd, USB_RAW_IOCTL_EP_WRITE, &io.inner);
+
+		pthread_mutex_lock(&lock);
+		if (ret < 0)
+			audio_in_errors++;
+		else
+			audio_in_packets++;
+		pthread_mutex_unlock(&lock);
+
+		if (ret < 0)
+			usleep(1000);
+	}
+
+	return NULL;
+}
+
+static void queue_input(struct outbox *box)
+{
+	struct raw_packet *pkt = outbox_add(box);
+	u8 data[GIP_MAX_INPUT_LENGTH] = {};
+
+	if (!pkt)
+		return;
+
+	/* evdev drops events that do not change the value */
+	pkt->sweep = ++input_count;
+	data[gip.model->input_sweep] = pkt->sweep;
+
+	pkt->inner.length = gip_put_packet(pkt->data, GIP_CMD_INPUT, 0,
+					gip_next_sequence(&gip, GIP_CMD_INPUT),
+					gip.model->input_length, 0, data);
+}
+
+static void *tick_thread(void *arg)
+{
+	static struct outbox box;
+	struct timespec next;
+	u64 now;
+
+	clock_gettime(CLOCK_MONOTONIC, &next);
+
+	while (!stop) {
+		next.tv_nsec += interval_us * NSEC_PER_USEC;
+		while (next.tv_nsec >= (long)NSEC_PER_SEC) {
+			next.tv_nsec -= NSEC_PER_SEC;
+			next.tv_sec++;
+		}
+
+		clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &next, NULL);
+
+		/* writes block until polled, do not catch up */
+		now = now_ns();
+		if (now > next.tv_sec * NSEC_PER_SEC + next.tv_nsec +
+		    interval_us * NSEC_PER_USEC)
+			clock_gettime(CLOCK_MONOTONIC, &next);
+
+		pthread_mutex_lock(&lock);
+
+		if (duration_s && time_ready &&
+		    now >= time_ready + duration_s * NSEC_PER_SEC) {
+			pthread_mutex_unlock(&lock);
+			stop = 1;
+			pthread_kill(main_thread, SIGINT);
+			break;
+		}
+
+		if (state == STATE_ANNOUNCED &&
+		    now - last_announce >= ANNOUNCE_RETRY_NS) {
+			/* announcement got lost during the reset */
+			last_announce = now;
+			gip_send_announce(&gip, &box);
+		} else if (state == STATE_READY && gip.model->input_length) {
+			if (!time_input_start)
+				time_input_start = now;
+
+			queue_input(&box);
+		}
+
+		pthread_mutex_unlock(&lock);
+
+		flush_outbox(&box);
+	}
+
+	return NULL;
+}
+
+static int open_evdev(void)
+{
+	struct input_id id;
+	unsigned long abs[ABS_CNT / (8 * sizeof(long)) + 1] = {};
+	int clock = CLOCK_MONOTONIC;
+	glob_t paths;
+	size_t i;
+	int fd;
+
+	if (glob(EVDEV_GLOB, 0, NULL, &paths))
+		return -1;
+
+	for (i = 0; i < paths.gl_pathc; i++) {
+		fd = open(paths.gl_pathv[i], O_RDONLY | O_NONBLOCK);
+		if (fd < 0)
+			continue;
+
+		if (!ioctl(fd, EVIOCGID, &id) && id.bustype == BUS_VIRTUAL &&
+		    id.vendor == gip.model->vendor &&
+		    id.product == gip.model->product &&
+		    ioctl(fd, EVIOCGBIT(EV_ABS, sizeof(abs)), abs) >= 0 &&
+		    (abs[gip.model->axis / (8 * sizeof(long))] &
+		     (1UL << (gip.model->axis % (8 * sizeof(long))))) &&
+		    !ioctl(fd, EVIOCSCLOCKID, &clock)) {
+			globfree(&paths);
+			return fd;
+		}
+
+		close(fd);
+	}
+
+	globfree(&paths);
+
+	return -1;
+}
+
+static void handle_input_event(struct input_event *ev)
+{
+	u64 time = ev->input_event_sec * NSEC_PER_SEC +
+		   ev->input_event_usec * NSEC_PER_USEC;
+	u8 sweep = (u32)ev->value >> gip.model->axis_shift;
+
+	if (ev->type != EV_ABS || ev->code != gip.model->axis)
+		return;
+
+	pthread_mutex_lock(&lock);
+
+	/* event could belong to a packet from before the reset */
+	if (input_times[sweep].completed &&
+	    time >= input_times[sweep].queued) {
+		latency_add(&queued_latency, time - input_times[sweep].queued);
+		if (time >= input_times[sweep].completed)
+			latency_add(&completed_latency,
+				    time - input_times[sweep].completed);
+	}
+
+	input_times[sweep].queued = 0;
+	input_times[sweep].completed = 0;
+
+	pthread_mutex_unlock(&lock);
+}
+
+/* matches events to the input packets by the swept value */
+static void *evdev_thread(void *arg)
+{
+	struct input_event evs[64];
+	struct pollfd pfd = {
+		.events = POLLIN,
+	};
+	int i, ret;
+
+	pfd.fd = -1;
+
+	while (!stop) {
+		if (pfd.fd < 0) {
+			if (__atomic_load_n(&state, __ATOMIC_RELAXED) ==
+			    STATE_UNCONFIGURED ||
+			    (pfd.fd = open_evdev()) < 0) {
+				usleep(EVDEV_RETRY_MS * 1000);
+				continue;
+			}
+		}
+
+		ret = poll(&pfd, 1, EVDEV_RETRY_MS);
+		if (ret <= 0)
+			continue;
+
+		ret = read(pfd.fd, evs, sizeof(evs));
+		if (ret < 0) {
+			/* input device gets removed when the host resets us */
+			if (errno != EAGAIN) {
+				close(pfd.fd);
+				pfd.fd = -1;
+			}
+
+			continue;
+		}
+
+		for (i = 0; i < ret / (int)sizeof(*evs); i++)
+			handle_input_event(&evs[i]);
+	}
+
+	if (pfd.fd >= 0)
+		close(pfd.fd);
+
+	return NULL;
+}
+
+static int put_string(u8 *buf, const char *str)
+{
+	int i, len = strlen(str);
+
+	buf[0] = 2 + len * 2;
+	buf[1] = USB_DT_STRING;
+
+	for (i = 0; i < len; i++)
+		put_le16(buf + 2 + i * 2, str[i]);
+
+	return buf[0];
+}
+
+static int put_desc(u8 *buf, int len, const void *desc, int desc_len)
+{
+	memcpy(buf + len, desc, desc_len);
+
+	return len + desc_len;
+}
+
+static int put_config(u8 *buf)
+{
+	struct usb_config_descriptor config = {
+		.bLength = USB_DT_CONFIG_SIZE,
+		.bDescriptorType = USB_DT_CONFIG,
+		.bNumInterfaces = 2,
+		.bConfigurationValue = 1,
+		.bmAttributes = USB_CONFIG_ATT_ONE | USB_CONFIG_ATT_WAKEUP,
+		/* 500 mA */
+		.bMaxPower = 250,
+	};
+	int len = USB_DT_CONFIG_SIZE;
+
+	len = put_desc(buf, len, &data_intf_desc, USB_DT_INTERFACE_SIZE);
+	len = put_desc(buf, len, &data_ep_descs[0], USB_DT_ENDPOINT_SIZE);
+	len = put_desc(buf, len, &data_ep_descs[1], USB_DT_ENDPOINT_SIZE);
+	len = put_desc(buf, len, &audio_intf_descs[0], USB_DT_INTERFACE_SIZE);
+	len = put_desc(buf, len, &audio_intf_descs[1], USB_DT_INTERFACE_SIZE);
+	len = put_desc(buf, len, &audio_ep_descs[0], USB_DT_ENDPOINT_SIZE);
+	len = put_desc(buf, len, &audio_ep_descs[1], USB_DT_ENDPOINT_SIZE);
+
+	config.wTotalLength = htole16(len);
+	memcpy(buf, &config, USB_DT_CONFIG_SIZE);
+
+	return len;
+}
+
+static int start_thread(void *(*func)(void *))
+{
+	sigset_t mask, old;
+	pthread_t thread;
+	int err;
+
+	/* signals are only handled by the control thread */
+	sigemptyset(&mask);
+	sigaddset(&mask, SIGINT);
+	sigaddset(&mask, SIGTERM);
+	pthread_sigmask(SIG_BLOCK, &mask, &old);
+	err = pthread_create(&thread, NULL, func, NULL);
+	pthread_sigmask(SIG_SETMASK, &old, NULL);
+
+	if (!err)
+		pthread_detach(thread);
+
+	return -err;
+}
+
+static int configure(void)
+{
+	int err;
+
+	/* the driver resets the device, endpoints stay enabled */
+	if (ep_data_out < 0) {
+		ep_data_out = ioctl(raw_fd, USB_RAW_IOCTL_EP_ENABLE,
+				    &data_ep_descs[0]);
+		ep_data_in = ioctl(raw_fd, USB_RAW_IOCTL_EP_ENABLE,
+				   &data_ep_descs[1]);
+		if (ep_data_out < 0 || ep_data_in < 0) {
+			perror("enable endpoints failed");
+			return -EIO;
+		}
+
+		err = start_thread(data_out_thread);
+		if (!err)
+			err = start_thread(tick_thread);
+		if (!err)
+			err = start_thread(evdev_thread);
+		if (err)
+			return err;
+	}
+
+	ioctl(raw_fd, USB_RAW_IOCTL_VBUS_DRAW, 250);
+	ioctl(raw_fd, USB_RAW_IOCTL_CONFIGURE, 0);
+
+	pthread_mutex_lock(&lock);
+
+	time_configured = now_ns();
+	configurations++;
+
+	/* announce again after every reset */
+	state = STATE_ANNOUNCED;
+	last_announce = 0;
+	audio_alt = 0;
+	audio_format_in = 0;
+	mic = false;
+	gip_reset(&gip);
+
+	pthread_mutex_unlock(&lock);
+
+	return 0;
+}
+
+static int set_audio_interface(u8 alt)
+{
+	int err;
+
+	if (alt > 1)
+		return -EINVAL;
+
+	/*
+	 * Endpoints with queued requests cannot be disabled.
+	 * They stay enabled, the host stops using them in setting 0.
+	 */
+	if (alt && ep_audio_out < 0) {
+		ep_audio_out = ioctl(raw_fd, USB_RAW_IOCTL_EP_ENABLE,
+				     &audio_ep_descs[0]);
+		ep_audio_in = ioctl(raw_fd, USB_RAW_IOCTL_EP_ENABLE,
+				    &audio_ep_descs[1]);
+		if (ep_audio_out < 0 || ep_audio_in < 0) {
+			perror("enable audio endpoints failed");
+			return -EIO;
+		}
+
+		err = start_thread(audio_out_thread);
+		if (!err)
+			err = start_thread(audio_in_thread);
+		if (err)
+			return err;
+	}
+
+	pthread_mutex_lock(&lock);
+	audio_alt = alt;
+	last_audio_out = 0;
+	pthread_mutex_unlock(&lock);
+
+	return 0;
+}
+
+static int handle_standard_in(struct usb_ctrlrequest *ctrl, u8 *data)
+{
+	struct usb_device_descriptor desc = device_desc_template;
+	u16 val = le16toh(ctrl->wValue);
+	u8 idx = val & 0xff;
+
+	switch (ctrl->bRequest) {
+	case USB_REQ_GET_DESCRIPTOR:
+		switch (val >> 8) {
+		case USB_DT_DEVICE:
+			desc.idVendor = htole16(gip.model->vendor);
+			desc.idProduct = htole16(gip.model->product);
+			memcpy(data, &desc, sizeof(desc));
+			return sizeof(desc);
+		case USB_DT_CONFIG:
+			return put_config(data);
+		case USB_DT_STRING:
+			if (!idx) {
+				/* English (United States) */
+				data[0] = 4;
+				data[1] = USB_DT_STRING;
+				put_le16(data + 2, 0x0409);
+				return 4;
+			}
+
+			if (idx > 3)
+				return -1;
+
+			return put_string(data, strings[idx - 1]);
+		}
+
+		return -1;
+	case USB_REQ_GET_STATUS:
+		put_le16(data, 0);
+		return 2;
+	case USB_REQ_GET_CONFIGURATION:
+		data[0] = 1;
+		return 1;
+	case USB_REQ_GET_INTERFACE:
+		pthread_mutex_lock(&lock);
+		data[0] = le16toh(ctrl->wIndex) == INTF_AUDIO ? audio_alt : 0;
+		pthread_mutex_unlock(&lock);
+		return 1;
+	}
+
+	return -1;
+}
+
+static int handle_standard_out(struct usb_ctrlrequest *ctrl)
+{
+	u16 val = le16toh(ctrl->wValue);
+
+	switch (ctrl->bRequest) {
+	case USB_REQ_SET_CONFIGURATION:
+		return configure();
+	case USB_REQ_SET_INTERFACE:
+		if (le16toh(ctrl->wIndex) == INTF_AUDIO)
+			return set_audio_interface(val);
+
+		return val ? -EINVAL : 0;
+	case USB_REQ_CLEAR_FEATURE:
+	case USB_REQ_SET_FEATURE:
+		return 0;
+	}
+
+	return -EINVAL;
+}
+
+static void handle_control(struct usb_ctrlrequest *ctrl)
+{
+	struct raw_ep0_io io = {};
+	u8 type = ctrl->bRequestType & USB_TYPE_MASK;
+	unsigned int len = le16toh(ctrl->wLength);
+	int ret;
+
+	if (len > sizeof(io.data))
+		len = sizeof(io.data);
+
+	/* the device has no vendor requests */
+	if (type != USB_TYPE_STANDARD)
+		goto err_stall;
+
+	if (ctrl->bRequestType & USB_DIR_IN) {
+		ret = handle_standard_in(ctrl, io.data);
+		if (ret < 0)
+			goto err_stall;
+
+		io.inner.length = ret;
+		if (io.inner.length > len)
+			io.inner.length = len;
+
+		ret = ioctl(raw_fd, USB_RAW_IOCTL_EP0_WRITE, &io.inner);
+	} else {
+		if (handle_standard_out(ctrl))
+			goto err_stall;
+
+		/* acknowledges the request */
+		io.inner.length = len;
+		ret = ioctl(raw_fd, USB_RAW_IOCTL_EP0_READ, &io.inner);
+	}
+
+	if (ret < 0 && errno != ESHUTDOWN && errno != ECONNRESET)
+		perror("control transfer failed");
+
+	return;
+
+err_stall:
+	ioctl(raw_fd, USB_RAW_IOCTL_EP0_STALL, 0);
+}
+
+static void print_phase(const char *name, u64 start, u64 end)
+{
+	if (start && end && end >= start)
+		printf("%-12s %.1f ms\n", name, (end - start) / 1e6);
+	else
+		printf("%-12s -\n", name);
+}
+
+static void print_latency(const char *name, struct latency *lat)
+{
+	if (!lat->count) {
+		printf("%-12s -\n", name);
+		return;
+	}
+
+	printf("%-12s min/avg/max %.1f/%.1f/%.1f us (%llu samples)\n", name,
+	       lat->min / 1e3, (double)lat->sum / lat->count / 1e3,
+	       lat->max / 1e3, (unsigned long long)lat->count);
+}
+
+static void print_report(void)
+{
+	double elapsed;
+
+	pthread_mutex_lock(&lock);
+
+	input_missed = input_packets > queued_latency.count ?
+		       input_packets - queued_latency.count : 0;
+	elapsed = time_input_end > time_input_start ?
+		  (time_input_end - time_input_start) / 1e9 : 0;
+
+	printf("model:       %s\n", gip.model->name);
+	print_phase("enumeration:", time_connect, time_configured);
+	printf("%-12s %llu configurations\n", "",
+	       (unsigned long long)configurations);
+	print_phase("ready:", time_configured, time_ready);
+	printf("%-12s %llu packets, %.0f packets/s, %llu errors\n", "input:",
+	       (unsigned long long)input_packets,
+	       elapsed ? input_packets / elapsed : 0,
+	       (unsigned long long)input_errors);
+	print_latency("evdev:", &queued_latency);
+	print_latency("  completed:", &completed_latency);
+	printf("%-12s %llu packets without event\n", "",
+	       (unsigned long long)input_missed);
+	print_latency("poll jitter:", &poll_jitter);
+	printf("%-12s %llu packets, %llu bytes, %llu errors\n", "data out:",
+	       (unsigned long long)data_out_packets,
+	       (unsigned long long)data_out_bytes,
+	       (unsigned long long)data_out_errors);
+
+	if (gip.model->audio_in) {
+		printf("%-12s %llu packets, %llu bytes, %llu underruns\n",
+		       "audio out:", (unsigned long long)audio_out_packets,
+		       (unsigned long long)audio_out_bytes,
+		       (unsigned long long)audio_out_underruns);
+		print_latency("  jitter:", &audio_jitter);
+		printf("%-12s %llu packets, %llu errors\n", "audio in:",
+		       (unsigned long long)audio_in_packets,
+		       (unsigned long long)audio_in_errors);
+	}
+
+	pthread_mutex_unlock(&lock);
+}
+
+static int run(const char *driver, const char *device)
+{
+	struct usb_raw_init init = {
+		.speed = USB_SPEED_FULL,
+	};
+	struct raw_control_event event;
+	int err = 0;
+
+	data_ep_descs[0].bInterval = poll_interval;
+	data_ep_descs[1].bInterval = poll_interval;
+
+	raw_fd = open(RAW_GADGET_PATH, O_RDWR);
+	if (raw_fd < 0) {
+		perror("open " RAW_GADGET_PATH);
+		return 1;
+	}
+
+	strncpy((char *)init.driver_name, driver, UDC_NAME_LENGTH_MAX - 1);
+	strncpy((char *)init.device_name, device, UDC_NAME_LENGTH_MAX - 1);
+
+	if (ioctl(raw_fd, USB_RAW_IOCTL_INIT, &init) ||
+	    ioctl(raw_fd, USB_RAW_IOCTL_RUN, 0)) {
+		perror("start gadget failed");
+		close(raw_fd);
+		return 1;
+	}
+
+	printf("emulating %s on %s\n", gip.model->name, device);
+
+	while (!stop) {
+		event.inner.type = USB_RAW_EVENT_INVALID;
+		event.inner.length = sizeof(event.ctrl);
+
+		if (ioctl(raw_fd, USB_RAW_IOCTL_EVENT_FETCH, &event.inner)) {
+			if (errno == EINTR)
+				continue;
+
+			err = -errno;
+			perror("fetch event failed");
+			break;
+		}
+
+		switch (event.inner.type) {
+		case USB_RAW_EVENT_CONNECT:
+			pthread_mutex_lock(&lock);
+			if (!time_connect)
+				time_connect = now_ns();
+			pthread_mutex_unlock(&lock);
+			break;
+		case USB_RAW_EVENT_CONTROL:
+			handle_control(&event.ctrl);
+			break;
+		}
+	}
+
+	print_report();
+	close(raw_fd);
+
+	return !!err;
+}
+
+static void usage(const char *name)
+{
+	fprintf(stderr,
+		"usage: %s [-m MODEL] [-i INTERVAL_US] [-p POLL_MS] "
+		"[-t SECONDS] [-u DRIVER] [-d DEVICE]\n"
+		"\n"
+		"Models: gamepad, strat, jaguar, headset. Input is sent every\n"
+		"INTERVAL_US, the data endpoints are polled every POLL_MS.\n"
+		"The report is printed after SECONDS or on exit.\n",
+		name);
+}
+
+int main(int argc, char **argv)
+{
+	struct sigaction act = {
+		.sa_handler = handle_signal,
+	};
+	const char *driver = UDC_DRIVER;
+	const char *device = UDC_DEVICE;
+	int opt;
+
+	gip.model = gip_find_model("gamepad");
+	gip.ops = &gip_ops;
+
+	while ((opt = getopt(argc, argv, "m:i:p:t:u:d:h")) != -1) {
+		switch (opt) {
+		case 'm':
+			gip.model = gip_find_model(optarg);
+			if (!gip.model) {
+				fprintf(stderr, "unknown model: %s\n", optarg);
+				return 1;
+			}
+			break;
+		case 'i':
+			interval_us = strtoul(optarg, NULL, 0);
+			break;
+		case 'p':
+			poll_interval = strtoul(optarg, NULL, 0);
+			break;
+		case 't':
+			duration_s = strtoul(optarg, NULL, 0);
+			break;
+		case 'u':
+			driver = optarg;
+			break;
+		case 'd':
+			device = optarg;
+			break;
+		default:
+			usage(argv[0]);
+			return opt != 'h';
+		}
+	}
+
+	if (optind != argc) {
+		usage(argv[0]);
+		return 1;
+	}
+
+	if (interval_us < 100)
+		interval_us = 100;
+
+	/* full-speed interrupt endpoints, in frames */
+	if (poll_interval < 1 || poll_interval > 255) {
+		fprintf(stderr, "poll interval must be 1-255 ms\n");
+		return 1;
+	}
+
+	/* interrupts blocking ioctls, no SA_RESTART */
+	sigaction(SIGINT, &act, NULL);
+	sigaction(SIGTERM, &act, NULL);
+	main_thread = pthread_self();
+
+	return run(driver, device);
+}
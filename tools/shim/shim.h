@@ -0,0 +1,484 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/*
+ * Copyright (C) 2021 Severin von Wnuck-Lipinski <severinvonw@outlook.de>
+ *
+ * Minimal kernel API for building the GIP protocol core in userspace.
+ * Everything is single-threaded: locks, per-CPU data and RCU are no-ops.
+ */
+
+#pragma once
+
+#include <endian.h>
+#include <errno.h>
+#include <stdarg.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+typedef uint8_t u8;
+typedef uint16_t u16;
+typedef uint32_t u32;
+typedef uint64_t u64;
+typedef int8_t s8;
+typedef int16_t s16;
+typedef int32_t s32;
+typedef int64_t s64;
+
+typedef uint8_t __u8;
+typedef uint16_t __u16;
+typedef uint32_t __u32;
+typedef uint64_t __u64;
+typedef uint16_t __le16;
+typedef uint32_t __le32;
+typedef uint64_t __le64;
+
+typedef unsigned int gfp_t;
+typedef s64 ktime_t;
+
+#define __packed __attribute__((packed))
+#define __rcu
+#define __percpu
+#define __user
+#undef __always_inline
+#define __always_inline inline __attribute__((always_inline))
+#define likely(x) __builtin_expect(!!(x), 1)
+#define unlikely(x) __builtin_expect(!!(x), 0)
+
+#define KERNEL_VERSION(a, b, c) (((a) << 16) + ((b) << 8) + (c))
+#define LINUX_VERSION_CODE KERNEL_VERSION(6, 13, 0)
+
+/* kernel-internal error codes */
+#define ENOTSUPP 524
+
+#define GFP_KERNEL 0u
+#define GFP_ATOMIC 1u
+#define __GFP_NOWARN 2u
+
+#define SZ_1K 0x00000400
+#define SZ_64K 0x00010000
+
+#define BITS_PER_LONG (8 * sizeof(long))
+#define BITS_TO_LONGS(n) (((n) + BITS_PER_LONG - 1) / BITS_PER_LONG)
+#define DECLARE_BITMAP(name, bits) unsigned long name[BITS_TO_LONGS(bits)]
+
+#define BIT(n) (1UL << (n))
+#define BIT_ULL(n) (1ULL << (n))
+#define GENMASK(h, l) (((~0UL) << (l)) & (~0UL >> (BITS_PER_LONG - 1 - (h))))
+#define FIELD_GET(m, v) ((typeof(m))(((v) & (m)) / ((m) & -(m))))
+#define FIELD_PREP(m, v) ((typeof(m))(((v) * ((m) & -(m))) & (m)))
+#define ARRAY_SIZE(a) (sizeof(a) / sizeof((a)[0]))
+
+#define min(a, b) ({ typeof(a) __a = (a); typeof(b) __b = (b); \
+		     __a < __b ? __a : __b; })
+#define max(a, b) ({ typeof(a) __a = (a); typeof(b) __b = (b); \
+		     __a > __b ? __a : __b; })
+#define min_t(t, a, b) min((t)(a), (t)(b))
+#define max_t(t, a, b) max((t)(a), (t)(b))
+
+#define container_of(ptr, type, member) \
+	((type *)((char *)(ptr) - offsetof(type, member)))
+#define struct_size(p, member, n) \
+	(sizeof(*(p)) + sizeof(*(p)->member) * (n))
+
+#define READ_ONCE(x) (*(volatile typeof(x) *)&(x))
+#define WRITE_ONCE(x, v) (*(volatile typeof(x) *)&(x) = (v))
+
+#define WARN_ON(cond) ({						\
+	bool __c = !!(cond);						\
+	if (__c)							\
+		fprintf(stderr, "WARN_ON(%s) at %s:%d\n", #cond,	\
+			__FILE__, __LINE__);				\
+	__c;								\
+})
+
+#define BUILD_BUG_ON(cond) ((void)sizeof(char[1 - 2 * !!(cond)]))
+
+#define ilog2(n) ((int)(63 - __builtin_clzll((u64)(n))))
+#define div_u64(a, b) ((u64)(a) / (b))
+#define div64_u64(a, b) ((u64)(a) / (b))
+
+#define cpu_to_le16(x) htole16(x)
+#define cpu_to_le32(x) htole32(x)
+#define cpu_to_le64(x) htole64(x)
+#define le16_to_cpu(x) le16toh(x)
+#define le32_to_cpu(x) le32toh(x)
+#define le64_to_cpu(x) le64toh(x)
+#define le16_to_cpup(p) le16toh(*(p))
+
+#define MAX_ERRNO 4095
+
+static inline void *ERR_PTR(long err)
+{
+	return (void *)err;
+}
+
+static inline long PTR_ERR(const void *ptr)
+{
+	return (long)ptr;
+}
+
+static inline bool IS_ERR(const void *ptr)
+{
+	return (unsigned long)ptr >= (unsigned long)-MAX_ERRNO;
+}
+
+/* module */
+struct module;
+
+#define THIS_MODULE ((struct module *)NULL)
+#define KBUILD_MODNAME "xone_gip"
+#define module_param(name, type, perm) extern int __shim_unused
+#define MODULE_PARM_DESC(name, desc) extern int __shim_unused
+#define EXPORT_SYMBOL_GPL(sym) extern int __shim_unused
+
+/* printk, silent unless shim_verbose is set */
+extern int shim_verbose;
+
+static inline void shim_printk(const char *fmt, ...)
+{
+	va_list args;
+
+	if (!shim_verbose)
+		return;
+
+	va_start(args, fmt);
+	vfprintf(stderr, fmt, args);
+	va_end(args);
+}
+
+#define pr_debug(...) shim_printk(__VA_ARGS__)
+#define pr_err(...) shim_printk(__VA_ARGS__)
+#define dev_dbg(dev, ...) shim_printk(__VA_ARGS__)
+#define dev_warn(dev, ...) shim_printk(__VA_ARGS__)
+#define dev_err(dev, ...) shim_printk(__VA_ARGS__)
+
+/* memory */
+static inline void *kzalloc(size_t size, gfp_t gfp)
+{
+	return calloc(1, size);
+}
+
+static inline void *kcalloc(size_t n, size_t size, gfp_t gfp)
+{
+	return calloc(n, size);
+}
+
+static inline void kfree(const void *ptr)
+{
+	free((void *)ptr);
+}
+
+/* bit operations on unsigned long arrays */
+static inline void set_bit(long nr, volatile unsigned long *addr)
+{
+	addr[nr / BITS_PER_LONG] |= BIT(nr % BITS_PER_LONG);
+}
+
+static inline void clear_bit(long nr, volatile unsigned long *addr)
+{
+	addr[nr / BITS_PER_LONG] &= ~BIT(nr % BITS_PER_LONG);
+}
+
+static inline bool test_bit(long nr, const volatile unsigned long *addr)
+{
+	return addr[nr / BITS_PER_LONG] & BIT(nr % BITS_PER_LONG);
+}
+
+static inline bool __test_and_set_bit(long nr, unsigned long *addr)
+{
+	bool old = test_bit(nr, addr);
+
+	set_bit(nr, addr);
+
+	return old;
+}
+
+static inline void bitmap_zero(unsigned long *addr, unsigned int nbits)
+{
+	memset(addr, 0, BITS_TO_LONGS(nbits) * sizeof(long));
+}
+
+static inline unsigned int bitmap_weight(const unsigned long *addr,
+					 unsigned int nbits)
+{
+	unsigned int i, weight = 0;
+
+	for (i = 0; i < nbits / BITS_PER_LONG; i++)
+		weight += __builtin_popcountl(addr[i]);
+
+	if (nbits % BITS_PER_LONG)
+		weight += __builtin_popcountl(addr[i] &
+					      (BIT(nbits % BITS_PER_LONG) - 1));
+
+	return weight;
+}
+
+static inline void bitmap_set(unsigned long *addr, unsigned int start,
+			      unsigned int nbits)
+{
+	while (nbits--)
+		set_bit(start++, addr);
+}
+
+static inline unsigned long find_first_zero_bit(const unsigned long *addr,
+						unsigned long size)
+{
+	unsigned long i, word;
+
+	for (i = 0; i * BITS_PER_LONG < size; i++) {
+		word = ~addr[i];
+		if (word)
+			return min(i * BITS_PER_LONG + __builtin_ctzl(word),
+				   size);
+	}
+
+	return size;
+}
+
+/* atomics, plain accesses are enough without threads */
+typedef struct {
+	int counter;
+} atomic_t;
+
+typedef struct {
+	s64 counter;
+} atomic64_t;
+
+#define atomic_read(v) ((v)->counter)
+#define atomic_set(v, i) ((v)->counter = (i))
+#define atomic64_read(v) ((v)->counter)
+#define atomic64_set(v, i) ((v)->counter = (i))
+#define atomic64_inc(v) ((v)->counter++)
+#define atomic64_add(i, v) ((v)->counter += (i))
+
+/* locking */
+typedef struct {
+	int unused;
+} spinlock_t;
+
+struct semaphore {
+	int count;
+};
+
+struct mutex {
+	int unused;
+};
+
+struct completion {
+	int done;
+};
+
+struct srcu_struct {
+	int unused;
+};
+
+typedef struct {
+	int unused;
+} wait_queue_head_t;
+
+#define spin_lock_init(lock) ((void)(lock))
+#define spin_lock_irqsave(lock, flags) ((void)(lock), (flags) = 0)
+#define spin_unlock_irqrestore(lock, flags) ((void)(lock), (void)(flags))
+
+#define srcu_read_lock(ssp) ((void)(ssp), 0)
+#define srcu_read_unlock(ssp, idx) ((void)(ssp), (void)(idx))
+#define srcu_dereference(p, ssp) (p)
+
+/* lists */
+struct list_head {
+	struct list_head *next, *prev;
+};
+
+#define LIST_HEAD(name) struct list_head name = { &(name), &(name) }
+
+static inline void INIT_LIST_HEAD(struct list_head *list)
+{
+	list->next = list;
+	list->prev = list;
+}
+
+static inline void __list_add(struct list_head *entry, struct list_head *prev,
+			      struct list_head *next)
+{
+	next->prev = entry;
+	entry->next = next;
+	entry->prev = prev;
+	prev->next = entry;
+}
+
+static inline void list_add_tail(struct list_head *entry,
+				 struct list_head *head)
+{
+	__list_add(entry, head->prev, head);
+}
+
+static inline void list_del(struct list_head *entry)
+{
+	entry->next->prev = entry->prev;
+	entry->prev->next = entry->next;
+}
+
+static inline bool list_empty(const struct list_head *head)
+{
+	return head->next == head;
+}
+
+static inline void list_splice_init(struct list_head *list,
+				    struct list_head *head)
+{
+	if (list_empty(list))
+		return;
+
+	list->next->prev = head;
+	list->prev->next = head->next;
+	head->next->prev = list->prev;
+	head->next = list->next;
+	INIT_LIST_HEAD(list);
+}
+
+#define list_entry(ptr, type, member) container_of(ptr, type, member)
+#define list_first_entry(ptr, type, member) \
+	list_entry((ptr)->next, type, member)
+#define list_next_entry(pos, member) \
+	list_entry((pos)->member.next, typeof(*(pos)), member)
+
+#define list_for_each_entry(pos, head, member)				\
+	for (pos = list_first_entry(head, typeof(*pos), member);	\
+	     &pos->member != (head);					\
+	     pos = list_next_entry(pos, member))
+
+#define list_for_each_entry_safe(pos, n, head, member)			\
+	for (pos = list_first_entry(head, typeof(*pos), member),	\
+	     n = list_next_entry(pos, member);				\
+	     &pos->member != (head);					\
+	     pos = n, n = list_next_entry(n, member))
+
+/* time */
+#define NSEC_PER_USEC 1000L
+#define NSEC_PER_MSEC 1000000L
+#define NSEC_PER_SEC 1000000000L
+#define MSEC_PER_SEC 1000L
+#define KTIME_MAX INT64_MAX
+
+static inline ktime_t ktime_get(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+static inline u64 ktime_get_ns(void)
+{
+	return ktime_get();
+}
+
+#define ktime_add_ms(kt, ms) ((kt) + (ms) * NSEC_PER_MSEC)
+#define ktime_sub(a, b) ((a) - (b))
+#define ktime_before(a, b) ((a) < (b))
+#define ktime_to_ns(kt) (kt)
+#define ns_to_ktime(ns) ((ktime_t)(ns))
+
+/* timers never fire, the benchmarks do not wait for them */
+enum hrtimer_restart {
+	HRTIMER_NORESTART,
+	HRTIMER_RESTART,
+};
+
+enum hrtimer_mode {
+	HRTIMER_MODE_ABS_SOFT,
+	HRTIMER_MODE_REL_SOFT,
+};
+
+struct hrtimer {
+	enum hrtimer_restart (*function)(struct hrtimer *timer);
+	ktime_t expires;
+};
+
+static inline void hrtimer_setup(struct hrtimer *timer,
+				 enum hrtimer_restart (*fn)(struct hrtimer *),
+				 clockid_t clock, enum hrtimer_mode mode)
+{
+	timer->function = fn;
+}
+
+static inline void hrtimer_start(struct hrtimer *timer, ktime_t time,
+				 enum hrtimer_mode mode)
+{
+	timer->expires = time;
+}
+
+static inline int hrtimer_cancel(struct hrtimer *timer)
+{
+	return 0;
+}
+
+/* devices and work */
+struct dentry;
+struct seq_file;
+
+struct device {
+	const char *init_name;
+};
+
+struct device_driver {
+	const char *name;
+};
+
+struct work_struct {
+	void (*func)(struct work_struct *work);
+};
+
+struct workqueue_struct;
+
+/* per-CPU data has a single instance */
+#define get_cpu_ptr(ptr) (ptr)
+#define put_cpu_ptr(ptr) ((void)(ptr))
+
+struct u64_stats_sync {
+	int unused;
+};
+
+typedef struct {
+	u64 v;
+} u64_stats_t;
+
+#define u64_stats_update_begin_irqsave(syncp) ((void)(syncp), 0UL)
+#define u64_stats_update_end_irqrestore(syncp, flags) \
+	((void)(syncp), (void)(flags))
+#define u64_stats_add(p, val) ((p)->v += (val))
+#define u64_stats_read(p) ((p)->v)
+
+struct static_key_false {
+	bool enabled;
+};
+
+#define DEFINE_STATIC_KEY_FALSE(name) struct static_key_false name
+#define DECLARE_STATIC_KEY_FALSE(name) extern struct static_key_false name
+#define static_branch_unlikely(key) unlikely((key)->enabled)
+
+#define DECLARE_KFIFO_PTR(fifo, type)					\
+	struct {							\
+		type *data;						\
+		unsigned int in, out, mask;				\
+	} fifo
+
+/* tracepoints compile to nothing */
+#define TP_PROTO(args...) args
+#define TP_ARGS(args...) args
+#define TRACE_EVENT(name, proto, ...)					\
+	static inline void trace_##name(proto) {}
+
+typedef struct {
+	u8 b[16];
+} guid_t;
+
+static inline bool guid_equal(const guid_t *a, const guid_t *b)
+{
+	return !memcmp(a, b, sizeof(guid_t));
+}
@@ -0,0 +1 @@
+/* tracepoints are not instantiated in userspace */
@@ -0,0 +1,165 @@
+// SPDX-License-Identifier: GPL-2.0-or-later
+/*
+ * Copyright (C) 2021 Severin von Wnuck-Lipinski <severinvonw@outlook.de>
+ *
+ * Idle and busy buffer lists of the software transports. Buffers handed
+ * out by get_buffer are idle again after put_buffer or once the device
+ * side has consumed them.
+ */
+
+#include <linux/slab.h>
+
+#include "buffers.h"
+
+void xone_buffers_init(struct xone_buffers *bufs)
+{
+	spin_lock_init(&bufs->lock);
+	INIT_LIST_HEAD(&bufs->data_idle);
+	INIT_LIST_HEAD(&bufs->audio_idle);
+	INIT_LIST_HEAD(&bufs->busy);
+}
+
+static struct list_head *xone_buffers_idle(struct xone_buffers *bufs,
+					   enum gip_adapter_buffer_type type)
+{
+	return type == GIP_BUF_DATA ? &bufs->data_idle : &bufs->audio_idle;
+}
+
+int xone_buffers_alloc(struct xone_buffers *bufs, struct xone_buffer **list,
+		       int count, enum gip_adapter_buffer_type type, int size)
+{
+	struct xone_buffer *buf;
+	unsigned long flags;
+	int i;
+
+	for (i = 0; i < count; i++) {
+		buf = kzalloc(struct_size(buf, data, size), GFP_KERNEL);
+		if (!buf)
+			return -ENOMEM;
+
+		buf->type = type;
+		buf->size = size;
+		list[i] = buf;
+
+		spin_lock_irqsave(&bufs->lock, flags);
+		list_add_tail(&buf->list, xone_buffers_idle(bufs, type));
+		spin_unlock_irqrestore(&bufs->lock, flags);
+	}
+
+	return 0;
+}
+
+void xone_buffers_free(struct xone_buffers *bufs, struct xone_buffer **list,
+		       int count)
+{
+	unsigned long flags;
+	int i;
+
+	spin_lock_irqsave(&bufs->lock, flags);
+
+	for (i = 0; i < count; i++)
+		if (list[i])
+			list_del_init(&list[i]->list);
+
+	spin_unlock_irqrestore(&bufs->lock, flags);
+
+	for (i = 0; i < count; i++) {
+		kfree(list[i]);
+		list[i] = NULL;
+	}
+}
+
+int xone_buffers_get(struct xone_buffers *bufs,
+		     struct gip_adapter_buffer *buf)
+{
+	struct xone_buffer *xbuf;
+	unsigned long flags;
+
+	if (buf->type != GIP_BUF_DATA && buf->type != GIP_BUF_AUDIO)
+		return -EINVAL;
+
+	spin_lock_irqsave(&bufs->lock, flags);
+
+	xbuf = list_first_entry_or_null(xone_buffers_idle(bufs, buf->type),
+					typeof(*xbuf), list);
+	if (xbuf)
+		list_del_init(&xbuf->list);
+
+	spin_unlock_irqrestore(&bufs->lock, flags);
+
+	if (!xbuf)
+		return -ENOSPC;
+
+	buf->context = xbuf;
+	buf->data = xbuf->data;
+	buf->length = xbuf->size;
+
+	return 0;
+}
+
+/* returns the buffer to the idle list once stopped */
+int xone_buffers_submit(struct xone_buffers *bufs,
+			struct gip_adapter_buffer *buf)
+{
+	struct xone_buffer *xbuf = buf->context;
+	unsigned long flags;
+	int err = 0;
+
+	xbuf->length = buf->length;
+
+	spin_lock_irqsave(&bufs->lock, flags);
+
+	if (bufs->stopped) {
+		list_add_tail(&xbuf->list, xone_buffers_idle(bufs, xbuf->type));
+		err = -ESHUTDOWN;
+	} else {
+		list_add_tail(&xbuf->list, &bufs->busy);
+	}
+
+	spin_unlock_irqrestore(&bufs->lock, flags);
+
+	return err;
+}
+
+/* also takes buffers that are still on the busy list */
+void xone_buffers_put(struct xone_buffers *bufs, struct xone_buffer *buf)
+{
+	unsigned long flags;
+
+	spin_lock_irqsave(&bufs->lock, flags);
+	list_move_tail(&buf->list, xone_buffers_idle(bufs, buf->type));
+	spin_unlock_irqrestore(&bufs->lock, flags);
+}
+
+/* oldest submitted buffer, stays on the busy list */
+struct xone_buffer *xone_buffers_first_busy(struct xone_buffers *bufs)
+{
+	struct xone_buffer *buf;
+	unsigned long flags;
+
+	spin_lock_irqsave(&bufs->lock, flags);
+	buf = list_first_entry_or_null(&bufs->busy, typeof(*buf), list);
+	spin_unlock_irqrestore(&bufs->lock, flags);
+
+	return buf;
+}
+
+/* moves all submitted buffers to the given list */
+void xone_buffers_take_busy(struct xone_buffers *bufs, struct list_head *list)
+{
+	unsigned long flags;
+
+	spin_lock_irqsave(&bufs->lock, flags);
+	list_splice_tail_init(&bufs->busy, list);
+	spin_unlock_irqrestore(&bufs->lock, flags);
+}
+
+/* buffers submitted afterwards are rejected */
+void xone_buffers_stop(struct xone_buffers *bufs)
+{
+	unsigned long flags;
+
+	spin_lock_irqsave(&bufs->lock, flags);
+	bufs->stopped = true;
+	spin_unlock_irqrestore(&bufs->lock, flags);
+}
@@ -0,0 +1,46 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/*
+ * Copyright (C) 2021 Severin von Wnuck-Lipinski <severinvonw@outlook.de>
+ */
+
+#pragma once
+
+#include <linux/list.h>
+#include <linux/spinlock.h>
+
+#include "../bus/bus.h"
+
+/* buffers of the software transports, sized for a single type */
+struct xone_buffer {
+	struct list_head list;
+	enum gip_adapter_buffer_type type;
+
+	int size;
+	int length;
+	u8 data[];
+};
+
+struct xone_buffers {
+	/* protects buffer lists */
+	spinlock_t lock;
+	struct list_head data_idle;
+	struct list_head audio_idle;
+	struct list_head busy;
+	bool stopped;
+};
+
+void xone_buffers_init(struct xone_buffers *bufs);
+int xone_buffers_alloc(struct xone_buffers *bufs, struct xone_buffer **list,
+		       int count, enum gip_adapter_buffer_type type, int size);
+void xone_buffers_free(struct xone_buffers *bufs, struct xone_buffer **list,
+		       int count);
+
+int xone_buffers_get(struct xone_buffers *bufs,
+		     struct gip_adapter_buffer *buf);
+int xone_buffers_submit(struct xone_buffers *bufs,
+			struct gip_adapter_buffer *buf);
+void xone_buffers_put(struct xone_buffers *bufs, struct xone_buffer *buf);
+
+struct xone_buffer *xone_buffers_first_busy(struct xone_buffers *bufs);
+void xone_buffers_take_busy(struct xone_buffers *bufs, struct list_head *list);
+void xone_buffers_stop(struct xone_buffers *bufs);
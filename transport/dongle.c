@@ -13,19 +13,51 @@
 #include <linux/firmware.h>
 #include <linux/kernel.h>
 #include <linux/workqueue.h>
+#include <linux/debugfs.h>
+#include <linux/seq_file.h>
+#include <linux/rcupdate.h>
+#include <linux/refcount.h>
+#include <linux/completion.h>
 #include <net/cfg80211.h>
 
 #include "mt76.h"
 #include "../bus/bus.h"
+#include "../bus/trace.h"
 
-#define XONE_DONGLE_NUM_IN_URBS 12
-#define XONE_DONGLE_NUM_OUT_URBS 12
+#define XONE_DONGLE_NUM_CMD_URBS 12
+
+/* WLAN IN and OUT URBs are resized by xone_dongle_pool_work */
+#define XONE_DONGLE_IN_URBS_PER_CLIENT 1
+#define XONE_DONGLE_OUT_URBS_PER_CLIENT 2
+#define XONE_DONGLE_POOL_STEP 2
+#define XONE_DONGLE_POOL_LIMIT 64
+#define XONE_DONGLE_POOL_GROW_DELAY msecs_to_jiffies(100)
+#define XONE_DONGLE_POOL_DECAY_DELAY msecs_to_jiffies(1000)
+
+/* waits for an OUT URB longer than this grow the pool */
+#define XONE_DONGLE_POOL_WAIT_NS (500 * NSEC_PER_USEC)
 
 #define XONE_DONGLE_LEN_CMD_PKT 0x0654
 #define XONE_DONGLE_LEN_WLAN_PKT 0x8400
 
+/* GIP payload, the message after the command header fits a command packet */
+#define XONE_DONGLE_LEN_OUT_PAYLOAD (XONE_DONGLE_LEN_CMD_PKT - \
+				     (sizeof(struct xone_dongle_tx_header) - \
+				      MT_CMD_HDR_LEN))
+
+/* header, payload, up to 4 bytes of padding and trailer */
+#define XONE_DONGLE_LEN_OUT_BUF (sizeof(struct xone_dongle_tx_header) + \
+				 XONE_DONGLE_LEN_CMD_PKT + sizeof(u32) + \
+				 MT_CMD_HDR_LEN)
+
 #define XONE_DONGLE_MAX_CLIENTS 16
 
+/* OUT URBs left for latency-sensitive commands under contention */
+#define XONE_DONGLE_TX_URGENT_URBS 2
+
+/* credit in bytes added to a waiting client per round */
+#define XONE_DONGLE_TX_QUANTUM XONE_DONGLE_LEN_CMD_PKT
+
 /* autosuspend delay in ms */
 #define XONE_DONGLE_SUSPEND_DELAY 60000
 
@@ -39,11 +71,36 @@
 #define XONE_DONGLE_OFFICIAL_PRODUCT 0x02fe
 #define XONE_DONGLE_KNOCKOFF_PRODUCT1 0x02e6
 
+static unsigned int in_urbs_min = 2;
+module_param(in_urbs_min, uint, 0644);
+MODULE_PARM_DESC(in_urbs_min, "Minimum number of WLAN IN URBs");
+
+static unsigned int in_urbs_max = 12;
+module_param(in_urbs_max, uint, 0644);
+MODULE_PARM_DESC(in_urbs_max, "Maximum number of WLAN IN URBs");
+
+static unsigned int out_urbs_min = 4;
+module_param(out_urbs_min, uint, 0644);
+MODULE_PARM_DESC(out_urbs_min, "Minimum number of OUT URBs");
+
+static unsigned int out_urbs_max = 32;
+module_param(out_urbs_max, uint, 0644);
+MODULE_PARM_DESC(out_urbs_max, "Maximum number of OUT URBs");
+
 enum xone_dongle_queue {
 	XONE_DONGLE_QUEUE_DATA = 0x00,
 	XONE_DONGLE_QUEUE_AUDIO = 0x02,
 };
 
+/* timed steps of xone_dongle_fw_load */
+enum xone_dongle_phase {
+	XONE_DONGLE_PHASE_REQUEST,
+	XONE_DONGLE_PHASE_FIRMWARE,
+	XONE_DONGLE_PHASE_URBS,
+	XONE_DONGLE_PHASE_RADIO,
+	XONE_DONGLE_PHASE_COUNT,
+};
+
 enum xone_dongle_fw_state {
 	XONE_DONGLE_FW_STATE_PENDING,
 	XONE_DONGLE_FW_STATE_STOP_LOADING,
@@ -51,18 +108,66 @@ enum xone_dongle_fw_state {
 	XONE_DONGLE_FW_STATE_READY,
 };
 
-struct xone_dongle_skb_cb {
+/* context of an OUT URB, the buffer is allocated with the URB */
+struct xone_dongle_out {
 	struct xone_dongle *dongle;
-	struct urb *urb;
+	/* for tracing, adapter might be gone on completion */
+	int adapter;
+	int length;
+	u8 wcid;
+	/* handed out by the scheduler, charged to the deficit */
+	bool granted;
+};
+
+/* per-WCID state of the OUT URB scheduler, protected by tx_lock */
+struct xone_dongle_tx_queue {
+	/* deficit round-robin credit in bytes */
+	int deficit;
+	/* URBs reserved for the client and taken by the client */
+	int granted;
+	int held;
+	u64 wait_start;
+
+	/* reset by writing to the debugfs file */
+	u64 waits;
+	u64 wait_ns;
+	u64 wait_max_ns;
+	u64 bytes;
+	int depth_max;
+};
+
+/* command header + WCID data + TXWI + QoS header + padding */
+struct xone_dongle_tx_header {
+	__le32 info;
+	u8 data[8];
+	struct mt76_txwi txwi;
+	struct ieee80211_qos_hdr hdr;
+	u8 padding[2];
+} __packed;
+
+/* cursor over a received URB buffer, avoids copying into an skb */
+struct xone_dongle_rx {
+	u8 *data;
+	unsigned int len;
+
+	/* completion time of the URB */
+	u64 time;
 };
 
 struct xone_dongle_client {
 	struct xone_dongle *dongle;
 	u8 wcid;
 	u8 address[ETH_ALEN];
-	bool encryption_enabled;
+
+	/* static part of every packet, see xone_dongle_init_tx_header */
+	struct xone_dongle_tx_header tx_header;
 
 	struct gip_adapter *adapter;
+
+	/* held by the receive path while the adapter is in use */
+	refcount_t refs;
+	struct completion released;
+	struct rcu_head rcu;
 };
 
 struct xone_dongle_event {
@@ -86,17 +191,43 @@ struct xone_dongle {
 
 	struct usb_anchor urbs_in_idle;
 	struct usb_anchor urbs_in_busy;
+	struct usb_anchor urbs_in_retired;
 	struct usb_anchor urbs_out_idle;
 	struct usb_anchor urbs_out_busy;
 
+	/* shares OUT URBs between clients, see xone_dongle_tx_schedule */
+	spinlock_t tx_lock;
+	int tx_urbs;
+	int tx_idle;
+	int tx_granted;
+	int tx_cursor;
+	DECLARE_BITMAP(tx_waiting, XONE_DONGLE_MAX_CLIENTS);
+	DECLARE_BITMAP(tx_urgent, XONE_DONGLE_MAX_CLIENTS);
+	struct xone_dongle_tx_queue tx_queues[XONE_DONGLE_MAX_CLIENTS];
+	int tx_busy_max;
+	int tx_urbs_max;
+
+	/* resizes the URB pools, stopped before the URBs are freed */
+	spinlock_t pool_lock;
+	struct delayed_work pool_work;
+	bool pool_stopped;
+	atomic_t pool_pressure;
+	int pool_boost;
+	unsigned long pool_decay;
+	int pool_out_target;
+	int pool_in_urbs;
+	int pool_in_urbs_max;
+	/* WLAN IN URBs to be retired on completion */
+	atomic_t pool_in_retire;
+
 	/* serializes pairing changes */
 	struct mutex pairing_lock;
 	struct delayed_work pairing_work;
 	bool pairing;
 
-	/* serializes access to clients array */
+	/* serializes updates of clients array, lookups use RCU */
 	spinlock_t clients_lock;
-	struct xone_dongle_client *clients[XONE_DONGLE_MAX_CLIENTS];
+	struct xone_dongle_client __rcu *clients[XONE_DONGLE_MAX_CLIENTS];
 	atomic_t client_count;
 	wait_queue_head_t disconnect_wait;
 
@@ -104,79 +235,479 @@ struct xone_dongle {
 	struct work_struct load_fw_work;
 
 	enum xone_dongle_fw_state fw_state;
+	u64 phase_ns[XONE_DONGLE_PHASE_COUNT];
 	u16 vendor;
 	u16 product;
+
+	struct gip_stats stats;
+	atomic64_t rx_time_max_ns;
+
+	struct dentry *debugfs;
 };
 
-static void xone_dongle_prep_packet(struct xone_dongle_client *client,
-				    struct sk_buff *skb,
-				    enum xone_dongle_queue queue)
+enum xone_dongle_stat {
+	XONE_DONGLE_STAT_RX_URBS,
+	XONE_DONGLE_STAT_RX_ERRORS,
+	XONE_DONGLE_STAT_RX_PROCESS_ERRORS,
+	XONE_DONGLE_STAT_RX_RESUBMIT_ERRORS,
+	/* time spent processing received URBs */
+	XONE_DONGLE_STAT_RX_TIME_NS,
+	XONE_DONGLE_STAT_TX_WAITS,
+	XONE_DONGLE_STAT_TX_URGENT_GRANTS,
+	XONE_DONGLE_STAT_TX_AUDIO_DROPS,
+	XONE_DONGLE_STAT_POOL_GROWS,
+	XONE_DONGLE_STAT_POOL_SHRINKS,
+	XONE_DONGLE_STAT_COUNT,
+};
+
+static const char * const xone_dongle_stat_names[] = {
+	[XONE_DONGLE_STAT_RX_URBS] = "rx_urbs",
+	[XONE_DONGLE_STAT_RX_ERRORS] = "rx_errors",
+	[XONE_DONGLE_STAT_RX_PROCESS_ERRORS] = "rx_process_errors",
+	[XONE_DONGLE_STAT_RX_RESUBMIT_ERRORS] = "rx_resubmit_errors",
+	[XONE_DONGLE_STAT_RX_TIME_NS] = "rx_time_ns",
+	[XONE_DONGLE_STAT_TX_WAITS] = "tx_waits",
+	[XONE_DONGLE_STAT_TX_URGENT_GRANTS] = "tx_urgent_grants",
+	[XONE_DONGLE_STAT_TX_AUDIO_DROPS] = "tx_audio_drops",
+	[XONE_DONGLE_STAT_POOL_GROWS] = "pool_grows",
+	[XONE_DONGLE_STAT_POOL_SHRINKS] = "pool_shrinks",
+};
+
+static_assert(ARRAY_SIZE(xone_dongle_stat_names) == XONE_DONGLE_STAT_COUNT);
+
+static struct dentry *xone_dongle_debugfs_root;
+
+/*
+ * Clients are only removed from the ordered event workqueue or once it has
+ * been destroyed, the client stays valid for the caller.
+ */
+static struct xone_dongle_client *
+xone_dongle_client_slot(struct xone_dongle *dongle, u8 wcid)
 {
-	struct ieee80211_qos_hdr hdr = {};
-	struct mt76_txwi txwi = {};
-	u8 data[] = {
-		0x00, 0x00, queue, client->wcid - 1, 0x00, 0x00, 0x00, 0x00,
-	};
+	struct xone_dongle_client *client;
+	unsigned long flags;
 
-	/* frame is sent from AP (DS) */
-	/* duration is the time required to transmit (in μs) */
-	hdr.frame_control = cpu_to_le16(IEEE80211_FTYPE_DATA |
-					IEEE80211_STYPE_QOS_DATA |
-					IEEE80211_FCTL_FROMDS);
+	spin_lock_irqsave(&dongle->clients_lock, flags);
+	client = rcu_dereference_protected(dongle->clients[wcid - 1],
+			lockdep_is_held(&dongle->clients_lock));
+	spin_unlock_irqrestore(&dongle->clients_lock, flags);
+
+	return client;
+}
+
+/* clears the slot, lookups might still hold references to the client */
+static struct xone_dongle_client *
+xone_dongle_take_client(struct xone_dongle *dongle, u8 wcid)
+{
+	struct xone_dongle_client *client;
+	unsigned long flags;
+
+	spin_lock_irqsave(&dongle->clients_lock, flags);
+	client = rcu_dereference_protected(dongle->clients[wcid - 1],
+			lockdep_is_held(&dongle->clients_lock));
+	RCU_INIT_POINTER(dongle->clients[wcid - 1], NULL);
+	spin_unlock_irqrestore(&dongle->clients_lock, flags);
+
+	return client;
+}
+
+static struct xone_dongle_client *
+xone_dongle_get_client(struct xone_dongle *dongle, u8 wcid)
+{
+	struct xone_dongle_client *client;
+
+	rcu_read_lock();
+
+	client = rcu_dereference(dongle->clients[wcid - 1]);
+	if (client && !refcount_inc_not_zero(&client->refs))
+		client = NULL;
+
+	rcu_read_unlock();
+
+	return client;
+}
+
+static void xone_dongle_put_client(struct xone_dongle_client *client)
+{
+	if (refcount_dec_and_test(&client->refs))
+		complete(&client->released);
+}
+
+static void xone_dongle_pool_schedule(struct xone_dongle *dongle,
+				      unsigned long delay)
+{
+	unsigned long flags;
+
+	spin_lock_irqsave(&dongle->pool_lock, flags);
+
+	if (!dongle->pool_stopped)
+		mod_delayed_work(system_wq, &dongle->pool_work, delay);
+
+	spin_unlock_irqrestore(&dongle->pool_lock, flags);
+}
+
+/* OUT URBs are running short, grows the pool after a short delay */
+static void xone_dongle_pool_pressure(struct xone_dongle *dongle)
+{
+	if (atomic_inc_return(&dongle->pool_pressure) == 1)
+		xone_dongle_pool_schedule(dongle, XONE_DONGLE_POOL_GROW_DELAY);
+}
+
+/* next set bit at or after start, wrapping around */
+static int xone_dongle_tx_find(unsigned long *bits, int start)
+{
+	int i = find_next_bit(bits, XONE_DONGLE_MAX_CLIENTS, start);
+
+	if (i >= XONE_DONGLE_MAX_CLIENTS)
+		i = find_first_bit(bits, XONE_DONGLE_MAX_CLIENTS);
+
+	return i < XONE_DONGLE_MAX_CLIENTS ? i : -ENOENT;
+}
+
+static int xone_dongle_tx_available(struct xone_dongle *dongle)
+{
+	return dongle->tx_idle - dongle->tx_granted;
+}
+
+static void xone_dongle_tx_grant(struct xone_dongle *dongle, int i, u64 now)
+{
+	struct xone_dongle_tx_queue *queue = &dongle->tx_queues[i];
+	u64 wait = now - queue->wait_start;
+
+	clear_bit(i, dongle->tx_waiting);
+	clear_bit(i, dongle->tx_urgent);
+
+	queue->granted++;
+	queue->waits++;
+	queue->wait_ns += wait;
+	queue->wait_max_ns = max(queue->wait_max_ns, wait);
+	dongle->tx_granted++;
+
+	if (wait > XONE_DONGLE_POOL_WAIT_NS)
+		xone_dongle_pool_pressure(dongle);
+}
+
+/* deficit round-robin over the waiting clients */
+static int xone_dongle_tx_next(struct xone_dongle *dongle)
+{
+	struct xone_dongle_tx_queue *queue;
+	int i;
+
+	for (;;) {
+		i = xone_dongle_tx_find(dongle->tx_waiting, dongle->tx_cursor);
+		if (i < 0)
+			return i;
+
+		queue = &dongle->tx_queues[i];
+		if (queue->deficit > 0) {
+			/* client keeps its turn while it has credit */
+			dongle->tx_cursor = i;
+			return i;
+		}
+
+		queue->deficit += XONE_DONGLE_TX_QUANTUM;
+		dongle->tx_cursor = (i + 1) % XONE_DONGLE_MAX_CLIENTS;
+	}
+}
+
+/*
+ * Hands idle URBs to waiting clients, urgent ones first.
+ * Waiting clients have stalled with queued packets and claim their grant
+ * as soon as they are kicked. Returns a mask of the clients to kick.
+ */
+static unsigned long xone_dongle_tx_schedule(struct xone_dongle *dongle)
+{
+	unsigned long kick = 0;
+	u64 now = ktime_get_ns();
+	int i;
+
+	lockdep_assert_held(&dongle->tx_lock);
+
+	while (xone_dongle_tx_available(dongle) > 0) {
+		i = xone_dongle_tx_find(dongle->tx_urgent, 0);
+		if (i < 0)
+			break;
+
+		xone_dongle_tx_grant(dongle, i, now);
+		gip_stats_inc(&dongle->stats,
+			      XONE_DONGLE_STAT_TX_URGENT_GRANTS);
+		kick |= BIT(i);
+	}
+
+	while (xone_dongle_tx_available(dongle) > XONE_DONGLE_TX_URGENT_URBS) {
+		i = xone_dongle_tx_next(dongle);
+		if (i < 0)
+			break;
+
+		xone_dongle_tx_grant(dongle, i, now);
+		kick |= BIT(i);
+	}
+
+	return kick;
+}
+
+static void xone_dongle_kick_clients(struct xone_dongle *dongle,
+				     unsigned long mask)
+{
+	struct xone_dongle_client *client;
+	int i;
+
+	for_each_set_bit(i, &mask, XONE_DONGLE_MAX_CLIENTS) {
+		client = xone_dongle_get_client(dongle, i + 1);
+		if (!client)
+			continue;
+
+		gip_tx_kick(client->adapter);
+		xone_dongle_put_client(client);
+	}
+}
+
+/* clients using or waiting for URBs */
+static int xone_dongle_tx_active(struct xone_dongle *dongle)
+{
+	int i, count = 0;
+
+	for (i = 0; i < XONE_DONGLE_MAX_CLIENTS; i++)
+		if (dongle->tx_queues[i].held ||
+		    test_bit(i, dongle->tx_waiting))
+			count++;
+
+	return count;
+}
+
+/*
+ * Audio cannot wait for a grant, the samples are dropped instead.
+ * Below its fair share a client may use the urgent URBs for audio.
+ */
+static bool xone_dongle_tx_admit_audio(struct xone_dongle *dongle,
+				       struct xone_dongle_tx_queue *queue)
+{
+	int avail = xone_dongle_tx_available(dongle);
+	int share;
+
+	if (avail > XONE_DONGLE_TX_URGENT_URBS)
+		return true;
+
+	if (avail <= 0)
+		return false;
+
+	share = (dongle->tx_urbs - XONE_DONGLE_TX_URGENT_URBS) /
+		max(xone_dongle_tx_active(dongle), 1);
+
+	return queue->held < share;
+}
+
+/*
+ * Takes an idle URB if the client was granted one or none are contended.
+ * Otherwise the client waits for its turn and gets kicked later.
+ */
+static struct urb *xone_dongle_tx_take(struct xone_dongle_client *client,
+				       struct gip_adapter_buffer *buf)
+{
+	struct xone_dongle *dongle = client->dongle;
+	struct xone_dongle_tx_queue *queue;
+	struct xone_dongle_out *out;
+	struct urb *urb;
+	unsigned long flags, kick;
+	int i = client->wcid - 1;
+	int depth = 0;
+	bool granted = false;
+
+	if (buf->type == GIP_BUF_DATA)
+		depth = gip_tx_depth(client->adapter);
+
+	spin_lock_irqsave(&dongle->tx_lock, flags);
+
+	queue = &dongle->tx_queues[i];
+	queue->depth_max = max(queue->depth_max, depth);
+
+	if (queue->granted) {
+		queue->granted--;
+		dongle->tx_granted--;
+		granted = true;
+	} else if (buf->type == GIP_BUF_AUDIO) {
+		if (!xone_dongle_tx_admit_audio(dongle, queue)) {
+			spin_unlock_irqrestore(&dongle->tx_lock, flags);
+			gip_stats_inc(&dongle->stats,
+				      XONE_DONGLE_STAT_TX_AUDIO_DROPS);
+			xone_dongle_pool_pressure(dongle);
+			return NULL;
+		}
+	} else if (xone_dongle_tx_available(dongle) <=
+		   (buf->urgent ? 0 : XONE_DONGLE_TX_URGENT_URBS)) {
+		if (!test_bit(i, dongle->tx_waiting) &&
+		    !test_bit(i, dongle->tx_urgent)) {
+			queue->wait_start = ktime_get_ns();
+			gip_stats_inc(&dongle->stats,
+				      XONE_DONGLE_STAT_TX_WAITS);
+		}
+
+		set_bit(i, buf->urgent ? dongle->tx_urgent :
+					 dongle->tx_waiting);
+		spin_unlock_irqrestore(&dongle->tx_lock, flags);
+
+		return NULL;
+	}
+
+	dongle->tx_idle--;
+	dongle->tx_busy_max = max(dongle->tx_busy_max,
+				  dongle->tx_urbs - dongle->tx_idle);
+	queue->held++;
+
+	spin_unlock_irqrestore(&dongle->tx_lock, flags);
+
+	/* idle count is only raised after anchoring */
+	urb = usb_get_from_anchor(&dongle->urbs_out_idle);
+	if (WARN_ON_ONCE(!urb)) {
+		spin_lock_irqsave(&dongle->tx_lock, flags);
+
+		dongle->tx_idle++;
+		queue->held--;
+		kick = xone_dongle_tx_schedule(dongle);
+
+		/* retry with the next released URB instead of spinning */
+		if (buf->type == GIP_BUF_DATA) {
+			queue->wait_start = ktime_get_ns();
+			set_bit(i, buf->urgent ? dongle->tx_urgent :
+						 dongle->tx_waiting);
+		}
+
+		spin_unlock_irqrestore(&dongle->tx_lock, flags);
+
+		xone_dongle_kick_clients(dongle, kick);
+		return NULL;
+	}
+
+	out = urb->context;
+	out->wcid = client->wcid;
+	out->granted = granted;
+
+	return urb;
+}
+
+/* returns an idle URB to the pool, called after anchoring it */
+static void xone_dongle_tx_release(struct xone_dongle *dongle, u8 wcid)
+{
+	unsigned long flags, kick;
+
+	spin_lock_irqsave(&dongle->tx_lock, flags);
+
+	dongle->tx_idle++;
+	dongle->tx_queues[wcid - 1].held--;
+	kick = xone_dongle_tx_schedule(dongle);
+
+	spin_unlock_irqrestore(&dongle->tx_lock, flags);
+
+	xone_dongle_kick_clients(dongle, kick);
+}
+
+static void xone_dongle_tx_charge(struct xone_dongle *dongle,
+				  struct xone_dongle_out *out, int len)
+{
+	struct xone_dongle_tx_queue *queue = &dongle->tx_queues[out->wcid - 1];
+	unsigned long flags;
+
+	spin_lock_irqsave(&dongle->tx_lock, flags);
+
+	/* only contended transfers count against the fair share */
+	if (out->granted)
+		queue->deficit -= len;
+
+	queue->bytes += len;
+
+	spin_unlock_irqrestore(&dongle->tx_lock, flags);
+}
+
+/* drops waits and grants of a removed client */
+static void xone_dongle_tx_forget(struct xone_dongle *dongle, u8 wcid)
+{
+	struct xone_dongle_tx_queue *queue = &dongle->tx_queues[wcid - 1];
+	unsigned long flags, kick;
+	int held;
+
+	spin_lock_irqsave(&dongle->tx_lock, flags);
+
+	clear_bit(wcid - 1, dongle->tx_waiting);
+	clear_bit(wcid - 1, dongle->tx_urgent);
+	dongle->tx_granted -= queue->granted;
+
+	/* URBs in flight are still released on completion */
+	held = queue->held;
+	memset(queue, 0, sizeof(*queue));
+	queue->held = held;
+
+	kick = xone_dongle_tx_schedule(dongle);
+
+	spin_unlock_irqrestore(&dongle->tx_lock, flags);
+
+	xone_dongle_kick_clients(dongle, kick);
+}
+
+static void xone_dongle_init_tx_header(struct xone_dongle_client *client)
+{
+	struct xone_dongle_tx_header *tx = &client->tx_header;
 
-	/* encrypt frame on transmission */
-	if (client->encryption_enabled)
-		hdr.frame_control |= cpu_to_le16(IEEE80211_FCTL_PROTECTED);
+	memset(tx, 0, sizeof(*tx));
 
-	hdr.duration_id = cpu_to_le16(144);
-	memcpy(hdr.addr1, client->address, ETH_ALEN);
-	memcpy(hdr.addr2, client->dongle->mt.address, ETH_ALEN);
-	memcpy(hdr.addr3, client->dongle->mt.address, ETH_ALEN);
+	/* queue is set for each packet */
+	tx->data[3] = client->wcid - 1;
 
 	/* wait for acknowledgment */
-	txwi.flags = cpu_to_le16(FIELD_PREP(MT_TXWI_FLAGS_MPDU_DENSITY,
-					    IEEE80211_HT_MPDU_DENSITY_4));
-	txwi.rate = cpu_to_le16(FIELD_PREP(MT_RXWI_RATE_PHY, MT_PHY_TYPE_OFDM));
-	txwi.ack_ctl = MT_TXWI_ACK_CTL_REQ;
-	txwi.wcid = client->wcid - 1;
-	txwi.len_ctl = cpu_to_le16(sizeof(hdr) + skb->len);
+	tx->txwi.flags = cpu_to_le16(FIELD_PREP(MT_TXWI_FLAGS_MPDU_DENSITY,
+						IEEE80211_HT_MPDU_DENSITY_4));
+	tx->txwi.rate = cpu_to_le16(FIELD_PREP(MT_RXWI_RATE_PHY,
+					       MT_PHY_TYPE_OFDM));
+	tx->txwi.ack_ctl = MT_TXWI_ACK_CTL_REQ;
+	tx->txwi.wcid = client->wcid - 1;
 
-	memset(skb_push(skb, 2), 0, 2);
-	memcpy(skb_push(skb, sizeof(hdr)), &hdr, sizeof(hdr));
-	memcpy(skb_push(skb, sizeof(txwi)), &txwi, sizeof(txwi));
-	memcpy(skb_push(skb, sizeof(data)), data, sizeof(data));
+	/* frame is sent from AP (DS) */
+	/* duration is the time required to transmit (in μs) */
+	tx->hdr.frame_control = cpu_to_le16(IEEE80211_FTYPE_DATA |
+					    IEEE80211_STYPE_QOS_DATA |
+					    IEEE80211_FCTL_FROMDS);
+	tx->hdr.duration_id = cpu_to_le16(144);
+	memcpy(tx->hdr.addr1, client->address, ETH_ALEN);
+	memcpy(tx->hdr.addr2, client->dongle->mt.address, ETH_ALEN);
+	memcpy(tx->hdr.addr3, client->dongle->mt.address, ETH_ALEN);
+}
 
-	xone_mt76_prep_command(skb, 0);
+static void xone_dongle_prep_packet(struct xone_dongle_client *client,
+				    struct urb *urb, int len,
+				    enum xone_dongle_queue queue)
+{
+	struct xone_dongle_tx_header *tx = urb->transfer_buffer;
+	/* message starts after the command header */
+	int msg_len = sizeof(*tx) - MT_CMD_HDR_LEN + len;
+	int pad = round_up(msg_len, sizeof(u32)) - msg_len + MT_CMD_HDR_LEN;
+
+	memcpy(tx, &client->tx_header, sizeof(*tx));
+	tx->info = xone_mt76_command_header(0, msg_len);
+	tx->data[2] = queue;
+	tx->txwi.len_ctl = cpu_to_le16(sizeof(tx->hdr) + len);
+
+	/* padding and trailer */
+	memset((u8 *)(tx + 1) + len, 0, pad);
+	urb->transfer_buffer_length = sizeof(*tx) + len + pad;
 }
 
 static int xone_dongle_get_buffer(struct gip_adapter *adap,
 				  struct gip_adapter_buffer *buf)
 {
 	struct xone_dongle_client *client = dev_get_drvdata(&adap->dev);
-	struct xone_dongle_skb_cb *cb;
+	struct xone_dongle_out *out;
 	struct urb *urb;
-	struct sk_buff *skb;
 
-	urb = usb_get_from_anchor(&client->dongle->urbs_out_idle);
+	urb = xone_dongle_tx_take(client, buf);
 	if (!urb)
 		return -ENOSPC;
 
-	skb = xone_mt76_alloc_message(XONE_DONGLE_LEN_CMD_PKT, GFP_ATOMIC);
-	if (!skb)
-		return -ENOMEM;
-
-	/* command header + WCID data + TXWI + QoS header + padding */
-	/* see xone_dongle_prep_packet and xone_mt76_prep_message */
-	skb_reserve(skb, MT_CMD_HDR_LEN + 8 + sizeof(struct mt76_txwi) +
-		    sizeof(struct ieee80211_qos_hdr) + 2 + MT_CMD_HDR_LEN);
-
-	cb = (struct xone_dongle_skb_cb *)skb->cb;
-	cb->dongle = client->dongle;
-	cb->urb = urb;
+	out = urb->context;
+	out->adapter = adap->id;
 
-	buf->context = skb;
-	buf->data = skb->data;
-	buf->length = skb_tailroom(skb);
+	buf->context = urb;
+	buf->data = urb->transfer_buffer +
+		    sizeof(struct xone_dongle_tx_header);
+	buf->length = XONE_DONGLE_LEN_OUT_PAYLOAD;
 
 	return 0;
 }
@@ -185,37 +716,47 @@ static int xone_dongle_submit_buffer(struct gip_adapter *adap,
 				     struct gip_adapter_buffer *buf)
 {
 	struct xone_dongle_client *client = dev_get_drvdata(&adap->dev);
-	struct xone_dongle_skb_cb *cb;
-	struct sk_buff *skb = buf->context;
+	struct urb *urb = buf->context;
+	struct xone_dongle_out *out = urb->context;
 	int err;
 
-	skb_put(skb, buf->length);
+	xone_dongle_tx_charge(client->dongle, out, buf->length);
+	out->length = buf->length;
 
 	if (buf->type == GIP_BUF_DATA)
-		xone_dongle_prep_packet(client, skb, XONE_DONGLE_QUEUE_DATA);
+		xone_dongle_prep_packet(client, urb, buf->length,
+					XONE_DONGLE_QUEUE_DATA);
 	else if (buf->type == GIP_BUF_AUDIO)
-		xone_dongle_prep_packet(client, skb, XONE_DONGLE_QUEUE_AUDIO);
+		xone_dongle_prep_packet(client, urb, buf->length,
+					XONE_DONGLE_QUEUE_AUDIO);
 	else
 		return -EINVAL;
 
-	cb = (struct xone_dongle_skb_cb *)skb->cb;
-	cb->urb->context = skb;
-	cb->urb->transfer_buffer = skb->data;
-	cb->urb->transfer_buffer_length = skb->len;
-	usb_anchor_urb(cb->urb, &client->dongle->urbs_out_busy);
+	usb_anchor_urb(urb, &client->dongle->urbs_out_busy);
 
-	err = usb_submit_urb(cb->urb, GFP_ATOMIC);
+	err = usb_submit_urb(urb, GFP_ATOMIC);
 	if (err) {
-		usb_unanchor_urb(cb->urb);
-		usb_anchor_urb(cb->urb, &client->dongle->urbs_out_idle);
-		dev_kfree_skb_any(skb);
+		usb_unanchor_urb(urb);
+		usb_anchor_urb(urb, &client->dongle->urbs_out_idle);
+		xone_dongle_tx_release(client->dongle, client->wcid);
 	}
 
-	usb_free_urb(cb->urb);
+	usb_free_urb(urb);
 
 	return err;
 }
 
+static void xone_dongle_put_buffer(struct gip_adapter *adap,
+				   struct gip_adapter_buffer *buf)
+{
+	struct xone_dongle_client *client = dev_get_drvdata(&adap->dev);
+	struct urb *urb = buf->context;
+
+	usb_anchor_urb(urb, &client->dongle->urbs_out_idle);
+	usb_free_urb(urb);
+	xone_dongle_tx_release(client->dongle, client->wcid);
+}
+
 static int xone_dongle_set_encryption_key(struct gip_adapter *adap,
 					  u8 *key, int len)
 {
@@ -228,6 +769,7 @@ static int xone_dongle_set_encryption_key(struct gip_adapter *adap,
 static struct gip_adapter_ops xone_dongle_adapter_ops = {
 	.get_buffer = xone_dongle_get_buffer,
 	.submit_buffer = xone_dongle_submit_buffer,
+	.put_buffer = xone_dongle_put_buffer,
 	.set_encryption_key = xone_dongle_set_encryption_key,
 };
 
@@ -339,6 +881,14 @@ static struct attribute *xone_dongle_attrs[] = {
 };
 ATTRIBUTE_GROUPS(xone_dongle);
 
+static void xone_dongle_free_client(struct xone_dongle_client *client)
+{
+	gip_destroy_adapter(client->adapter);
+
+	/* lookups might still be reading the refcount */
+	kfree_rcu(client, rcu);
+}
+
 static struct xone_dongle_client *
 xone_dongle_create_client(struct xone_dongle *dongle, u8 *addr)
 {
@@ -347,7 +897,7 @@ xone_dongle_create_client(struct xone_dongle *dongle, u8 *addr)
 
 	/* find free WCID */
 	for (i = 0; i < XONE_DONGLE_MAX_CLIENTS; i++)
-		if (!dongle->clients[i])
+		if (!rcu_access_pointer(dongle->clients[i]))
 			break;
 
 	if (i == XONE_DONGLE_MAX_CLIENTS)
@@ -360,6 +910,9 @@ xone_dongle_create_client(struct xone_dongle *dongle, u8 *addr)
 	client->dongle = dongle;
 	client->wcid = i + 1;
 	memcpy(client->address, addr, ETH_ALEN);
+	xone_dongle_init_tx_header(client);
+	refcount_set(&client->refs, 1);
+	init_completion(&client->released);
 
 	client->adapter = gip_create_adapter(dongle->mt.dev,
 					     &xone_dongle_adapter_ops, 1);
@@ -398,11 +951,12 @@ static int xone_dongle_add_client(struct xone_dongle *dongle, u8 *addr)
 		__func__, client->wcid, addr);
 
 	spin_lock_irqsave(&dongle->clients_lock, flags);
-	dongle->clients[client->wcid - 1] = client;
+	rcu_assign_pointer(dongle->clients[client->wcid - 1], client);
 	spin_unlock_irqrestore(&dongle->clients_lock, flags);
 
 	atomic_inc(&dongle->client_count);
 	usb_autopm_get_interface(to_usb_interface(dongle->mt.dev));
+	xone_dongle_pool_schedule(dongle, 0);
 
 	return 0;
 
@@ -417,21 +971,19 @@ static int xone_dongle_remove_client(struct xone_dongle *dongle, u8 wcid)
 {
 	struct xone_dongle_client *client;
 	int err;
-	unsigned long flags;
 
-	client = dongle->clients[wcid - 1];
+	client = xone_dongle_take_client(dongle, wcid);
 	if (!client)
 		return 0;
 
 	dev_dbg(dongle->mt.dev, "%s: wcid=%d, address=%pM\n",
 		__func__, wcid, client->address);
 
-	spin_lock_irqsave(&dongle->clients_lock, flags);
-	dongle->clients[wcid - 1] = NULL;
-	spin_unlock_irqrestore(&dongle->clients_lock, flags);
-
-	gip_destroy_adapter(client->adapter);
-	kfree(client);
+	/* wait for the receive path to drop its references */
+	xone_dongle_put_client(client);
+	wait_for_completion(&client->released);
+	xone_dongle_free_client(client);
+	xone_dongle_tx_forget(dongle, wcid);
 
 	err = xone_mt76_remove_client(&dongle->mt, wcid);
 	if (err)
@@ -444,6 +996,7 @@ static int xone_dongle_remove_client(struct xone_dongle *dongle, u8 wcid)
 
 	wake_up(&dongle->disconnect_wait);
 	usb_autopm_put_interface(to_usb_interface(dongle->mt.dev));
+	xone_dongle_pool_schedule(dongle, 0);
 
 	return err;
 }
@@ -468,7 +1021,7 @@ static int xone_dongle_enable_client_encryption(struct xone_dongle *dongle,
 	u8 data[] = { 0x00, 0x00 };
 	int err;
 
-	client = dongle->clients[wcid - 1];
+	client = xone_dongle_client_slot(dongle, wcid);
 	if (!client)
 		return -EINVAL;
 
@@ -481,7 +1034,10 @@ static int xone_dongle_enable_client_encryption(struct xone_dongle *dongle,
 	if (err)
 		return err;
 
-	client->encryption_enabled = true;
+	/* encrypt frames on transmission */
+	WRITE_ONCE(client->tx_header.hdr.frame_control,
+		   client->tx_header.hdr.frame_control |
+		   cpu_to_le16(IEEE80211_FCTL_PROTECTED));
 
 	return 0;
 }
@@ -546,23 +1102,53 @@ xone_dongle_alloc_event(struct xone_dongle *dongle,
 	return evt;
 }
 
+static void *xone_dongle_rx_pull(struct xone_dongle_rx *rx, unsigned int len)
+{
+	void *data = rx->data;
+
+	rx->data += len;
+	rx->len -= len;
+
+	return data;
+}
+
+static void xone_dongle_rx_trim(struct xone_dongle_rx *rx, unsigned int len)
+{
+	if (rx->len > len)
+		rx->len = len;
+}
+
+static unsigned int xone_dongle_rx_hdrlen(struct xone_dongle_rx *rx)
+{
+	unsigned int hdr_len;
+
+	/* see ieee80211_get_hdrlen_from_skb */
+	if (rx->len < 10)
+		return 0;
+
+	hdr_len = ieee80211_hdrlen(get_unaligned((__le16 *)rx->data));
+	if (hdr_len > rx->len)
+		return 0;
+
+	return hdr_len;
+}
+
 static int xone_dongle_handle_qos_data(struct xone_dongle *dongle,
-				       struct sk_buff *skb, u8 wcid)
+				       struct xone_dongle_rx *rx, u8 wcid)
 {
 	struct xone_dongle_client *client;
-	int err = 0;
-	unsigned long flags;
+	int err;
 
 	if (!wcid || wcid > XONE_DONGLE_MAX_CLIENTS)
 		return 0;
 
-	spin_lock_irqsave(&dongle->clients_lock, flags);
-
-	client = dongle->clients[wcid - 1];
-	if (client)
-		err = gip_process_buffer(client->adapter, skb->data, skb->len);
+	client = xone_dongle_get_client(dongle, wcid);
+	if (!client)
+		return 0;
 
-	spin_unlock_irqrestore(&dongle->clients_lock, flags);
+	err = gip_process_buffer(client->adapter, rx->data, rx->len,
+				 rx->time);
+	xone_dongle_put_client(client);
 
 	return err;
 }
@@ -602,16 +1188,16 @@ static int xone_dongle_handle_disassociation(struct xone_dongle *dongle,
 }
 
 static int xone_dongle_handle_client_command(struct xone_dongle *dongle,
-					     struct sk_buff *skb,
+					     struct xone_dongle_rx *rx,
 					     u8 wcid, u8 *addr)
 {
 	struct xone_dongle_event *evt;
 	enum xone_dongle_event_type evt_type;
 
-	if (skb->len < 2 || skb->data[0] != XONE_MT_WLAN_RESERVED)
+	if (rx->len < 2 || rx->data[0] != XONE_MT_WLAN_RESERVED)
 		return -EINVAL;
 
-	switch (skb->data[1]) {
+	switch (rx->data[1]) {
 	case XONE_MT_CLIENT_PAIR_REQ:
 		evt_type = XONE_DONGLE_EVT_PAIR_CLIENT;
 		break;
@@ -651,14 +1237,14 @@ static int xone_dongle_handle_button(struct xone_dongle *dongle)
 }
 
 static int xone_dongle_handle_loss(struct xone_dongle *dongle,
-				   struct sk_buff *skb)
+				   struct xone_dongle_rx *rx)
 {
 	u8 wcid;
 
-	if (skb->len < sizeof(wcid))
+	if (rx->len < sizeof(wcid))
 		return -EINVAL;
 
-	wcid = skb->data[0];
+	wcid = rx->data[0];
 	if (!wcid || wcid > XONE_DONGLE_MAX_CLIENTS)
 		return 0;
 
@@ -668,29 +1254,31 @@ static int xone_dongle_handle_loss(struct xone_dongle *dongle,
 }
 
 static int xone_dongle_process_frame(struct xone_dongle *dongle,
-				     struct sk_buff *skb,
-				     unsigned int hdr_len, u8 wcid)
+				     struct xone_dongle_rx *rx,
+				     unsigned int hdr_len, unsigned int pad,
+				     u8 wcid)
 {
 	struct ieee80211_hdr_3addr *hdr =
-		(struct ieee80211_hdr_3addr *)skb->data;
+		(struct ieee80211_hdr_3addr *)rx->data;
 	u16 type;
 
 	/* ignore invalid frames */
-	if (skb->len < hdr_len || hdr_len < sizeof(*hdr))
+	if (rx->len < hdr_len + pad || hdr_len < sizeof(*hdr))
 		return 0;
 
-	skb_pull(skb, hdr_len);
+	/* frame body follows the padding */
+	xone_dongle_rx_pull(rx, hdr_len + pad);
 	type = le16_to_cpu(hdr->frame_control);
 
 	switch (type & (IEEE80211_FCTL_FTYPE | IEEE80211_FCTL_STYPE)) {
 	case IEEE80211_FTYPE_DATA | IEEE80211_STYPE_QOS_DATA:
-		return xone_dongle_handle_qos_data(dongle, skb, wcid);
+		return xone_dongle_handle_qos_data(dongle, rx, wcid);
 	case IEEE80211_FTYPE_MGMT | IEEE80211_STYPE_ASSOC_REQ:
 		return xone_dongle_handle_association(dongle, hdr->addr2);
 	case IEEE80211_FTYPE_MGMT | IEEE80211_STYPE_DISASSOC:
 		return xone_dongle_handle_disassociation(dongle, wcid);
 	case IEEE80211_FTYPE_MGMT | XONE_MT_WLAN_RESERVED:
-		return xone_dongle_handle_client_command(dongle, skb, wcid,
+		return xone_dongle_handle_client_command(dongle, rx, wcid,
 							 hdr->addr2);
 	}
 
@@ -698,57 +1286,65 @@ static int xone_dongle_process_frame(struct xone_dongle *dongle,
 }
 
 static int xone_dongle_process_wlan(struct xone_dongle *dongle,
-				    struct sk_buff *skb)
+				    struct xone_dongle_rx *rx)
 {
-	struct mt76_rxwi *rxwi = (struct mt76_rxwi *)skb->data;
-	unsigned int hdr_len;
+	struct mt76_rxwi *rxwi;
+	unsigned int hdr_len, pad = 0;
 	u32 ctl;
 
-	if (skb->len < sizeof(*rxwi))
+	if (rx->len < sizeof(*rxwi))
 		return -EINVAL;
 
-	skb_pull(skb, sizeof(*rxwi));
-	hdr_len = ieee80211_get_hdrlen_from_skb(skb);
+	rxwi = xone_dongle_rx_pull(rx, sizeof(*rxwi));
+	hdr_len = xone_dongle_rx_hdrlen(rx);
 
 	/* 2 bytes of padding after 802.11 header */
 	if (rxwi->rxinfo & cpu_to_le32(MT_RXINFO_L2PAD)) {
-		if (skb->len < hdr_len + 2)
+		if (rx->len < hdr_len + 2)
 			return -EINVAL;
 
-		memmove(skb->data + 2, skb->data, hdr_len);
-		skb_pull(skb, 2);
+		pad = 2;
 	}
 
+	/* the MPDU length does not include the padding */
 	ctl = le32_to_cpu(rxwi->ctl);
-	skb_trim(skb, FIELD_GET(MT_RXWI_CTL_MPDU_LEN, ctl));
+	xone_dongle_rx_trim(rx, FIELD_GET(MT_RXWI_CTL_MPDU_LEN, ctl) + pad);
 
-	return xone_dongle_process_frame(dongle, skb, hdr_len,
+	return xone_dongle_process_frame(dongle, rx, hdr_len, pad,
 					 FIELD_GET(MT_RXWI_CTL_WCID, ctl));
 }
 
 static int xone_dongle_process_message(struct xone_dongle *dongle,
-				       struct sk_buff *skb)
+				       struct xone_dongle_rx *rx)
 {
 	enum mt76_dma_msg_port port;
 	u32 info;
+	u8 seq;
 
 	/* command header + trailer */
-	if (skb->len < MT_CMD_HDR_LEN * 2)
+	if (rx->len < MT_CMD_HDR_LEN * 2)
 		return -EINVAL;
 
-	info = get_unaligned_le32(skb->data);
+	info = get_unaligned_le32(rx->data);
 	port = FIELD_GET(MT_RX_FCE_INFO_D_PORT, info);
+	seq = FIELD_GET(MT_RX_FCE_INFO_CMD_SEQ, info);
 
 	/* ignore command reponses */
-	if (FIELD_GET(MT_RX_FCE_INFO_CMD_SEQ, info) == 0x01)
+	if (seq == 0x01)
+		return 0;
+
+	/* responses to queued commands */
+	if (seq && port == MT_CPU_RX_PORT) {
+		xone_mt76_handle_response(&dongle->mt, info);
 		return 0;
+	}
 
 	/* remove header + trailer */
-	skb_pull(skb, MT_CMD_HDR_LEN);
-	skb_trim(skb, skb->len - MT_CMD_HDR_LEN);
+	xone_dongle_rx_pull(rx, MT_CMD_HDR_LEN);
+	rx->len -= MT_CMD_HDR_LEN;
 
 	if (port == MT_WLAN_PORT)
-		return xone_dongle_process_wlan(dongle, skb);
+		return xone_dongle_process_wlan(dongle, rx);
 
 	if (port != MT_CPU_RX_PORT)
 		return 0;
@@ -757,30 +1353,29 @@ static int xone_dongle_process_message(struct xone_dongle *dongle,
 	case XONE_MT_EVT_BUTTON:
 		return xone_dongle_handle_button(dongle);
 	case XONE_MT_EVT_PACKET_RX:
-		return xone_dongle_process_wlan(dongle, skb);
+		return xone_dongle_process_wlan(dongle, rx);
 	case XONE_MT_EVT_CLIENT_LOST:
-		return xone_dongle_handle_loss(dongle, skb);
+		return xone_dongle_handle_loss(dongle, rx);
 	}
 
 	return 0;
 }
 
 static int xone_dongle_process_buffer(struct xone_dongle *dongle,
-				      void *data, int len)
+				      void *data, int len, u64 time)
 {
-	struct sk_buff *skb;
+	/* parsed in place, the URB is only resubmitted afterwards */
+	struct xone_dongle_rx rx = {
+		.data = data,
+		.len = len,
+		.time = time,
+	};
 	int err;
 
 	if (!len)
 		return 0;
 
-	skb = dev_alloc_skb(len);
-	if (!skb)
-		return -ENOMEM;
-
-	skb_put_data(skb, data, len);
-
-	err = xone_dongle_process_message(dongle, skb);
+	err = xone_dongle_process_message(dongle, &rx);
 	if (err) {
 		dev_err(dongle->mt.dev, "%s: process failed: %d\n",
 			__func__, err);
@@ -788,14 +1383,31 @@ static int xone_dongle_process_buffer(struct xone_dongle *dongle,
 				     16, 1, data, len, false);
 	}
 
-	dev_kfree_skb(skb);
-
 	return err;
 }
 
-static void xone_dongle_complete_in(struct urb *urb)
+static void xone_dongle_account_rx(struct xone_dongle *dongle, u64 start)
+{
+	u64 delta = ktime_get_ns() - start;
+	s64 max = atomic64_read(&dongle->rx_time_max_ns);
+
+	gip_stats_inc(&dongle->stats, XONE_DONGLE_STAT_RX_URBS);
+	gip_stats_add(&dongle->stats, XONE_DONGLE_STAT_RX_TIME_NS, delta);
+
+	while (delta > max) {
+		s64 old = atomic64_cmpxchg(&dongle->rx_time_max_ns, max, delta);
+
+		if (old == max)
+			break;
+
+		max = old;
+	}
+}
+
+static void xone_dongle_complete_in(struct urb *urb)
 {
 	struct xone_dongle *dongle = urb->context;
+	u64 start;
 	int err;
 
 	switch (urb->status) {
@@ -807,19 +1419,35 @@ static void xone_dongle_complete_in(struct urb *urb)
 		usb_anchor_urb(urb, &dongle->urbs_in_idle);
 		return;
 	default:
+		gip_stats_inc(&dongle->stats, XONE_DONGLE_STAT_RX_ERRORS);
 		goto resubmit;
 	}
 
+	start = ktime_get_ns();
 	err = xone_dongle_process_buffer(dongle, urb->transfer_buffer,
-					 urb->actual_length);
-	if (err)
+					 urb->actual_length, start);
+	if (err) {
+		gip_stats_inc(&dongle->stats,
+			      XONE_DONGLE_STAT_RX_PROCESS_ERRORS);
 		dev_err(dongle->mt.dev, "%s: process failed: %d\n",
 			__func__, err);
+	}
+
+	xone_dongle_account_rx(dongle, start);
 
 resubmit:
+	/* pool has shrunk, freed by xone_dongle_pool_work */
+	if (usb_pipeendpoint(urb->pipe) == XONE_MT_EP_IN_WLAN &&
+	    atomic_add_unless(&dongle->pool_in_retire, -1, 0)) {
+		usb_anchor_urb(urb, &dongle->urbs_in_retired);
+		return;
+	}
+
 	/* can fail during USB device removal */
 	err = usb_submit_urb(urb, GFP_ATOMIC);
 	if (err) {
+		gip_stats_inc(&dongle->stats,
+			      XONE_DONGLE_STAT_RX_RESUBMIT_ERRORS);
 		dev_dbg(dongle->mt.dev, "%s: submit failed: %d\n",
 			__func__, err);
 		usb_anchor_urb(urb, &dongle->urbs_in_idle);
@@ -830,66 +1458,335 @@ resubmit:
 
 static void xone_dongle_complete_out(struct urb *urb)
 {
-	struct sk_buff *skb = urb->context;
-	struct xone_dongle_skb_cb *cb = (struct xone_dongle_skb_cb *)skb->cb;
+	struct xone_dongle_out *out = urb->context;
+	struct xone_dongle *dongle = out->dongle;
 
-	usb_anchor_urb(urb, &cb->dongle->urbs_out_idle);
-	dev_consume_skb_any(skb);
+	trace_gip_tx_complete(out->adapter, urb, out->length, urb->status);
+
+	usb_anchor_urb(urb, &dongle->urbs_out_idle);
+	xone_dongle_tx_release(dongle, out->wcid);
 }
 
-static int xone_dongle_init_urbs_in(struct xone_dongle *dongle,
-				    int ep, int buf_len)
+static int xone_dongle_add_urb_in(struct xone_dongle *dongle,
+				  int ep, int buf_len)
 {
 	struct xone_mt76 *mt = &dongle->mt;
 	struct urb *urb;
 	void *buf;
-	int i, err;
+	int err;
+
+	urb = usb_alloc_urb(0, GFP_KERNEL);
+	if (!urb)
+		return -ENOMEM;
 
-	for (i = 0; i < XONE_DONGLE_NUM_IN_URBS; i++) {
-		urb = usb_alloc_urb(0, GFP_KERNEL);
-		if (!urb)
-			return -ENOMEM;
+	usb_anchor_urb(urb, &dongle->urbs_in_busy);
+	usb_free_urb(urb);
 
-		usb_anchor_urb(urb, &dongle->urbs_in_busy);
+	buf = usb_alloc_coherent(mt->udev, buf_len,
+				 GFP_KERNEL, &urb->transfer_dma);
+	if (!buf)
+		return -ENOMEM;
+
+	usb_fill_bulk_urb(urb, mt->udev,
+			  usb_rcvbulkpipe(mt->udev, ep), buf, buf_len,
+			  xone_dongle_complete_in, dongle);
+	urb->transfer_flags |= URB_NO_TRANSFER_DMA_MAP;
+
+	/* resubmitted on resume, freed with the idle URBs */
+	err = usb_submit_urb(urb, GFP_KERNEL);
+	if (err) {
+		usb_unanchor_urb(urb);
+		usb_anchor_urb(urb, &dongle->urbs_in_idle);
+	}
+
+	return err;
+}
+
+static void xone_dongle_free_urbs_in(struct usb_anchor *anchor)
+{
+	struct urb *urb;
+
+	while ((urb = usb_get_from_anchor(anchor))) {
+		usb_free_coherent(urb->dev, urb->transfer_buffer_length,
+				  urb->transfer_buffer, urb->transfer_dma);
 		usb_free_urb(urb);
+	}
+}
 
-		buf = usb_alloc_coherent(mt->udev, buf_len,
-					 GFP_KERNEL, &urb->transfer_dma);
-		if (!buf)
-			return -ENOMEM;
+static int xone_dongle_add_urb_out(struct xone_dongle *dongle)
+{
+	struct xone_mt76 *mt = &dongle->mt;
+	struct xone_dongle_out *out;
+	struct urb *urb;
+	unsigned long flags, kick;
+	void *buf;
+	int err;
 
-		usb_fill_bulk_urb(urb, mt->udev,
-				  usb_rcvbulkpipe(mt->udev, ep), buf, buf_len,
-				  xone_dongle_complete_in, dongle);
-		urb->transfer_flags |= URB_NO_TRANSFER_DMA_MAP;
+	urb = usb_alloc_urb(0, GFP_KERNEL);
+	if (!urb)
+		return -ENOMEM;
 
-		err = usb_submit_urb(urb, GFP_KERNEL);
+	out = kzalloc(sizeof(*out), GFP_KERNEL);
+	if (!out) {
+		err = -ENOMEM;
+		goto err_free_urb;
+	}
+
+	/* buffers are reused, avoids allocations for every packet */
+	buf = usb_alloc_coherent(mt->udev, XONE_DONGLE_LEN_OUT_BUF,
+				 GFP_KERNEL, &urb->transfer_dma);
+	if (!buf) {
+		err = -ENOMEM;
+		goto err_free_out;
+	}
+
+	out->dongle = dongle;
+	usb_fill_bulk_urb(urb, mt->udev,
+			  usb_sndbulkpipe(mt->udev, XONE_MT_EP_OUT),
+			  buf, XONE_DONGLE_LEN_OUT_BUF,
+			  xone_dongle_complete_out, out);
+	urb->transfer_flags |= URB_NO_TRANSFER_DMA_MAP;
+
+	/* only complete URBs are handed out */
+	usb_anchor_urb(urb, &dongle->urbs_out_idle);
+	usb_free_urb(urb);
+
+	spin_lock_irqsave(&dongle->tx_lock, flags);
+
+	dongle->tx_urbs++;
+	dongle->tx_idle++;
+	dongle->tx_urbs_max = max(dongle->tx_urbs_max, dongle->tx_urbs);
+	kick = xone_dongle_tx_schedule(dongle);
+
+	spin_unlock_irqrestore(&dongle->tx_lock, flags);
+
+	xone_dongle_kick_clients(dongle, kick);
+
+	return 0;
+
+err_free_out:
+	kfree(out);
+err_free_urb:
+	usb_free_urb(urb);
+
+	return err;
+}
+
+static void xone_dongle_free_urb_out(struct urb *urb)
+{
+	usb_free_coherent(urb->dev, XONE_DONGLE_LEN_OUT_BUF,
+			  urb->transfer_buffer, urb->transfer_dma);
+	kfree(urb->context);
+	usb_free_urb(urb);
+}
+
+/* only idle URBs can be removed */
+static bool xone_dongle_remove_urb_out(struct xone_dongle *dongle)
+{
+	struct urb *urb;
+	unsigned long flags;
+
+	spin_lock_irqsave(&dongle->tx_lock, flags);
+
+	if (xone_dongle_tx_available(dongle) <= 0) {
+		spin_unlock_irqrestore(&dongle->tx_lock, flags);
+		return false;
+	}
+
+	dongle->tx_urbs--;
+	dongle->tx_idle--;
+
+	spin_unlock_irqrestore(&dongle->tx_lock, flags);
+
+	urb = usb_get_from_anchor(&dongle->urbs_out_idle);
+	if (WARN_ON_ONCE(!urb))
+		return false;
+
+	xone_dongle_free_urb_out(urb);
+
+	return true;
+}
+
+static void xone_dongle_free_urbs_out(struct xone_dongle *dongle)
+{
+	struct urb *urb;
+	unsigned long flags;
+
+	spin_lock_irqsave(&dongle->tx_lock, flags);
+	dongle->tx_urbs = 0;
+	dongle->tx_idle = 0;
+	spin_unlock_irqrestore(&dongle->tx_lock, flags);
+
+	while ((urb = usb_get_from_anchor(&dongle->urbs_out_idle)))
+		xone_dongle_free_urb_out(urb);
+}
+
+/* scales with the connected clients, OUT URBs also with contention */
+static int xone_dongle_pool_target(struct xone_dongle *dongle,
+				   unsigned int min, unsigned int max,
+				   int per_client, int boost)
+{
+	int count = atomic_read(&dongle->client_count);
+
+	min = clamp_t(unsigned int, min, 1, XONE_DONGLE_POOL_LIMIT);
+	max = clamp_t(unsigned int, max, min, XONE_DONGLE_POOL_LIMIT);
+
+	return clamp_t(int, min + count * per_client + boost, min, max);
+}
+
+static int xone_dongle_resize_urbs_in(struct xone_dongle *dongle)
+{
+	int target = xone_dongle_pool_target(dongle, READ_ONCE(in_urbs_min),
+					     READ_ONCE(in_urbs_max),
+					     XONE_DONGLE_IN_URBS_PER_CLIENT, 0);
+	int err;
+
+	while (dongle->pool_in_urbs < target) {
+		/* keep URBs that have not been retired yet */
+		if (!atomic_add_unless(&dongle->pool_in_retire, -1, 0)) {
+			err = xone_dongle_add_urb_in(dongle,
+						     XONE_MT_EP_IN_WLAN,
+						     XONE_DONGLE_LEN_WLAN_PKT);
+			if (err)
+				return err;
+
+			gip_stats_inc(&dongle->stats,
+				      XONE_DONGLE_STAT_POOL_GROWS);
+		}
+
+		dongle->pool_in_urbs++;
+		dongle->pool_in_urbs_max = max(dongle->pool_in_urbs_max,
+					       dongle->pool_in_urbs);
+	}
+
+	/* busy URBs are retired on completion, see xone_dongle_complete_in */
+	while (dongle->pool_in_urbs > target) {
+		atomic_inc(&dongle->pool_in_retire);
+		dongle->pool_in_urbs--;
+		gip_stats_inc(&dongle->stats, XONE_DONGLE_STAT_POOL_SHRINKS);
+	}
+
+	return 0;
+}
+
+static int xone_dongle_resize_urbs_out(struct xone_dongle *dongle)
+{
+	/* the urgent URBs alone cannot carry other packets */
+	unsigned int min = max_t(unsigned int, READ_ONCE(out_urbs_min),
+				 XONE_DONGLE_TX_URGENT_URBS + 1);
+	int target = xone_dongle_pool_target(dongle, min,
+					     READ_ONCE(out_urbs_max),
+					     XONE_DONGLE_OUT_URBS_PER_CLIENT,
+					     dongle->pool_boost);
+	int err;
+
+	dongle->pool_out_target = target;
+
+	while (READ_ONCE(dongle->tx_urbs) < target) {
+		err = xone_dongle_add_urb_out(dongle);
 		if (err)
 			return err;
+
+		gip_stats_inc(&dongle->stats, XONE_DONGLE_STAT_POOL_GROWS);
 	}
 
+	/* busy URBs are removed on a later run */
+	while (READ_ONCE(dongle->tx_urbs) > target &&
+	       xone_dongle_remove_urb_out(dongle))
+		gip_stats_inc(&dongle->stats, XONE_DONGLE_STAT_POOL_SHRINKS);
+
 	return 0;
 }
 
+static int xone_dongle_init_urbs_in(struct xone_dongle *dongle)
+{
+	int i, err;
+
+	for (i = 0; i < XONE_DONGLE_NUM_CMD_URBS; i++) {
+		err = xone_dongle_add_urb_in(dongle, XONE_MT_EP_IN_CMD,
+					     XONE_DONGLE_LEN_CMD_PKT);
+		if (err)
+			return err;
+	}
+
+	dongle->pool_in_urbs = 0;
+	atomic_set(&dongle->pool_in_retire, 0);
+
+	return xone_dongle_resize_urbs_in(dongle);
+}
+
 static int xone_dongle_init_urbs_out(struct xone_dongle *dongle)
 {
-	struct xone_mt76 *mt = &dongle->mt;
-	struct urb *urb;
-	int i;
+	unsigned long flags;
 
-	for (i = 0; i < XONE_DONGLE_NUM_OUT_URBS; i++) {
-		urb = usb_alloc_urb(0, GFP_KERNEL);
-		if (!urb)
-			return -ENOMEM;
+	spin_lock_irqsave(&dongle->tx_lock, flags);
 
-		usb_fill_bulk_urb(urb, mt->udev,
-				  usb_sndbulkpipe(mt->udev, XONE_MT_EP_OUT),
-				  NULL, 0, xone_dongle_complete_out, NULL);
-		usb_anchor_urb(urb, &dongle->urbs_out_idle);
-		usb_free_urb(urb);
+	dongle->tx_urbs = 0;
+	dongle->tx_idle = 0;
+	dongle->tx_granted = 0;
+	bitmap_zero(dongle->tx_waiting, XONE_DONGLE_MAX_CLIENTS);
+	bitmap_zero(dongle->tx_urgent, XONE_DONGLE_MAX_CLIENTS);
+	memset(dongle->tx_queues, 0, sizeof(dongle->tx_queues));
+
+	spin_unlock_irqrestore(&dongle->tx_lock, flags);
+
+	dongle->pool_boost = 0;
+	atomic_set(&dongle->pool_pressure, 0);
+
+	return xone_dongle_resize_urbs_out(dongle);
+}
+
+static void xone_dongle_pool_work(struct work_struct *work)
+{
+	struct xone_dongle *dongle = container_of(to_delayed_work(work),
+						  typeof(*dongle), pool_work);
+	int err;
+
+	if (dongle->fw_state != XONE_DONGLE_FW_STATE_READY)
+		return;
+
+	/* grow while OUT URBs run short, shrink again once they do not */
+	if (atomic_xchg(&dongle->pool_pressure, 0)) {
+		dongle->pool_boost = min(dongle->pool_boost +
+					 XONE_DONGLE_POOL_STEP,
+					 XONE_DONGLE_POOL_LIMIT);
+		dongle->pool_decay = jiffies + XONE_DONGLE_POOL_DECAY_DELAY;
+	} else if (dongle->pool_boost &&
+		   time_after_eq(jiffies, dongle->pool_decay)) {
+		dongle->pool_boost = max(dongle->pool_boost -
+					 XONE_DONGLE_POOL_STEP, 0);
+		dongle->pool_decay = jiffies + XONE_DONGLE_POOL_DECAY_DELAY;
 	}
 
-	return 0;
+	err = xone_dongle_resize_urbs_in(dongle);
+	if (err)
+		dev_dbg(dongle->mt.dev, "%s: resize IN failed: %d\n",
+			__func__, err);
+
+	err = xone_dongle_resize_urbs_out(dongle);
+	if (err)
+		dev_dbg(dongle->mt.dev, "%s: resize OUT failed: %d\n",
+			__func__, err);
+
+	xone_dongle_free_urbs_in(&dongle->urbs_in_retired);
+
+	/* decay the boost and free the remaining URBs later */
+	if ((dongle->pool_boost || atomic_read(&dongle->pool_in_retire) ||
+	     READ_ONCE(dongle->tx_urbs) > dongle->pool_out_target) &&
+	    !delayed_work_pending(&dongle->pool_work))
+		xone_dongle_pool_schedule(dongle,
+					  XONE_DONGLE_POOL_DECAY_DELAY);
+}
+
+static void xone_dongle_pool_stop(struct xone_dongle *dongle)
+{
+	unsigned long flags;
+
+	spin_lock_irqsave(&dongle->pool_lock, flags);
+	dongle->pool_stopped = true;
+	spin_unlock_irqrestore(&dongle->pool_lock, flags);
+
+	cancel_delayed_work_sync(&dongle->pool_work);
 }
 
 static int xone_dongle_fw_requester(const struct firmware **fw,
@@ -917,6 +1814,15 @@ static int xone_dongle_fw_requester(const struct firmware **fw,
 	return err;
 }
 
+static void xone_dongle_end_phase(struct xone_dongle *dongle,
+				  enum xone_dongle_phase phase, u64 *start)
+{
+	u64 now = ktime_get_ns();
+
+	WRITE_ONCE(dongle->phase_ns[phase], now - *start);
+	*start = now;
+}
+
 static void xone_dongle_fw_load(struct work_struct *work)
 {
 	struct xone_dongle *dongle =
@@ -925,6 +1831,7 @@ static void xone_dongle_fw_load(struct work_struct *work)
 	struct xone_mt76 *mt = &dongle->mt;
 	const struct firmware *fw;
 	char fwname[25];
+	u64 start = ktime_get_ns();
 	int err;
 
 	switch (dongle->product) {
@@ -951,7 +1858,7 @@ static void xone_dongle_fw_load(struct work_struct *work)
 		return;
 	}
 	dev_dbg(mt->dev, "%s: firmware requested successfully\n", __func__);
-
+	xone_dongle_end_phase(dongle, XONE_DONGLE_PHASE_REQUEST, &start);
 
 	err = xone_mt76_load_firmware(mt, fw);
 	release_firmware(fw);
@@ -962,25 +1869,21 @@ static void xone_dongle_fw_load(struct work_struct *work)
 		return;
 	}
 
+	xone_dongle_end_phase(dongle, XONE_DONGLE_PHASE_FIRMWARE, &start);
+
 	err = xone_dongle_init_urbs_out(dongle);
 	if (err) {
 		dongle->fw_state = XONE_DONGLE_FW_STATE_ERROR;
 		return;
 	}
 
-	err = xone_dongle_init_urbs_in(dongle, XONE_MT_EP_IN_CMD,
-				       XONE_DONGLE_LEN_CMD_PKT);
+	err = xone_dongle_init_urbs_in(dongle);
 	if (err) {
 		dongle->fw_state = XONE_DONGLE_FW_STATE_ERROR;
 		return;
 	}
 
-	err = xone_dongle_init_urbs_in(dongle, XONE_MT_EP_IN_WLAN,
-				       XONE_DONGLE_LEN_WLAN_PKT);
-	if (err) {
-		dongle->fw_state = XONE_DONGLE_FW_STATE_ERROR;
-		return;
-	}
+	xone_dongle_end_phase(dongle, XONE_DONGLE_PHASE_URBS, &start);
 
 	err = xone_mt76_init_radio(mt);
 	if (err){
@@ -989,6 +1892,8 @@ static void xone_dongle_fw_load(struct work_struct *work)
 		return;
 	}
 
+	xone_dongle_end_phase(dongle, XONE_DONGLE_PHASE_RADIO, &start);
+
 	dongle->fw_state = XONE_DONGLE_FW_STATE_READY;
 
 	device_wakeup_enable(&dongle->mt.udev->dev);
@@ -1003,6 +1908,8 @@ static int xone_dongle_init(struct xone_dongle *dongle)
 	init_usb_anchor(&dongle->urbs_out_busy);
 	init_usb_anchor(&dongle->urbs_in_idle);
 	init_usb_anchor(&dongle->urbs_in_busy);
+	init_usb_anchor(&dongle->urbs_in_retired);
+	dongle->pool_stopped = false;
 
 	dongle->fw_state = XONE_DONGLE_FW_STATE_PENDING;
 	schedule_work(&dongle->load_fw_work);
@@ -1014,25 +1921,21 @@ static int xone_dongle_power_off_clients(struct xone_dongle *dongle)
 	struct xone_dongle_client *client;
 	int i;
 	int err = 0;
-	unsigned long flags;
 
 	if (dongle->fw_state != XONE_DONGLE_FW_STATE_READY)
 		return 0;
 
-	spin_lock_irqsave(&dongle->clients_lock, flags);
-
 	for (i = 0; i < XONE_DONGLE_MAX_CLIENTS; i++) {
-		client = dongle->clients[i];
+		client = xone_dongle_get_client(dongle, i + 1);
 		if (!client)
 			continue;
 
 		err = gip_power_off_adapter(client->adapter);
+		xone_dongle_put_client(client);
 		if (err)
 			break;
 	}
 
-	spin_unlock_irqrestore(&dongle->clients_lock, flags);
-
 	if (err)
 		return err;
 
@@ -1048,9 +1951,9 @@ static int xone_dongle_power_off_clients(struct xone_dongle *dongle)
 static void xone_dongle_destroy(struct xone_dongle *dongle)
 {
 	struct xone_dongle_client *client;
-	struct urb *urb;
 	int i;
 
+	xone_dongle_pool_stop(dongle);
 	usb_kill_anchored_urbs(&dongle->urbs_in_busy);
 	destroy_workqueue(dongle->event_wq);
 	cancel_delayed_work(&dongle->pairing_work);
@@ -1066,28 +1969,189 @@ static void xone_dongle_destroy(struct xone_dongle *dongle)
 		pr_debug("%s: FW loading cancelled", __func__);
 	}
 
+	/* completions kick clients, stop them before freeing any */
+	usb_kill_anchored_urbs(&dongle->urbs_out_busy);
+	xone_mt76_kill_queue(&dongle->mt);
+
 	for (i = 0; i < XONE_DONGLE_MAX_CLIENTS; i++) {
-		client = dongle->clients[i];
+		client = xone_dongle_take_client(dongle, i + 1);
 		if (!client)
 			continue;
 
-		gip_destroy_adapter(client->adapter);
-		kfree(client);
-		dongle->clients[i] = NULL;
+		xone_dongle_put_client(client);
+		wait_for_completion(&client->released);
+		xone_dongle_free_client(client);
 	}
 
+	/* adapter removal might have submitted packets */
 	usb_kill_anchored_urbs(&dongle->urbs_out_busy);
+	xone_dongle_free_urbs_out(dongle);
+	xone_dongle_free_urbs_in(&dongle->urbs_in_idle);
+	xone_dongle_free_urbs_in(&dongle->urbs_in_retired);
 
-	while ((urb = usb_get_from_anchor(&dongle->urbs_out_idle)))
-		usb_free_urb(urb);
+	mutex_destroy(&dongle->pairing_lock);
+	gip_stats_free(&dongle->stats);
+}
 
-	while ((urb = usb_get_from_anchor(&dongle->urbs_in_idle))) {
-		usb_free_coherent(urb->dev, urb->transfer_buffer_length,
-				  urb->transfer_buffer, urb->transfer_dma);
-		usb_free_urb(urb);
+static int xone_dongle_stats_show(struct seq_file *s, void *data)
+{
+	struct xone_dongle *dongle = s->private;
+
+	gip_stats_show(s, &dongle->stats);
+	seq_printf(s, "rx_time_max_ns: %lld\n",
+		   atomic64_read(&dongle->rx_time_max_ns));
+
+	return 0;
+}
+
+static void xone_dongle_stats_reset(struct xone_dongle *dongle)
+{
+	gip_stats_reset(&dongle->stats);
+	atomic64_set(&dongle->rx_time_max_ns, 0);
+}
+DEFINE_GIP_STATS_ATTRIBUTE(xone_dongle_stats);
+
+static int xone_dongle_tx_show(struct seq_file *s, void *data)
+{
+	struct xone_dongle *dongle = s->private;
+	struct xone_dongle_tx_queue queues[XONE_DONGLE_MAX_CLIENTS];
+	struct xone_dongle_tx_queue *queue;
+	struct xone_dongle_client *client;
+	unsigned long flags;
+	int urbs, idle, granted, depth, i;
+
+	spin_lock_irqsave(&dongle->tx_lock, flags);
+	urbs = dongle->tx_urbs;
+	idle = dongle->tx_idle;
+	granted = dongle->tx_granted;
+	memcpy(queues, dongle->tx_queues, sizeof(queues));
+	spin_unlock_irqrestore(&dongle->tx_lock, flags);
+
+	seq_printf(s, "urbs: %d\nidle: %d\ngranted: %d\n",
+		   urbs, idle, granted);
+
+	for (i = 0; i < XONE_DONGLE_MAX_CLIENTS; i++) {
+		client = xone_dongle_get_client(dongle, i + 1);
+		if (!client)
+			continue;
+
+		depth = gip_tx_depth(client->adapter);
+		xone_dongle_put_client(client);
+
+		queue = &queues[i];
+		seq_printf(s, "wcid %d:\n", i + 1);
+		seq_printf(s, "  depth: %d\n  depth_max: %d\n",
+			   depth, queue->depth_max);
+		seq_printf(s, "  held: %d\n  deficit: %d\n",
+			   queue->held, queue->deficit);
+		seq_printf(s, "  waits: %llu\n  wait_avg_ns: %llu\n",
+			   queue->waits, queue->waits ?
+			   div64_u64(queue->wait_ns, queue->waits) : 0);
+		seq_printf(s, "  wait_max_ns: %llu\n  bytes: %llu\n",
+			   queue->wait_max_ns, queue->bytes);
 	}
 
-	mutex_destroy(&dongle->pairing_lock);
+	return 0;
+}
+
+static void xone_dongle_tx_reset(struct xone_dongle *dongle)
+{
+	struct xone_dongle_tx_queue *queue;
+	unsigned long flags;
+	int i;
+
+	spin_lock_irqsave(&dongle->tx_lock, flags);
+
+	for (i = 0; i < XONE_DONGLE_MAX_CLIENTS; i++) {
+		queue = &dongle->tx_queues[i];
+		queue->waits = 0;
+		queue->wait_ns = 0;
+		queue->wait_max_ns = 0;
+		queue->bytes = 0;
+		queue->depth_max = 0;
+	}
+
+	spin_unlock_irqrestore(&dongle->tx_lock, flags);
+}
+DEFINE_GIP_STATS_ATTRIBUTE(xone_dongle_tx);
+
+static int xone_dongle_pool_show(struct seq_file *s, void *data)
+{
+	struct xone_dongle *dongle = s->private;
+	unsigned long flags;
+	int urbs, urbs_max, busy_max;
+
+	spin_lock_irqsave(&dongle->tx_lock, flags);
+	urbs = dongle->tx_urbs;
+	urbs_max = dongle->tx_urbs_max;
+	busy_max = dongle->tx_busy_max;
+	spin_unlock_irqrestore(&dongle->tx_lock, flags);
+
+	seq_printf(s, "in_urbs: %d\n", READ_ONCE(dongle->pool_in_urbs));
+	seq_printf(s, "in_urbs_max: %d\n",
+		   READ_ONCE(dongle->pool_in_urbs_max));
+	seq_printf(s, "in_retiring: %d\n",
+		   atomic_read(&dongle->pool_in_retire));
+	seq_printf(s, "out_urbs: %d\n", urbs);
+	seq_printf(s, "out_urbs_max: %d\n", urbs_max);
+	seq_printf(s, "out_busy_max: %d\n", busy_max);
+	seq_printf(s, "out_target: %d\n", READ_ONCE(dongle->pool_out_target));
+	seq_printf(s, "out_boost: %d\n", READ_ONCE(dongle->pool_boost));
+
+	return 0;
+}
+
+/* high-water marks start again from the current sizes */
+static void xone_dongle_pool_reset(struct xone_dongle *dongle)
+{
+	unsigned long flags;
+
+	spin_lock_irqsave(&dongle->tx_lock, flags);
+	dongle->tx_urbs_max = dongle->tx_urbs;
+	dongle->tx_busy_max = dongle->tx_urbs - dongle->tx_idle;
+	spin_unlock_irqrestore(&dongle->tx_lock, flags);
+
+	WRITE_ONCE(dongle->pool_in_urbs_max, READ_ONCE(dongle->pool_in_urbs));
+}
+DEFINE_GIP_STATS_ATTRIBUTE(xone_dongle_pool);
+
+/* durations of the last firmware load and radio initialization */
+static int xone_dongle_bringup_show(struct seq_file *s, void *data)
+{
+	struct xone_dongle *dongle = s->private;
+	u64 *radio = dongle->mt.phase_ns;
+
+	seq_printf(s, "request_ns: %llu\n",
+		   READ_ONCE(dongle->phase_ns[XONE_DONGLE_PHASE_REQUEST]));
+	seq_printf(s, "firmware_ns: %llu\n",
+		   READ_ONCE(dongle->phase_ns[XONE_DONGLE_PHASE_FIRMWARE]));
+	seq_printf(s, "urbs_ns: %llu\n",
+		   READ_ONCE(dongle->phase_ns[XONE_DONGLE_PHASE_URBS]));
+	seq_printf(s, "radio_ns: %llu\n",
+		   READ_ONCE(dongle->phase_ns[XONE_DONGLE_PHASE_RADIO]));
+	seq_printf(s, "radio_registers_ns: %llu\n",
+		   READ_ONCE(radio[XONE_MT_PHASE_REGISTERS]));
+	seq_printf(s, "radio_calibration_ns: %llu\n",
+		   READ_ONCE(radio[XONE_MT_PHASE_CALIBRATION]));
+	seq_printf(s, "radio_channels_ns: %llu\n",
+		   READ_ONCE(radio[XONE_MT_PHASE_CHANNELS]));
+
+	return 0;
+}
+DEFINE_SHOW_ATTRIBUTE(xone_dongle_bringup);
+
+static void xone_dongle_init_debugfs(struct xone_dongle *dongle)
+{
+	dongle->debugfs = debugfs_create_dir(dev_name(dongle->mt.dev),
+					     xone_dongle_debugfs_root);
+	debugfs_create_file("stats", 0644, dongle->debugfs, dongle,
+			    &xone_dongle_stats_fops);
+	debugfs_create_file("tx", 0644, dongle->debugfs, dongle,
+			    &xone_dongle_tx_fops);
+	debugfs_create_file("pool", 0644, dongle->debugfs, dongle,
+			    &xone_dongle_pool_fops);
+	debugfs_create_file("bringup", 0444, dongle->debugfs, dongle,
+			    &xone_dongle_bringup_fops);
 }
 
 static int xone_dongle_probe(struct usb_interface *intf,
@@ -1102,18 +2166,29 @@ static int xone_dongle_probe(struct usb_interface *intf,
 
 	dongle->mt.dev = &intf->dev;
 	dongle->mt.udev = interface_to_usbdev(intf);
+	xone_mt76_init_queue(&dongle->mt);
 
 	dongle->vendor = id->idVendor;
 	dongle->product = id->idProduct;
 
+	err = gip_stats_init(&dongle->stats, xone_dongle_stat_names,
+			     XONE_DONGLE_STAT_COUNT, GFP_KERNEL);
+	if (err)
+		return err;
+
 	dongle->event_wq = alloc_ordered_workqueue("xone_dongle", 0);
-	if (!dongle->event_wq)
+	if (!dongle->event_wq) {
+		gip_stats_free(&dongle->stats);
 		return -ENOMEM;
+	}
 
 	mutex_init(&dongle->pairing_lock);
 	INIT_DELAYED_WORK(&dongle->pairing_work, xone_dongle_pairing_timeout);
 	INIT_WORK(&dongle->load_fw_work, xone_dongle_fw_load);
 	spin_lock_init(&dongle->clients_lock);
+	spin_lock_init(&dongle->tx_lock);
+	spin_lock_init(&dongle->pool_lock);
+	INIT_DELAYED_WORK(&dongle->pool_work, xone_dongle_pool_work);
 	init_waitqueue_head(&dongle->disconnect_wait);
 
 	usb_reset_device(dongle->mt.udev);
@@ -1131,6 +2206,8 @@ static int xone_dongle_probe(struct usb_interface *intf,
 		return err;
 	}
 
+	xone_dongle_init_debugfs(dongle);
+
 	/* enable USB remote wakeup and autosuspend */
 	intf->needs_remote_wakeup = true;
 	return 0;
@@ -1142,6 +2219,7 @@ static void xone_dongle_disconnect(struct usb_interface *intf)
 	int err;
 
 	device_remove_groups(&intf->dev, xone_dongle_groups);
+	debugfs_remove_recursive(dongle->debugfs);
 
 	/* can fail during USB device removal */
 	err = xone_dongle_power_off_clients(dongle);
@@ -1168,8 +2246,15 @@ static int xone_dongle_suspend(struct usb_interface *intf, pm_message_t message)
 		dev_err(dongle->mt.dev, "%s: power off failed: %d\n",
 			__func__, err);
 
+	/* responses arrive on the IN URBs */
+	err = xone_mt76_sync(&dongle->mt);
+	if (err)
+		dev_dbg(dongle->mt.dev, "%s: sync failed: %d\n",
+			__func__, err);
+
 	usb_kill_anchored_urbs(&dongle->urbs_in_busy);
 	usb_kill_anchored_urbs(&dongle->urbs_out_busy);
+	xone_mt76_kill_queue(&dongle->mt);
 	cancel_delayed_work(&dongle->pairing_work);
 
 	return xone_mt76_suspend_radio(&dongle->mt);
@@ -1223,7 +2308,6 @@ static void xone_dongle_shutdown(struct usb_interface *intf)
 static int xone_dongle_pre_reset(struct usb_interface *intf)
 {
 	struct xone_dongle *dongle = usb_get_intfdata(intf);
-	struct urb *urb;
 
 	pr_debug("%s", __func__);
 
@@ -1235,17 +2319,13 @@ static int xone_dongle_pre_reset(struct usb_interface *intf)
 		dongle->fw_state = XONE_DONGLE_FW_STATE_STOP_LOADING;
 
 	cancel_delayed_work(&dongle->pairing_work);
+	xone_dongle_pool_stop(dongle);
 	usb_kill_anchored_urbs(&dongle->urbs_in_busy);
 	usb_kill_anchored_urbs(&dongle->urbs_out_busy);
-
-	while ((urb = usb_get_from_anchor(&dongle->urbs_out_idle)))
-		usb_free_urb(urb);
-
-	while ((urb = usb_get_from_anchor(&dongle->urbs_in_idle))) {
-		usb_free_coherent(urb->dev, urb->transfer_buffer_length,
-				  urb->transfer_buffer, urb->transfer_dma);
-		usb_free_urb(urb);
-	}
+	xone_mt76_kill_queue(&dongle->mt);
+	xone_dongle_free_urbs_out(dongle);
+	xone_dongle_free_urbs_in(&dongle->urbs_in_idle);
+	xone_dongle_free_urbs_in(&dongle->urbs_in_retired);
 
 	return 0;
 }
@@ -1314,7 +2394,27 @@ static struct usb_driver xone_dongle_driver = {
 	.soft_unbind = true,
 };
 
-module_usb_driver(xone_dongle_driver);
+static int __init xone_dongle_module_init(void)
+{
+	int err;
+
+	xone_dongle_debugfs_root = debugfs_create_dir("xone-dongle", NULL);
+
+	err = usb_register(&xone_dongle_driver);
+	if (err)
+		debugfs_remove_recursive(xone_dongle_debugfs_root);
+
+	return err;
+}
+
+static void __exit xone_dongle_module_exit(void)
+{
+	usb_deregister(&xone_dongle_driver);
+	debugfs_remove_recursive(xone_dongle_debugfs_root);
+}
+
+module_init(xone_dongle_module_init);
+module_exit(xone_dongle_module_exit);
 
 MODULE_DEVICE_TABLE(usb, xone_dongle_id_table);
 MODULE_AUTHOR("Severin von Wnuck-Lipinski <severinvonw@outlook.de>");
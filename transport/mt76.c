@@ -17,6 +17,9 @@
 
 #define XONE_MT_POLL_RETRIES 50
 
+/* register writes per in-band message (192 bytes) */
+#define XONE_MT_REG_BATCH_SIZE 24
+
 #define XONE_MT_RF_PATCH 0x0130
 #define XONE_MT_FW_LOAD_IVB 0x12
 #define XONE_MT_FW_ILM_OFFSET 0x080000
@@ -32,6 +35,17 @@
 
 #define XONE_MT_WCID_KEY_LEN 16
 
+struct xone_mt76_reg {
+	u32 addr;
+	u32 val;
+};
+
+/* stored in the skb of queued messages */
+struct xone_mt76_skb_cb {
+	struct xone_mt76 *mt;
+	u8 sequence;
+};
+
 /* commands specific to the dongle's firmware */
 enum xone_mt76_ms_command {
 	XONE_MT_SET_MAC_ADDRESS = 0x00,
@@ -73,6 +87,11 @@ static char override_mac[ETH_ALEN] = { 0 };
 module_param_array(override_mac, byte, NULL, 0444);
 MODULE_PARM_DESC(override_mac, "Override MAC address (6 bytes), helps deconflict counterfeit adapters");
 
+/* off until measured on real dongles, cleared if the firmware fails */
+static bool batch_registers;
+module_param(batch_registers, bool, 0644);
+MODULE_PARM_DESC(batch_registers, "Batch the initial register writes (experimental)");
+
 static u32 xone_mt76_read_register(struct xone_mt76 *mt, u32 addr)
 {
 	u8 req = MT_VEND_MULTI_READ;
@@ -204,11 +223,24 @@ static void xone_mt76_prep_message(struct sk_buff *skb, u32 info)
 	memset(skb_put(skb, pad), 0, pad);
 }
 
-void xone_mt76_prep_command(struct sk_buff *skb, enum mt76_mcu_cmd cmd)
+static u32 xone_mt76_command_info(enum mt76_mcu_cmd cmd)
 {
-	xone_mt76_prep_message(skb, MT_MCU_MSG_TYPE_CMD |
-			       FIELD_PREP(MT_MCU_MSG_PORT, MT_CPU_TX_PORT) |
-			       FIELD_PREP(MT_MCU_MSG_CMD_TYPE, cmd));
+	return MT_MCU_MSG_TYPE_CMD |
+	       FIELD_PREP(MT_MCU_MSG_PORT, MT_CPU_TX_PORT) |
+	       FIELD_PREP(MT_MCU_MSG_CMD_TYPE, cmd);
+}
+
+static void xone_mt76_prep_command(struct sk_buff *skb, enum mt76_mcu_cmd cmd)
+{
+	xone_mt76_prep_message(skb, xone_mt76_command_info(cmd));
+}
+
+/* header for messages built without an skb, see xone_mt76_prep_message */
+__le32 xone_mt76_command_header(enum mt76_mcu_cmd cmd, int len)
+{
+	return cpu_to_le32(xone_mt76_command_info(cmd) |
+			   FIELD_PREP(MT_MCU_MSG_LEN,
+				      round_up(len, sizeof(u32))));
 }
 
 static int xone_mt76_send_command(struct xone_mt76 *mt, struct sk_buff *skb,
@@ -225,10 +257,9 @@ static int xone_mt76_send_command(struct xone_mt76 *mt, struct sk_buff *skb,
 	return err;
 }
 
-static int xone_mt76_send_wlan(struct xone_mt76 *mt, struct sk_buff *skb)
+static void xone_mt76_prep_wlan(struct sk_buff *skb)
 {
 	struct mt76_txwi txwi = {};
-	int err;
 
 	/* wait for acknowledgment */
 	/* ignore wireless client identifier (WCID) */
@@ -248,6 +279,13 @@ static int xone_mt76_send_wlan(struct xone_mt76 *mt, struct sk_buff *skb)
 			       FIELD_PREP(MT_TXD_INFO_QSEL, MT_QSEL_EDCA) |
 			       MT_TXD_INFO_WIV |
 			       MT_TXD_INFO_80211);
+}
+
+static int xone_mt76_send_wlan(struct xone_mt76 *mt, struct sk_buff *skb)
+{
+	int err;
+
+	xone_mt76_prep_wlan(skb);
 
 	err = usb_bulk_msg(mt->udev, usb_sndbulkpipe(mt->udev, XONE_MT_EP_OUT),
 			   skb->data, skb->len, NULL, XONE_MT_USB_TIMEOUT);
@@ -256,6 +294,212 @@ static int xone_mt76_send_wlan(struct xone_mt76 *mt, struct sk_buff *skb)
 	return err;
 }
 
+void xone_mt76_init_queue(struct xone_mt76 *mt)
+{
+	init_usb_anchor(&mt->urbs);
+	spin_lock_init(&mt->lock);
+	init_waitqueue_head(&mt->wait);
+}
+
+static void xone_mt76_end_command(struct xone_mt76 *mt, u8 seq, int err)
+{
+	unsigned long flags;
+
+	spin_lock_irqsave(&mt->lock, flags);
+
+	if (__test_and_clear_bit(seq, &mt->pending)) {
+		mt->status[seq] = err;
+		wake_up(&mt->wait);
+	}
+
+	spin_unlock_irqrestore(&mt->lock, flags);
+}
+
+/* returns zero if all sequence numbers are awaiting a response */
+static u8 xone_mt76_next_sequence(struct xone_mt76 *mt)
+{
+	unsigned long flags;
+	u8 seq = 0;
+	int i;
+
+	spin_lock_irqsave(&mt->lock, flags);
+
+	for (i = XONE_MT_SEQ_FIRST; i < XONE_MT_SEQ_COUNT; i++) {
+		if (++mt->sequence >= XONE_MT_SEQ_COUNT ||
+		    mt->sequence < XONE_MT_SEQ_FIRST)
+			mt->sequence = XONE_MT_SEQ_FIRST;
+
+		if (!test_bit(mt->sequence, &mt->pending)) {
+			seq = mt->sequence;
+			__set_bit(seq, &mt->pending);
+			mt->status[seq] = 0;
+			break;
+		}
+	}
+
+	spin_unlock_irqrestore(&mt->lock, flags);
+
+	return seq;
+}
+
+static void xone_mt76_complete_message(struct urb *urb)
+{
+	struct sk_buff *skb = urb->context;
+	struct xone_mt76_skb_cb *cb = (struct xone_mt76_skb_cb *)skb->cb;
+
+	if (urb->status) {
+		dev_dbg(cb->mt->dev, "%s: transfer failed: %d\n",
+			__func__, urb->status);
+
+		if (cb->sequence)
+			xone_mt76_end_command(cb->mt, cb->sequence,
+					      urb->status);
+	}
+
+	dev_kfree_skb_any(skb);
+}
+
+static int xone_mt76_queue_message(struct xone_mt76 *mt, struct sk_buff *skb,
+				   u8 seq)
+{
+	struct xone_mt76_skb_cb *cb = (struct xone_mt76_skb_cb *)skb->cb;
+	struct urb *urb;
+	int err;
+
+	urb = usb_alloc_urb(0, GFP_KERNEL);
+	if (!urb) {
+		err = -ENOMEM;
+		goto err_free_skb;
+	}
+
+	cb->mt = mt;
+	cb->sequence = seq;
+
+	usb_fill_bulk_urb(urb, mt->udev,
+			  usb_sndbulkpipe(mt->udev, XONE_MT_EP_OUT),
+			  skb->data, skb->len,
+			  xone_mt76_complete_message, skb);
+	usb_anchor_urb(urb, &mt->urbs);
+
+	/* the anchor keeps the URB until completion */
+	err = usb_submit_urb(urb, GFP_KERNEL);
+	if (err)
+		usb_unanchor_urb(urb);
+
+	usb_free_urb(urb);
+
+	if (!err)
+		return 0;
+
+err_free_skb:
+	if (seq)
+		xone_mt76_end_command(mt, seq, 0);
+
+	kfree_skb(skb);
+
+	return err;
+}
+
+/*
+ * Sends a command without waiting for the transfer. Commands are numbered
+ * so that the firmware's responses can be awaited, the sequence number is
+ * added to seqs for xone_mt76_wait_commands.
+ */
+static int xone_mt76_queue_command(struct xone_mt76 *mt, struct sk_buff *skb,
+				   enum mt76_mcu_cmd cmd, unsigned long *seqs)
+{
+	u8 seq = 0;
+
+	/* packets for the clients are not answered */
+	if (cmd)
+		seq = xone_mt76_next_sequence(mt);
+
+	xone_mt76_prep_message(skb, xone_mt76_command_info(cmd) |
+			       FIELD_PREP(MT_MCU_MSG_CMD_SEQ, seq));
+
+	if (seq && seqs)
+		__set_bit(seq, seqs);
+
+	return xone_mt76_queue_message(mt, skb, seq);
+}
+
+static int xone_mt76_queue_wlan(struct xone_mt76 *mt, struct sk_buff *skb)
+{
+	xone_mt76_prep_wlan(skb);
+
+	return xone_mt76_queue_message(mt, skb, 0);
+}
+
+void xone_mt76_handle_response(struct xone_mt76 *mt, u32 info)
+{
+	u8 seq = FIELD_GET(MT_RX_FCE_INFO_CMD_SEQ, info);
+	u8 evt = FIELD_GET(MT_RX_FCE_INFO_EVT_TYPE, info);
+	int err = 0;
+
+	if (evt != XONE_MT_EVT_CMD_DONE) {
+		dev_err(mt->dev, "%s: command %u failed: 0x%02x\n",
+			__func__, seq, evt);
+		err = -EREMOTEIO;
+	}
+
+	xone_mt76_end_command(mt, seq, err);
+}
+
+/* waits for the responses to the given commands, returns the first error */
+static int xone_mt76_wait_commands(struct xone_mt76 *mt, unsigned long seqs)
+{
+	unsigned long flags;
+	int seq, err = 0;
+
+	if (!wait_event_timeout(mt->wait, !(READ_ONCE(mt->pending) & seqs),
+				msecs_to_jiffies(XONE_MT_USB_TIMEOUT)))
+		err = -ETIMEDOUT;
+
+	spin_lock_irqsave(&mt->lock, flags);
+
+	for_each_set_bit(seq, &seqs, XONE_MT_SEQ_COUNT)
+		if (!err)
+			err = mt->status[seq];
+
+	/* missing responses are not awaited again */
+	mt->pending &= ~seqs;
+
+	spin_unlock_irqrestore(&mt->lock, flags);
+
+	return err;
+}
+
+/* waits for the responses to all queued commands */
+int xone_mt76_sync(struct xone_mt76 *mt)
+{
+	unsigned long flags;
+	int err = 0;
+
+	if (!wait_event_timeout(mt->wait, !READ_ONCE(mt->pending),
+				msecs_to_jiffies(XONE_MT_USB_TIMEOUT)))
+		err = -ETIMEDOUT;
+
+	/* failures are reported by the operation that queued the command */
+	spin_lock_irqsave(&mt->lock, flags);
+	mt->pending = 0;
+	spin_unlock_irqrestore(&mt->lock, flags);
+
+	return err;
+}
+
+void xone_mt76_kill_queue(struct xone_mt76 *mt)
+{
+	unsigned long flags;
+
+	usb_kill_anchored_urbs(&mt->urbs);
+
+	spin_lock_irqsave(&mt->lock, flags);
+	mt->pending = 0;
+	spin_unlock_irqrestore(&mt->lock, flags);
+
+	wake_up_all(&mt->wait);
+}
+
 static int xone_mt76_select_function(struct xone_mt76 *mt,
 				     enum mt76_mcu_function func, u32 val)
 {
@@ -286,39 +530,88 @@ static int xone_mt76_load_cr(struct xone_mt76 *mt, enum mt76_mcu_cr_mode mode)
 	return xone_mt76_send_command(mt, skb, MT_CMD_LOAD_CR);
 }
 
-static int xone_mt76_send_ms_command(struct xone_mt76 *mt,
-				     enum xone_mt76_ms_command cmd,
-				     void *data, int len)
+static struct sk_buff *xone_mt76_alloc_ms_command(enum xone_mt76_ms_command cmd,
+						  void *data, int len)
 {
 	struct sk_buff *skb;
 
 	skb = xone_mt76_alloc_message(sizeof(u32) + len, GFP_KERNEL);
 	if (!skb)
-		return -ENOMEM;
+		return NULL;
 
 	put_unaligned_le32(cmd, skb_put(skb, sizeof(u32)));
 	skb_put_data(skb, data, len);
 
+	return skb;
+}
+
+static int xone_mt76_send_ms_command(struct xone_mt76 *mt,
+				     enum xone_mt76_ms_command cmd,
+				     void *data, int len)
+{
+	struct sk_buff *skb;
+
+	skb = xone_mt76_alloc_ms_command(cmd, data, len);
+	if (!skb)
+		return -ENOMEM;
+
 	/* send command to Microsoft's proprietary firmware */
 	return xone_mt76_send_command(mt, skb, MT_CMD_INIT_GAIN_OP);
 }
 
-static int xone_mt76_write_burst(struct xone_mt76 *mt, u32 idx,
-				 void *data, int len)
+static int xone_mt76_queue_ms_command(struct xone_mt76 *mt,
+				      enum xone_mt76_ms_command cmd,
+				      void *data, int len,
+				      unsigned long *seqs)
 {
 	struct sk_buff *skb;
 
-	skb = xone_mt76_alloc_message(sizeof(idx) + len, GFP_KERNEL);
+	skb = xone_mt76_alloc_ms_command(cmd, data, len);
 	if (!skb)
 		return -ENOMEM;
 
+	return xone_mt76_queue_command(mt, skb, MT_CMD_INIT_GAIN_OP, seqs);
+}
+
+static struct sk_buff *xone_mt76_alloc_burst(u32 idx, void *data, int len)
+{
+	struct sk_buff *skb;
+
+	skb = xone_mt76_alloc_message(sizeof(idx) + len, GFP_KERNEL);
+	if (!skb)
+		return NULL;
+
 	/* register offset in memory */
 	put_unaligned_le32(idx + MT_MCU_MEMMAP_WLAN, skb_put(skb, sizeof(idx)));
 	skb_put_data(skb, data, len);
 
+	return skb;
+}
+
+static int xone_mt76_write_burst(struct xone_mt76 *mt, u32 idx,
+				 void *data, int len)
+{
+	struct sk_buff *skb;
+
+	skb = xone_mt76_alloc_burst(idx, data, len);
+	if (!skb)
+		return -ENOMEM;
+
 	return xone_mt76_send_command(mt, skb, MT_CMD_BURST_WRITE);
 }
 
+static int xone_mt76_queue_burst(struct xone_mt76 *mt, u32 idx,
+				 void *data, int len, unsigned long *seqs)
+{
+	struct sk_buff *skb;
+
+	skb = xone_mt76_alloc_burst(idx, data, len);
+	if (!skb)
+		return -ENOMEM;
+
+	return xone_mt76_queue_command(mt, skb, MT_CMD_BURST_WRITE, seqs);
+}
+
 int xone_mt76_set_led_mode(struct xone_mt76 *mt, enum xone_mt76_led_mode mode)
 {
 	struct sk_buff *skb;
@@ -329,7 +622,7 @@ int xone_mt76_set_led_mode(struct xone_mt76 *mt, enum xone_mt76_led_mode mode)
 
 	put_unaligned_le32(mode, skb_put(skb, sizeof(u32)));
 
-	return xone_mt76_send_command(mt, skb, MT_CMD_LED_MODE_OP);
+	return xone_mt76_queue_command(mt, skb, MT_CMD_LED_MODE_OP, NULL);
 }
 
 static int xone_mt76_set_power_mode(struct xone_mt76 *mt,
@@ -847,8 +1140,127 @@ static int xone_mt76_calibrate_radio(struct xone_mt76 *mt)
 	return 0;
 }
 
-static void xone_mt76_init_registers(struct xone_mt76 *mt)
+/* written after the DMA and power setup, see xone_mt76_init_registers */
+static const struct xone_mt76_reg xone_mt76_init_regs[] = {
+	{ MT_WMM_AIFSN, 0x2273 },
+	{ MT_WMM_CWMIN, 0x2344 },
+	{ MT_WMM_CWMAX, 0x34aa },
+	{ MT_FCE_DMA_ADDR, 0x041200 },
+	{ MT_TSO_CTRL, 0 },
+	{ MT_PBF_SYS_CTRL, 0x080c00 },
+	{ MT_PBF_TX_MAX_PCNT, 0x1fbf1f1f },
+	{ MT_FCE_PSE_CTRL, 0x01 },
+	{ MT_MAC_SYS_CTRL,
+	  MT_MAC_SYS_CTRL_ENABLE_RX | MT_MAC_SYS_CTRL_ENABLE_TX },
+	{ MT_AUTO_RSP_CFG, 0x13 },
+	{ MT_MAX_LEN_CFG, 0x3e3fff },
+	{ MT_AMPDU_MAX_LEN_20M1S, 0xfffc9855 },
+	{ MT_AMPDU_MAX_LEN_20M2S, 0xff },
+	{ MT_BKOFF_SLOT_CFG, 0x0109 },
+	{ MT_PWR_PIN_CFG, 0 },
+	{ MT_EDCA_CFG_AC(0), 0x064320 },
+	{ MT_EDCA_CFG_AC(1), 0x0a4700 },
+	{ MT_EDCA_CFG_AC(2), 0x043238 },
+	{ MT_EDCA_CFG_AC(3), 0x03212f },
+	{ MT_TX_PIN_CFG, 0x150f0f },
+	{ MT_TX_SW_CFG0, 0x101001 },
+	{ MT_TX_SW_CFG1, 0x010000 },
+	{ MT_TXOP_CTRL_CFG, 0x10583f },
+	{ MT_TX_TIMEOUT_CFG, 0x0a0f90 },
+	{ MT_TX_RETRY_CFG, 0x47d01f0f },
+	{ MT_CCK_PROT_CFG, 0x03f40003 },
+	{ MT_OFDM_PROT_CFG, 0x03f40003 },
+	{ MT_MM20_PROT_CFG, 0x01742004 },
+	{ MT_GF20_PROT_CFG, 0x01742004 },
+	{ MT_GF40_PROT_CFG, 0x03f42084 },
+	{ MT_EXP_ACK_TIME, 0x2c00dc },
+	{ MT_TX_ALC_CFG_2, 0x22160a00 },
+	{ MT_TX_ALC_CFG_3, 0x22160a76 },
+	{ MT_TX_ALC_CFG_0, 0x3f3f1818 },
+	{ MT_TX_ALC_CFG_4, 0x0606 },
+	{ MT_PIFS_TX_CFG, 0x060fff },
+	{ MT_RX_FILTR_CFG, 0x017f17 },
+	{ MT_LEGACY_BASIC_RATE, 0x017f },
+	{ MT_HT_BASIC_RATE, 0x8003 },
+	{ MT_PN_PAD_MODE, 0x02 },
+	{ MT_TXOP_HLDR_ET, 0x02 },
+	{ MT_TX_PROT_CFG6, 0xe3f42004 },
+	{ MT_TX_PROT_CFG7, 0xe3f42084 },
+	{ MT_TX_PROT_CFG8, 0xe3f42104 },
+	{ MT_DACCLK_EN_DLY_CFG, 0 },
+	{ MT_RF_PA_MODE_ADJ0, 0xee000000 },
+	{ MT_RF_PA_MODE_ADJ1, 0xee000000 },
+	{ MT_TX0_RF_GAIN_CORR, 0x0f3c3c3c },
+	{ MT_TX1_RF_GAIN_CORR, 0x0f3c3c3c },
+	{ MT_PBF_CFG, 0x1efebcf5 },
+	{ MT_PAUSE_ENABLE_CONTROL1, 0x0a },
+	{ MT_RF_BYPASS_0, 0x7f000000 },
+	{ MT_RF_SETTING_0, 0x1a800000 },
+	{ MT_XIFS_TIME_CFG, 0x33a40e0a },
+	{ MT_FCE_L2_STUFF, 0x03ff0223 },
+	{ MT_TX_RTS_CFG, 0 },
+	{ MT_BEACON_TIME_CFG, 0x0640 },
+	{ MT_EXT_CCA_CFG, 0xf0e4 },
+	{ MT_CH_TIME_CFG, 0x015f },
+};
+
+static int xone_mt76_batch_registers(struct xone_mt76 *mt,
+				     const struct xone_mt76_reg *regs,
+				     int count)
+{
+	struct sk_buff *skb;
+	unsigned long seqs = 0;
+	int i, j, n, err;
+
+	for (i = 0; i < count; i += n) {
+		n = min(count - i, XONE_MT_REG_BATCH_SIZE);
+		skb = xone_mt76_alloc_message(n * sizeof(u32) * 2, GFP_KERNEL);
+		if (!skb)
+			return -ENOMEM;
+
+		for (j = i; j < i + n; j++) {
+			put_unaligned_le32(regs[j].addr + MT_MCU_MEMMAP_WLAN,
+					   skb_put(skb, sizeof(u32)));
+			put_unaligned_le32(regs[j].val,
+					   skb_put(skb, sizeof(u32)));
+		}
+
+		err = xone_mt76_queue_command(mt, skb, MT_CMD_RANDOM_WRITE,
+					      &seqs);
+		if (err)
+			return err;
+	}
+
+	/* control messages are not ordered with bulk messages */
+	return xone_mt76_wait_commands(mt, seqs);
+}
+
+static int xone_mt76_write_registers(struct xone_mt76 *mt,
+				     const struct xone_mt76_reg *regs,
+				     int count)
+{
+	int i, err;
+
+	if (READ_ONCE(batch_registers)) {
+		err = xone_mt76_batch_registers(mt, regs, count);
+		if (!err)
+			return 0;
+
+		/* writes are idempotent, repeat them one by one */
+		dev_warn(mt->dev, "%s: batched writes failed: %d\n",
+			 __func__, err);
+		WRITE_ONCE(batch_registers, false);
+	}
+
+	for (i = 0; i < count; i++)
+		xone_mt76_write_register(mt, regs[i].addr, regs[i].val);
+
+	return 0;
+}
+
+static int xone_mt76_init_registers(struct xone_mt76 *mt)
 {
+	/* the in-band messages depend on the USB DMA setup */
 	xone_mt76_write_register(mt, MT_MAC_SYS_CTRL,
 				 MT_MAC_SYS_CTRL_RESET_BBP |
 				 MT_MAC_SYS_CTRL_RESET_CSR);
@@ -857,67 +1269,9 @@ static void xone_mt76_init_registers(struct xone_mt76 *mt)
 	xone_mt76_write_register(mt, MT_PWR_PIN_CFG, 0);
 	xone_mt76_write_register(mt, MT_LDO_CTRL_1, 0x6b006464);
 	xone_mt76_write_register(mt, MT_WPDMA_GLO_CFG, 0x70);
-	xone_mt76_write_register(mt, MT_WMM_AIFSN, 0x2273);
-	xone_mt76_write_register(mt, MT_WMM_CWMIN, 0x2344);
-	xone_mt76_write_register(mt, MT_WMM_CWMAX, 0x34aa);
-	xone_mt76_write_register(mt, MT_FCE_DMA_ADDR, 0x041200);
-	xone_mt76_write_register(mt, MT_TSO_CTRL, 0);
-	xone_mt76_write_register(mt, MT_PBF_SYS_CTRL, 0x080c00);
-	xone_mt76_write_register(mt, MT_PBF_TX_MAX_PCNT, 0x1fbf1f1f);
-	xone_mt76_write_register(mt, MT_FCE_PSE_CTRL, 0x01);
-	xone_mt76_write_register(mt, MT_MAC_SYS_CTRL,
-				 MT_MAC_SYS_CTRL_ENABLE_RX |
-				 MT_MAC_SYS_CTRL_ENABLE_TX);
-	xone_mt76_write_register(mt, MT_AUTO_RSP_CFG, 0x13);
-	xone_mt76_write_register(mt, MT_MAX_LEN_CFG, 0x3e3fff);
-	xone_mt76_write_register(mt, MT_AMPDU_MAX_LEN_20M1S, 0xfffc9855);
-	xone_mt76_write_register(mt, MT_AMPDU_MAX_LEN_20M2S, 0xff);
-	xone_mt76_write_register(mt, MT_BKOFF_SLOT_CFG, 0x0109);
-	xone_mt76_write_register(mt, MT_PWR_PIN_CFG, 0);
-	xone_mt76_write_register(mt, MT_EDCA_CFG_AC(0), 0x064320);
-	xone_mt76_write_register(mt, MT_EDCA_CFG_AC(1), 0x0a4700);
-	xone_mt76_write_register(mt, MT_EDCA_CFG_AC(2), 0x043238);
-	xone_mt76_write_register(mt, MT_EDCA_CFG_AC(3), 0x03212f);
-	xone_mt76_write_register(mt, MT_TX_PIN_CFG, 0x150f0f);
-	xone_mt76_write_register(mt, MT_TX_SW_CFG0, 0x101001);
-	xone_mt76_write_register(mt, MT_TX_SW_CFG1, 0x010000);
-	xone_mt76_write_register(mt, MT_TXOP_CTRL_CFG, 0x10583f);
-	xone_mt76_write_register(mt, MT_TX_TIMEOUT_CFG, 0x0a0f90);
-	xone_mt76_write_register(mt, MT_TX_RETRY_CFG, 0x47d01f0f);
-	xone_mt76_write_register(mt, MT_CCK_PROT_CFG, 0x03f40003);
-	xone_mt76_write_register(mt, MT_OFDM_PROT_CFG, 0x03f40003);
-	xone_mt76_write_register(mt, MT_MM20_PROT_CFG, 0x01742004);
-	xone_mt76_write_register(mt, MT_GF20_PROT_CFG, 0x01742004);
-	xone_mt76_write_register(mt, MT_GF40_PROT_CFG, 0x03f42084);
-	xone_mt76_write_register(mt, MT_EXP_ACK_TIME, 0x2c00dc);
-	xone_mt76_write_register(mt, MT_TX_ALC_CFG_2, 0x22160a00);
-	xone_mt76_write_register(mt, MT_TX_ALC_CFG_3, 0x22160a76);
-	xone_mt76_write_register(mt, MT_TX_ALC_CFG_0, 0x3f3f1818);
-	xone_mt76_write_register(mt, MT_TX_ALC_CFG_4, 0x0606);
-	xone_mt76_write_register(mt, MT_PIFS_TX_CFG, 0x060fff);
-	xone_mt76_write_register(mt, MT_RX_FILTR_CFG, 0x017f17);
-	xone_mt76_write_register(mt, MT_LEGACY_BASIC_RATE, 0x017f);
-	xone_mt76_write_register(mt, MT_HT_BASIC_RATE, 0x8003);
-	xone_mt76_write_register(mt, MT_PN_PAD_MODE, 0x02);
-	xone_mt76_write_register(mt, MT_TXOP_HLDR_ET, 0x02);
-	xone_mt76_write_register(mt, MT_TX_PROT_CFG6, 0xe3f42004);
-	xone_mt76_write_register(mt, MT_TX_PROT_CFG7, 0xe3f42084);
-	xone_mt76_write_register(mt, MT_TX_PROT_CFG8, 0xe3f42104);
-	xone_mt76_write_register(mt, MT_DACCLK_EN_DLY_CFG, 0);
-	xone_mt76_write_register(mt, MT_RF_PA_MODE_ADJ0, 0xee000000);
-	xone_mt76_write_register(mt, MT_RF_PA_MODE_ADJ1, 0xee000000);
-	xone_mt76_write_register(mt, MT_TX0_RF_GAIN_CORR, 0x0f3c3c3c);
-	xone_mt76_write_register(mt, MT_TX1_RF_GAIN_CORR, 0x0f3c3c3c);
-	xone_mt76_write_register(mt, MT_PBF_CFG, 0x1efebcf5);
-	xone_mt76_write_register(mt, MT_PAUSE_ENABLE_CONTROL1, 0x0a);
-	xone_mt76_write_register(mt, MT_RF_BYPASS_0, 0x7f000000);
-	xone_mt76_write_register(mt, MT_RF_SETTING_0, 0x1a800000);
-	xone_mt76_write_register(mt, MT_XIFS_TIME_CFG, 0x33a40e0a);
-	xone_mt76_write_register(mt, MT_FCE_L2_STUFF, 0x03ff0223);
-	xone_mt76_write_register(mt, MT_TX_RTS_CFG, 0);
-	xone_mt76_write_register(mt, MT_BEACON_TIME_CFG, 0x0640);
-	xone_mt76_write_register(mt, MT_EXT_CCA_CFG, 0xf0e4);
-	xone_mt76_write_register(mt, MT_CH_TIME_CFG, 0x015f);
+
+	return xone_mt76_write_registers(mt, xone_mt76_init_regs,
+					 ARRAY_SIZE(xone_mt76_init_regs));
 }
 
 static u16 xone_mt76_get_chip_id(struct xone_mt76 *mt)
@@ -930,8 +1284,18 @@ static u16 xone_mt76_get_chip_id(struct xone_mt76 *mt)
 	return (id[1] << 8) | id[2];
 }
 
+static void xone_mt76_end_phase(struct xone_mt76 *mt,
+				 enum xone_mt76_phase phase, u64 *start)
+{
+	u64 now = ktime_get_ns();
+
+	WRITE_ONCE(mt->phase_ns[phase], now - *start);
+	*start = now;
+}
+
 int xone_mt76_init_radio(struct xone_mt76 *mt)
 {
+	u64 start;
 	int err;
 
 	dev_dbg(mt->dev, "%s: id=0x%04x\n", __func__,
@@ -949,7 +1313,13 @@ int xone_mt76_init_radio(struct xone_mt76 *mt)
 	if (err)
 		return err;
 
-	xone_mt76_init_registers(mt);
+	start = ktime_get_ns();
+
+	err = xone_mt76_init_registers(mt);
+	if (err)
+		return err;
+
+	xone_mt76_end_phase(mt, XONE_MT_PHASE_REGISTERS, &start);
 
 	err = xone_mt76_calibrate_crystal(mt);
 	if (err)
@@ -967,6 +1337,8 @@ int xone_mt76_init_radio(struct xone_mt76 *mt)
 	if (err)
 		return err;
 
+	xone_mt76_end_phase(mt, XONE_MT_PHASE_CALIBRATION, &start);
+
 	err = xone_mt76_init_channels(mt);
 	if (err)
 		return err;
@@ -974,6 +1346,8 @@ int xone_mt76_init_radio(struct xone_mt76 *mt)
 	/* mandatory delay after channel change */
 	msleep(1000);
 
+	xone_mt76_end_phase(mt, XONE_MT_PHASE_CHANNELS, &start);
+
 	return xone_mt76_set_pairing(mt, false);
 }
 
@@ -1121,7 +1495,7 @@ int xone_mt76_pair_client(struct xone_mt76 *mt, u8 *addr)
 	skb_put_u8(skb, XONE_MT_CLIENT_PAIR_RESP);
 	skb_put_data(skb, data, sizeof(data));
 
-	return xone_mt76_send_wlan(mt, skb);
+	return xone_mt76_queue_wlan(mt, skb);
 }
 
 int xone_mt76_associate_client(struct xone_mt76 *mt, u8 wcid, u8 *addr)
@@ -1131,6 +1505,7 @@ int xone_mt76_associate_client(struct xone_mt76 *mt, u8 wcid, u8 *addr)
 	u8 data[] = { wcid - 1, 0x00, 0x00, 0x00, 0x40, 0x1f, 0x00, 0x00 };
 	int mgmt_len = sizeof(struct ieee80211_hdr_3addr) +
 		       sizeof(mgmt.u.assoc_resp);
+	unsigned long seqs = 0;
 	int err;
 
 	skb = xone_mt76_alloc_message(sizeof(struct mt76_txwi) + mgmt_len + 8,
@@ -1152,16 +1527,22 @@ int xone_mt76_associate_client(struct xone_mt76 *mt, u8 wcid, u8 *addr)
 	skb_put_data(skb, &mgmt, mgmt_len);
 	memset(skb_put(skb, 8), 0, 8);
 
-	err = xone_mt76_write_burst(mt, MT_WCID_ADDR(wcid), addr, ETH_ALEN);
+	err = xone_mt76_queue_burst(mt, MT_WCID_ADDR(wcid), addr, ETH_ALEN,
+				    &seqs);
 	if (err)
 		goto err_free_skb;
 
-	err = xone_mt76_send_ms_command(mt, XONE_MT_ADD_CLIENT,
-					data, sizeof(data));
+	err = xone_mt76_queue_ms_command(mt, XONE_MT_ADD_CLIENT,
+					 data, sizeof(data), &seqs);
 	if (err)
 		goto err_free_skb;
 
-	return xone_mt76_send_wlan(mt, skb);
+	err = xone_mt76_queue_wlan(mt, skb);
+	if (err)
+		return err;
+
+	/* steps are pipelined, only the whole operation is awaited */
+	return xone_mt76_wait_commands(mt, seqs);
 
 err_free_skb:
 	kfree_skb(skb);
@@ -1209,7 +1590,7 @@ int xone_mt76_send_client_command(struct xone_mt76 *mt, u8 wcid, u8 *addr,
 	if (data)
 		skb_put_data(skb, data, len);
 
-	return xone_mt76_send_command(mt, skb, 0);
+	return xone_mt76_queue_command(mt, skb, 0, NULL);
 }
 
 int xone_mt76_set_client_key(struct xone_mt76 *mt, u8 wcid, u8 *key, int len)
@@ -1218,21 +1599,27 @@ int xone_mt76_set_client_key(struct xone_mt76 *mt, u8 wcid, u8 *key, int len)
 	__le32 attr = cpu_to_le32(FIELD_PREP(MT_WCID_ATTR_PKEY_MODE,
 					     MT_CIPHER_AES_CCMP) |
 				  MT_WCID_ATTR_PAIRWISE);
+	unsigned long seqs = 0;
 	int err;
 
 	if (len != XONE_MT_WCID_KEY_LEN)
 		return -EINVAL;
 
-	err = xone_mt76_write_burst(mt, MT_WCID_KEY(wcid), key, len);
+	err = xone_mt76_queue_burst(mt, MT_WCID_KEY(wcid), key, len, &seqs);
 	if (err)
 		return err;
 
-	err = xone_mt76_write_burst(mt, MT_WCID_IV(wcid), iv, sizeof(iv));
+	err = xone_mt76_queue_burst(mt, MT_WCID_IV(wcid), iv, sizeof(iv),
+				    &seqs);
 	if (err)
 		return err;
 
-	return xone_mt76_write_burst(mt, MT_WCID_ATTR(wcid),
-				     &attr, sizeof(attr));
+	err = xone_mt76_queue_burst(mt, MT_WCID_ATTR(wcid),
+				    &attr, sizeof(attr), &seqs);
+	if (err)
+		return err;
+
+	return xone_mt76_wait_commands(mt, seqs);
 }
 
 int xone_mt76_remove_client(struct xone_mt76 *mt, u8 wcid)
@@ -1242,25 +1629,33 @@ int xone_mt76_remove_client(struct xone_mt76 *mt, u8 wcid)
 	u8 iv[8] = {};
 	u32 attr = 0;
 	u8 key[XONE_MT_WCID_KEY_LEN] = {};
+	unsigned long seqs = 0;
 	int err;
 
-	err = xone_mt76_send_ms_command(mt, XONE_MT_REMOVE_CLIENT,
-					data, sizeof(data));
+	err = xone_mt76_queue_ms_command(mt, XONE_MT_REMOVE_CLIENT,
+					 data, sizeof(data), &seqs);
+	if (err)
+		return err;
+
+	err = xone_mt76_queue_burst(mt, MT_WCID_ADDR(wcid), addr, sizeof(addr),
+				    &seqs);
 	if (err)
 		return err;
 
-	err = xone_mt76_write_burst(mt, MT_WCID_ADDR(wcid), addr, sizeof(addr));
+	err = xone_mt76_queue_burst(mt, MT_WCID_IV(wcid), iv, sizeof(iv),
+				    &seqs);
 	if (err)
 		return err;
 
-	err = xone_mt76_write_burst(mt, MT_WCID_IV(wcid), iv, sizeof(iv));
+	err = xone_mt76_queue_burst(mt, MT_WCID_ATTR(wcid),
+				    &attr, sizeof(attr), &seqs);
 	if (err)
 		return err;
 
-	err = xone_mt76_write_burst(mt, MT_WCID_ATTR(wcid),
-				    &attr, sizeof(attr));
+	err = xone_mt76_queue_burst(mt, MT_WCID_KEY(wcid), key, sizeof(key),
+				    &seqs);
 	if (err)
 		return err;
 
-	return xone_mt76_write_burst(mt, MT_WCID_KEY(wcid), key, sizeof(key));
+	return xone_mt76_wait_commands(mt, seqs);
 }
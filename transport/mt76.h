@@ -23,6 +23,9 @@ enum xone_mt76_led_mode {
 };
 
 enum xone_mt76_event {
+	/* responses to commands */
+	XONE_MT_EVT_CMD_DONE = 0x00,
+	XONE_MT_EVT_CMD_ERROR = 0x01,
 	XONE_MT_EVT_BUTTON = 0x04,
 	XONE_MT_EVT_CHANNELS = 0x0a,
 	XONE_MT_EVT_PACKET_RX = 0x0c,
@@ -42,6 +45,14 @@ enum xone_mt76_client_command {
 	XONE_MT_CLIENT_ENABLE_ENCRYPTION = 0x10,
 };
 
+/* timed steps of xone_mt76_init_radio */
+enum xone_mt76_phase {
+	XONE_MT_PHASE_REGISTERS,
+	XONE_MT_PHASE_CALIBRATION,
+	XONE_MT_PHASE_CHANNELS,
+	XONE_MT_PHASE_COUNT,
+};
+
 struct xone_mt76_channel {
 	u8 index;
 	u8 band;
@@ -51,6 +62,10 @@ struct xone_mt76_channel {
 	u8 power;
 };
 
+/* sequence numbers of queued commands, responses to 1 are ignored */
+#define XONE_MT_SEQ_FIRST 0x02
+#define XONE_MT_SEQ_COUNT 0x10
+
 struct xone_mt76 {
 	struct device *dev;
 	struct usb_device *udev;
@@ -60,10 +75,28 @@ struct xone_mt76 {
 
 	struct xone_mt76_channel channels[XONE_MT_NUM_CHANNELS];
 	struct xone_mt76_channel *channel;
+
+	/* durations of the last radio initialization */
+	u64 phase_ns[XONE_MT_PHASE_COUNT];
+
+	/* commands sent without waiting, see xone_mt76_queue_command */
+	struct usb_anchor urbs;
+	spinlock_t lock;
+	wait_queue_head_t wait;
+	unsigned long pending;
+	u8 sequence;
+
+	/* result of each sequence number, reset when it is reused */
+	int status[XONE_MT_SEQ_COUNT];
 };
 
 struct sk_buff *xone_mt76_alloc_message(int len, gfp_t gfp);
-void xone_mt76_prep_command(struct sk_buff *skb, enum mt76_mcu_cmd cmd);
+__le32 xone_mt76_command_header(enum mt76_mcu_cmd cmd, int len);
+
+void xone_mt76_init_queue(struct xone_mt76 *mt);
+void xone_mt76_handle_response(struct xone_mt76 *mt, u32 info);
+int xone_mt76_sync(struct xone_mt76 *mt);
+void xone_mt76_kill_queue(struct xone_mt76 *mt);
 
 int xone_mt76_set_led_mode(struct xone_mt76 *mt, enum xone_mt76_led_mode mode);
 int xone_mt76_load_firmware(struct xone_mt76 *mt, const struct firmware *fw);
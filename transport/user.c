@@ -0,0 +1,441 @@
+// SPDX-License-Identifier: GPL-2.0-or-later
+/*
+ * Copyright (C) 2021 Severin von Wnuck-Lipinski <severinvonw@outlook.de>
+ *
+ * Adapters driven by userspace through a character device, similar to uhid.
+ */
+
+#include <linux/module.h>
+#include <linux/slab.h>
+#include <linux/miscdevice.h>
+#include <linux/poll.h>
+#include <linux/uaccess.h>
+#include <linux/kfifo.h>
+
+#include "../bus/bus.h"
+#include "buffers.h"
+#include "user.h"
+
+#define XONE_USER_NUM_DATA_BUFS 12
+#define XONE_USER_NUM_AUDIO_BUFS 12
+#define XONE_USER_NUM_AUDIO_PKTS 8
+#define XONE_USER_NUM_EVENTS 16
+
+#define XONE_USER_LEN_DATA_PKT 64
+#define XONE_USER_LEN_WRITE SZ_64K
+
+struct xone_user {
+	struct gip_adapter *adapter;
+
+	struct xone_buffers bufs;
+	struct xone_buffer *bufs_data[XONE_USER_NUM_DATA_BUFS];
+	struct xone_buffer *bufs_audio[XONE_USER_NUM_AUDIO_BUFS];
+
+	/* serializes readers and reallocation of audio buffers */
+	struct mutex read_lock;
+	wait_queue_head_t wait;
+
+	/* only written from process context with read_lock held */
+	DECLARE_KFIFO(events, struct gip_user_record, XONE_USER_NUM_EVENTS);
+
+	/* buffers of all writers are processed in order */
+	spinlock_t rx_lock;
+};
+
+static struct miscdevice xone_user_misc;
+
+static void xone_user_put_event(struct xone_user *user, u8 type, u32 param)
+{
+	struct gip_user_record rec = {
+		.type = type,
+		.param = cpu_to_le32(param),
+	};
+
+	mutex_lock(&user->read_lock);
+
+	if (!kfifo_put(&user->events, rec))
+		dev_warn(&user->adapter->dev, "%s: event 0x%02x lost\n",
+			 __func__, type);
+
+	mutex_unlock(&user->read_lock);
+
+	wake_up_interruptible(&user->wait);
+}
+
+static int xone_user_get_buffer(struct gip_adapter *adap,
+				struct gip_adapter_buffer *buf)
+{
+	struct xone_user *user = dev_get_drvdata(&adap->dev);
+
+	return xone_buffers_get(&user->bufs, buf);
+}
+
+static int xone_user_submit_buffer(struct gip_adapter *adap,
+				   struct gip_adapter_buffer *buf)
+{
+	struct xone_user *user = dev_get_drvdata(&adap->dev);
+	int err;
+
+	err = xone_buffers_submit(&user->bufs, buf);
+	if (!err)
+		wake_up_interruptible(&user->wait);
+
+	return err;
+}
+
+static void xone_user_put_buffer(struct gip_adapter *adap,
+				 struct gip_adapter_buffer *buf)
+{
+	struct xone_user *user = dev_get_drvdata(&adap->dev);
+
+	xone_buffers_put(&user->bufs, buf->context);
+}
+
+static int xone_user_enable_audio(struct gip_adapter *adap)
+{
+	xone_user_put_event(dev_get_drvdata(&adap->dev),
+			    GIP_USER_AUDIO_ENABLE, 0);
+
+	return 0;
+}
+
+static int xone_user_init_audio_in(struct gip_adapter *adap)
+{
+	xone_user_put_event(dev_get_drvdata(&adap->dev),
+			    GIP_USER_AUDIO_INIT_IN, 0);
+
+	return 0;
+}
+
+static int xone_user_init_audio_out(struct gip_adapter *adap, int pkt_len)
+{
+	struct xone_user *user = dev_get_drvdata(&adap->dev);
+	int err;
+
+	mutex_lock(&user->read_lock);
+
+	xone_buffers_free(&user->bufs, user->bufs_audio,
+			  XONE_USER_NUM_AUDIO_BUFS);
+
+	err = xone_buffers_alloc(&user->bufs, user->bufs_audio,
+				 XONE_USER_NUM_AUDIO_BUFS, GIP_BUF_AUDIO,
+				 pkt_len * XONE_USER_NUM_AUDIO_PKTS);
+	if (err)
+		xone_buffers_free(&user->bufs, user->bufs_audio,
+				  XONE_USER_NUM_AUDIO_BUFS);
+
+	mutex_unlock(&user->read_lock);
+
+	if (err)
+		return err;
+
+	xone_user_put_event(user, GIP_USER_AUDIO_INIT_OUT, pkt_len);
+
+	return 0;
+}
+
+static int xone_user_disable_audio(struct gip_adapter *adap)
+{
+	struct xone_user *user = dev_get_drvdata(&adap->dev);
+
+	/* unread audio buffers are dropped */
+	mutex_lock(&user->read_lock);
+	xone_buffers_free(&user->bufs, user->bufs_audio,
+			  XONE_USER_NUM_AUDIO_BUFS);
+	mutex_unlock(&user->read_lock);
+
+	xone_user_put_event(user, GIP_USER_AUDIO_DISABLE, 0);
+
+	return 0;
+}
+
+static int xone_user_replay_buffer(struct gip_adapter *adap, void *data,
+				   int len, u64 time)
+{
+	struct xone_user *user = dev_get_drvdata(&adap->dev);
+	int err;
+
+	spin_lock_bh(&user->rx_lock);
+	err = gip_process_buffer(adap, data, len, time);
+	spin_unlock_bh(&user->rx_lock);
+
+	return err;
+}
+
+static struct gip_adapter_ops xone_user_adapter_ops = {
+	.get_buffer = xone_user_get_buffer,
+	.submit_buffer = xone_user_submit_buffer,
+	.put_buffer = xone_user_put_buffer,
+	.enable_audio = xone_user_enable_audio,
+	.init_audio_in = xone_user_init_audio_in,
+	.init_audio_out = xone_user_init_audio_out,
+	.disable_audio = xone_user_disable_audio,
+	.replay_buffer = xone_user_replay_buffer,
+};
+
+static bool xone_user_readable(struct xone_user *user)
+{
+	return xone_buffers_first_busy(&user->bufs) ||
+	       !kfifo_is_empty(&user->events);
+}
+
+static void xone_user_free(struct xone_user *user)
+{
+	xone_buffers_free(&user->bufs, user->bufs_data,
+			  XONE_USER_NUM_DATA_BUFS);
+	xone_buffers_free(&user->bufs, user->bufs_audio,
+			  XONE_USER_NUM_AUDIO_BUFS);
+	kfree(user);
+}
+
+static int xone_user_open(struct inode *inode, struct file *file)
+{
+	struct xone_user *user;
+	int err;
+
+	user = kzalloc(sizeof(*user), GFP_KERNEL);
+	if (!user)
+		return -ENOMEM;
+
+	xone_buffers_init(&user->bufs);
+	spin_lock_init(&user->rx_lock);
+	mutex_init(&user->read_lock);
+	init_waitqueue_head(&user->wait);
+	INIT_KFIFO(user->events);
+
+	err = xone_buffers_alloc(&user->bufs, user->bufs_data,
+				 XONE_USER_NUM_DATA_BUFS, GIP_BUF_DATA,
+				 XONE_USER_LEN_DATA_PKT);
+	if (err)
+		goto err_free_user;
+
+	user->adapter = gip_create_adapter(xone_user_misc.this_device,
+					   &xone_user_adapter_ops,
+					   XONE_USER_NUM_AUDIO_PKTS);
+	if (IS_ERR(user->adapter)) {
+		err = PTR_ERR(user->adapter);
+		goto err_free_user;
+	}
+
+	dev_set_drvdata(&user->adapter->dev, user);
+	file->private_data = user;
+
+	return nonseekable_open(inode, file);
+
+err_free_user:
+	xone_user_free(user);
+
+	return err;
+}
+
+static int xone_user_release(struct inode *inode, struct file *file)
+{
+	struct xone_user *user = file->private_data;
+
+	/* submitted buffers are not read anymore */
+	xone_buffers_stop(&user->bufs);
+
+	gip_destroy_adapter(user->adapter);
+	xone_user_free(user);
+
+	return 0;
+}
+
+/* copies the oldest submitted buffer, returns zero if it does not fit */
+static ssize_t xone_user_read_buffer(struct xone_user *user,
+				     char __user *data, size_t count,
+				     enum gip_adapter_buffer_type *type)
+{
+	struct xone_buffer *buf;
+	struct gip_user_record rec = {};
+	size_t len;
+
+	buf = xone_buffers_first_busy(&user->bufs);
+	if (!buf)
+		return 0;
+
+	/* buffers are only freed with read_lock held */
+	len = sizeof(rec) + buf->length;
+	if (count < len)
+		return 0;
+
+	rec.type = buf->type == GIP_BUF_DATA ? GIP_USER_DATA : GIP_USER_AUDIO;
+	rec.length = cpu_to_le16(buf->length);
+
+	if (copy_to_user(data, &rec, sizeof(rec)) ||
+	    copy_to_user(data + sizeof(rec), buf->data, buf->length))
+		return -EFAULT;
+
+	*type = buf->type;
+	xone_buffers_put(&user->bufs, buf);
+
+	return len;
+}
+
+static ssize_t xone_user_read_records(struct xone_user *user,
+				      char __user *data, size_t count)
+{
+	struct gip_user_record rec;
+	enum gip_adapter_buffer_type type;
+	bool kick = false;
+	size_t pos = 0;
+	ssize_t len;
+
+	/* events first, they precede the buffers depending on them */
+	while (count - pos >= sizeof(rec) && kfifo_peek(&user->events, &rec)) {
+		if (copy_to_user(data + pos, &rec, sizeof(rec)))
+			return -EFAULT;
+
+		kfifo_skip(&user->events);
+		pos += sizeof(rec);
+	}
+
+	for (;;) {
+		len = xone_user_read_buffer(user, data + pos, count - pos,
+					    &type);
+		if (len < 0)
+			return len;
+
+		if (!len)
+			break;
+
+		pos += len;
+		kick |= type == GIP_BUF_DATA;
+	}
+
+	/* resume queued packets */
+	if (kick)
+		gip_tx_kick(user->adapter);
+
+	/* the first record has to fit */
+	if (!pos && xone_user_readable(user))
+		return -EINVAL;
+
+	return pos;
+}
+
+static ssize_t xone_user_read(struct file *file, char __user *data,
+			      size_t count, loff_t *ppos)
+{
+	struct xone_user *user = file->private_data;
+	ssize_t len;
+	int err;
+
+	for (;;) {
+		if (!xone_user_readable(user)) {
+			if (file->f_flags & O_NONBLOCK)
+				return -EAGAIN;
+
+			err = wait_event_interruptible(user->wait,
+						       xone_user_readable(user));
+			if (err)
+				return err;
+		}
+
+		err = mutex_lock_interruptible(&user->read_lock);
+		if (err)
+			return err;
+
+		len = xone_user_read_records(user, data, count);
+		mutex_unlock(&user->read_lock);
+
+		/* another reader might have been faster */
+		if (len)
+			return len;
+	}
+}
+
+static int xone_user_process_record(struct xone_user *user,
+				    struct gip_user_record *rec, u8 *data)
+{
+	int len = le16_to_cpu(rec->length);
+	int err;
+
+	if (rec->type != GIP_USER_DATA && rec->type != GIP_USER_AUDIO)
+		return -EINVAL;
+
+	if (!len)
+		return 0;
+
+	/* transports process buffers from URB completions */
+	spin_lock_bh(&user->rx_lock);
+	err = gip_process_buffer(user->adapter, data, len, ktime_get_ns());
+	spin_unlock_bh(&user->rx_lock);
+
+	if (err)
+		dev_dbg(&user->adapter->dev, "%s: process failed: %d\n",
+			__func__, err);
+
+	return 0;
+}
+
+/* accepts whole records, a partial record is left to the caller */
+static ssize_t xone_user_write(struct file *file, const char __user *data,
+			       size_t count, loff_t *ppos)
+{
+	struct xone_user *user = file->private_data;
+	struct gip_user_record *rec;
+	size_t pos = 0, len;
+	int err = 0;
+	u8 *buf;
+
+	count = min_t(size_t, count, XONE_USER_LEN_WRITE);
+
+	buf = memdup_user(data, count);
+	if (IS_ERR(buf))
+		return PTR_ERR(buf);
+
+	while (count - pos >= sizeof(*rec)) {
+		rec = (struct gip_user_record *)(buf + pos);
+		len = sizeof(*rec) + le16_to_cpu(rec->length);
+		if (count - pos < len)
+			break;
+
+		err = xone_user_process_record(user, rec,
+					       buf + pos + sizeof(*rec));
+		if (err)
+			break;
+
+		pos += len;
+	}
+
+	kfree(buf);
+
+	if (!pos)
+		return err ?: -EINVAL;
+
+	return pos;
+}
+
+static __poll_t xone_user_poll(struct file *file, poll_table *wait)
+{
+	struct xone_user *user = file->private_data;
+
+	poll_wait(file, &user->wait, wait);
+
+	/* writes never block */
+	return (xone_user_readable(user) ? EPOLLIN | EPOLLRDNORM : 0) |
+	       EPOLLOUT | EPOLLWRNORM;
+}
+
+static const struct file_operations xone_user_fops = {
+	.owner = THIS_MODULE,
+	.open = xone_user_open,
+	.release = xone_user_release,
+	.read = xone_user_read,
+	.write = xone_user_write,
+	.poll = xone_user_poll,
+};
+
+static struct miscdevice xone_user_misc = {
+	.minor = MISC_DYNAMIC_MINOR,
+	.name = "gip-transport",
+	.fops = &xone_user_fops,
+};
+
+module_misc_device(xone_user_misc);
+
+MODULE_AUTHOR("Severin von Wnuck-Lipinski <severinvonw@outlook.de>");
+MODULE_DESCRIPTION("xone userspace transport");
+MODULE_VERSION("#VERSION#");
+MODULE_LICENSE("GPL");
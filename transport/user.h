@@ -0,0 +1,35 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/*
+ * Copyright (C) 2021 Severin von Wnuck-Lipinski <severinvonw@outlook.de>
+ */
+
+#pragma once
+
+#include <linux/types.h>
+
+/*
+ * Record format of /dev/gip-transport, also used by userspace.
+ * Reads return buffers submitted by the bus and audio events, writes take
+ * buffers received from the device. Each buffer record is followed by
+ * 'length' bytes of data. A single read or write can contain any number
+ * of whole records. All fields are little-endian.
+ */
+enum gip_user_type {
+	/* buffers in both directions */
+	GIP_USER_DATA = 0x00,
+	GIP_USER_AUDIO = 0x01,
+
+	/* events, only read */
+	GIP_USER_AUDIO_ENABLE = 0x10,
+	GIP_USER_AUDIO_INIT_IN = 0x11,
+	/* param is the length of a single audio packet */
+	GIP_USER_AUDIO_INIT_OUT = 0x12,
+	GIP_USER_AUDIO_DISABLE = 0x13,
+};
+
+struct gip_user_record {
+	__u8 type;
+	__u8 reserved;
+	__le16 length;
+	__le32 param;
+} __attribute__((packed));
@@ -0,0 +1,1417 @@
+// SPDX-License-Identifier: GPL-2.0-or-later
+/*
+ * Copyright (C) 2021 Severin von Wnuck-Lipinski <severinvonw@outlook.de>
+ *
+ * Software adapters with scripted devices, used to benchmark the bus and
+ * the drivers without hardware.
+ */
+
+#include <linux/module.h>
+#include <linux/version.h>
+#include <linux/slab.h>
+#include <linux/bitfield.h>
+#include <linux/hid.h>
+#include <linux/kthread.h>
+#include <linux/debugfs.h>
+#include <linux/seq_file.h>
+
+#include "../bus/bus.h"
+#include "../auth/client.h"
+#include "buffers.h"
+
+#define XONE_VIRTUAL_NUM_DATA_BUFS 12
+#define XONE_VIRTUAL_NUM_AUDIO_BUFS 12
+#define XONE_VIRTUAL_NUM_AUDIO_PKTS 8
+
+#define XONE_VIRTUAL_LEN_DATA_PKT 64
+
+/* longest transfer sent by a device, see xone_virtual_send */
+#define XONE_VIRTUAL_LEN_TRANSFER GIP_AUTH_CLIENT_PKT_MAX_LEN
+#define XONE_VIRTUAL_LEN_CHUNK_BUF 1024
+
+/* staging buffers for packets sent by the devices */
+#define XONE_VIRTUAL_LEN_RX_WORK 2048
+#define XONE_VIRTUAL_LEN_RX_INPUT 512
+#define XONE_VIRTUAL_LEN_RX_AUDIO 2048
+
+#define XONE_VIRTUAL_MAX_INPUT_LEN 16
+#define XONE_VIRTUAL_MIN_INTERVAL_US 100
+#define XONE_VIRTUAL_IDLE_INTERVAL_MS 100
+
+static unsigned int adapters = 1;
+module_param(adapters, uint, 0444);
+MODULE_PARM_DESC(adapters, "Number of virtual adapters");
+
+static char *models[GIP_MAX_CLIENTS] = { "gamepad" };
+static int model_count = 1;
+module_param_array(models, charp, &model_count, 0444);
+MODULE_PARM_DESC(models, "Device model of each client (gamepad, headset, chatpad, strat, glam, jaguar)");
+
+static unsigned int input_interval_us = 4000;
+module_param(input_interval_us, uint, 0644);
+MODULE_PARM_DESC(input_interval_us, "Time between input packets (us), 0 disables input");
+
+static unsigned int reconnect_ms;
+module_param(reconnect_ms, uint, 0444);
+MODULE_PARM_DESC(reconnect_ms, "Time between client reconnects (ms), 0 disables reconnects");
+
+static unsigned int rumble_threads;
+module_param(rumble_threads, uint, 0444);
+MODULE_PARM_DESC(rumble_threads, "Threads sending rumble updates to each adapter, 0 disables the burst benchmark");
+
+static unsigned int rumble_rate = 10000;
+module_param(rumble_rate, uint, 0644);
+MODULE_PARM_DESC(rumble_rate, "Rumble updates per second for each adapter, shared by its threads");
+
+struct xone_virtual_model {
+	const char *name;
+	const char *class;
+	u16 vendor;
+	u16 product;
+
+	/* periodic input packets, no input without length */
+	u8 input_command;
+	u8 input_options;
+	u8 input_length;
+	/* byte of the input packet that changes with every packet */
+	u8 input_sweep;
+
+	/* audio formats, zero without audio */
+	u8 audio_in;
+	u8 audio_out;
+
+	bool hid;
+};
+
+static const struct xone_virtual_model xone_virtual_models[] = {
+	{
+		.name = "gamepad",
+		.class = "Windows.Xbox.Input.Gamepad",
+		.vendor = GIP_VID_MICROSOFT,
+		.product = 0x0b12,
+		.input_command = GIP_CMD_INPUT,
+		.input_length = 14,
+		/* left stick X axis */
+		.input_sweep = 7,
+	}, {
+		.name = "headset",
+		.class = "Windows.Xbox.Input.Headset",
+		.vendor = GIP_VID_MICROSOFT,
+		.audio_in = GIP_AUD_FORMAT_24KHZ_MONO,
+		.audio_out = GIP_AUD_FORMAT_48KHZ_STEREO,
+	}, {
+		.name = "chatpad",
+		.class = "Windows.Xbox.Input.Chatpad",
+		.vendor = GIP_VID_MICROSOFT,
+		.input_command = GIP_CMD_HID_REPORT,
+		.input_options = GIP_OPT_INTERNAL,
+		.input_length = 8,
+		.hid = true,
+	}, {
+		.name = "strat",
+		.class = "MadCatz.Xbox.Guitar.Stratocaster",
+		.vendor = 0x0738,
+		.input_command = GIP_CMD_INPUT,
+		.input_length = 7,
+		/* whammy bar */
+		.input_sweep = 3,
+	}, {
+		.name = "glam",
+		.class = "MadCatz.Xbox.Drums.Glam",
+		.vendor = 0x0738,
+		.input_command = GIP_CMD_INPUT,
+		.input_length = 6,
+		/* drum pads */
+		.input_sweep = 2,
+	}, {
+		.name = "jaguar",
+		.class = "PDP.Xbox.Guitar.Jaguar",
+		.vendor = 0x0e6f,
+		.input_command = GIP_CMD_INPUT,
+		.input_length = 4,
+		/* whammy bar */
+		.input_sweep = 3,
+	},
+};
+
+/* advertised by every model */
+/* same layout as the rumble packets of the gamepad driver */
+struct xone_virtual_pkt_rumble {
+	u8 unknown;
+	u8 motors;
+	u8 left_trigger;
+	u8 right_trigger;
+	u8 left;
+	u8 right;
+	u8 duration;
+	u8 delay;
+	u8 repeat;
+} __packed;
+
+static const guid_t xone_virtual_interface =
+	GUID_INIT(0x082e402c, 0x07df, 0x45e1,
+		  0xa5, 0xab, 0xa3, 0x12, 0x7a, 0xf1, 0x97, 0xb5);
+
+/* vendor-defined reports, the chatpad does not type anything */
+static const u8 xone_virtual_hid_report[] = {
+	0x06, 0x00, 0xff,	/* Usage Page (Vendor Defined) */
+	0x09, 0x01,		/* Usage (0x01) */
+	0xa1, 0x01,		/* Collection (Application) */
+	0x15, 0x00,		/*   Logical Minimum (0) */
+	0x26, 0xff, 0x00,	/*   Logical Maximum (255) */
+	0x75, 0x08,		/*   Report Size (8) */
+	0x95, 0x08,		/*   Report Count (8) */
+	0x09, 0x01,		/*   Usage (0x01) */
+	0x81, 0x02,		/*   Input (Data, Variable, Absolute) */
+	0xc0,			/* End Collection */
+};
+
+enum xone_virtual_event {
+	XONE_VIRTUAL_EVT_RECONNECT,
+};
+
+enum xone_virtual_stat {
+	/* buffers and packets submitted by the bus */
+	XONE_VIRTUAL_STAT_TX_BUFFERS,
+	XONE_VIRTUAL_STAT_TX_PACKETS,
+	XONE_VIRTUAL_STAT_TX_STALLS,
+	XONE_VIRTUAL_STAT_TX_ERRORS,
+	/* buffers sent by the devices */
+	XONE_VIRTUAL_STAT_RX_BUFFERS,
+	XONE_VIRTUAL_STAT_RX_ERRORS,
+	/* time spent processing sent buffers */
+	XONE_VIRTUAL_STAT_RX_TIME_NS,
+	XONE_VIRTUAL_STAT_INPUT,
+	XONE_VIRTUAL_STAT_AUDIO_IN,
+	XONE_VIRTUAL_STAT_AUDIO_OUT,
+	XONE_VIRTUAL_STAT_RUMBLE,
+	XONE_VIRTUAL_STAT_LED,
+	XONE_VIRTUAL_STAT_AUTHENTICATED,
+	XONE_VIRTUAL_STAT_CONNECTS,
+	XONE_VIRTUAL_STAT_COUNT,
+};
+
+static const char * const xone_virtual_stat_names[] = {
+	[XONE_VIRTUAL_STAT_TX_BUFFERS] = "tx_buffers",
+	[XONE_VIRTUAL_STAT_TX_PACKETS] = "tx_packets",
+	[XONE_VIRTUAL_STAT_TX_STALLS] = "tx_stalls",
+	[XONE_VIRTUAL_STAT_TX_ERRORS] = "tx_errors",
+	[XONE_VIRTUAL_STAT_RX_BUFFERS] = "rx_buffers",
+	[XONE_VIRTUAL_STAT_RX_ERRORS] = "rx_errors",
+	[XONE_VIRTUAL_STAT_RX_TIME_NS] = "rx_time_ns",
+	[XONE_VIRTUAL_STAT_INPUT] = "input",
+	[XONE_VIRTUAL_STAT_AUDIO_IN] = "audio_in",
+	[XONE_VIRTUAL_STAT_AUDIO_OUT] = "audio_out",
+	[XONE_VIRTUAL_STAT_RUMBLE] = "rumble",
+	[XONE_VIRTUAL_STAT_LED] = "led",
+	[XONE_VIRTUAL_STAT_AUTHENTICATED] = "authenticated",
+	[XONE_VIRTUAL_STAT_CONNECTS] = "connects",
+};
+
+static_assert(ARRAY_SIZE(xone_virtual_stat_names) == XONE_VIRTUAL_STAT_COUNT);
+
+struct xone_virtual_client {
+	struct xone_virtual *virt;
+	const struct xone_virtual_model *model;
+	u8 id;
+
+	/* only changed by the device work, read by the timers */
+	bool connected;
+	bool input;
+	bool mic;
+	u8 audio_in;
+
+	u8 input_count;
+	u8 sequence[256];
+
+	struct gip_auth_client auth;
+
+	/* chunked transfer from the host */
+	struct xone_virtual_chunk {
+		u8 command;
+		u32 length;
+		u32 received;
+		u8 data[XONE_VIRTUAL_LEN_CHUNK_BUF];
+	} chunk;
+};
+
+struct xone_virtual {
+	struct gip_adapter *adapter;
+
+	struct xone_buffers bufs;
+	struct xone_buffer *bufs_data[XONE_VIRTUAL_NUM_DATA_BUFS];
+	struct xone_buffer *bufs_audio[XONE_VIRTUAL_NUM_AUDIO_BUFS];
+
+	/* device side, consumes submitted buffers */
+	struct work_struct work;
+	struct delayed_work reconnect_work;
+	unsigned long events;
+
+	struct hrtimer input_timer;
+	struct hrtimer audio_timer;
+
+	/* packets of all devices arrive in order, like on an endpoint */
+	spinlock_t rx_lock;
+	u8 rx_work[XONE_VIRTUAL_LEN_RX_WORK];
+	u8 rx_input[XONE_VIRTUAL_LEN_RX_INPUT];
+	u8 rx_audio[XONE_VIRTUAL_LEN_RX_AUDIO];
+	u8 scratch[XONE_VIRTUAL_LEN_TRANSFER];
+
+	struct xone_virtual_client clients[GIP_MAX_CLIENTS];
+	int client_count;
+
+	/* write locked while the devices disconnect, removing bus clients */
+	rwlock_t clients_lock;
+
+	/* rumble burst benchmark, see xone_virtual_rumble_thread */
+	struct task_struct **rumble_tasks;
+	atomic_t rumble_next;
+	atomic64_t rumble_updates;
+	u64 rumble_start;
+	u64 rumble_latency[GIP_TX_LATENCY_BUCKETS];
+
+	struct gip_stats stats;
+	atomic64_t rx_time_max_ns;
+
+	struct dentry *debugfs;
+};
+
+static struct device *xone_virtual_root;
+static struct dentry *xone_virtual_debugfs_root;
+static struct xone_virtual **xone_virtual_adapters;
+
+static u8 xone_virtual_next_sequence(struct xone_virtual_client *vc, u8 cmd)
+{
+	u8 seq = vc->sequence[cmd] + 1 ?: 1;
+
+	vc->sequence[cmd] = seq;
+
+	return seq;
+}
+
+static int xone_virtual_put_pkt(u8 *buf, struct gip_header *hdr, void *data)
+{
+	int hdr_len = gip_get_header_length(hdr);
+
+	gip_encode_header(hdr, buf);
+
+	if (data)
+		memcpy(buf + hdr_len, data, hdr->packet_length);
+	else
+		memset(buf + hdr_len, 0, hdr->packet_length);
+
+	return hdr_len + hdr->packet_length;
+}
+
+static void xone_virtual_account_rx(struct xone_virtual *virt, u64 start)
+{
+	u64 delta = ktime_get_ns() - start;
+	s64 max = atomic64_read(&virt->rx_time_max_ns);
+
+	gip_stats_inc(&virt->stats, XONE_VIRTUAL_STAT_RX_BUFFERS);
+	gip_stats_add(&virt->stats, XONE_VIRTUAL_STAT_RX_TIME_NS, delta);
+
+	while (delta > max) {
+		s64 old = atomic64_cmpxchg(&virt->rx_time_max_ns, max, delta);
+
+		if (old == max)
+			break;
+
+		max = old;
+	}
+}
+
+/* hands a buffer of device packets to the bus */
+static void xone_virtual_deliver(struct xone_virtual *virt, u8 *data, int len)
+{
+	u64 start;
+	int err;
+
+	spin_lock_bh(&virt->rx_lock);
+	start = ktime_get_ns();
+	err = gip_process_buffer(virt->adapter, data, len, start);
+	xone_virtual_account_rx(virt, start);
+	spin_unlock_bh(&virt->rx_lock);
+
+	if (err) {
+		gip_stats_inc(&virt->stats, XONE_VIRTUAL_STAT_RX_ERRORS);
+		dev_dbg(&virt->adapter->dev, "%s: process failed: %d\n",
+			__func__, err);
+	}
+}
+
+/* sends a packet, chunked when it exceeds the maximum length */
+static void xone_virtual_send(struct xone_virtual_client *vc,
+			      u8 cmd, u8 options, void *data, u32 len)
+{
+	struct xone_virtual *virt = vc->virt;
+	struct gip_header hdr = {
+		.command = cmd,
+		.options = vc->id | options,
+		.sequence = xone_virtual_next_sequence(vc, cmd),
+	};
+	u32 offset, chunk;
+	int pos = 0;
+
+	BUILD_BUG_ON(XONE_VIRTUAL_LEN_TRANSFER / GIP_PKT_MAX_LENGTH *
+		     (GIP_PKT_MAX_LENGTH + 8) + 24 > XONE_VIRTUAL_LEN_RX_WORK);
+
+	if (len <= GIP_PKT_MAX_LENGTH) {
+		hdr.packet_length = len;
+		pos = xone_virtual_put_pkt(virt->rx_work, &hdr, data);
+		xone_virtual_deliver(virt, virt->rx_work, pos);
+		return;
+	}
+
+	if (WARN_ON(len > XONE_VIRTUAL_LEN_TRANSFER))
+		return;
+
+	/* devices never wait for acknowledgments */
+	for (offset = 0; offset < len; offset += chunk) {
+		chunk = min_t(u32, len - offset, GIP_PKT_MAX_LENGTH);
+
+		hdr.options = vc->id | options | GIP_OPT_CHUNK;
+		hdr.packet_length = chunk;
+		hdr.chunk_offset = offset;
+
+		/* chunk offset of first chunk is total length */
+		if (!offset) {
+			hdr.options |= GIP_OPT_CHUNK_START |
+				       GIP_OPT_ACKNOWLEDGE;
+			hdr.chunk_offset = len;
+		}
+
+		pos += xone_virtual_put_pkt(virt->rx_work + pos, &hdr,
+					    data + offset);
+	}
+
+	/* empty chunk signals the completion of the transfer */
+	hdr.options = vc->id | options | GIP_OPT_CHUNK;
+	hdr.packet_length = 0;
+	hdr.chunk_offset = len;
+	pos += xone_virtual_put_pkt(virt->rx_work + pos, &hdr, NULL);
+
+	xone_virtual_deliver(virt, virt->rx_work, pos);
+}
+
+static void xone_virtual_send_acknowledge(struct xone_virtual_client *vc,
+					  struct gip_header *ack,
+					  u32 len, u32 remaining)
+{
+	struct xone_virtual *virt = vc->virt;
+	struct gip_pkt_acknowledge pkt = {};
+	struct gip_header hdr = {
+		.command = GIP_CMD_ACKNOWLEDGE,
+		.options = vc->id | GIP_OPT_INTERNAL,
+		.sequence = ack->sequence,
+		.packet_length = sizeof(pkt),
+	};
+
+	pkt.command = ack->command;
+	pkt.options = vc->id | GIP_OPT_INTERNAL;
+	pkt.length = cpu_to_le16(len);
+	pkt.remaining = cpu_to_le16(remaining);
+
+	xone_virtual_deliver(virt, virt->rx_work,
+			     xone_virtual_put_pkt(virt->rx_work, &hdr, &pkt));
+}
+
+static void xone_virtual_send_announce(struct xone_virtual_client *vc)
+{
+	const struct xone_virtual_model *model = vc->model;
+	struct gip_pkt_announce pkt = {};
+
+	/* locally administered address */
+	pkt.address[0] = 0x02;
+	pkt.address[4] = vc->virt->adapter->id;
+	pkt.address[5] = vc->id;
+	pkt.vendor_id = cpu_to_le16(model->vendor);
+	pkt.product_id = cpu_to_le16(model->product);
+	pkt.fw_version.major = cpu_to_le16(1);
+	pkt.hw_version.major = cpu_to_le16(1);
+
+	xone_virtual_send(vc, GIP_CMD_ANNOUNCE, GIP_OPT_INTERNAL,
+			  &pkt, sizeof(pkt));
+}
+
+static void xone_virtual_send_status(struct xone_virtual_client *vc,
+				     bool connected)
+{
+	struct gip_pkt_status pkt = {};
+
+	if (connected)
+		pkt.status = GIP_STATUS_CONNECTED |
+			     FIELD_PREP(GIP_BATT_TYPE, GIP_BATT_TYPE_STANDARD) |
+			     FIELD_PREP(GIP_BATT_LEVEL, GIP_BATT_LEVEL_FULL);
+
+	xone_virtual_send(vc, GIP_CMD_STATUS, GIP_OPT_INTERNAL,
+			  &pkt, sizeof(pkt));
+}
+
+static int xone_virtual_put_element(u8 *data, int off, const void *items,
+				    u8 count, int item_len)
+{
+	data[off++] = count;
+	memcpy(data + off, items, count * item_len);
+
+	return off + count * item_len;
+}
+
+static int xone_virtual_put_identify(struct xone_virtual_client *vc, u8 *buf)
+{
+	const struct xone_virtual_model *model = vc->model;
+	struct gip_pkt_identify *pkt = (struct gip_pkt_identify *)buf;
+	struct gip_firmware_version ver = {
+		.major = cpu_to_le16(1),
+	};
+	struct hid_descriptor desc = {
+		.bLength = sizeof(desc),
+		.bDescriptorType = HID_DT_HID,
+		.bcdHID = cpu_to_le16(0x0111),
+		.bNumDescriptors = 1,
+		.desc[0] = {
+			.bDescriptorType = HID_DT_REPORT,
+			.wDescriptorLength =
+				cpu_to_le16(sizeof(xone_virtual_hid_report)),
+		},
+	};
+	u8 formats[] = { model->audio_in, model->audio_out };
+	u8 caps = 0x01;
+	u16 class_len = strlen(model->class);
+	/* offsets start after the unknown header */
+	u8 *data = buf + sizeof(pkt->unknown);
+	int off = sizeof(*pkt) - sizeof(pkt->unknown);
+
+	memset(pkt, 0, sizeof(*pkt));
+
+	pkt->firmware_versions_offset = cpu_to_le16(off);
+	off = xone_virtual_put_element(data, off, &ver, 1, sizeof(ver));
+
+	if (model->audio_in) {
+		pkt->audio_formats_offset = cpu_to_le16(off);
+		off = xone_virtual_put_element(data, off, formats, 1,
+					       sizeof(formats));
+	}
+
+	pkt->capabilities_out_offset = cpu_to_le16(off);
+	off = xone_virtual_put_element(data, off, &caps, 1, sizeof(caps));
+	pkt->capabilities_in_offset = cpu_to_le16(off);
+	off = xone_virtual_put_element(data, off, &caps, 1, sizeof(caps));
+
+	pkt->classes_offset = cpu_to_le16(off);
+	data[off++] = 1;
+	put_unaligned_le16(class_len, data + off);
+	off += sizeof(class_len);
+	memcpy(data + off, model->class, class_len);
+	off += class_len;
+
+	pkt->interfaces_offset = cpu_to_le16(off);
+	off = xone_virtual_put_element(data, off, &xone_virtual_interface, 1,
+				       sizeof(xone_virtual_interface));
+
+	if (model->hid) {
+		pkt->hid_descriptor_offset = cpu_to_le16(off);
+		data[off++] = sizeof(desc) + sizeof(xone_virtual_hid_report);
+		memcpy(data + off, &desc, sizeof(desc));
+		off += sizeof(desc);
+		memcpy(data + off, xone_virtual_hid_report,
+		       sizeof(xone_virtual_hid_report));
+		off += sizeof(xone_virtual_hid_report);
+	}
+
+	return sizeof(pkt->unknown) + off;
+}
+
+static int xone_virtual_handle_identify(struct xone_virtual_client *vc)
+{
+	struct xone_virtual *virt = vc->virt;
+	int len = xone_virtual_put_identify(vc, virt->scratch);
+
+	xone_virtual_send(vc, GIP_CMD_IDENTIFY, GIP_OPT_INTERNAL,
+			  virt->scratch, len);
+
+	return 0;
+}
+
+static int xone_virtual_handle_power(struct xone_virtual_client *vc,
+				     void *data, u32 len)
+{
+	struct gip_pkt_power *pkt = data;
+	struct gip_pkt_audio_volume vol = {
+		.control.subcommand = GIP_AUD_CTRL_VOLUME,
+		.mute = GIP_AUD_VOLUME_UNMUTED,
+		.out = 100,
+		.chat = 50,
+		.in = 100,
+	};
+
+	if (len < sizeof(*pkt))
+		return -EINVAL;
+
+	if (pkt->mode != GIP_PWR_ON) {
+		WRITE_ONCE(vc->input, false);
+		WRITE_ONCE(vc->mic, false);
+		return 0;
+	}
+
+	xone_virtual_send_status(vc, true);
+
+	if (vc->model->input_length)
+		WRITE_ONCE(vc->input, true);
+
+	/* audio starts once the format has been accepted */
+	if (!vc->audio_in)
+		return 0;
+
+	xone_virtual_send(vc, GIP_CMD_AUDIO_CONTROL, GIP_OPT_INTERNAL,
+			  &vol, sizeof(vol));
+	WRITE_ONCE(vc->mic, true);
+
+	return 0;
+}
+
+static int xone_virtual_handle_auth(struct xone_virtual_client *vc,
+				    void *data, u32 len)
+{
+	struct xone_virtual *virt = vc->virt;
+	bool complete = vc->auth.complete;
+	int err;
+
+	if (!vc->auth.shash_transcript) {
+		err = gip_auth_client_init(&vc->auth);
+		if (err)
+			return err;
+	}
+
+	err = gip_auth_client_process_pkt(&vc->auth, data, len, virt->scratch);
+	if (err < 0)
+		return err;
+
+	if (err)
+		xone_virtual_send(vc, GIP_CMD_AUTHENTICATE, GIP_OPT_INTERNAL,
+				  virt->scratch, err);
+
+	if (!complete && vc->auth.complete)
+		gip_stats_inc(&virt->stats, XONE_VIRTUAL_STAT_AUTHENTICATED);
+
+	return 0;
+}
+
+static int xone_virtual_handle_audio_format(struct xone_virtual_client *vc,
+					    void *data, u32 len)
+{
+	const struct xone_virtual_model *model = vc->model;
+	struct gip_pkt_audio_format *pkt = data;
+
+	if (len < sizeof(*pkt) || !model->audio_in)
+		return -EINVAL;
+
+	/* rejected formats are answered with the supported ones */
+	if (pkt->in == model->audio_in && pkt->out == model->audio_out)
+		vc->audio_in = pkt->in;
+
+	pkt->in = model->audio_in;
+	pkt->out = model->audio_out;
+
+	xone_virtual_send(vc, GIP_CMD_AUDIO_CONTROL, GIP_OPT_INTERNAL,
+			  pkt, sizeof(*pkt));
+
+	return 0;
+}
+
+static int xone_virtual_handle_audio_control(struct xone_virtual_client *vc,
+					     void *data, u32 len)
+{
+	struct gip_pkt_audio_control *pkt = data;
+
+	if (len < sizeof(*pkt))
+		return -EINVAL;
+
+	/* volume changes are ignored */
+	if (pkt->subcommand == GIP_AUD_CTRL_FORMAT)
+		return xone_virtual_handle_audio_format(vc, data, len);
+
+	return 0;
+}
+
+static int xone_virtual_dispatch_pkt(struct xone_virtual_client *vc,
+				     u8 cmd, void *data, u32 len)
+{
+	struct xone_virtual *virt = vc->virt;
+
+	switch (cmd) {
+	case GIP_CMD_IDENTIFY:
+		return xone_virtual_handle_identify(vc);
+	case GIP_CMD_POWER:
+		return xone_virtual_handle_power(vc, data, len);
+	case GIP_CMD_AUTHENTICATE:
+		return xone_virtual_handle_auth(vc, data, len);
+	case GIP_CMD_AUDIO_CONTROL:
+		return xone_virtual_handle_audio_control(vc, data, len);
+	case GIP_CMD_RUMBLE:
+		gip_stats_inc(&virt->stats, XONE_VIRTUAL_STAT_RUMBLE);
+		return 0;
+	case GIP_CMD_LED:
+		gip_stats_inc(&virt->stats, XONE_VIRTUAL_STAT_LED);
+		return 0;
+	case GIP_CMD_AUDIO_SAMPLES:
+		gip_stats_inc(&virt->stats, XONE_VIRTUAL_STAT_AUDIO_OUT);
+		return 0;
+	default:
+		/* transfers are never retransmitted, acks are ignored */
+		return 0;
+	}
+}
+
+static int xone_virtual_process_chunk(struct xone_virtual_client *vc,
+				      struct gip_header *hdr, void *data)
+{
+	struct xone_virtual_chunk *chunk = &vc->chunk;
+
+	if (hdr->options & GIP_OPT_CHUNK_START) {
+		/* offset is total length of all chunks */
+		if (hdr->chunk_offset > sizeof(chunk->data))
+			return -EINVAL;
+
+		chunk->command = hdr->command;
+		chunk->length = hdr->chunk_offset;
+		chunk->received = 0;
+		hdr->chunk_offset = 0;
+	}
+
+	if (!chunk->length || hdr->command != chunk->command)
+		return -EPROTO;
+
+	if (hdr->packet_length) {
+		/* only chunks in order, the host resends the others */
+		if (hdr->chunk_offset == chunk->received &&
+		    chunk->received + hdr->packet_length <= chunk->length) {
+			memcpy(chunk->data + chunk->received, data,
+			       hdr->packet_length);
+			chunk->received += hdr->packet_length;
+		}
+
+		if ((hdr->options & GIP_OPT_ACKNOWLEDGE) ||
+		    chunk->received == chunk->length)
+			xone_virtual_send_acknowledge(vc, hdr, chunk->received,
+						      chunk->length -
+						      chunk->received);
+
+		return 0;
+	}
+
+	/* empty chunk signals the completion of the transfer */
+	chunk->length = 0;
+	if (chunk->received != hdr->chunk_offset)
+		return -EPROTO;
+
+	return xone_virtual_dispatch_pkt(vc, chunk->command,
+					 chunk->data, chunk->received);
+}
+
+static int xone_virtual_process_pkt(struct xone_virtual_client *vc,
+				    struct gip_header *hdr, void *data)
+{
+	if (hdr->options & GIP_OPT_CHUNK)
+		return xone_virtual_process_chunk(vc, hdr, data);
+
+	if (hdr->options & GIP_OPT_ACKNOWLEDGE)
+		xone_virtual_send_acknowledge(vc, hdr, hdr->packet_length, 0);
+
+	return xone_virtual_dispatch_pkt(vc, hdr->command, data,
+					 hdr->packet_length);
+}
+
+static void xone_virtual_process_buffer(struct xone_virtual *virt,
+					struct xone_buffer *buf)
+{
+	struct xone_virtual_client *vc;
+	struct gip_header hdr;
+	u8 *data = buf->data;
+	int len = buf->length;
+	int hdr_len, id, err;
+
+	gip_stats_inc(&virt->stats, XONE_VIRTUAL_STAT_TX_BUFFERS);
+
+	while (len > GIP_HDR_MIN_LENGTH) {
+		hdr_len = gip_decode_header(&hdr, data, len);
+		if (len < hdr_len + hdr.packet_length) {
+			gip_stats_inc(&virt->stats,
+				      XONE_VIRTUAL_STAT_TX_ERRORS);
+			return;
+		}
+
+		gip_stats_inc(&virt->stats, XONE_VIRTUAL_STAT_TX_PACKETS);
+
+		id = hdr.options & GIP_HDR_CLIENT_ID;
+		if (id < virt->client_count) {
+			vc = &virt->clients[id];
+			err = xone_virtual_process_pkt(vc, &hdr,
+						       data + hdr_len);
+			if (err) {
+				gip_stats_inc(&virt->stats,
+					      XONE_VIRTUAL_STAT_TX_ERRORS);
+				dev_dbg(&virt->adapter->dev,
+					"%s: command 0x%02x failed: %d\n",
+					__func__, hdr.command, err);
+			}
+		}
+
+		data += hdr_len + hdr.packet_length;
+		len -= hdr_len + hdr.packet_length;
+	}
+}
+
+static void xone_virtual_connect(struct xone_virtual_client *vc)
+{
+	vc->connected = true;
+	gip_stats_inc(&vc->virt->stats, XONE_VIRTUAL_STAT_CONNECTS);
+
+	/* host requests the identification */
+	xone_virtual_send_announce(vc);
+}
+
+static void xone_virtual_disconnect(struct xone_virtual_client *vc)
+{
+	WRITE_ONCE(vc->input, false);
+	WRITE_ONCE(vc->mic, false);
+
+	vc->connected = false;
+	vc->audio_in = 0;
+	vc->chunk.length = 0;
+
+	/* bus client is freed once removed */
+	write_lock_bh(&vc->virt->clients_lock);
+	xone_virtual_send_status(vc, false);
+	write_unlock_bh(&vc->virt->clients_lock);
+}
+
+static void xone_virtual_reconnect_clients(struct xone_virtual *virt)
+{
+	int i;
+
+	for (i = virt->client_count - 1; i >= 0; i--)
+		if (virt->clients[i].connected)
+			xone_virtual_disconnect(&virt->clients[i]);
+
+	for (i = 0; i < virt->client_count; i++)
+		xone_virtual_connect(&virt->clients[i]);
+}
+
+static void xone_virtual_work(struct work_struct *work)
+{
+	struct xone_virtual *virt = container_of(work, typeof(*virt), work);
+	struct xone_buffer *buf, *tmp;
+	LIST_HEAD(bufs);
+
+	if (test_and_clear_bit(XONE_VIRTUAL_EVT_RECONNECT, &virt->events))
+		xone_virtual_reconnect_clients(virt);
+
+	xone_buffers_take_busy(&virt->bufs, &bufs);
+
+	list_for_each_entry_safe(buf, tmp, &bufs, list) {
+		list_del_init(&buf->list);
+		xone_virtual_process_buffer(virt, buf);
+		xone_buffers_put(&virt->bufs, buf);
+
+		/* resume queued packets */
+		if (buf->type == GIP_BUF_DATA)
+			gip_tx_kick(virt->adapter);
+	}
+}
+
+static void xone_virtual_reconnect(struct work_struct *work)
+{
+	struct xone_virtual *virt = container_of(to_delayed_work(work),
+						 typeof(*virt),
+						 reconnect_work);
+
+	set_bit(XONE_VIRTUAL_EVT_RECONNECT, &virt->events);
+	schedule_work(&virt->work);
+	schedule_delayed_work(&virt->reconnect_work,
+			      msecs_to_jiffies(reconnect_ms));
+}
+
+static int xone_virtual_put_input(struct xone_virtual_client *vc, u8 *buf)
+{
+	const struct xone_virtual_model *model = vc->model;
+	struct gip_header hdr = {
+		.command = model->input_command,
+		.options = vc->id | model->input_options,
+		.sequence = xone_virtual_next_sequence(vc,
+						       model->input_command),
+		.packet_length = model->input_length,
+	};
+	u8 data[XONE_VIRTUAL_MAX_INPUT_LEN] = {};
+
+	data[model->input_sweep] = vc->input_count++;
+
+	return xone_virtual_put_pkt(buf, &hdr, data);
+}
+
+static enum hrtimer_restart xone_virtual_send_input(struct hrtimer *timer)
+{
+	struct xone_virtual *virt = container_of(timer, typeof(*virt),
+						 input_timer);
+	unsigned int interval = READ_ONCE(input_interval_us);
+	struct xone_virtual_client *vc;
+	int i, count = 0, len = 0;
+
+	if (!interval) {
+		hrtimer_forward_now(timer,
+				    ms_to_ktime(XONE_VIRTUAL_IDLE_INTERVAL_MS));
+		return HRTIMER_RESTART;
+	}
+
+	for (i = 0; i < virt->client_count; i++) {
+		vc = &virt->clients[i];
+		if (!READ_ONCE(vc->input))
+			continue;
+
+		len += xone_virtual_put_input(vc, virt->rx_input + len);
+		count++;
+	}
+
+	if (len) {
+		gip_stats_add(&virt->stats, XONE_VIRTUAL_STAT_INPUT, count);
+		xone_virtual_deliver(virt, virt->rx_input, len);
+	}
+
+	hrtimer_forward_now(timer, us_to_ktime(max(interval,
+						   XONE_VIRTUAL_MIN_INTERVAL_US)));
+
+	return HRTIMER_RESTART;
+}
+
+static void xone_virtual_post_rumble(struct xone_virtual *virt,
+				     struct xone_virtual_pkt_rumble *pkt)
+{
+	struct gip_client *client;
+	int id;
+
+	/* spread the updates over all clients */
+	id = (unsigned int)atomic_inc_return(&virt->rumble_next) %
+	     virt->client_count;
+
+	read_lock_bh(&virt->clients_lock);
+
+	client = READ_ONCE(virt->adapter->clients[id]);
+	if (client && !gip_send_rumble(client, pkt, sizeof(*pkt)))
+		atomic64_inc(&virt->rumble_updates);
+
+	read_unlock_bh(&virt->clients_lock);
+}
+
+/* acts like the rumble timers of many drivers firing at the same time */
+static int xone_virtual_rumble_thread(void *data)
+{
+	struct xone_virtual *virt = data;
+	struct xone_virtual_pkt_rumble pkt = {
+		.motors = 0x0f,
+		.duration = 0xff,
+		.repeat = 0xeb,
+	};
+	ktime_t next = ktime_get();
+	unsigned int rate;
+
+	while (!kthread_should_stop()) {
+		rate = READ_ONCE(rumble_rate);
+		if (!rate) {
+			msleep_interruptible(XONE_VIRTUAL_IDLE_INTERVAL_MS);
+			next = ktime_get();
+			continue;
+		}
+
+		/* the achieved rate drops when the threads fall behind */
+		next = ktime_add_ns(next, div_u64((u64)NSEC_PER_SEC *
+						  rumble_threads, rate));
+		if (ktime_before(next, ktime_get()))
+			next = ktime_get();
+
+		pkt.left++;
+		pkt.right = pkt.left;
+		xone_virtual_post_rumble(virt, &pkt);
+
+		set_current_state(TASK_INTERRUPTIBLE);
+		schedule_hrtimeout(&next, HRTIMER_MODE_ABS);
+	}
+
+	return 0;
+}
+
+static int xone_virtual_start_rumble(struct xone_virtual *virt)
+{
+	struct task_struct *task;
+	int i;
+
+	virt->rumble_tasks = kcalloc(rumble_threads,
+				     sizeof(*virt->rumble_tasks), GFP_KERNEL);
+	if (!virt->rumble_tasks)
+		return -ENOMEM;
+
+	for (i = 0; i < rumble_threads; i++) {
+		task = kthread_run(xone_virtual_rumble_thread, virt,
+				   "xone-rumble/%d.%d", virt->adapter->id, i);
+		if (IS_ERR(task))
+			return PTR_ERR(task);
+
+		virt->rumble_tasks[i] = task;
+	}
+
+	return 0;
+}
+
+static void xone_virtual_stop_rumble(struct xone_virtual *virt)
+{
+	int i;
+
+	if (!virt->rumble_tasks)
+		return;
+
+	for (i = 0; i < rumble_threads; i++)
+		if (virt->rumble_tasks[i])
+			kthread_stop(virt->rumble_tasks[i]);
+
+	kfree(virt->rumble_tasks);
+	virt->rumble_tasks = NULL;
+}
+
+static int xone_virtual_get_fragment_size(u8 format)
+{
+	int rate, channels;
+
+	switch (format) {
+	case GIP_AUD_FORMAT_16KHZ_MONO:
+		rate = 16000;
+		channels = 1;
+		break;
+	case GIP_AUD_FORMAT_24KHZ_MONO:
+		rate = 24000;
+		channels = 1;
+		break;
+	case GIP_AUD_FORMAT_48KHZ_STEREO:
+		rate = 48000;
+		channels = 2;
+		break;
+	default:
+		return 0;
+	}
+
+	return rate * channels * sizeof(s16) * GIP_AUDIO_INTERVAL /
+	       MSEC_PER_SEC / XONE_VIRTUAL_NUM_AUDIO_PKTS;
+}
+
+static enum hrtimer_restart xone_virtual_send_audio(struct hrtimer *timer)
+{
+	struct xone_virtual *virt = container_of(timer, typeof(*virt),
+						 audio_timer);
+	struct xone_virtual_client *vc;
+	struct gip_header hdr = {
+		.command = GIP_CMD_AUDIO_SAMPLES,
+	};
+	int i, j, len;
+
+	BUILD_BUG_ON(XONE_VIRTUAL_NUM_AUDIO_PKTS * 200 >
+		     XONE_VIRTUAL_LEN_RX_AUDIO);
+
+	for (i = 0; i < virt->client_count; i++) {
+		vc = &virt->clients[i];
+		if (!READ_ONCE(vc->mic))
+			continue;
+
+		/* silence, samples start with the length field */
+		hdr.options = vc->id | GIP_OPT_INTERNAL;
+		hdr.packet_length = sizeof(struct gip_pkt_audio_samples) +
+			xone_virtual_get_fragment_size(READ_ONCE(vc->audio_in));
+
+		for (j = 0, len = 0; j < XONE_VIRTUAL_NUM_AUDIO_PKTS; j++) {
+			hdr.sequence = xone_virtual_next_sequence(vc,
+								  hdr.command);
+			len += xone_virtual_put_pkt(virt->rx_audio + len,
+						    &hdr, NULL);
+		}
+
+		gip_stats_add(&virt->stats, XONE_VIRTUAL_STAT_AUDIO_IN,
+			      XONE_VIRTUAL_NUM_AUDIO_PKTS);
+		xone_virtual_deliver(virt, virt->rx_audio, len);
+	}
+
+	hrtimer_forward_now(timer, ms_to_ktime(GIP_AUDIO_INTERVAL));
+
+	return HRTIMER_RESTART;
+}
+
+static int xone_virtual_get_buffer(struct gip_adapter *adap,
+				   struct gip_adapter_buffer *buf)
+{
+	struct xone_virtual *virt = dev_get_drvdata(&adap->dev);
+	int err;
+
+	err = xone_buffers_get(&virt->bufs, buf);
+	if (err == -ENOSPC)
+		gip_stats_inc(&virt->stats, XONE_VIRTUAL_STAT_TX_STALLS);
+
+	return err;
+}
+
+static int xone_virtual_submit_buffer(struct gip_adapter *adap,
+				      struct gip_adapter_buffer *buf)
+{
+	struct xone_virtual *virt = dev_get_drvdata(&adap->dev);
+	int err;
+
+	err = xone_buffers_submit(&virt->bufs, buf);
+	if (err)
+		return err;
+
+	/* processed by the device after the submitter returns */
+	schedule_work(&virt->work);
+
+	return 0;
+}
+
+static void xone_virtual_put_buffer(struct gip_adapter *adap,
+				    struct gip_adapter_buffer *buf)
+{
+	struct xone_virtual *virt = dev_get_drvdata(&adap->dev);
+
+	xone_buffers_put(&virt->bufs, buf->context);
+}
+
+static int xone_virtual_enable_audio(struct gip_adapter *adap)
+{
+	return 0;
+}
+
+static int xone_virtual_init_audio_in(struct gip_adapter *adap)
+{
+	return 0;
+}
+
+static int xone_virtual_init_audio_out(struct gip_adapter *adap, int pkt_len)
+{
+	struct xone_virtual *virt = dev_get_drvdata(&adap->dev);
+	int err;
+
+	xone_buffers_free(&virt->bufs, virt->bufs_audio,
+			  XONE_VIRTUAL_NUM_AUDIO_BUFS);
+
+	err = xone_buffers_alloc(&virt->bufs, virt->bufs_audio,
+				 XONE_VIRTUAL_NUM_AUDIO_BUFS, GIP_BUF_AUDIO,
+				 pkt_len * XONE_VIRTUAL_NUM_AUDIO_PKTS);
+	if (err)
+		xone_buffers_free(&virt->bufs, virt->bufs_audio,
+				  XONE_VIRTUAL_NUM_AUDIO_BUFS);
+
+	return err;
+}
+
+static int xone_virtual_disable_audio(struct gip_adapter *adap)
+{
+	struct xone_virtual *virt = dev_get_drvdata(&adap->dev);
+
+	/* device returns all submitted buffers */
+	flush_work(&virt->work);
+	xone_buffers_free(&virt->bufs, virt->bufs_audio,
+			  XONE_VIRTUAL_NUM_AUDIO_BUFS);
+
+	return 0;
+}
+
+static int xone_virtual_replay_buffer(struct gip_adapter *adap, void *data,
+				      int len, u64 time)
+{
+	struct xone_virtual *virt = dev_get_drvdata(&adap->dev);
+	int err;
+
+	spin_lock_bh(&virt->rx_lock);
+	err = gip_process_buffer(adap, data, len, time);
+	spin_unlock_bh(&virt->rx_lock);
+
+	return err;
+}
+
+static struct gip_adapter_ops xone_virtual_adapter_ops = {
+	.get_buffer = xone_virtual_get_buffer,
+	.submit_buffer = xone_virtual_submit_buffer,
+	.put_buffer = xone_virtual_put_buffer,
+	.enable_audio = xone_virtual_enable_audio,
+	.init_audio_in = xone_virtual_init_audio_in,
+	.init_audio_out = xone_virtual_init_audio_out,
+	.disable_audio = xone_virtual_disable_audio,
+	.replay_buffer = xone_virtual_replay_buffer,
+};
+
+static int xone_virtual_stats_show(struct seq_file *s, void *data)
+{
+	struct xone_virtual *virt = s->private;
+
+	gip_stats_show(s, &virt->stats);
+	seq_printf(s, "rx_time_max_ns: %lld\n",
+		   atomic64_read(&virt->rx_time_max_ns));
+
+	return 0;
+}
+
+static void xone_virtual_stats_reset(struct xone_virtual *virt)
+{
+	gip_stats_reset(&virt->stats);
+	atomic64_set(&virt->rx_time_max_ns, 0);
+}
+DEFINE_GIP_STATS_ATTRIBUTE(xone_virtual_stats);
+
+/* enqueue latencies are taken from the adapter's TX histogram */
+static int xone_virtual_rumble_show(struct seq_file *s, void *data)
+{
+	struct xone_virtual *virt = s->private;
+	atomic64_t *latency = virt->adapter->tx.latency;
+	u64 counts[GIP_TX_LATENCY_BUCKETS];
+	u64 elapsed = ktime_get_ns() - READ_ONCE(virt->rumble_start);
+	u64 updates = atomic64_read(&virt->rumble_updates);
+	u64 total = 0, sum = 0;
+	int i;
+
+	for (i = 0; i < GIP_TX_LATENCY_BUCKETS; i++) {
+		counts[i] = atomic64_read(&latency[i]) -
+			    READ_ONCE(virt->rumble_latency[i]);
+		total += counts[i];
+	}
+
+	/* upper bound of the bucket holding the 99th percentile */
+	for (i = 0; i < GIP_TX_LATENCY_BUCKETS - 1; i++) {
+		sum += counts[i];
+		if (sum * 100 >= total * 99)
+			break;
+	}
+
+	seq_printf(s, "threads: %u\n", rumble_threads);
+	seq_printf(s, "updates: %llu\n", updates);
+	seq_printf(s, "rate_per_sec: %llu\n",
+		   elapsed ? div64_u64(updates * NSEC_PER_SEC, elapsed) : 0);
+	seq_printf(s, "enqueued: %llu\n", total);
+	seq_printf(s, "enqueue_p99_ns: %llu\n", total ? BIT_ULL(i) : 0);
+
+	return 0;
+}
+
+/* starts a new measurement */
+static void xone_virtual_rumble_reset(struct xone_virtual *virt)
+{
+	atomic64_t *latency = virt->adapter->tx.latency;
+	int i;
+
+	for (i = 0; i < GIP_TX_LATENCY_BUCKETS; i++)
+		WRITE_ONCE(virt->rumble_latency[i], atomic64_read(&latency[i]));
+
+	atomic64_set(&virt->rumble_updates, 0);
+	WRITE_ONCE(virt->rumble_start, ktime_get_ns());
+}
+DEFINE_GIP_STATS_ATTRIBUTE(xone_virtual_rumble);
+
+static const struct xone_virtual_model *xone_virtual_find_model(const char *name)
+{
+	int i;
+
+	for (i = 0; i < ARRAY_SIZE(xone_virtual_models); i++)
+		if (!strcmp(xone_virtual_models[i].name, name))
+			return &xone_virtual_models[i];
+
+	return NULL;
+}
+
+static void xone_virtual_free(struct xone_virtual *virt)
+{
+	int i;
+
+	for (i = 0; i < virt->client_count; i++)
+		if (virt->clients[i].auth.shash_transcript)
+			gip_auth_client_free(&virt->clients[i].auth);
+
+	xone_buffers_free(&virt->bufs, virt->bufs_data,
+			  XONE_VIRTUAL_NUM_DATA_BUFS);
+	xone_buffers_free(&virt->bufs, virt->bufs_audio,
+			  XONE_VIRTUAL_NUM_AUDIO_BUFS);
+	gip_stats_free(&virt->stats);
+	kfree(virt);
+}
+
+static void xone_virtual_destroy(struct xone_virtual *virt)
+{
+	xone_virtual_stop_rumble(virt);
+	debugfs_remove_recursive(virt->debugfs);
+
+	/* stop the devices, submitted buffers are not processed anymore */
+	xone_buffers_stop(&virt->bufs);
+
+	cancel_delayed_work_sync(&virt->reconnect_work);
+	hrtimer_cancel(&virt->input_timer);
+	hrtimer_cancel(&virt->audio_timer);
+	cancel_work_sync(&virt->work);
+
+	gip_destroy_adapter(virt->adapter);
+	xone_virtual_free(virt);
+}
+
+static struct xone_virtual *xone_virtual_create(void)
+{
+	struct xone_virtual *virt;
+	struct xone_virtual_client *vc;
+	int i, err;
+
+	virt = kzalloc(sizeof(*virt), GFP_KERNEL);
+	if (!virt)
+		return ERR_PTR(-ENOMEM);
+
+	xone_buffers_init(&virt->bufs);
+	spin_lock_init(&virt->rx_lock);
+	rwlock_init(&virt->clients_lock);
+	INIT_WORK(&virt->work, xone_virtual_work);
+	INIT_DELAYED_WORK(&virt->reconnect_work, xone_virtual_reconnect);
+
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(6, 13, 0)
+	hrtimer_setup(&virt->input_timer, xone_virtual_send_input,
+		      CLOCK_MONOTONIC, HRTIMER_MODE_REL_SOFT);
+	hrtimer_setup(&virt->audio_timer, xone_virtual_send_audio,
+		      CLOCK_MONOTONIC, HRTIMER_MODE_REL_SOFT);
+#else
+	hrtimer_init(&virt->input_timer, CLOCK_MONOTONIC,
+		     HRTIMER_MODE_REL_SOFT);
+	virt->input_timer.function = xone_virtual_send_input;
+	hrtimer_init(&virt->audio_timer, CLOCK_MONOTONIC,
+		     HRTIMER_MODE_REL_SOFT);
+	virt->audio_timer.function = xone_virtual_send_audio;
+#endif
+
+	err = gip_stats_init(&virt->stats, xone_virtual_stat_names,
+			     XONE_VIRTUAL_STAT_COUNT, GFP_KERNEL);
+	if (err) {
+		kfree(virt);
+		return ERR_PTR(err);
+	}
+
+	for (i = 0; i < model_count; i++) {
+		vc = &virt->clients[i];
+		vc->virt = virt;
+		vc->id = i;
+		vc->model = xone_virtual_find_model(models[i]);
+		if (!vc->model) {
+			pr_err("%s: unknown model: %s\n", __func__, models[i]);
+			err = -EINVAL;
+			goto err_free_virt;
+		}
+	}
+
+	virt->client_count = model_count;
+
+	err = xone_buffers_alloc(&virt->bufs, virt->bufs_data,
+				 XONE_VIRTUAL_NUM_DATA_BUFS, GIP_BUF_DATA,
+				 XONE_VIRTUAL_LEN_DATA_PKT);
+	if (err)
+		goto err_free_virt;
+
+	virt->adapter = gip_create_adapter(xone_virtual_root,
+					   &xone_virtual_adapter_ops,
+					   XONE_VIRTUAL_NUM_AUDIO_PKTS);
+	if (IS_ERR(virt->adapter)) {
+		err = PTR_ERR(virt->adapter);
+		goto err_free_virt;
+	}
+
+	dev_set_drvdata(&virt->adapter->dev, virt);
+
+	virt->debugfs = debugfs_create_dir(dev_name(&virt->adapter->dev),
+					   xone_virtual_debugfs_root);
+	debugfs_create_file("stats", 0644, virt->debugfs, virt,
+			    &xone_virtual_stats_fops);
+
+	/* devices announce themselves, then stream until removed */
+	set_bit(XONE_VIRTUAL_EVT_RECONNECT, &virt->events);
+	schedule_work(&virt->work);
+
+	hrtimer_start(&virt->input_timer, 0, HRTIMER_MODE_REL_SOFT);
+	hrtimer_start(&virt->audio_timer, 0, HRTIMER_MODE_REL_SOFT);
+
+	if (reconnect_ms)
+		schedule_delayed_work(&virt->reconnect_work,
+				      msecs_to_jiffies(reconnect_ms));
+
+	if (rumble_threads) {
+		xone_virtual_rumble_reset(virt);
+		debugfs_create_file("rumble", 0644, virt->debugfs, virt,
+				    &xone_virtual_rumble_fops);
+
+		err = xone_virtual_start_rumble(virt);
+		if (err) {
+			xone_virtual_destroy(virt);
+			return ERR_PTR(err);
+		}
+	}
+
+	return virt;
+
+err_free_virt:
+	xone_virtual_free(virt);
+
+	return ERR_PTR(err);
+}
+
+static void xone_virtual_destroy_all(void)
+{
+	int i;
+
+	for (i = adapters - 1; i >= 0; i--)
+		if (xone_virtual_adapters[i])
+			xone_virtual_destroy(xone_virtual_adapters[i]);
+
+	kfree(xone_virtual_adapters);
+	debugfs_remove_recursive(xone_virtual_debugfs_root);
+	root_device_unregister(xone_virtual_root);
+}
+
+static int __init xone_virtual_module_init(void)
+{
+	struct xone_virtual *virt;
+	int i;
+
+	if (!model_count || model_count > GIP_MAX_CLIENTS)
+		return -EINVAL;
+
+	xone_virtual_adapters = kcalloc(adapters,
+					sizeof(*xone_virtual_adapters),
+					GFP_KERNEL);
+	if (!xone_virtual_adapters)
+		return -ENOMEM;
+
+	xone_virtual_root = root_device_register("xone-virtual");
+	if (IS_ERR(xone_virtual_root)) {
+		kfree(xone_virtual_adapters);
+		return PTR_ERR(xone_virtual_root);
+	}
+
+	xone_virtual_debugfs_root = debugfs_create_dir("xone-virtual", NULL);
+
+	for (i = 0; i < adapters; i++) {
+		virt = xone_virtual_create();
+		if (IS_ERR(virt)) {
+			xone_virtual_destroy_all();
+			return PTR_ERR(virt);
+		}
+
+		xone_virtual_adapters[i] = virt;
+	}
+
+	return 0;
+}
+
+static void __exit xone_virtual_module_exit(void)
+{
+	xone_virtual_destroy_all();
+}
+
+module_init(xone_virtual_module_init);
+module_exit(xone_virtual_module_exit);
+
+MODULE_AUTHOR("Severin von Wnuck-Lipinski <severinvonw@outlook.de>");
+MODULE_DESCRIPTION("xone virtual adapter");
+MODULE_VERSION("#VERSION#");
+MODULE_LICENSE("GPL");
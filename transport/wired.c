@@ -8,6 +8,7 @@
 #include <linux/usb.h>
 
 #include "../bus/bus.h"
+#include "../bus/trace.h"
 
 #define XONE_WIRED_INTF_DATA 0
 #define XONE_WIRED_INTF_AUDIO 1
@@ -32,6 +33,7 @@ struct xone_wired {
 	struct usb_device *udev;
 
 	struct xone_wired_port {
+		struct xone_wired *wired;
 		struct device *dev;
 
 		struct usb_endpoint_descriptor *ep_in;
@@ -51,6 +53,7 @@ static void xone_wired_complete_data_in(struct urb *urb)
 {
 	struct xone_wired *wired = urb->context;
 	struct device *dev = wired->data_port.dev;
+	u64 time = ktime_get_ns();
 	int err;
 
 	switch (urb->status) {
@@ -68,7 +71,7 @@ static void xone_wired_complete_data_in(struct urb *urb)
 		goto resubmit;
 
 	err = gip_process_buffer(wired->adapter, urb->transfer_buffer,
-				 urb->actual_length);
+				 urb->actual_length, time);
 	if (err) {
 		dev_err(dev, "%s: process failed: %d\n", __func__, err);
 		print_hex_dump_debug("xone-wired packet: ",
@@ -89,6 +92,7 @@ static void xone_wired_complete_audio_in(struct urb *urb)
 	struct xone_wired *wired = urb->context;
 	struct device *dev = wired->audio_port.dev;
 	struct usb_iso_packet_descriptor *desc;
+	u64 time = ktime_get_ns();
 	int i, err;
 
 	if (urb->status)
@@ -108,7 +112,7 @@ static void xone_wired_complete_audio_in(struct urb *urb)
 
 		err = gip_process_buffer(wired->adapter,
 					 urb->transfer_buffer + desc->offset,
-					 desc->actual_length);
+					 desc->actual_length, time);
 		if (err)
 			dev_err(dev, "%s: process failed: %d\n", __func__, err);
 	}
@@ -122,8 +126,18 @@ static void xone_wired_complete_audio_in(struct urb *urb)
 static void xone_wired_complete_out(struct urb *urb)
 {
 	struct xone_wired_port *port = urb->context;
+	struct xone_wired *wired = port->wired;
 
 	usb_anchor_urb(urb, &port->urbs_out_idle);
+
+	if (port != &wired->data_port)
+		return;
+
+	trace_gip_tx_complete(wired->adapter->id, urb, urb->actual_length,
+			      urb->status);
+
+	/* resume queued packets */
+	gip_tx_kick(wired->adapter);
 }
 
 static int xone_wired_init_data_in(struct xone_wired *wired)
@@ -260,6 +274,22 @@ static int xone_wired_submit_buffer(struct gip_adapter *adap,
 	return err;
 }
 
+static void xone_wired_put_buffer(struct gip_adapter *adap,
+				  struct gip_adapter_buffer *buf)
+{
+	struct xone_wired *wired = dev_get_drvdata(&adap->dev);
+	struct xone_wired_port *port;
+	struct urb *urb = buf->context;
+
+	if (buf->type == GIP_BUF_DATA)
+		port = &wired->data_port;
+	else
+		port = &wired->audio_port;
+
+	usb_anchor_urb(urb, &port->urbs_out_idle);
+	usb_free_urb(urb);
+}
+
 static int xone_wired_enable_audio(struct gip_adapter *adap)
 {
 	struct xone_wired *wired = dev_get_drvdata(&adap->dev);
@@ -385,6 +415,7 @@ static int xone_wired_disable_audio(struct gip_adapter *adap)
 static struct gip_adapter_ops xone_wired_adapter_ops = {
 	.get_buffer = xone_wired_get_buffer,
 	.submit_buffer = xone_wired_submit_buffer,
+	.put_buffer = xone_wired_put_buffer,
 	.enable_audio = xone_wired_enable_audio,
 	.init_audio_in = xone_wired_init_audio_in,
 	.init_audio_out = xone_wired_init_audio_out,
@@ -420,6 +451,7 @@ static int xone_wired_init_data_port(struct xone_wired *wired,
 	struct xone_wired_port *port = &wired->data_port;
 	int err;
 
+	port->wired = wired;
 	init_usb_anchor(&port->urbs_out_idle);
 	init_usb_anchor(&port->urbs_out_busy);
 
@@ -440,6 +472,7 @@ static int xone_wired_init_audio_port(struct xone_wired *wired)
 	struct usb_host_interface *alt;
 	int err;
 
+	port->wired = wired;
 	init_usb_anchor(&port->urbs_out_idle);
 	init_usb_anchor(&port->urbs_out_busy);
 
@@ -502,6 +535,9 @@ static int xone_wired_probe(struct usb_interface *intf,
 
 	dev_set_drvdata(&wired->adapter->dev, wired);
 
+	/* keep adapter around for completions of pending URBs */
+	get_device(&wired->adapter->dev);
+
 	err = xone_wired_init_data_out(wired);
 	if (err)
 		goto err_free_urbs;
@@ -520,6 +556,7 @@ static int xone_wired_probe(struct usb_interface *intf,
 err_free_urbs:
 	xone_wired_free_urbs(&wired->data_port);
 	gip_destroy_adapter(wired->adapter);
+	put_device(&wired->adapter->dev);
 
 	return err;
 }
@@ -540,6 +577,7 @@ static void xone_wired_disconnect(struct usb_interface *intf)
 
 	usb_kill_anchored_urbs(&wired->data_port.urbs_out_busy);
 	xone_wired_free_urbs(&wired->data_port);
+	put_device(&wired->adapter->dev);
 
 	usb_set_intfdata(intf, NULL);
 }